@@ -19,6 +19,8 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sched.h>
+#include <pthread.h>
 
 // Project Include Files
 #include <cmpsc311_log.h>
@@ -33,9 +35,32 @@ int fileHandle = -1;				// This is the filehandle that we are using to write.
 int echoHandle = -1;				// This is descriptor to echo the content with
 int errored = 0;					// Is the log permanently errored?
 
+// Asynchronous sink, a bounded ring of formatted entries (many producers
+// claim slots by sequence number, the drain thread is the only consumer)
+#define LOG_ENTRY_SIZE (MAX_LOG_MESSAGE_SIZE*2)	// Header plus message
+#define LOG_DRAIN_SIZE (64*1024)				// Bytes written per drain
+#define LOG_DRAIN_SPINS 64						// Empty polls before sleeping
+typedef struct {
+	uint64_t sequence;			// The position the slot is ready for
+	int      length;			// The length of the entry
+	char     entry[LOG_ENTRY_SIZE]; // The formatted entry
+} LogAsyncSlot;
+LogAsyncSlot *asyncRing = NULL;	// The ring of entries (NULL if in line)
+uint64_t asyncMask;					// The ring size, less one
+uint64_t asyncHead;					// The next position to claim
+uint64_t asyncTail;					// The next position to drain
+int asyncEnabled = 0;				// Are entries going to the ring?
+int asyncWriters = 0;				// Callers between check and queue
+int asyncStop = 0;					// Drain the ring and exit the thread
+pthread_t asyncThread;				// The drain thread
+
 // Functional prototypes
 int openLog( void );
 int closeLog( void );
+int formatLogEntry( char *entry, int size, unsigned long lvl, const char *fmt, va_list args );
+int writeLogEntry( const char *entry, int length );
+void queueLogEntry( const char *entry, int length );
+void *drainLog( void *arg );
 
 //
 // Functions
@@ -151,6 +176,94 @@ int initializeLogWithFilehandle( int out ) {
     return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : enableLogAsync
+// Description  : Write the log entries from a background thread, so callers
+//                only format the entry and queue it (the ring has entries
+//                slots, a caller waits for one only when the ring is full)
+//
+// Inputs       : entries - the ring size (rounded up to a power of 2)
+// Outputs      : 0 if successful, -1 if failure
+
+int enableLogAsync( uint32_t entries ) {
+
+	// Local variables
+	static int registered = 0;
+	uint64_t i, size = 2;
+
+	// Nothing to do if already on, open the log now (the thread writes it)
+	if ( asyncRing != NULL ) {
+		return( 0 );
+	}
+	if ( fileHandle == -1 ) {
+		openLog();
+	}
+	if ( errored ) {
+		return( -1 );
+	}
+
+	// Setup the ring, each slot is ready for its first position
+	while ( size < entries ) {
+		size <<= 1;
+	}
+	if ( (asyncRing = calloc(size, sizeof(LogAsyncSlot))) == NULL ) {
+		fprintf( stderr, "Error allocating log ring [%s]", logFilename );
+		return( -1 );
+	}
+	for ( i=0; i<size; i++ ) {
+		asyncRing[i].sequence = i;
+	}
+	asyncMask = size - 1;
+	asyncHead = asyncTail = 0;
+	asyncStop = 0;
+
+	// Start the drain thread, flush whatever is queued at exit
+	if ( pthread_create(&asyncThread, NULL, drainLog, NULL) != 0 ) {
+		fprintf( stderr, "Error starting log thread [%s]", logFilename );
+		free( asyncRing );
+		asyncRing = NULL;
+		return( -1 );
+	}
+	if ( ! registered ) {
+		atexit( disableLogAsync );
+		registered = 1;
+	}
+	__atomic_store_n( &asyncEnabled, 1, __ATOMIC_SEQ_CST );
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : disableLogAsync
+// Description  : Drain the queued entries, go back to writing entries in line
+//
+// Inputs       : none
+// Outputs      : none
+
+void disableLogAsync( void ) {
+
+	// Nothing to do if not on
+	if ( asyncRing == NULL ) {
+		return;
+	}
+
+	// Send new entries in line, wait for the callers already queueing
+	__atomic_store_n( &asyncEnabled, 0, __ATOMIC_SEQ_CST );
+	while ( __atomic_load_n(&asyncWriters, __ATOMIC_SEQ_CST) > 0 ) {
+		sched_yield();
+	}
+
+	// Let the thread drain the ring, then release it
+	__atomic_store_n( &asyncStop, 1, __ATOMIC_RELEASE );
+	pthread_join( asyncThread, NULL );
+	free( asyncRing );
+	asyncRing = NULL;
+	return;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : registerLogLevel
@@ -193,7 +306,7 @@ unsigned long registerLogLevel( const char *descriptor, int enable ) {
 // Inputs       : lvl - the levels to log on, format (etc)
 // Outputs      : 0 if successful, -1 if failure
 
-int logMessage( unsigned long lvl, const char *fmt, ...) {
+int (logMessage)( unsigned long lvl, const char *fmt, ...) {
 
     // Call the the va list version of the logging message
 	va_list args;
@@ -218,9 +331,8 @@ int logMessage( unsigned long lvl, const char *fmt, ...) {
 int vlogMessage( unsigned long lvl, const char *fmt, va_list args ) {
 
 	// Local variables
-    char msg[MAX_LOG_MESSAGE_SIZE], tbuf[MAX_LOG_MESSAGE_SIZE];
-    int first = 1, ret, writelen, i;
-    time_t tm;
+    char entry[LOG_ENTRY_SIZE];
+    int ret, writelen;
 
 	// Bail out if not read, open file if necessary
     if ( !levelEnabled(lvl) ) {
@@ -237,49 +349,16 @@ int vlogMessage( unsigned long lvl, const char *fmt, va_list args ) {
     	return( errored );
     }
 
-    // Add header with descriptor names
-    time(&tm);
-    strncpy(tbuf, ctime((const time_t *)&tm), MAX_LOG_MESSAGE_SIZE);
-    tbuf[strlen(tbuf)-1] = 0x0;
-    strncat(tbuf, " [", MAX_LOG_MESSAGE_SIZE);
-    for ( i=0; i<MAX_LOG_LEVEL; i++ ) {
-        if ( levelEnabled((1<<i)&lvl) ) {
-
-        	// Comma separate the levels if necessary
-            if ( !first ) {
-            	strncat(tbuf, ",", MAX_LOG_MESSAGE_SIZE);
-            } else {
-            	first = 0;
-            }
-
-            // Add the level descriptor
-            if ( descriptors[i] == NULL ) {
-            	strncat(tbuf, "*BAD LEVEL*", MAX_LOG_MESSAGE_SIZE);
-            } else {
-                strncat(tbuf, descriptors[i], MAX_LOG_MESSAGE_SIZE);
-            }
-          }
-    }
-    strncat(tbuf, "] ", MAX_LOG_MESSAGE_SIZE);
-
-    // Setup the "printf" like message, get write len
-	vsnprintf( msg, MAX_LOG_MESSAGE_SIZE, fmt, args );
-    strncat(tbuf, msg, MAX_LOG_MESSAGE_SIZE);
-    writelen = strlen(tbuf);
-
-    // Check if we need to CR/LF the line
-    if ( tbuf[writelen-1] != '\n' ) {
-    	strncat(tbuf, "\n", MAX_LOG_MESSAGE_SIZE);
-        writelen = strlen(tbuf);
-    }
-
-    // Echo, then Write the entry to the log and return
-    if (echoHandle != -1 ) {
-    	ret = write( echoHandle, tbuf, writelen );
-    }
-    if ( (ret=write(fileHandle, tbuf, strlen(tbuf))) != writelen ) {
-    	fprintf( stderr, "Error writing to log : %s [%s] (%d)", tbuf, logFilename, ret );
+    // Format the entry, then queue it for the drain thread or write it
+    writelen = formatLogEntry( entry, LOG_ENTRY_SIZE, lvl, fmt, args );
+    __atomic_add_fetch( &asyncWriters, 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n(&asyncEnabled, __ATOMIC_SEQ_CST) ) {
+    	queueLogEntry( entry, writelen );
+    	ret = writelen;
+    } else {
+    	ret = writeLogEntry( entry, writelen );
     }
+    __atomic_sub_fetch( &asyncWriters, 1, __ATOMIC_SEQ_CST );
     return( ret );
 }
 
@@ -304,6 +383,7 @@ int logAssert( int expr, const char *file, int line, const char *fmt, ...) {
 	va_start(args, fmt);
 	int ret = vlogMessage( LOG_ERROR_LEVEL, fmt, args );
     va_end(args);
+    disableLogAsync();
     assert( 0 );
 
     // Return the log return (UNREACHABLE)
@@ -313,6 +393,177 @@ int logAssert( int expr, const char *file, int line, const char *fmt, ...) {
 //
 // Private Interfaces
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatLogEntry
+// Description  : Format a log entry (time, level descriptors and message)
+//
+// Inputs       : entry - the buffer to format the entry into
+//                size - the size of the buffer
+//                lvl - the levels logged on
+//                fmt - format (etc)
+//                args - the list of arguments for log message
+// Outputs      : the length of the entry
+
+int formatLogEntry( char *entry, int size, unsigned long lvl, const char *fmt, va_list args ) {
+
+	// Local variables
+    char msg[MAX_LOG_MESSAGE_SIZE], tbuf[64];
+    int first = 1, len, i;
+    time_t tm;
+
+    // Add header with descriptor names
+    time(&tm);
+    ctime_r((const time_t *)&tm, tbuf); // (re-entrant, callers may be threads)
+    tbuf[strlen(tbuf)-1] = 0x0;
+    len = snprintf( entry, size, "%s [", tbuf );
+    for ( i=0; i<MAX_LOG_LEVEL; i++ ) {
+        if ( levelEnabled((1<<i)&lvl) ) {
+
+        	// Comma separate the levels, add the level descriptor
+            len += snprintf( &entry[len], size-len, "%s%s", (first) ? "" : ",",
+            		(descriptors[i] == NULL) ? "*BAD LEVEL*" : descriptors[i] );
+            len = (len < size) ? len : size-1;
+            first = 0;
+        }
+    }
+
+    // Setup the "printf" like message (at most MAX_LOG_MESSAGE_SIZE)
+	vsnprintf( msg, MAX_LOG_MESSAGE_SIZE, fmt, args );
+    len += snprintf( &entry[len], size-len, "] %s", msg );
+    len = (len < size) ? len : size-1;
+
+    // Check if we need to CR/LF the line
+    if ( entry[len-1] != '\n' ) {
+    	len = (len < size-1) ? len+1 : len;
+    	entry[len-1] = '\n';
+    	entry[len] = 0x0;
+    }
+    return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeLogEntry
+// Description  : Echo, then write a formatted entry (or entries) to the log
+//
+// Inputs       : entry - the entries to write
+//                length - the length of the entries
+// Outputs      : the bytes written
+
+int writeLogEntry( const char *entry, int length ) {
+
+	// Local variables
+	int ret;
+
+    // Echo, then Write the entry to the log and return
+    if (echoHandle != -1 ) {
+    	ret = write( echoHandle, entry, length );
+    }
+    if ( (ret=write(fileHandle, entry, length)) != length ) {
+    	fprintf( stderr, "Error writing to log : %.*s [%s] (%d)", length, entry, logFilename, ret );
+    }
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueLogEntry
+// Description  : Queue a formatted entry on the ring for the drain thread
+//
+// Inputs       : entry - the entry to queue
+//                length - the length of the entry
+// Outputs      : none
+
+void queueLogEntry( const char *entry, int length ) {
+
+	// Local variables
+	uint64_t pos, seq;
+	LogAsyncSlot *slot;
+
+	// Claim the next position whose slot is free (wait if the ring is full)
+	pos = __atomic_load_n( &asyncHead, __ATOMIC_RELAXED );
+	while ( 1 ) {
+		slot = &asyncRing[pos&asyncMask];
+		seq = __atomic_load_n( &slot->sequence, __ATOMIC_ACQUIRE );
+		if ( seq == pos ) {
+			if ( __atomic_compare_exchange_n(&asyncHead, &pos, pos+1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+				break;
+			}
+		} else {
+			if ( (int64_t)(seq - pos) < 0 ) {
+				sched_yield();
+			}
+			pos = __atomic_load_n( &asyncHead, __ATOMIC_RELAXED );
+		}
+	}
+
+	// Copy the entry in, and hand the slot to the drain thread
+	memcpy( slot->entry, entry, length );
+	slot->length = length;
+	__atomic_store_n( &slot->sequence, pos+1, __ATOMIC_RELEASE );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drainLog
+// Description  : The drain thread, writes the queued entries in batches
+//                until asked to stop (and the ring is empty)
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *drainLog( void *arg ) {
+
+	// Local variables
+	char *batch = malloc( LOG_DRAIN_SIZE );
+	struct timespec idle = { 0, 1000000 };
+	LogAsyncSlot *slot;
+	int length, stop, spins = 0;
+
+	while ( 1 ) {
+
+		// Collect the ready entries (in order) that fit in the batch
+		stop = __atomic_load_n( &asyncStop, __ATOMIC_ACQUIRE );
+		length = 0;
+		while ( 1 ) {
+			slot = &asyncRing[asyncTail&asyncMask];
+			if ( (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != asyncTail+1) ||
+					((batch != NULL) && (length+slot->length > LOG_DRAIN_SIZE)) ) {
+				break;
+			}
+
+			// Copy out (or write, if no batch) and free the slot
+			if ( batch != NULL ) {
+				memcpy( &batch[length], slot->entry, slot->length );
+				length += slot->length;
+			} else {
+				writeLogEntry( slot->entry, slot->length );
+			}
+			__atomic_store_n( &slot->sequence, asyncTail+asyncMask+1, __ATOMIC_RELEASE );
+			asyncTail ++;
+		}
+
+		// Write the batch, stop once empty after being asked, idle otherwise
+		if ( length > 0 ) {
+			writeLogEntry( batch, length );
+			spins = 0;
+		} else if ( stop ) {
+			break;
+		} else if ( ++spins < LOG_DRAIN_SPINS ) {
+			sched_yield();
+		} else {
+			nanosleep( &idle, NULL );
+		}
+	}
+
+	// Cleanup and return
+	free( batch );
+	return( NULL );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : openLog
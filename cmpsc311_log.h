@@ -12,6 +12,10 @@
 //         functions operate on bit masks of levels (lvl).  Log entries are
 //         given a level which is checked at run-time.  If the log level is
 //         enabled, then the entry it written to the log, and not otherwise.
+//         Entries on constant levels outside CMPSC311_LOG_COMPILED_LEVELS
+//         are compiled out of the callers (e.g., building with
+//         -DCMPSC311_LOG_COMPILED_LEVELS=0xb drops the INFO entries), and
+//         the arguments of an entry on a disabled level are not evaluated.
 //
 //  Author   : Patrick McDaniel
 //  Created  : Sat Sep 14 10:19:45 EDT 2013
@@ -20,6 +24,7 @@
 // Include files
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 //
 // Library Constants
@@ -41,6 +46,10 @@
 #define MAX_LOG_MESSAGE_SIZE	1024
 #define CMPSC311_LOG_STDOUT 1
 #define CMPSC311_LOG_STDERR 2
+#define LOG_ASYNC_DEFAULT_ENTRIES	1024
+#ifndef CMPSC311_LOG_COMPILED_LEVELS
+#define CMPSC311_LOG_COMPILED_LEVELS	(~0UL)
+#endif
 
 //
 // Interface
@@ -69,6 +78,12 @@ int initializeLogWithFilename( const char *logname );
 int initializeLogWithFilehandle( int out );
 	// Create a log with a fixed file handle
 
+int enableLogAsync( uint32_t entries );
+	// Write the log entries from a background thread (ring of entries)
+
+void disableLogAsync( void );
+	// Drain the queued entries, go back to writing entries in line
+
 //
 // Logging functions
 
@@ -78,6 +93,14 @@ int logMessage( unsigned long lvl, const char *fmt, ...);
 int vlogMessage( unsigned long lvl, const char *fmt, va_list args );
 	// Log call the vararg list version
 
+// Check the level before the call (and compile out elided levels)
+extern unsigned long logLevel;
+#define logMessage(lvl, ...) ({ \
+	int __log_ret = 0; \
+	if ( ((lvl) & CMPSC311_LOG_COMPILED_LEVELS) && (logLevel & (lvl)) ) \
+		__log_ret = (logMessage)(lvl, __VA_ARGS__); \
+	__log_ret; })
+
 //
 // Assert functions
 
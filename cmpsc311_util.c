@@ -14,6 +14,7 @@
 
 // System include files
 #include <stdint.h>
+#include <time.h>
 #include <gcrypt.h>
 
 // Project Include Files
@@ -147,6 +148,22 @@ uint32_t getRandomValue( uint32_t min, uint32_t max ) {
 	return( val );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getMonotonicNanos
+// Description  : Read the monotonic clock (for timing, it never jumps)
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds (from an arbitrary start)
+
+uint64_t getMonotonicNanos( void ) {
+
+	// Read the clock, convert to nanoseconds
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return( ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : compareTimes
@@ -216,6 +233,48 @@ uint64_t ntohll64(uint64_t val) {
     return(val);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashString
+// Description  : Fast (non-cryptographic) hash of a string (FNV-1a), for
+//                indexing hash tables
+//
+// Inputs       : str - the string to hash
+// Outputs      : the hash value
+
+uint32_t hashString( const char *str ) {
+
+	// Fold in each byte of the string
+	uint32_t hash = 2166136261u;
+	while ( *str != '\0' ) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+	return( hash );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashBuffer
+// Description  : Fast (non-cryptographic) hash of a buffer of bytes (FNV-1a),
+//                for indexing hash tables
+//
+// Inputs       : buf - the bytes to hash
+//                len - the number of bytes
+// Outputs      : the hash value
+
+uint32_t hashBuffer( const void *buf, uint32_t len ) {
+
+	// Fold in each byte of the buffer
+	const unsigned char *bytes = buf;
+	uint32_t hash = 2166136261u, i;
+	for ( i=0; i<len; i++ ) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return( hash );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : b64UnitTest
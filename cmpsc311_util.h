@@ -37,7 +37,10 @@ uint32_t getRandomValue( uint32_t min, uint32_t max );
     // Using strong randomness, generate random number
 
 long compareTimes(struct timeval * tm1, struct timeval * tm2);
-    // Compare two timer values 
+    // Compare two timer values (use getMonotonicNanos for new timing)
+
+uint64_t getMonotonicNanos( void );
+    // Read the monotonic clock in nanoseconds
 
 uint64_t htonll64(uint64_t val);
 	// Create a 64-byte host-to-network conversion
@@ -45,6 +48,12 @@ uint64_t htonll64(uint64_t val);
 uint64_t ntohll64(uint64_t val);
 	// Create a 64-byte network-to-host conversion
 
+uint32_t hashString( const char *str );
+	// Fast (non-cryptographic) hash of a string, for hash tables
+
+uint32_t hashBuffer( const void *buf, uint32_t len );
+	// Fast (non-cryptographic) hash of a buffer of bytes, for hash tables
+
 int b64UnitTest( void );
 	// 64-bit conversion unit test
 #endif
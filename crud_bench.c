@@ -0,0 +1,250 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_bench.c
+//  Description    : This is the implementation of the CRUD simulator
+//                   benchmark.  Latencies are kept in log-linear histograms
+//                   (16 buckets per power of 2, so percentiles are within
+//                   about 6%) that threads update with atomic adds, so the
+//                   parallel replay can be timed as well.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Tue Nov 18 14:20:00 EST 2014
+//
+
+// Includes
+#include <string.h>
+
+// Project Includes
+#include <crud_bench.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Type definitions
+
+// The statistics kept for each operation
+typedef struct {
+	uint64_t count;                       // The number of operations
+	uint64_t bytes;                       // The bytes read or written
+	uint64_t total;                       // The sum of the latencies (ns)
+	uint64_t max;                         // The longest latency (ns)
+	uint64_t buckets[CRUD_BENCH_BUCKETS]; // The latency histogram
+} CrudBenchOperation;
+
+//
+// Global data
+
+static int crud_bench_enabled = 0; // Are operations being timed?
+static CrudBenchOperation crud_bench_ops[CRUD_BENCH_MAXOP];
+static const char *crud_bench_names[CRUD_BENCH_MAXOP] = {
+	"open", "close", "read", "write", "seek", "format", "mount", "unmount"
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_bucket
+// Description  : Find the histogram bucket of a latency
+//
+// Inputs       : ns - the latency
+// Outputs      : the bucket
+
+static int crud_bench_bucket( uint64_t ns ) {
+
+	// Local variables
+	int msb;
+
+	// Small values have a bucket each, the rest keep 4 bits after the top one
+	if ( ns < (1 << CRUD_BENCH_SUB_BITS) ) {
+		return( (int)ns );
+	}
+	msb = 63 - __builtin_clzll(ns);
+	return( ((msb - CRUD_BENCH_SUB_BITS + 1) << CRUD_BENCH_SUB_BITS) +
+		(int)((ns >> (msb - CRUD_BENCH_SUB_BITS)) & ((1 << CRUD_BENCH_SUB_BITS) - 1)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_limit
+// Description  : Find the largest latency a histogram bucket holds
+//
+// Inputs       : bucket - the bucket
+// Outputs      : the latency
+
+static uint64_t crud_bench_limit( int bucket ) {
+
+	// Local variables
+	int shift = (bucket >> CRUD_BENCH_SUB_BITS) - 1;
+	uint64_t sub = bucket & ((1 << CRUD_BENCH_SUB_BITS) - 1);
+
+	// Undo crud_bench_bucket
+	if ( shift < 0 ) {
+		return( bucket );
+	}
+	return( (((1ULL << CRUD_BENCH_SUB_BITS) + sub + 1) << shift) - 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_percentile
+// Description  : Find a percentile of the latencies of an operation
+//
+// Inputs       : op - the operation statistics
+//                fraction - the percentile (0.5 is the median)
+// Outputs      : the latency (ns), the upper limit of its bucket
+
+static uint64_t crud_bench_percentile( CrudBenchOperation *op, double fraction ) {
+
+	// Local variables
+	uint64_t rank, seen = 0;
+	int i;
+
+	// Walk the buckets until the rank is passed
+	rank = (uint64_t)(fraction * op->count);
+	if ( rank >= op->count ) {
+		rank = op->count - 1;
+	}
+	for (i=0; i<CRUD_BENCH_BUCKETS; i++) {
+		seen += op->buckets[i];
+		if ( seen > rank ) {
+			return( (crud_bench_limit(i) < op->max) ? crud_bench_limit(i) : op->max );
+		}
+	}
+	return( op->max );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_enable
+// Description  : Turn the timing of operations on or off
+//
+// Inputs       : enabled - 1 to time operations, 0 not to
+// Outputs      : the previous setting
+
+int crud_bench_enable( int enabled ) {
+	int was = crud_bench_enabled;
+	crud_bench_enabled = enabled;
+	return( was );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_reset
+// Description  : Forget every operation timed so far (no operations may be
+//                in flight)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_bench_reset( void ) {
+	memset(crud_bench_ops, 0x0, sizeof(crud_bench_ops));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_now
+// Description  : Get the time an operation starts
+//
+// Inputs       : none
+// Outputs      : the monotonic time (ns), 0 when not benchmarking
+
+uint64_t crud_bench_now( void ) {
+	return( crud_bench_enabled ? getMonotonicNanos() : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_record
+// Description  : Add a timed operation to its statistics
+//
+// Inputs       : op - the operation
+//                start - the time the operation started (crud_bench_now)
+//                bytes - the bytes read or written (<= 0 if none)
+// Outputs      : none
+
+void crud_bench_record( CRUD_BENCH_OP op, uint64_t start, int64_t bytes ) {
+
+	// Local variables
+	CrudBenchOperation *stats = &crud_bench_ops[op];
+	uint64_t ns, max;
+
+	// Nothing to do unless benchmarking
+	if ( ! crud_bench_enabled ) {
+		return;
+	}
+
+	// Add it in, threads may be recording the same operation
+	ns = getMonotonicNanos() - start;
+	__atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->total, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->buckets[crud_bench_bucket(ns)], 1, __ATOMIC_RELAXED);
+	if ( bytes > 0 ) {
+		__atomic_fetch_add(&stats->bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+	}
+	max = __atomic_load_n(&stats->max, __ATOMIC_RELAXED);
+	while ( (ns > max) && (! __atomic_compare_exchange_n(&stats->max, &max, ns, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_report
+// Description  : Log a summary of the operations timed for a workload and
+//                add them to the JSON output (as one element of an array)
+//
+// Inputs       : workload - the name of the workload
+//                elapsed - the time the workload took (ns)
+//                json - the JSON output (NULL for none)
+//                first - 1 if this is the first element of the array
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_bench_report( const char *workload, uint64_t elapsed, FILE *json, int first ) {
+
+	// Local variables
+	CrudBenchOperation *stats;
+	uint64_t count = 0, bytes = 0, p50, p99, p999;
+	double seconds = (elapsed > 0) ? elapsed / 1e9 : 1e-9;
+	int i, listed = 0;
+
+	// Add up the operations
+	for (i=0; i<CRUD_BENCH_MAXOP; i++) {
+		count += crud_bench_ops[i].count;
+		bytes += crud_bench_ops[i].bytes;
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "CRUD bench [%s] : %lu ops in %.3f s, %.0f ops/sec, %.0f bytes/sec",
+		workload, count, seconds, count / seconds, bytes / seconds );
+	if ( json != NULL ) {
+		fprintf( json, "%s    {\n      \"workload\": \"%s\",\n      \"seconds\": %.6f,\n"
+			"      \"ops\": %lu,\n      \"bytes\": %lu,\n      \"ops_per_sec\": %.1f,\n"
+			"      \"bytes_per_sec\": %.1f,\n      \"operations\": {",
+			first ? "" : ",\n", workload, seconds, count, bytes, count / seconds, bytes / seconds );
+	}
+
+	// Now each operation that was seen
+	for (i=0; i<CRUD_BENCH_MAXOP; i++) {
+		stats = &crud_bench_ops[i];
+		if ( stats->count == 0 ) {
+			continue;
+		}
+		p50 = crud_bench_percentile(stats, 0.5);
+		p99 = crud_bench_percentile(stats, 0.99);
+		p999 = crud_bench_percentile(stats, 0.999);
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD bench [%s] %-7s : %8lu ops, %9.0f ops/sec, %11.0f bytes/sec, "
+			"mean %lu ns, p50 %lu ns, p99 %lu ns, p999 %lu ns, max %lu ns", workload, crud_bench_names[i],
+			stats->count, stats->count / seconds, stats->bytes / seconds, stats->total / stats->count,
+			p50, p99, p999, stats->max );
+		if ( json != NULL ) {
+			fprintf( json, "%s\n        \"%s\": { \"count\": %lu, \"bytes\": %lu, \"ops_per_sec\": %.1f, "
+				"\"bytes_per_sec\": %.1f, \"mean_ns\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, "
+				"\"p999_ns\": %lu, \"max_ns\": %lu }", listed ? "," : "", crud_bench_names[i],
+				stats->count, stats->bytes, stats->count / seconds, stats->bytes / seconds,
+				stats->total / stats->count, p50, p99, p999, stats->max );
+		}
+		listed ++;
+	}
+	if ( (json != NULL) && (fprintf( json, "\n      }\n    }" ) < 0) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
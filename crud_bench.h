@@ -0,0 +1,63 @@
+#ifndef CRUD_BENCH_INCLUDED
+#define CRUD_BENCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_bench.h
+//  Description    : This is the header file for the latency and throughput
+//                   benchmark of the CRUD simulator.  Each file system call
+//                   the simulator makes is timed on the monotonic clock and
+//                   added to a per-operation histogram.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Tue Nov 18 14:20:00 EST 2014
+//
+
+// Include files
+#include <stdio.h>
+#include <stdint.h>
+
+// Defines
+#define CRUD_BENCH_SUB_BITS 4 // Histogram buckets per power of 2 (as log2)
+#define CRUD_BENCH_BUCKETS ((64 - CRUD_BENCH_SUB_BITS) << CRUD_BENCH_SUB_BITS)
+
+// Time a call as a benchmark operation, giving back its result
+#define CRUD_BENCH_TIMED(op, bytes, call) ({ \
+	uint64_t crud_bench_start = crud_bench_now(); \
+	__typeof__(call) crud_bench_result = (call); \
+	crud_bench_record((op), crud_bench_start, (bytes)); \
+	crud_bench_result; })
+
+// Type definitions
+
+// These are the operations timed
+typedef enum {
+	CRUD_BENCH_OPEN    = 0, // crud_open
+	CRUD_BENCH_CLOSE   = 1, // crud_close
+	CRUD_BENCH_READ    = 2, // crud_read
+	CRUD_BENCH_WRITE   = 3, // crud_write
+	CRUD_BENCH_SEEK    = 4, // crud_seek
+	CRUD_BENCH_FORMAT  = 5, // crud_format
+	CRUD_BENCH_MOUNT   = 6, // crud_mount
+	CRUD_BENCH_UNMOUNT = 7, // crud_unmount
+	CRUD_BENCH_MAXOP   = 8, // The number of operations
+} CRUD_BENCH_OP;
+
+// Functional prototypes
+
+int crud_bench_enable( int enabled );
+	// Turn the timing of operations on or off
+
+void crud_bench_reset( void );
+	// Forget every operation timed so far
+
+uint64_t crud_bench_now( void );
+	// The time an operation starts (0 when not benchmarking)
+
+void crud_bench_record( CRUD_BENCH_OP op, uint64_t start, int64_t bytes );
+	// Add an operation that started at start and moved bytes
+
+int crud_bench_report( const char *workload, uint64_t elapsed, FILE *json, int first );
+	// Log a summary of the operations timed, add them to the JSON output
+
+#endif
@@ -0,0 +1,1472 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_cache.c
+//  Description    : This is the implementation of the client-side object
+//                   cache.  Whole objects are kept in a fixed number of cache
+//                   lines, looked up through a hash on the OID and evicted in
+//                   least-recently-used order.  Updates are either written
+//                   through to the server or held dirty until eviction/flush.
+//                   The lines are split into shards by OID, each with its own
+//                   lock, so threads working on different objects rarely
+//                   wait on each other.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Sat Nov 15 10:12:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_cache.h>
+#include <crud_network.h>
+#include <crud_slab.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_CACHE_BUCKET(shard, oid) (((oid) / (shard)->cache->nshards) % (shard)->nbuckets)
+
+// Type definitions
+
+// This is a single cache line, holding the contents of one object
+typedef struct crud_cache_line {
+    CrudOID   oid;                   // The object held in the line (0 if free)
+    uint32_t  length;                // The length of the object
+    uint32_t  capacity;              // The number of bytes allocated for data
+    char     *data;                  // The contents of the object
+    uint8_t   dirty;                 // Flag indicating line needs write back
+    uint32_t  dirty_lo;              // First dirty byte of the object
+    uint32_t  dirty_hi;              // One past the last dirty byte
+    struct crud_cache_line *prev;    // The next more recently used line
+    struct crud_cache_line *next;    // The next less recently used line
+    struct crud_cache_line *hnext;   // The next line in the hash bucket
+} CrudCacheLine;
+
+// This is one shard of a cache, an LRU cache of the objects that hash to it
+typedef struct {
+    struct crud_cache   *cache;      // The cache the shard belongs to
+    pthread_mutex_t      lock;       // Held while the shard is in use
+    uint32_t             max_lines;  // The number of lines of the shard
+    CrudCacheLine       *lines;      // The cache line storage
+    CrudCacheLine      **buckets;    // The OID hash buckets
+    uint32_t             nbuckets;   // The number of hash buckets
+    uint32_t             used;       // Number of lines handed out
+    CrudCacheLine       *mru;        // Most recently used line
+    CrudCacheLine       *lru;        // Least recently used line
+    CrudCacheLine       *free;       // List of released lines
+
+    // Shard statistics
+    uint64_t hits;                   // Lookups satisfied from the cache
+    uint64_t misses;                 // Lookups that required a server read
+    uint64_t evictions;              // Lines evicted to make room
+    uint64_t writebacks;             // Dirty lines written to the server
+    uint64_t ranged;                 // Misses served by range requests
+    uint64_t prefetched;             // Objects read in ahead of their use
+} CrudCacheShard;
+
+// This is a cache of the objects of one server
+struct crud_cache {
+    CrudEndpoint        *ep;         // The server the objects are on
+    CrudSlab            *slab;       // The allocator of the line buffers
+    pthread_mutex_t      lock;       // Held while setting up or releasing shards
+    int                  ready;      // Set once the shards are allocated
+    CRUD_CACHE_POLICY    policy;     // Write policy
+    int                  bypass;     // Set if caching is disabled (0 lines)
+    uint32_t             nshards;    // The number of shards in use
+    CrudCacheShard       shards[CRUD_CACHE_SHARDS];
+};
+
+// Static Data (the configuration caches take when they are set up)
+static uint32_t            cache_max_lines = CRUD_CACHE_DEFAULT_LINES; // Configured lines
+static CRUD_CACHE_POLICY   cache_policy = CRUD_CACHE_WRITE_THROUGH; // Write policy
+static int                 cache_bypass = 0;       // Set if caching is disabled (0 lines)
+
+//
+// Module local functions
+
+static int cache_setup(CrudCache *cache);
+static CrudCacheShard *cache_shard(CrudCache *cache, CrudOID oid);
+static int shard_setup(CrudCacheShard *shard, uint32_t lines);
+static int shard_flush(CrudCacheShard *shard);
+static CrudCacheLine *cache_lookup(CrudCacheShard *shard, CrudOID oid);
+static CrudCacheLine *cache_insert(CrudCacheShard *shard, CrudOID oid, uint32_t length);
+static void cache_remove(CrudCacheShard *shard, CrudCacheLine *line);
+static int cache_resize(CrudCacheShard *shard, CrudCacheLine *line, uint32_t length);
+static void cache_mark_dirty(CrudCacheLine *line, uint32_t lo, uint32_t hi);
+static int cache_fill(CrudCacheShard *shard, CrudCacheLine *line);
+static void cache_keep(CrudCache *cache, CrudOID oid, uint32_t length, char *buf);
+static int cache_writeback(CrudCacheShard *shard, CrudCacheLine *line);
+static CrudRequest cache_writeback_request(CrudCacheShard *shard, CrudCacheLine *line,
+        CrudRequestExt *ext, char **buf);
+static int cache_writeback_done(CrudCacheShard *shard, CrudCacheLine *line, CrudResponse response);
+static int32_t cache_range_request(CrudCache *cache, CRUD_REQUEST_TYPES req, CrudOID oid,
+        uint32_t offset, uint32_t count, char *buf);
+static int32_t cache_read_request(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf);
+static int cache_prefetch_requests(CrudCache *cache, CrudCompoundOp *ops, uint32_t count);
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_init
+// Description  : Set the number of cache lines and the write policy.  Caches
+//                take the settings when they next set up their lines (on
+//                first use, or first use after crud_cache_close).
+//
+// Inputs       : lines - the number of objects to cache (0 disables caching)
+//                policy - write-through or write-back
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_init(uint32_t lines, CRUD_CACHE_POLICY policy) {
+    cache_max_lines = lines;
+    cache_policy = policy;
+    cache_bypass = (lines == 0);
+    if (cache_bypass)
+    {
+        // Keep a single scratch line per shard so callers always get a buffer back
+        cache_max_lines = CRUD_CACHE_SHARDS;
+        cache_policy = CRUD_CACHE_WRITE_THROUGH;
+    }
+
+    logMessage(LOG_INFO_LEVEL, "CRUD cache configured with %u lines, %s.", lines,
+            (cache_policy == CRUD_CACHE_WRITE_BACK) ? "write-back" : "write-through");
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_new
+// Description  : Make a new (empty) cache of the objects of a server
+//
+// Inputs       : ep - the server the objects are on
+//                slab - the allocator to take line buffers from
+// Outputs      : the cache, NULL if failure
+
+CrudCache *crud_cache_new(CrudEndpoint *ep, CrudSlab *slab) {
+    // Declare variables
+    CrudCache *cache;
+    int i;
+
+    if ((cache = calloc(1, sizeof(CrudCache))) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache allocation failed.");
+        return NULL;
+    }
+    cache->ep = ep;
+    cache->slab = slab;
+    pthread_mutex_init(&cache->lock, NULL);
+    for (i = 0; i < CRUD_CACHE_SHARDS; i++)
+    {
+        cache->shards[i].cache = cache;
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+    }
+
+    return cache;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_free
+// Description  : Release a cache (dropping anything not yet written back, so
+//                crud_cache_close it first)
+//
+// Inputs       : cache - the cache to release
+// Outputs      : none
+
+void crud_cache_free(CrudCache *cache) {
+    // Declare variables
+    uint32_t i, j;
+
+    if (cache == NULL)
+        return;
+
+    for (i = 0; i < CRUD_CACHE_SHARDS; i++)
+    {
+        for (j = 0; cache->shards[i].lines != NULL && j < cache->shards[i].max_lines; j++)
+            crud_slab_release(cache->slab, cache->shards[i].lines[j].data);
+        free(cache->shards[i].lines);
+        free(cache->shards[i].buckets);
+        pthread_mutex_destroy(&cache->shards[i].lock);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_get
+// Description  : Get a pointer to the cached contents of an object, reading
+//                the whole object from the server on a miss.  The pointer
+//                remains valid until the next call into the cache (by any
+//                thread).
+//
+// Inputs       : cache - the cache
+//                oid - the object to get
+//                length - the length of the object
+// Outputs      : pointer to the object contents, NULL if failure
+
+char *crud_cache_get(CrudCache *cache, CrudOID oid, uint32_t length) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+
+    if (cache_setup(cache) != 0)
+        return NULL;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+
+    // Check for a hit on an up to date line, read the object on a miss
+    line = cache_lookup(shard, oid);
+    if (line != NULL && line->length == length && !cache->bypass)
+    {
+        shard->hits++;
+    }
+    else
+    {
+        shard->misses++;
+        if (line != NULL)
+            cache_remove(shard, line);
+        if ((line = cache_insert(shard, oid, length)) != NULL && cache_fill(shard, line) != 0)
+            line = NULL;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return (line != NULL) ? line->data : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_put
+// Description  : Update the whole contents of an object through the cache.  In
+//                write-through mode the update is sent immediately, in
+//                write-back mode the line is marked dirty.
+//
+// Inputs       : cache - the cache
+//                oid - the object to update
+//                length - the length of the object
+//                buf - the new contents (may be the pointer from _get)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_put(CrudCache *cache, CrudOID oid, uint32_t length, char *buf) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+    int result = 0;
+
+    if (cache_setup(cache) != 0)
+        return -1;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+
+    // Find or make the line, then copy the contents in
+    line = cache_lookup(shard, oid);
+    if (line != NULL && line->length != length)
+    {
+        cache_remove(shard, line);
+        line = NULL;
+    }
+    if (line == NULL && (line = cache_insert(shard, oid, length)) == NULL)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+    if (buf != line->data)
+        memcpy(line->data, buf, length);
+
+    // Write back now or later depending on policy
+    cache_mark_dirty(line, 0, length);
+    if (cache->policy == CRUD_CACHE_WRITE_THROUGH)
+    {
+        if (cache_writeback(shard, line) != 0)
+        {
+            cache_remove(shard, line);
+            result = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_read
+// Description  : Read a range of an object through the cache.  Misses on
+//                small objects (or if the server cannot do ranges) pull the
+//                whole object into a line, misses on large objects read just
+//                the range from the server.
+//
+// Inputs       : cache - the cache
+//                oid - the object to read
+//                length - the length of the object
+//                offset - the first byte to read
+//                count - the number of bytes to read (within the object)
+//                buf - the place to put the bytes
+// Outputs      : the number of bytes read, -1 if failure
+
+int32_t crud_cache_read(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+
+    if (cache_setup(cache) != 0)
+        return -1;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+
+    // Hit, just copy out of the line
+    line = cache_lookup(shard, oid);
+    if (line != NULL && line->length == length && !cache->bypass)
+    {
+        shard->hits++;
+        memcpy(buf, &line->data[offset], count);
+        pthread_mutex_unlock(&shard->lock);
+        return count;
+    }
+    shard->misses++;
+
+    // Large object (or uncached) miss, read only the range (no line is
+    //  involved, so the shard is free for others meanwhile)
+    if ((crud_endpoint_capabilities(cache->ep) & CRUD_CAP_RANGE) &&
+            (length > CRUD_CACHE_RANGE_MIN || cache->bypass))
+    {
+        shard->ranged++;
+        pthread_mutex_unlock(&shard->lock);
+        return cache_range_request(cache, CRUD_READ_RANGE, oid, offset, count, buf);
+    }
+
+    // Uncached miss, receive the range straight into buf
+    if (cache->bypass)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return cache_read_request(cache, oid, length, offset, count, buf);
+    }
+
+    // Otherwise fill a line with the whole object
+    if (line != NULL)
+        cache_remove(shard, line);
+    if ((line = cache_insert(shard, oid, length)) == NULL || cache_fill(shard, line) != 0)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+    memcpy(buf, &line->data[offset], count);
+    pthread_mutex_unlock(&shard->lock);
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_lines
+// Description  : Get the number of lines of a cache
+//
+// Inputs       : cache - the cache
+// Outputs      : the number of lines (0 if caching is disabled)
+
+uint32_t crud_cache_lines(CrudCache *cache) {
+    // Declare variables
+    uint32_t i, lines = 0;
+
+    if (cache_setup(cache) != 0 || cache->bypass)
+        return 0;
+    for (i = 0; i < cache->nshards; i++)
+        lines += cache->shards[i].max_lines;
+    return lines;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_prefetch
+// Description  : Read objects into cache lines ahead of their use.  The ones
+//                not cached are read together, in one CRUD_COMPOUND if the
+//                server has them (pipelined reads if not), so a run of them
+//                costs one round trip instead of one each.  The caller must
+//                keep the objects from being written meanwhile (the file
+//                system holds the lock of their file), and to read no more
+//                than the cache can hold until they are used.
+//
+// Inputs       : cache - the cache
+//                oids - the objects (CRUD_NO_OBJECT ones are skipped)
+//                lengths - the lengths of the objects
+//                count - the number of objects (at most CRUD_CACHE_PREFETCH_MAX)
+// Outputs      : the number of objects read in, -1 if failure
+
+int crud_cache_prefetch(CrudCache *cache, const CrudOID *oids, const uint32_t *lengths, uint32_t count) {
+    // Declare variables
+    CrudCompoundOp ops[CRUD_CACHE_PREFETCH_MAX];
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+    CrudOID oid;
+    uint32_t i, n = 0, bytes = 0, length;
+    int fetched = 0;
+    char *data;
+
+    if (cache_setup(cache) != 0)
+        return -1;
+    if (cache->bypass || count > CRUD_CACHE_PREFETCH_MAX)
+        return 0;
+
+    // Pick out the objects not cached (up to what one response holds)
+    for (i = 0; i < count; i++)
+    {
+        if (oids[i] == CRUD_NO_OBJECT || bytes + lengths[i] > CRUD_COMPOUND_MAX_BYTES)
+            continue;
+        shard = cache_shard(cache, oids[i]);
+        pthread_mutex_lock(&shard->lock);
+        line = cache_lookup(shard, oids[i]);
+        pthread_mutex_unlock(&shard->lock);
+        if (line != NULL && line->length == lengths[i])
+            continue;
+        ops[n].op = construct_crud_request(oids[i], CRUD_READ, lengths[i], CRUD_NULL_FLAG, 0);
+        ops[n].ext = bytes;
+        n++;
+        bytes += lengths[i];
+    }
+    if (n == 0)
+        return 0;
+
+    // Read them all into one buffer (ext holds the place of each meanwhile)
+    if ((data = crud_slab_alloc(cache->slab, bytes)) == NULL)
+        return -1;
+    for (i = 0; i < n; i++)
+    {
+        ops[i].buf = &data[ops[i].ext];
+        ops[i].ext = 0;
+    }
+    cache_prefetch_requests(cache, ops, n);
+
+    // Put the ones read in lines, unless they were cached meanwhile
+    for (i = 0; i < n; i++)
+    {
+        oid = CRUD_HEADER_OID(ops[i].op);
+        length = CRUD_HEADER_LENGTH(ops[i].op);
+        if (CRUD_HEADER_RESULT(ops[i].response) || CRUD_HEADER_LENGTH(ops[i].response) != length)
+            continue;
+        shard = cache_shard(cache, oid);
+        pthread_mutex_lock(&shard->lock);
+        if (cache_lookup(shard, oid) == NULL && (line = cache_insert(shard, oid, length)) != NULL)
+        {
+            memcpy(line->data, ops[i].buf, line->length);
+            shard->prefetched++;
+            fetched++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    crud_slab_release(cache->slab, data);
+    return fetched;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_write
+// Description  : Write a range of an object (in place) through the cache.
+//                With range support only the changed bytes are sent to the
+//                server, and large uncached objects are not read first.
+//
+// Inputs       : cache - the cache
+//                oid - the object to write
+//                length - the length of the object
+//                offset - the first byte to write
+//                count - the number of bytes to write (within the object)
+//                buf - the bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_write(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+    int result = 0;
+
+    if (cache_setup(cache) != 0)
+        return -1;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+
+    // Find the line, or decide how to handle the miss
+    line = cache_lookup(shard, oid);
+    if (line == NULL || line->length != length || cache->bypass)
+    {
+        shard->misses++;
+
+        // Large object miss, update just the range on the server
+        if ((crud_endpoint_capabilities(cache->ep) & CRUD_CAP_RANGE) && length > CRUD_CACHE_RANGE_MIN)
+        {
+            shard->ranged++;
+            pthread_mutex_unlock(&shard->lock);
+            return (cache_range_request(cache, CRUD_UPDATE_RANGE, oid, offset, count, buf) == -1) ? -1 : 0;
+        }
+
+        // Read the whole object into a line
+        if (line != NULL)
+            cache_remove(shard, line);
+        if ((line = cache_insert(shard, oid, length)) == NULL || cache_fill(shard, line) != 0)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+    }
+    else
+    {
+        shard->hits++;
+    }
+
+    // Change the bytes and write back now or later depending on policy
+    memcpy(&line->data[offset], buf, count);
+    cache_mark_dirty(line, offset, offset + count);
+    if (cache->policy == CRUD_CACHE_WRITE_THROUGH)
+    {
+        if (cache_writeback(shard, line) != 0)
+        {
+            cache_remove(shard, line);
+            result = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_extend
+// Description  : Write a range that runs past the end of an object, growing
+//                the object in place on the server (CRUD_CAP_GROW).  Only
+//                the new bytes are sent; growth is always written through so
+//                the server length and any cached line agree.
+//
+// Inputs       : cache - the cache
+//                oid - the object to write
+//                length - the current length of the object
+//                offset - the first byte to write (at most length)
+//                count - the number of bytes to write
+//                buf - the bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_extend(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+    int result = 0;
+
+    if (cache_setup(cache) != 0)
+        return -1;
+
+    // Check the range and that the server can do this at all
+    if (!(crud_endpoint_capabilities(cache->ep) & CRUD_CAP_GROW) || offset > length ||
+            offset + count > CRUD_MAX_OBJECT_SIZE)
+        return -1;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+
+    // Grow the object on the server
+    line = cache_lookup(shard, oid);
+    if (cache_range_request(cache, CRUD_UPDATE_RANGE, oid, offset, count, buf) == -1)
+    {
+        if (line != NULL)
+            cache_remove(shard, line);
+        result = -1;
+    }
+
+    // Grow the cached copy to match (or drop it if we cannot)
+    else if (line != NULL)
+    {
+        if (line->length != length || cache_resize(shard, line, offset + count) != 0)
+            cache_remove(shard, line);
+        else
+            memcpy(&line->data[offset], buf, count);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_create
+// Description  : Create a new object on the server (always immediate, we need
+//                the OID) and keep a copy of the contents in the cache.
+//
+// Inputs       : cache - the cache
+//                length - the length of the new object
+//                buf - the contents of the new object
+// Outputs      : the new object ID, CRUD_NO_OBJECT if failure
+
+CrudOID crud_cache_create(CrudCache *cache, uint32_t length, char *buf) {
+    // Declare variables
+    CrudResponse response;
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    if (cache_setup(cache) != 0)
+        return CRUD_NO_OBJECT;
+
+    // Create the object on the server
+    response = crud_endpoint_operation(cache->ep, construct_crud_request(0, CRUD_CREATE,
+                length, CRUD_NULL_FLAG, 0), buf);
+    deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+    if (rres == 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache create of %u bytes failed.", length);
+        return CRUD_NO_OBJECT;
+    }
+
+    // Keep the contents around, a failure here is not fatal
+    cache_keep(cache, roid, length, buf);
+    return roid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_replace
+// Description  : Create a new object to replace an old one, then delete the
+//                old one (dropping any cached copy).  If the server supports
+//                CRUD_COMPOUND both go out in one round trip.
+//
+// Inputs       : cache - the cache
+//                oid - the object being replaced
+//                length - the length of the new object
+//                buf - the contents of the new object
+// Outputs      : the new object ID, CRUD_NO_OBJECT if failure
+
+CrudOID crud_cache_replace(CrudCache *cache, CrudOID oid, uint32_t length, char *buf) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+    CrudCompoundOp ops[2];
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    if (cache_setup(cache) != 0)
+        return CRUD_NO_OBJECT;
+
+    // Without compound requests, it is just a create and a delete
+    if (!(crud_endpoint_capabilities(cache->ep) & CRUD_CAP_COMPOUND))
+    {
+        roid = crud_cache_create(cache, length, buf);
+        if (roid == CRUD_NO_OBJECT || crud_cache_delete(cache, oid) != 0)
+            return CRUD_NO_OBJECT;
+        return roid;
+    }
+
+    // Drop the old line, then create and delete on the server together
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+    if ((line = cache_lookup(shard, oid)) != NULL)
+        cache_remove(shard, line);
+    pthread_mutex_unlock(&shard->lock);
+
+    ops[0].op = construct_crud_request(0, CRUD_CREATE, length, CRUD_NULL_FLAG, 0);
+    ops[0].ext = 0;
+    ops[0].buf = buf;
+    ops[1].op = construct_crud_request(oid, CRUD_DELETE, 0, CRUD_NULL_FLAG, 0);
+    ops[1].ext = 0;
+    ops[1].buf = NULL;
+    if (crud_endpoint_compound(cache->ep, ops, 2) != 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache replace of object [%u] failed.", oid);
+        return CRUD_NO_OBJECT;
+    }
+    deconstruct_crud_request(ops[0].response, &roid, &rreq, &rlength, &rflags, &rres);
+
+    // Keep the new contents around, a failure here is not fatal
+    cache_keep(cache, roid, length, buf);
+    return roid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_delete
+// Description  : Delete an object from the server, dropping any cached copy
+//                (including unwritten dirty contents).
+//
+// Inputs       : cache - the cache
+//                oid - the object to delete
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_delete(CrudCache *cache, CrudOID oid) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+    CrudResponse response;
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    if (cache_setup(cache) != 0)
+        return -1;
+
+    // Drop the line, then delete on the server
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+    if ((line = cache_lookup(shard, oid)) != NULL)
+        cache_remove(shard, line);
+    pthread_mutex_unlock(&shard->lock);
+
+    response = crud_endpoint_operation(cache->ep, construct_crud_request(oid, CRUD_DELETE,
+                0, CRUD_NULL_FLAG, 0), NULL);
+    deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+    if (rres == 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache delete of object [%u] failed.", oid);
+        return -1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_forget
+// Description  : Drop any cached copy of an object (including unwritten dirty
+//                contents), for a caller deleting the object itself, e.g. in
+//                a batch of requests.
+//
+// Inputs       : cache - the cache
+//                oid - the object being deleted
+// Outputs      : none
+
+void crud_cache_forget(CrudCache *cache, CrudOID oid) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+
+    if (!cache->ready)
+        return;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+    if ((line = cache_lookup(shard, oid)) != NULL)
+        cache_remove(shard, line);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_flush
+// Description  : Write all dirty cache lines back to the server
+//
+// Inputs       : cache - the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_flush(CrudCache *cache) {
+    // Declare variables
+    uint32_t i;
+    int failed = 0;
+
+    if (!cache->ready)
+        return 0;
+
+    for (i = 0; i < cache->nshards; i++)
+    {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        if (shard_flush(&cache->shards[i]) != 0)
+            failed = 1;
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+
+    return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_invalidate
+// Description  : Drop all of the cache lines without writing them back, used
+//                when the contents of the device are no longer valid.
+//
+// Inputs       : cache - the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_invalidate(CrudCache *cache) {
+    // Declare variables
+    CrudCacheShard *shard;
+    uint32_t i;
+
+    if (!cache->ready)
+        return 0;
+
+    // Remove the lines one at a time from the LRU end
+    for (i = 0; i < cache->nshards; i++)
+    {
+        shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        while (shard->lru != NULL)
+            cache_remove(shard, shard->lru);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_close
+// Description  : Flush the cache, log the statistics and release the lines
+//                (the cache can still be used, lines are set up again)
+//
+// Inputs       : cache - the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_close(CrudCache *cache) {
+    // Declare variables
+    CrudCacheShard *shard;
+    uint32_t i, j;
+    uint64_t hits = 0, misses = 0, evictions = 0, writebacks = 0, ranged = 0, prefetched = 0, lookups;
+
+    // Write back whatever is still dirty
+    if (crud_cache_flush(cache) != 0)
+        return -1;
+
+    // Release all of the memory, adding up the statistics
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < cache->nshards; i++)
+    {
+        shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        hits += shard->hits;
+        misses += shard->misses;
+        evictions += shard->evictions;
+        writebacks += shard->writebacks;
+        ranged += shard->ranged;
+        prefetched += shard->prefetched;
+
+        for (j = 0; j < shard->max_lines; j++)
+            crud_slab_release(cache->slab, shard->lines[j].data);
+        free(shard->lines);
+        free(shard->buckets);
+        shard->lines = NULL;
+        shard->buckets = NULL;
+        shard->nbuckets = 0;
+        shard->used = 0;
+        shard->mru = shard->lru = shard->free = NULL;
+        shard->hits = shard->misses = shard->evictions = shard->writebacks = shard->ranged = 0;
+        shard->prefetched = 0;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    cache->nshards = 0;
+    __atomic_store_n(&cache->ready, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&cache->lock);
+
+    // Report the statistics
+    lookups = hits + misses;
+    logMessage(LOG_OUTPUT_LEVEL, "CRUD cache : %lu hits, %lu misses (%.1f%% hit rate), "
+            "%lu evictions, %lu write backs, %lu ranged misses, %lu prefetched.", hits, misses,
+            (lookups == 0) ? 0.0 : (100.0 * hits) / lookups,
+            evictions, writebacks, ranged, prefetched);
+
+    return 0;
+}
+
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_setup
+// Description  : Set up the shards of a cache on first use, with the
+//                configured lines spread over them
+//
+// Inputs       : cache - the cache
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_setup(CrudCache *cache) {
+    // Declare variables
+    uint32_t i, lines;
+    int result = 0;
+
+    // Already done?
+    if (__atomic_load_n(&cache->ready, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if (!cache->ready)
+    {
+        // Take the configuration, never more shards than lines
+        cache->policy = cache_policy;
+        cache->bypass = cache_bypass;
+        cache->nshards = (cache_max_lines < CRUD_CACHE_SHARDS) ? cache_max_lines : CRUD_CACHE_SHARDS;
+        if (cache->nshards == 0)
+            cache->nshards = 1;
+        lines = (cache_max_lines + cache->nshards - 1) / cache->nshards;
+
+        for (i = 0; i < cache->nshards && result == 0; i++)
+            result = shard_setup(&cache->shards[i], lines);
+        if (result != 0)
+        {
+            while (i-- > 0)
+            {
+                free(cache->shards[i].lines);
+                free(cache->shards[i].buckets);
+                cache->shards[i].lines = NULL;
+                cache->shards[i].buckets = NULL;
+            }
+            cache->nshards = 0;
+        }
+        else
+        {
+            __atomic_store_n(&cache->ready, 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_shard
+// Description  : Get the shard holding an object
+//
+// Inputs       : cache - the cache
+//                oid - the object
+// Outputs      : the shard
+
+static CrudCacheShard *cache_shard(CrudCache *cache, CrudOID oid) {
+    return &cache->shards[oid % cache->nshards];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_setup
+// Description  : Allocate the cache lines and hash buckets of a shard
+//
+// Inputs       : shard - the shard
+//                lines - the number of lines
+// Outputs      : 0 if successful, -1 if failure
+
+static int shard_setup(CrudCacheShard *shard, uint32_t lines) {
+    // Size the hash table to about one line per bucket
+    shard->max_lines = lines;
+    shard->nbuckets = lines;
+    shard->lines = calloc(lines, sizeof(CrudCacheLine));
+    shard->buckets = calloc(shard->nbuckets, sizeof(CrudCacheLine *));
+    if (shard->lines == NULL || shard->buckets == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache allocation of %u lines failed.", lines);
+        free(shard->lines);
+        free(shard->buckets);
+        shard->lines = NULL;
+        shard->buckets = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_flush
+// Description  : Write the dirty lines of a shard back to the server (the
+//                shard must be locked)
+//
+// Inputs       : shard - the shard
+// Outputs      : 0 if successful, -1 if failure
+
+static int shard_flush(CrudCacheShard *shard) {
+    // Declare variables
+    CrudCacheLine *line;
+    CrudRequest request;
+    CrudRequestExt ext;
+    CrudResponse response;
+    void *tag;
+    char *buf;
+    int inflight = 0, failed = 0;
+
+    // Walk the LRU list, writing back anything dirty.  The updates are
+    //  independent, so they are pipelined rather than sent one at a time.
+    for (line = shard->mru; line != NULL && !failed; line = line->next)
+    {
+        if (!line->dirty)
+            continue;
+
+        if (inflight == CRUD_PIPELINE_DEPTH)
+        {
+            if (crud_client_poll(&response, &tag) != 1)
+            {
+                failed = 1;
+                break;
+            }
+            inflight--;
+            if (cache_writeback_done(shard, tag, response) != 0)
+                failed = 1;
+        }
+
+        request = cache_writeback_request(shard, line, &ext, &buf);
+        if (crud_endpoint_submit(shard->cache->ep, request, ext, buf, line) != 0)
+            failed = 1;
+        else
+            inflight++;
+    }
+
+    // Collect the rest of the responses
+    while (crud_client_poll(&response, &tag) > 0)
+    {
+        if (cache_writeback_done(shard, tag, response) != 0)
+            failed = 1;
+    }
+
+    return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_lookup
+// Description  : Find the line holding an object and make it most recent
+//
+// Inputs       : shard - the (locked) shard of the object
+//                oid - the object to find
+// Outputs      : the cache line, NULL if not cached
+
+static CrudCacheLine *cache_lookup(CrudCacheShard *shard, CrudOID oid) {
+    // Declare variables
+    CrudCacheLine *line;
+
+    // Find the line in the hash bucket
+    for (line = shard->buckets[CRUD_CACHE_BUCKET(shard, oid)]; line != NULL; line = line->hnext)
+    {
+        if (line->oid == oid)
+            break;
+    }
+    if (line == NULL || line == shard->mru)
+        return line;
+
+    // Unlink from the LRU list and push on the front
+    line->prev->next = line->next;
+    if (line->next != NULL)
+        line->next->prev = line->prev;
+    else
+        shard->lru = line->prev;
+    line->prev = NULL;
+    line->next = shard->mru;
+    shard->mru->prev = line;
+    shard->mru = line;
+
+    return line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_insert
+// Description  : Get a line for an object (evicting the LRU line if needed),
+//                sized to hold length bytes, and make it most recent.
+//
+// Inputs       : shard - the (locked) shard of the object
+//                oid - the object to place in the line
+//                length - the length of the object
+// Outputs      : the cache line, NULL if failure
+
+static CrudCacheLine *cache_insert(CrudCacheShard *shard, CrudOID oid, uint32_t length) {
+    // Declare variables
+    CrudCacheLine *line;
+    char *data;
+    uint32_t bucket;
+
+    // Find a line: free list, unused storage, or the LRU victim
+    if (shard->free != NULL)
+    {
+        line = shard->free;
+        shard->free = line->next;
+    }
+    else if (shard->used < shard->max_lines)
+    {
+        line = &shard->lines[shard->used++];
+    }
+    else
+    {
+        line = shard->lru;
+        if (line->dirty && cache_writeback(shard, line) != 0)
+            return NULL;
+        shard->evictions++;
+        cache_remove(shard, line);
+        shard->free = line->next;
+    }
+
+    // Make sure the data buffer is large enough (the old contents are not needed)
+    if (line->capacity < length || line->data == NULL)
+    {
+        if ((data = crud_slab_alloc(shard->cache->slab, length)) == NULL)
+        {
+            line->next = shard->free;
+            shard->free = line;
+            return NULL;
+        }
+        crud_slab_release(shard->cache->slab, line->data);
+        line->data = data;
+        line->capacity = crud_slab_capacity(data);
+    }
+    line->oid = oid;
+    line->length = length;
+    line->dirty = 0;
+
+    // Put the line in its hash bucket and at the front of the LRU list
+    bucket = CRUD_CACHE_BUCKET(shard, oid);
+    line->hnext = shard->buckets[bucket];
+    shard->buckets[bucket] = line;
+    line->prev = NULL;
+    line->next = shard->mru;
+    if (shard->mru != NULL)
+        shard->mru->prev = line;
+    else
+        shard->lru = line;
+    shard->mru = line;
+
+    return line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_remove
+// Description  : Unlink a line from the hash and LRU list and free it.  The
+//                data buffer is kept for reuse.
+//
+// Inputs       : shard - the (locked) shard of the line
+//                line - the line to remove
+// Outputs      : none
+
+static void cache_remove(CrudCacheShard *shard, CrudCacheLine *line) {
+    // Declare variables
+    CrudCacheLine **link;
+
+    // Unlink from the hash bucket
+    for (link = &shard->buckets[CRUD_CACHE_BUCKET(shard, line->oid)]; *link != NULL; link = &(*link)->hnext)
+    {
+        if (*link == line)
+        {
+            *link = line->hnext;
+            break;
+        }
+    }
+
+    // Unlink from the LRU list
+    if (line->prev != NULL)
+        line->prev->next = line->next;
+    else
+        shard->mru = line->next;
+    if (line->next != NULL)
+        line->next->prev = line->prev;
+    else
+        shard->lru = line->prev;
+
+    // Put on the free list
+    line->oid = CRUD_NO_OBJECT;
+    line->dirty = 0;
+    line->prev = NULL;
+    line->hnext = NULL;
+    line->next = shard->free;
+    shard->free = line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_keep
+// Description  : Insert the contents of a newly created object in the cache
+//                (nothing happens if there is no line to put it in)
+//
+// Inputs       : cache - the cache
+//                oid - the new object
+//                length - the length of the object
+//                buf - its contents
+// Outputs      : none
+
+static void cache_keep(CrudCache *cache, CrudOID oid, uint32_t length, char *buf) {
+    // Declare variables
+    CrudCacheShard *shard;
+    CrudCacheLine *line;
+
+    if (cache->bypass)
+        return;
+
+    shard = cache_shard(cache, oid);
+    pthread_mutex_lock(&shard->lock);
+    if ((line = cache_insert(shard, oid, length)) != NULL)
+        memcpy(line->data, buf, length);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_fill
+// Description  : Read the whole object held in a (new) line from the server,
+//                removing the line if that fails
+//
+// Inputs       : shard - the (locked) shard of the line
+//                line - the line to fill
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_fill(CrudCacheShard *shard, CrudCacheLine *line) {
+    // Declare variables
+    CrudResponse response;
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    response = crud_endpoint_operation(shard->cache->ep, construct_crud_request(line->oid,
+                CRUD_READ, line->length, CRUD_NULL_FLAG, 0), line->data);
+    deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+    if (rres == 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache read of object [%u] failed.", line->oid);
+        cache_remove(shard, line);
+        return -1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_writeback
+// Description  : Send the contents of a line to the server as an UPDATE
+//
+// Inputs       : shard - the (locked) shard of the line
+//                line - the line to write back
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_writeback(CrudCacheShard *shard, CrudCacheLine *line) {
+    // Declare variables
+    CrudRequest request;
+    CrudRequestExt ext;
+    char *buf;
+
+    request = cache_writeback_request(shard, line, &ext, &buf);
+    return cache_writeback_done(shard, line,
+            crud_endpoint_range_operation(shard->cache->ep, request, (uint32_t) ext, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_writeback_request
+// Description  : Build the request that writes a dirty line back to the
+//                server, only sending the dirty bytes if the server can take
+//                a range
+//
+// Inputs       : shard - the (locked) shard of the line
+//                line - the cache line to write back
+//                ext - the place to put the extension word (offset)
+//                buf - the place to put the start of the bytes to send
+// Outputs      : the request
+
+static CrudRequest cache_writeback_request(CrudCacheShard *shard, CrudCacheLine *line,
+        CrudRequestExt *ext, char **buf) {
+    if ((crud_endpoint_capabilities(shard->cache->ep) & CRUD_CAP_RANGE) &&
+            (line->dirty_lo > 0 || line->dirty_hi < line->length))
+    {
+        *ext = line->dirty_lo;
+        *buf = &line->data[line->dirty_lo];
+        return construct_crud_request(line->oid, CRUD_UPDATE_RANGE,
+                line->dirty_hi - line->dirty_lo, CRUD_NULL_FLAG, 0);
+    }
+
+    *ext = 0;
+    *buf = line->data;
+    return construct_crud_request(line->oid, CRUD_UPDATE, line->length, CRUD_NULL_FLAG, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_writeback_done
+// Description  : Complete the write back of a line once the server responded
+//
+// Inputs       : shard - the (locked) shard of the line
+//                line - the cache line written back
+//                response - the response of the server
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_writeback_done(CrudCacheShard *shard, CrudCacheLine *line, CrudResponse response) {
+    // Declare variables
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+    if (rres == 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache write back of object [%u] failed.", line->oid);
+        return -1;
+    }
+
+    if (shard->cache->policy == CRUD_CACHE_WRITE_BACK)
+        shard->writebacks++;
+    line->dirty = 0;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_resize
+// Description  : Change the length of the object held in a line, keeping the
+//                existing contents
+//
+// Inputs       : shard - the shard holding the line
+//                line - the line to resize
+//                length - the new object length
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_resize(CrudCacheShard *shard, CrudCacheLine *line, uint32_t length) {
+    // Declare variables
+    char *data;
+
+    if (length > line->capacity)
+    {
+        if ((data = crud_slab_resize(shard->cache->slab, line->data, length)) == NULL)
+            return -1;
+        line->data = data;
+        line->capacity = crud_slab_capacity(data);
+    }
+    line->length = length;
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_mark_dirty
+// Description  : Mark a range of a line as needing write back, growing the
+//                dirty range of the line to cover it
+//
+// Inputs       : line - the line to mark
+//                lo - the first dirty byte
+//                hi - one past the last dirty byte
+// Outputs      : none
+
+static void cache_mark_dirty(CrudCacheLine *line, uint32_t lo, uint32_t hi) {
+    if (!line->dirty)
+    {
+        line->dirty = 1;
+        line->dirty_lo = lo;
+        line->dirty_hi = hi;
+        return;
+    }
+    if (lo < line->dirty_lo)
+        line->dirty_lo = lo;
+    if (hi > line->dirty_hi)
+        line->dirty_hi = hi;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_range_request
+// Description  : Send a range request (CRUD_READ_RANGE/CRUD_UPDATE_RANGE) to
+//                the server
+//
+// Inputs       : cache - the cache
+//                req - the range request type
+//                oid - the object to access
+//                offset - the first byte of the range
+//                count - the number of bytes in the range
+//                buf - the bytes to read into or write from
+// Outputs      : the number of bytes transferred, -1 if failure
+
+static int32_t cache_range_request(CrudCache *cache, CRUD_REQUEST_TYPES req, CrudOID oid,
+        uint32_t offset, uint32_t count, char *buf) {
+    // Declare variables
+    CrudResponse response;
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    response = crud_endpoint_range_operation(cache->ep, construct_crud_request(oid, req,
+                count, CRUD_NULL_FLAG, 0), offset, buf);
+    deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+    if (rres == 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache %s of object [%u] at %u failed.",
+                CRUD_REQUEST_TYPE_LABLES[req], oid, offset);
+        return -1;
+    }
+
+    return rlength;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_prefetch_requests
+// Description  : Send the reads of a prefetch together, a CRUD_COMPOUND if
+//                the server has them and pipelined requests if not
+//
+// Inputs       : cache - the cache
+//                ops - the reads (responses are put in place, the result
+//                      bit set if not executed)
+//                count - the number of reads
+// Outputs      : 0 if they all succeeded, -1 if any failed
+
+static int cache_prefetch_requests(CrudCache *cache, CrudCompoundOp *ops, uint32_t count) {
+    // Declare variables
+    CrudResponse response;
+    uint32_t i;
+    void *tag;
+    int failed = 0;
+
+    if (crud_endpoint_capabilities(cache->ep) & CRUD_CAP_COMPOUND)
+        return crud_endpoint_compound(cache->ep, ops, (int) count);
+
+    // Collect responses as the pipeline fills, then the rest
+    for (i = 0; i < count; i++)
+    {
+        ops[i].response = -1;
+        if (i >= CRUD_PIPELINE_DEPTH && crud_client_poll(&response, &tag) == 1)
+            ((CrudCompoundOp *) tag)->response = response;
+        if (crud_endpoint_submit(cache->ep, ops[i].op, 0, ops[i].buf, &ops[i]) != 0)
+            failed = 1;
+    }
+    while (crud_client_poll(&response, &tag) > 0)
+        ((CrudCompoundOp *) tag)->response = response;
+
+    for (i = 0; i < count && !failed; i++)
+        failed = CRUD_HEADER_RESULT(ops[i].response) != 0;
+    return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_read_request
+// Description  : Read part of an object with a whole object CRUD_READ,
+//                receiving only the wanted bytes into the buffer
+//
+// Inputs       : cache - the cache
+//                oid - the object to read
+//                length - the length of the object
+//                offset - the first byte of the range
+//                count - the number of bytes in the range
+//                buf - the place to put the bytes
+// Outputs      : the number of bytes read, -1 if failure
+
+static int32_t cache_read_request(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf) {
+    // Declare variables
+    CrudResponse response;
+    CrudOID roid;
+    CRUD_REQUEST_TYPES rreq;
+    uint32_t rlength;
+    uint8_t rflags, rres;
+
+    response = crud_endpoint_read_operation(cache->ep, construct_crud_request(oid, CRUD_READ,
+                length, CRUD_NULL_FLAG, 0), offset, count, buf);
+    deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+    if (rres == 1 || rlength != length)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD cache read of object [%u] failed.", oid);
+        return -1;
+    }
+
+    return count;
+}
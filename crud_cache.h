@@ -0,0 +1,98 @@
+#ifndef CRUD_CACHE_INCLUDED
+#define CRUD_CACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_cache.h
+//  Description    : This is the header file for the client-side object cache
+//                   that sits between the file IO layer and the CRUD client
+//                   protocol (crud_client_operation).  Each file system has
+//                   its own cache, safe to use from many threads at once.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Sat Nov 15 10:12:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+#include <crud_network.h>
+#include <crud_slab.h>
+
+// Defines
+#define CRUD_CACHE_DEFAULT_LINES 1024
+#define CRUD_CACHE_RANGE_MIN 4096 // Larger objects are accessed by range on a miss
+#define CRUD_CACHE_SHARDS 16 // Independently locked parts of a cache
+#define CRUD_CACHE_PREFETCH_MAX CRUD_COMPOUND_MAX_OPS // Most objects one prefetch reads
+
+// Type definitions
+
+// These are the cache write policies
+typedef enum {
+	CRUD_CACHE_WRITE_THROUGH = 0, // Updates are sent to the server immediately
+	CRUD_CACHE_WRITE_BACK    = 1, // Updates are held until eviction or flush
+} CRUD_CACHE_POLICY;
+
+// This is a cache of the objects of one server (opaque)
+typedef struct crud_cache CrudCache;
+
+//
+// Cache interface
+
+int crud_cache_init(uint32_t lines, CRUD_CACHE_POLICY policy);
+	// Set the number of cache lines (objects) and the write policy of caches
+
+CrudCache *crud_cache_new(CrudEndpoint *ep, CrudSlab *slab);
+	// Make a new cache of the objects of a server, with buffers from an allocator
+
+void crud_cache_free(CrudCache *cache);
+	// Release a cache (close it first)
+
+char *crud_cache_get(CrudCache *cache, CrudOID oid, uint32_t length);
+	// Get a pointer to the cached contents of an object, reading on a miss
+
+int crud_cache_put(CrudCache *cache, CrudOID oid, uint32_t length, char *buf);
+	// Update the contents of an object through the cache
+
+int32_t crud_cache_read(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf);
+	// Read a range of an object through the cache
+
+uint32_t crud_cache_lines(CrudCache *cache);
+	// Get the number of lines of a cache (0 if caching is disabled)
+
+int crud_cache_prefetch(CrudCache *cache, const CrudOID *oids, const uint32_t *lengths, uint32_t count);
+	// Read objects into the cache ahead of their use, in one round trip
+
+int crud_cache_write(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf);
+	// Write a range of an object (in place) through the cache
+
+int crud_cache_extend(CrudCache *cache, CrudOID oid, uint32_t length, uint32_t offset,
+        uint32_t count, char *buf);
+	// Write a range that runs past the end of an object, growing it in place
+
+CrudOID crud_cache_create(CrudCache *cache, uint32_t length, char *buf);
+	// Create a new object on the server and insert it into the cache
+
+CrudOID crud_cache_replace(CrudCache *cache, CrudOID oid, uint32_t length, char *buf);
+	// Create a new object replacing an old one, and delete the old one
+
+int crud_cache_delete(CrudCache *cache, CrudOID oid);
+	// Delete an object from the server and drop it from the cache
+
+void crud_cache_forget(CrudCache *cache, CrudOID oid);
+	// Drop an object from the cache without writing it back (it is being deleted)
+
+int crud_cache_flush(CrudCache *cache);
+	// Write all dirty cache lines back to the server
+
+int crud_cache_invalidate(CrudCache *cache);
+	// Drop all cache lines without writing them back (e.g., on format)
+
+int crud_cache_close(CrudCache *cache);
+	// Flush the cache, log the hit/miss statistics and release the lines
+
+#endif
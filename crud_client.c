@@ -8,27 +8,208 @@
 //
 
 // Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
 // Project Include Files
 #include <crud_network.h>
+#include <crud_store.h>
+#include <crud_compress.h>
+#include <crud_uring.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+// Defines
+#define CRUD_POOL_MAX_CONNECTIONS 64
+#define CRUD_MAX_ENDPOINTS 64
+#define CRUD_PIPELINE_LINKS CRUD_MAX_SHARDS // Servers a pipeline can have requests in flight to
+#define CRUD_SINK_SIZE 65536 // Size of the buffer unwanted read bytes are dropped into
+#define CRUD_RESPONSE_BYTES(op) (CRUD_HEADER_REQ(op) == CRUD_READ || \
+        CRUD_HEADER_REQ(op) == CRUD_READ_RANGE ? CRUD_HEADER_LENGTH(op) : 0)
+#define CRUD_RING_ENTRIES (2 * CRUD_PIPELINE_LINKS) // A send and a receive per link
+#define CRUD_RING_INBOX_BYTES 65536 // Receive buffer of each link (ring transport)
+#define CRUD_RING_DIRECT_BYTES (CRUD_RING_INBOX_BYTES / 2) // Payloads received in place from here
+#define CRUD_RING_SEND 1 // Completion of the send of a link
+#define CRUD_RING_INBOX 2 // Completion of a receive into the inbox of a link
+#define CRUD_RING_PAYLOAD 3 // Completion of a receive straight into a read buffer
+#define CRUD_RING_TAG(link, kind) ((uint64_t) ((link) - crud_pipe.links) << 8 | (kind))
+#define CRUD_RING_INBOX_OF(link) (crud_ring_buffer + ((link) - crud_pipe.links) * CRUD_RING_INBOX_BYTES)
+
+// Type definitions
+
+// This is a point of a placement ring
+typedef struct {
+    uint32_t  hash;                     // Position on the ring
+    uint32_t  shard;                    // Server owning the ring up to here
+} CrudShardPoint;
+
+// This is a CRUD server the client talks to, or a list of them
+struct crud_endpoint {
+    char      address[INET_ADDRSTRLEN]; // Address of the server
+    uint16_t  port;                     // Port of the server
+    uint32_t  caps;                     // Extensions negotiated with the server
+    uint8_t   used;                     // Flag indicating the slot is in use
+    uint8_t   local;                    // Flag indicating it is the local store
+
+    // Sharded endpoints only (nshards is 0 for a single server)
+    char            *servers;           // The server list
+    uint32_t         nshards;           // Number of servers
+    CrudEndpoint    *shards[CRUD_MAX_SHARDS]; // The servers, in list order
+    CrudShardPoint  *ring;              // Placement ring (sorted by hash)
+    uint32_t         npoints;           // Points on the ring
+    uint32_t         creates;           // Objects placed so far (the placement key)
+};
+
+// This is a pooled connection to a CRUD server
+typedef struct {
+    CrudEndpoint *ep;                   // The server connected to
+    int           fd;                   // Socket file descriptor (-1 if slot unused)
+    uint8_t       busy;                 // Flag indicating an operation is using it
+} CrudConnection;
+
+// This is a request submitted to the pipeline
+typedef struct {
+    CrudRequest     op;                 // The request
+    void           *buf;                // The buffer of the request
+    void           *tag;                // The caller's tag for the request
+    CrudResponse    response;           // The response (once received)
+    CrudConnection *conn;               // Connection it is in flight on (NULL once answered)
+    uint32_t        shard;              // Shard bits to put in the response OID
+    uint8_t         sharded;            // Flag indicating it went to a list of servers
+
+    // Ring transport only (requests wait in the entry until the link sends)
+    uint8_t         queued;             // Flag indicating it is not sent yet
+    CrudRequestExt  ext;                // The extension word
+    CrudRequest     header;             // The header in network byte order (while sending)
+    CrudRequestExt  ext_word;           // The extension word in network byte order
+} CrudPipelineEntry;
+
+// This is a connection the pipeline has requests in flight on
+typedef struct {
+    CrudConnection *conn;               // The connection (NULL if unused)
+    int             count;              // Requests in flight on it
+    uint32_t        bytes;              // Read bytes in flight on it
+
+    // Ring transport only: one send of every queued request, and one receive
+    //  (into the inbox of the link, or straight into a large read buffer)
+    int             queued;             // Requests not sent yet
+    uint8_t         sending;            // Flag indicating a send is in flight
+    uint8_t         receiving;          // Flag indicating a receive is in flight
+    uint8_t         failed;             // Flag indicating it is dropped once they complete
+    uint8_t         reading;            // Flag indicating a read payload is arriving
+    CrudResponse    response;           // The response whose payload is arriving
+    uint32_t        got;                // Bytes of that payload in place
+    uint32_t        fill;               // Bytes in the inbox, not taken yet
+    struct msghdr   msg;                // The send in flight
+    struct iovec    iov[3 * CRUD_PIPELINE_DEPTH]; // Its pieces
+} CrudPipelineLink;
+
+// The pipeline: a ring of submitted requests, oldest first, in flight on up
+// to one connection per server.  Each server answers the requests on its
+// connection in order, so the oldest entry in flight on a connection is
+// the one the next response there belongs to.
+typedef struct {
+    CrudPipelineEntry entries[CRUD_PIPELINE_DEPTH];
+    CrudPipelineLink  links[CRUD_PIPELINE_LINKS];
+    int             head;               // The oldest entry
+    int             count;              // Entries submitted but not yet polled
+} CrudPipeline;
+
 // Global variables
 int            crud_network_shutdown = 0; // Flag indicating shutdown
 unsigned char *crud_network_address = NULL; // Address of CRUD server 
 unsigned short crud_network_port = 0; // Port of CRUD server
-int            socket_fd = -1; // socket file descriptor
+char          *crud_network_store = NULL; // Local store file used instead
+int            crud_network_compress = 0; // Code payloads for servers that take them
+int            crud_network_uring = 0; // Pipeline through an io_uring ring
+
+// The endpoints and the connection pool, shared by all threads (each
+// connection is used by one thread at a time, while it is busy)
+pthread_mutex_t crud_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+CrudEndpoint crud_endpoints[CRUD_MAX_ENDPOINTS];
+CrudConnection crud_pool[CRUD_POOL_MAX_CONNECTIONS] = {
+    [0 ... CRUD_POOL_MAX_CONNECTIONS-1] = { .fd = -1 }
+};
+
+// Each thread has its own pipeline and sink (contents never used), and a
+// buffer for coded payloads (allocated on first use)
+__thread CrudPipeline crud_pipe;
+__thread char crud_sink[CRUD_SINK_SIZE];
+__thread char *crud_coded = NULL;
+__thread uint32_t crud_coded_size = 0;
+
+// With crud_network_uring each thread also has a ring (set up on first use,
+// released when the thread exits) and the inboxes of its links, registered
+// with the ring so the kernel does not map them on every receive
+__thread CrudUring *crud_ring = NULL;
+__thread int crud_ring_state = 0; // 0 not set up, 1 ready, -1 blocking sockets
+__thread int crud_ring_fixed = 0; // Flag indicating the inboxes are registered
+__thread char *crud_ring_buffer = NULL;
+pthread_once_t crud_ring_once = PTHREAD_ONCE_INIT;
+pthread_key_t crud_ring_key;
+
+// The wire statistics, by request type (updated atomically by all threads)
+CrudWireStats crud_wire[CRUD_MAXVAL];
 
 //
 // Functions
 
-int crud_send(CrudRequest request, void *buf);
-CrudResponse crud_receive(void *buf);
+CrudResponse crud_client_request(CrudEndpoint *ep, CrudRequest op, CrudRequestExt ext,
+        void *buf, uint32_t skip, uint32_t take);
+CrudConnection *crud_pool_acquire(CrudEndpoint *ep, int handshake);
+void crud_pool_release(CrudConnection *conn);
+void crud_pool_drop(CrudConnection *conn);
+int crud_connect(CrudConnection *conn, CrudEndpoint *ep);
+int crud_handshake(CrudConnection *conn);
+CrudPipelineLink *crud_pipe_link(CrudEndpoint *ep);
+int crud_pipe_receive(CrudPipelineLink *link);
+void crud_pipe_fail(CrudPipelineLink *link);
+void crud_pipe_quickack(CrudPipelineLink *link, CrudPipelineEntry *entry);
+int crud_ring_ready(void);
+void crud_ring_key_init(void);
+void crud_ring_release(void *ring);
+int crud_ring_receive(CrudPipelineLink *link);
+int crud_ring_step(void);
+int crud_ring_post(CrudPipelineLink *link);
+void crud_ring_complete(uint64_t tag, int32_t result);
+int crud_ring_take(CrudPipelineLink *link);
+void crud_ring_finish(CrudPipelineLink *link, CrudPipelineEntry *entry, CrudResponse response);
+CrudPipelineEntry *crud_ring_oldest(CrudPipelineLink *link);
+void crud_ring_fail(CrudPipelineLink *link);
+void crud_ring_idle(CrudPipelineLink *link);
+CrudEndpoint *crud_shard_group(const char *servers, uint16_t port);
+CrudEndpoint *crud_shard_route(CrudEndpoint *ep, CrudRequest *op, int home, uint32_t *shard);
+CrudResponse crud_shard_tag(CrudResponse response, uint32_t shard);
+CrudResponse crud_shard_request(CrudEndpoint *ep, CrudRequest op, CrudRequestExt ext,
+        void *buf, uint32_t skip, uint32_t take);
+int crud_shard_compound(CrudEndpoint *ep, CrudCompoundOp *ops, int count);
+int crud_shard_broadcast(CrudRequest op);
+uint32_t crud_shard_hash(uint32_t x);
+int crud_send(int fd, CrudRequest request, CrudRequestExt ext, void *buf, int compress);
+uint32_t crud_code_payload(void *buf, uint32_t length);
+char *crud_coded_buffer(uint32_t bytes);
+int crud_pack(struct iovec *iov, CrudRequest request, CrudRequestExt ext, void *buf,
+        CrudRequest *header, CrudRequestExt *ext_word, uint64_t *payload);
+int crud_send_iov(int fd, struct iovec *iov, int count, uint64_t *calls);
+void crud_msg_advance(struct msghdr *msg, size_t written);
+int crud_send_compound(int fd, CrudCompoundOp *ops, int count);
+int crud_receive_compound(int fd, CrudResponse *response, CrudCompoundOp *ops, int count);
+int crud_receive(int fd, CrudResponse *response, void *buf);
+int crud_receive_range(int fd, CrudResponse *response, void *buf, uint32_t skip, uint32_t take);
+int crud_receive_coded(int fd, uint32_t length, void *buf, uint32_t skip, uint32_t take,
+        uint32_t *received, uint64_t *calls);
+int crud_discard(int fd, uint32_t length, uint64_t *calls);
+int crud_recv_all(int fd, void *buf, size_t length, uint64_t *calls);
+void crud_wire_count(CrudWireStats *stats, uint64_t bytes_sent, uint64_t bytes_received,
+        uint64_t syscalls, uint64_t wait_ns);
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -45,146 +226,2266 @@ CrudResponse crud_receive(void *buf);
 // Outputs      : the response structure encoded as needed
 
 CrudResponse crud_client_operation(CrudRequest op, void *buf) {
+    return crud_endpoint_operation(crud_client_endpoint(NULL, 0), op, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_range_operation
+// Description  : This is the client operation for the range requests
+//                (CRUD_READ_RANGE/CRUD_UPDATE_RANGE), which carry the offset
+//                of the range in an extension word after the header.  Only
+//                valid if the server negotiated CRUD_CAP_RANGE.
+//
+// Inputs       : op - the request opcode for the command
+//                offset - the offset into the object of the range
+//                buf - the block to be read/written from
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_client_range_operation(CrudRequest op, uint32_t offset, void *buf) {
+    return crud_endpoint_range_operation(crud_client_endpoint(NULL, 0), op, offset, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_read_operation
+// Description  : Read part of an object with a plain CRUD_READ (for servers
+//                without CRUD_CAP_RANGE), receiving only the wanted bytes
+//                into the buffer and dropping the rest as they arrive.
+//
+// Inputs       : op - the CRUD_READ request (length is the whole object)
+//                offset - the first byte wanted
+//                count - the number of bytes wanted
+//                buf - the place to put the wanted bytes
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_client_read_operation(CrudRequest op, uint32_t offset, uint32_t count, void *buf) {
+    return crud_endpoint_read_operation(crud_client_endpoint(NULL, 0), op, offset, count, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_capabilities
+// Description  : Return the protocol extensions negotiated with the server
+//
+// Inputs       : none
+// Outputs      : mask of CRUD_CAP_* values (0 if basic protocol only)
+
+uint32_t crud_client_capabilities(void) {
+    return crud_endpoint_capabilities(crud_client_endpoint(NULL, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_submit
+// Description  : Pipelined request to the default server (crud_endpoint_submit)
+//
+// Inputs       : op - the request opcode for the command
+//                ext - the extension word (range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                tag - a value handed back with the response
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_client_submit(CrudRequest op, CrudRequestExt ext, void *buf, void *tag) {
+    return crud_endpoint_submit(crud_client_endpoint(NULL, 0), op, ext, buf, tag);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_compound
+// Description  : Compound request to the default server (crud_endpoint_compound)
+//
+// Inputs       : ops - the sub-requests (responses are put in place)
+//                count - the number of sub-requests
+// Outputs      : 0 if every sub-request succeeded, -1 if failure
+
+int crud_client_compound(CrudCompoundOp *ops, int count) {
+    return crud_endpoint_compound(crud_client_endpoint(NULL, 0), ops, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_endpoint
+// Description  : Get the handle of a CRUD server (the same handle every time
+//                for the same address and port).  Handles live for the rest
+//                of the program.
+//
+// Inputs       : address - the IP address of the server, or a list of
+//                          servers (NULL for the one given by
+//                          crud_network_address, or the default)
+//                port - the port of the server (0 for crud_network_port, or
+//                       the default)
+// Outputs      : the endpoint, or NULL if failure (if crud_network_store is
+//                set, the default is instead the local store)
+
+CrudEndpoint *crud_client_endpoint(const char *address, uint16_t port) {
+    // Declare variables
+    CrudEndpoint *ep = NULL;
+    int i, local;
+
+    // Fall back to the local store or the configured server, then the defaults
+    local = (address == NULL && port == 0 && crud_network_store != NULL);
+    if (local)
+        address = CRUD_LOCAL_ADDRESS;
+    else if (address == NULL)
+        address = (crud_network_address != NULL) ? (const char *) crud_network_address : CRUD_DEFAULT_IP;
+    if (port == 0 && !local)
+        port = (crud_network_port != 0) ? crud_network_port : CRUD_DEFAULT_PORT;
+    if (strchr(address, ',') != NULL || strchr(address, ':') != NULL)
+        return crud_shard_group(address, port);
+
+    pthread_mutex_lock(&crud_pool_lock);
+    for (i = 0; i < CRUD_MAX_ENDPOINTS; i++)
+    {
+        if (crud_endpoints[i].used && crud_endpoints[i].port == port &&
+                strcmp(crud_endpoints[i].address, address) == 0)
+        {
+            ep = &crud_endpoints[i];
+            break;
+        }
+        if (!crud_endpoints[i].used && ep == NULL)
+            ep = &crud_endpoints[i];
+    }
+
+    // Add a new one in the first free slot
+    if (ep != NULL && !ep->used)
+    {
+        strncpy(ep->address, address, sizeof(ep->address) - 1);
+        ep->address[sizeof(ep->address) - 1] = '\0';
+        ep->port = port;
+        ep->caps = 0;
+        ep->used = 1;
+        ep->local = (uint8_t) local;
+    }
+    pthread_mutex_unlock(&crud_pool_lock);
+
+    if (ep == NULL)
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : too many servers [%d].", CRUD_MAX_ENDPOINTS);
+    return ep;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_endpoint_operation
+// Description  : Send a request to a server and return the response (see
+//                crud_client_operation)
+//
+// Inputs       : ep - the server
+//                op - the request opcode for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_endpoint_operation(CrudEndpoint *ep, CrudRequest op, void *buf) {
+    return crud_client_request(ep, op, 0, buf, 0, UINT32_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_endpoint_range_operation
+// Description  : Send a range request to a server (see
+//                crud_client_range_operation)
+//
+// Inputs       : ep - the server
+//                op - the request opcode for the command
+//                offset - the offset into the object of the range
+//                buf - the block to be read/written from
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_endpoint_range_operation(CrudEndpoint *ep, CrudRequest op, uint32_t offset, void *buf) {
+    return crud_client_request(ep, op, (CrudRequestExt) offset, buf, 0, UINT32_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_endpoint_read_operation
+// Description  : Read part of an object from a server with a plain CRUD_READ
+//                (see crud_client_read_operation)
+//
+// Inputs       : ep - the server
+//                op - the CRUD_READ request (length is the whole object)
+//                offset - the first byte wanted
+//                count - the number of bytes wanted
+//                buf - the place to put the wanted bytes
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_endpoint_read_operation(CrudEndpoint *ep, CrudRequest op, uint32_t offset,
+        uint32_t count, void *buf) {
+    return crud_client_request(ep, op, 0, buf, offset, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_endpoint_capabilities
+// Description  : Return the protocol extensions negotiated with a server
+//
+// Inputs       : ep - the server
+// Outputs      : mask of CRUD_CAP_* values (0 if basic protocol only)
+
+uint32_t crud_endpoint_capabilities(CrudEndpoint *ep) {
+    return (ep != NULL) ? __atomic_load_n(&ep->caps, __ATOMIC_RELAXED) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_endpoint_compound
+// Description  : Send several requests to a server in one CRUD_COMPOUND, so
+//                they cost a single round trip.  The server executes them in
+//                order and stops at the first that fails; the ones not
+//                executed are left with the result bit set.  Only valid if
+//                the server negotiated CRUD_CAP_COMPOUND.  Not retried if
+//                the connection is lost (some may have executed).
+//
+// Inputs       : ep - the server
+//                ops - the sub-requests (responses are put in place)
+//                count - the number of sub-requests (at most
+//                        CRUD_COMPOUND_MAX_OPS)
+// Outputs      : 0 if every sub-request succeeded, -1 if failure
+
+int crud_endpoint_compound(CrudEndpoint *ep, CrudCompoundOp *ops, int count) {
+    // Declare variables
+    CrudConnection *conn;
+    CrudResponse response;
+    int i, req, closing = 0;
+
+    if (ep == NULL || count <= 0 || count > CRUD_COMPOUND_MAX_OPS)
+        return -1;
+    if (!(crud_endpoint_capabilities(ep) & CRUD_CAP_COMPOUND))
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : server does not support compound requests.");
+        return -1;
+    }
+
+    // Check the sub-requests (a CRUD_CLOSE can only come last)
+    for (i = 0; i < count; i++)
+    {
+        req = CRUD_HEADER_REQ(ops[i].op);
+        if (req == CRUD_INIT || req == CRUD_COMPOUND || req >= CRUD_MAXVAL || closing)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : bad compound sub-request %d [%lx].", i, ops[i].op);
+            return -1;
+        }
+        closing = (req == CRUD_CLOSE);
+        ops[i].response = -1;
+    }
+    if (ep->local)
+        return crud_store_compound(ops, count);
+    if (ep->nshards > 0)
+        return crud_shard_compound(ep, ops, count);
+
+    // Send the whole batch, receive the responses
+    conn = crud_pool_acquire(ep, 1);
+    if (conn == NULL)
+        return -1;
+    if (crud_send_compound(conn->fd, ops, count) == 0 &&
+            crud_receive_compound(conn->fd, &response, ops, count) == 0)
+    {
+        // if it ended in CRUD_CLOSE, close the connection
+        if (closing)
+            crud_pool_drop(conn);
+        else
+            crud_pool_release(conn);
+        return CRUD_HEADER_RESULT(response) ? -1 : 0;
+    }
+
+    crud_pool_drop(conn);
+    logMessage(LOG_ERROR_LEVEL, "CRUD client : CRUD_COMPOUND failed, connection lost.");
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_request
+// Description  : This is the common implementation of the client operations.
+//                Requests go over a pooled connection to the server,
+//                connecting on demand.  If the connection turns out to be
+//                broken, idempotent requests are retried once on a new one.
+//                Requests to the local store are executed in place.
+//
+// Inputs       : ep - the server
+//                op - the request opcode for the command
+//                ext - the extension word (range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                skip - read bytes to drop before filling buf
+//                take - most read bytes to put in buf (the rest are dropped)
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_client_request(CrudEndpoint *ep, CrudRequest op, CrudRequestExt ext,
+        void *buf, uint32_t skip, uint32_t take) {
     // Declare variables
+    CrudConnection *conn;
     CrudResponse response;
     uint8_t req;
+    int attempt, idempotent;
+
+    if (ep == NULL)
+        return -1;
 
     // Extract the request type
-    req = (uint8_t) ((op >> 28) & 0xf);
+    req = CRUD_HEADER_REQ(op);
+    idempotent = (req == CRUD_READ || req == CRUD_READ_RANGE ||
+            req == CRUD_UPDATE || req == CRUD_UPDATE_RANGE);
 
-    // if CRUD_INIT then make a connection to the server 
+    // CRUD_INIT asks the server which protocol extensions it supports
     if (req == CRUD_INIT)
+        op = CRUD_HEADER_SET_FLAGS(op, CRUD_EXT_PROBE_FLAG);
+    if (ep->nshards > 0)
+        return crud_shard_request(ep, op, ext, buf, skip, take);
+
+    if (ep->local)
+    {
+        response = crud_store_request(op, ext, buf, skip, take);
+        if (req == CRUD_INIT)
+            __atomic_store_n(&ep->caps, (CRUD_HEADER_RESULT(response) == 0) ?
+                CRUD_HEADER_LENGTH(response) : 0, __ATOMIC_RELAXED);
+        return response;
+    }
+
+    for (attempt = 0; attempt < 2; attempt++)
     {
-        // Create socket
-        socket_fd = socket(PF_INET, SOCK_STREAM, 0);
-        if (socket_fd == -1)
+        // Get a connection (a new one is set up unless this is the INIT)
+        conn = crud_pool_acquire(ep, req != CRUD_INIT);
+        if (conn == NULL)
+            return -1;
+
+        // Send request to server, receive response
+        if (crud_send(conn->fd, op, ext, buf, crud_network_compress &&
+                    (crud_endpoint_capabilities(ep) & CRUD_CAP_COMPRESS)) == 0 &&
+                crud_receive_range(conn->fd, &response, buf, skip, take) == 0)
         {
-            printf("Error on socket creation\n");
-            return(-1);
+            // A server with extensions answers INIT with its capabilities as length
+            if (req == CRUD_INIT)
+                __atomic_store_n(&ep->caps, (CRUD_HEADER_RESULT(response) == 0) ?
+                    CRUD_HEADER_LENGTH(response) : 0, __ATOMIC_RELAXED);
+
+            // if CRUD_CLOSE, close the connection
+            if (req == CRUD_CLOSE)
+                crud_pool_drop(conn);
+            else
+                crud_pool_release(conn);
+            return response;
         }
 
-        // Specify address to connect to
-        struct sockaddr_in v4;
-        v4.sin_family = AF_INET;
-        v4.sin_port = htons(CRUD_DEFAULT_PORT);
-        if (inet_aton(CRUD_DEFAULT_IP, &(v4.sin_addr)) == 0)
+        // The connection is broken, only retry if the request can be repeated
+        crud_pool_drop(conn);
+        if (!idempotent)
+            break;
+        logMessage(LOG_WARNING_LEVEL, "CRUD client : connection lost, retrying %s.",
+                CRUD_REQUEST_TYPE_LABLES[req]);
+    }
+
+    logMessage(LOG_ERROR_LEVEL, "CRUD client : %s failed, connection lost.",
+            CRUD_REQUEST_TYPE_LABLES[req]);
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shard_group
+// Description  : Get the handle of a list of servers sharing the objects
+//                (the same handle every time for the same list).  The
+//                placement ring has CRUD_SHARD_VNODES points per server,
+//                placed by list index so every client builds the same ring.
+//
+// Inputs       : servers - the "ip[:port],..." list of servers
+//                port - the port of servers given without one
+// Outputs      : the endpoint, or NULL if failure
+
+CrudEndpoint *crud_shard_group(const char *servers, uint16_t port) {
+    // Declare variables
+    CrudEndpoint *ep = NULL, *shards[CRUD_MAX_SHARDS];
+    CrudShardPoint *ring, point;
+    char address[INET_ADDRSTRLEN], *colon;
+    const char *token, *end;
+    uint32_t nshards = 0, npoints, i, j;
+    unsigned long p;
+    size_t len;
+
+    // Use the handle of the list if there is one
+    pthread_mutex_lock(&crud_pool_lock);
+    for (i = 0; i < CRUD_MAX_ENDPOINTS; i++)
+    {
+        if (crud_endpoints[i].used && crud_endpoints[i].nshards > 0 &&
+                crud_endpoints[i].port == port && strcmp(crud_endpoints[i].servers, servers) == 0)
         {
-            return(-1);
+            pthread_mutex_unlock(&crud_pool_lock);
+            return &crud_endpoints[i];
         }
+    }
+    pthread_mutex_unlock(&crud_pool_lock);
 
-        // Connect
-        if (connect(socket_fd, (const struct sockaddr *)&v4,
-                    sizeof(struct sockaddr)) == -1)
+    // Get the handles of the servers
+    for (token = servers; *token != '\0'; token = (*end == ',') ? end + 1 : end)
+    {
+        end = strchr(token, ',');
+        if (end == NULL)
+            end = token + strlen(token);
+        len = (size_t) (end - token);
+        if (len == 0 || len >= sizeof(address) + 6 || nshards == CRUD_MAX_SHARDS)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : bad server list [%s] (at most %d servers).",
+                    servers, CRUD_MAX_SHARDS);
+            return NULL;
+        }
+        p = port;
+        if ((colon = memchr(token, ':', len)) != NULL)
+        {
+            p = strtoul(colon + 1, NULL, 10);
+            len = (size_t) (colon - token);
+        }
+        if (len >= sizeof(address) || p == 0 || p > 0xffff)
         {
-            printf("Error connecting to server\n");
-            return(-1);
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : bad server [%.*s] in list.", (int) (end - token), token);
+            return NULL;
         }
+        memcpy(address, token, len);
+        address[len] = '\0';
+        if ((shards[nshards++] = crud_client_endpoint(address, (uint16_t) p)) == NULL)
+            return NULL;
     }
 
-    // Send request to server
-    if (crud_send(op, buf) != 0)
-        return -1;
+    // Build the placement ring (sorted by hash, a small insertion sort).  The
+    //  points hash values with the high bit set, the placement keys values
+    //  without, so that no key lands exactly on a point.
+    npoints = nshards * CRUD_SHARD_VNODES;
+    if ((ring = malloc(npoints * sizeof(CrudShardPoint))) == NULL)
+        return NULL;
+    for (i = 0; i < npoints; i++)
+    {
+        point.shard = i / CRUD_SHARD_VNODES;
+        point.hash = crud_shard_hash(0x80000000u | (point.shard << 16) | (i % CRUD_SHARD_VNODES));
+        for (j = i; j > 0 && ring[j-1].hash > point.hash; j--)
+            ring[j] = ring[j-1];
+        ring[j] = point;
+    }
+
+    // Another thread may have added the list meanwhile
+    pthread_mutex_lock(&crud_pool_lock);
+    for (i = 0; i < CRUD_MAX_ENDPOINTS; i++)
+    {
+        if (crud_endpoints[i].used && crud_endpoints[i].nshards > 0 &&
+                crud_endpoints[i].port == port && strcmp(crud_endpoints[i].servers, servers) == 0)
+        {
+            ep = &crud_endpoints[i];
+            break;
+        }
+        if (!crud_endpoints[i].used && ep == NULL)
+            ep = &crud_endpoints[i];
+    }
+    if (ep != NULL && !ep->used)
+    {
+        if ((ep->servers = strdup(servers)) == NULL)
+        {
+            pthread_mutex_unlock(&crud_pool_lock);
+            free(ring);
+            return NULL;
+        }
+        strcpy(ep->address, "");
+        ep->port = port;
+        ep->caps = 0;
+        ep->local = 0;
+        memcpy(ep->shards, shards, nshards * sizeof(CrudEndpoint *));
+        ep->ring = ring;
+        ep->npoints = npoints;
+        ep->creates = 0;
+        ep->nshards = nshards;
+        ep->used = 1;
+        ring = NULL;
+    }
+    pthread_mutex_unlock(&crud_pool_lock);
+
+    free(ring);
+    if (ep == NULL)
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : too many servers [%d].", CRUD_MAX_ENDPOINTS);
+    return ep;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shard_route
+// Description  : Pick the server of a list a request goes to, and turn the
+//                OID of the request into the one on that server.  New
+//                objects are placed by hashing a count of the objects
+//                created, which spreads them evenly without moving any
+//                object once placed.  The priority object lives on the first
+//                server.
+//
+// Inputs       : ep - the list of servers
+//                op - the request (its OID is rewritten)
+//                home - server for a CRUD_CREATE (-1 to place it on the ring)
+//                shard - the place to put the list index of the server
+// Outputs      : the server, or NULL if failure
+
+CrudEndpoint *crud_shard_route(CrudEndpoint *ep, CrudRequest *op, int home, uint32_t *shard) {
+    // Declare variables
+    uint32_t oid = CRUD_HEADER_OID(*op), key, lo, hi, mid;
+    uint8_t req = CRUD_HEADER_REQ(*op);
 
-    // Receive response
-    response = crud_receive(buf);
+    if (CRUD_HEADER_FLAGS(*op) & CRUD_PRIORITY_OBJECT)
+        *shard = 0;
+    else if (req == CRUD_CREATE && home >= 0)
+        *shard = (uint32_t) home;
+    else if (req == CRUD_CREATE)
+    {
+        // The first point at or after the key owns it (wrapping around)
+        key = crud_shard_hash(__atomic_fetch_add(&ep->creates, 1, __ATOMIC_RELAXED) & 0x7fffffff);
+        lo = 0;
+        hi = ep->npoints;
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            if (ep->ring[mid].hash < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        *shard = ep->ring[lo % ep->npoints].shard;
+    }
+    else
+        *shard = CRUD_SHARD_OF(oid);
 
-    // if CRUD_CLOSE, close the connection
-    if (req == CRUD_CLOSE) 
+    if (*shard >= ep->nshards)
     {
-        close(socket_fd);
-        socket_fd = -1;
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : object [%x] is on server %u, only %u in list.",
+                oid, *shard, ep->nshards);
+        return NULL;
     }
+    *op = CRUD_HEADER_SET_OID(*op, CRUD_SHARD_LOCAL(oid));
+    return ep->shards[*shard];
+}
 
-    return response;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shard_tag
+// Description  : Put the list index of the server into the OID of a
+//                response from it.  A server handing out OIDs that do not
+//                leave room for the index fails the request.
+//
+// Inputs       : response - the response from the server
+//                shard - the list index of the server
+// Outputs      : the response as seen by the caller
+
+CrudResponse crud_shard_tag(CrudResponse response, uint32_t shard) {
+    if (CRUD_HEADER_RESULT(response))
+        return response;
+    if (CRUD_SHARD_OF(CRUD_HEADER_OID(response)) != 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : server returned object [%x], too large to shard.",
+                CRUD_HEADER_OID(response));
+        return response | CRUD_HEADER_RES_MASK;
+    }
+    return response | ((CrudResponse) shard << (CRUD_SHARD_SHIFT + 32));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shard_broadcast
+// Description  : Check whether a request goes to every server of a list
+//
+// Inputs       : op - the request
+// Outputs      : 1 if it is a CRUD_INIT, CRUD_FORMAT or CRUD_CLOSE, 0 if not
+
+int crud_shard_broadcast(CrudRequest op) {
+    uint8_t req = CRUD_HEADER_REQ(op);
+    return (req == CRUD_INIT || req == CRUD_FORMAT || req == CRUD_CLOSE);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_send
-// Description  : This is the function that sends the client CrudRequest to the
-//                  server (and buffer if necessary).
+// Function     : crud_shard_hash
+// Description  : Scramble a 32 bit value (the murmur3 finalizer)
+//
+// Inputs       : x - the value
+// Outputs      : the hash
+
+uint32_t crud_shard_hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : request - the request opcode for the command
+// Function     : crud_shard_request
+// Description  : Send a request to a list of servers.  CRUD_INIT,
+//                CRUD_FORMAT and CRUD_CLOSE go to every server, and fail if
+//                any of them fails; the extensions of the list are the ones
+//                all servers offer.  Other requests go to the server of the
+//                object.
+//
+// Inputs       : ep - the list of servers
+//                op - the request opcode for the command
+//                ext - the extension word (range requests only)
 //                buf - the block to be read/written from (READ/WRITE)
-// Outputs      : 0 if successful, -1 if error 
+//                skip - read bytes to drop before filling buf
+//                take - most read bytes to put in buf (the rest are dropped)
+// Outputs      : the response structure encoded as needed
 
-int crud_send(CrudRequest request, void *buf)
-{
+CrudResponse crud_shard_request(CrudEndpoint *ep, CrudRequest op, CrudRequestExt ext,
+        void *buf, uint32_t skip, uint32_t take) {
     // Declare variables
-    int request_length = sizeof(CrudRequest), request_written;
-    CrudRequest *request_network_order = malloc(request_length);
-    int req = ((request >> 28) & 0xf);
-    int buf_length = ((request >> 4) & 0xffffff), buf_written;
+    CrudEndpoint *server;
+    CrudResponse response = -1, first = -1;
+    uint32_t i, shard, caps = UINT32_MAX, failed = 0;
 
-    // Convert request value to network byte order 
-    *request_network_order = htonll64(request);
+    if (crud_shard_broadcast(op))
+    {
+        for (i = 0; i < ep->nshards; i++)
+        {
+            response = crud_client_request(ep->shards[i], op, ext, buf, skip, take);
+            failed |= CRUD_HEADER_RESULT(response);
+            caps &= crud_endpoint_capabilities(ep->shards[i]);
+            if (i == 0)
+                first = response;
+        }
+        if (CRUD_HEADER_REQ(op) == CRUD_INIT)
+            __atomic_store_n(&ep->caps, failed ? 0 : caps, __ATOMIC_RELAXED);
+        return first | failed;
+    }
+
+    if ((server = crud_shard_route(ep, &op, -1, &shard)) == NULL)
+        return -1;
+    response = crud_client_request(server, op, ext, buf, skip, take);
+    return crud_shard_tag(response, shard);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shard_compound
+// Description  : Send a compound request to a list of servers.  Each server
+//                gets the sub-requests for its objects (and the CRUD_INIT,
+//                CRUD_FORMAT and CRUD_CLOSE ones), all servers working on
+//                theirs at the same time.  Each server executes its part in
+//                order and stops at its own first failure.  Objects created
+//                go on the server of the first object named, so that a
+//                create and delete replacing an object stay together.
+//
+// Inputs       : ep - the list of servers
+//                ops - the (checked) sub-requests (responses are put in place)
+//                count - the number of sub-requests
+// Outputs      : 0 if every sub-request succeeded, -1 if failure
+
+int crud_shard_compound(CrudEndpoint *ep, CrudCompoundOp *ops, int count) {
+    // Declare variables
+    CrudCompoundOp sub[CRUD_MAX_SHARDS][CRUD_COMPOUND_MAX_OPS];
+    CrudConnection *conn[CRUD_MAX_SHARDS];
+    CrudRequest op;
+    CrudResponse response;
+    int nsub[CRUD_MAX_SHARDS], where[CRUD_COMPOUND_MAX_OPS][CRUD_MAX_SHARDS];
+    int i, home = -1, failed = 0;
+    uint32_t s, shard, oid;
+    uint8_t req;
 
-    // Send converted request value, make sure all bytes are sent
-    request_written = write(socket_fd, request_network_order, request_length); 
-    while (request_written < request_length)
+    // Find the server of the first object named
+    for (i = 0; i < count && home < 0; i++)
     {
-        request_written += write(socket_fd, &((char *)request_network_order)[request_written],
-                request_length - request_written);
+        req = CRUD_HEADER_REQ(ops[i].op);
+        oid = CRUD_HEADER_OID(ops[i].op);
+        if (CRUD_HEADER_FLAGS(ops[i].op) & CRUD_PRIORITY_OBJECT)
+            home = 0;
+        else if (req == CRUD_READ || req == CRUD_UPDATE || req == CRUD_DELETE ||
+                req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE)
+            home = (CRUD_SHARD_OF(oid) < ep->nshards) ? (int) CRUD_SHARD_OF(oid) : -1;
     }
-    free(request_network_order);
 
-    // Check if you need to send buffer as well
-    if (req == CRUD_CREATE || req == CRUD_UPDATE)
+    // Split the sub-requests by server
+    memset(nsub, 0, sizeof(nsub));
+    for (i = 0; i < count; i++)
     {
-        buf_written = write(socket_fd, buf, buf_length);
-        while (buf_written < buf_length)
+        if (crud_shard_broadcast(ops[i].op))
         {
-            buf_written += write(socket_fd, &((char *)buf)[buf_written], buf_length - buf_written);
+            for (s = 0; s < ep->nshards; s++)
+            {
+                where[i][s] = nsub[s];
+                sub[s][nsub[s]++] = ops[i];
+            }
+            continue;
         }
+        for (s = 0; s < ep->nshards; s++)
+            where[i][s] = -1;
+        op = ops[i].op;
+        if (crud_shard_route(ep, &op, home, &shard) == NULL)
+            return -1;
+        where[i][shard] = nsub[shard];
+        sub[shard][nsub[shard]] = ops[i];
+        sub[shard][nsub[shard]++].op = op;
     }
 
-    return 0;
-}
+    // Send every server its part, then collect the responses
+    for (s = 0; s < ep->nshards; s++)
+    {
+        conn[s] = NULL;
+        if (nsub[s] == 0)
+            continue;
+        conn[s] = crud_pool_acquire(ep->shards[s], 1);
+        if (conn[s] == NULL || crud_send_compound(conn[s]->fd, sub[s], nsub[s]) != 0)
+        {
+            if (conn[s] != NULL)
+                crud_pool_drop(conn[s]);
+            conn[s] = NULL;
+            failed = 1;
+        }
+    }
+    for (s = 0; s < ep->nshards; s++)
+    {
+        if (conn[s] == NULL)
+            continue;
+        if (crud_receive_compound(conn[s]->fd, &response, sub[s], nsub[s]) != 0)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : CRUD_COMPOUND failed, connection lost.");
+            crud_pool_drop(conn[s]);
+            failed = 1;
+            continue;
+        }
+        failed |= CRUD_HEADER_RESULT(response);
 
+        // if its part ended in a CRUD_CLOSE, close the connection
+        if (CRUD_HEADER_REQ(sub[s][nsub[s]-1].op) == CRUD_CLOSE)
+            crud_pool_drop(conn[s]);
+        else
+            crud_pool_release(conn[s]);
+    }
+
+    // Put the responses in place (a broadcast one fails if any server failed it)
+    for (i = 0; i < count; i++)
+    {
+        ops[i].response = 0;
+        for (s = 0; s < ep->nshards; s++)
+        {
+            if (where[i][s] < 0)
+                continue;
+            response = sub[s][where[i][s]].response;
+            if (crud_shard_broadcast(ops[i].op))
+                ops[i].response = ((s == 0) ? response : ops[i].response) | CRUD_HEADER_RESULT(response);
+            else
+                ops[i].response = crud_shard_tag(response, s);
+        }
+    }
+    return failed ? -1 : 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_receive
-// Description  : This is the function that receives the server response (and
-//                  buffer if necessary).
+// Function     : crud_endpoint_submit
+// Description  : Send a request to the server without waiting for the
+//                response, so that many independent requests can be in
+//                flight on one connection.  The responses are collected in
+//                submission order with crud_client_poll.  The buffer must stay
+//                valid until then.  Not for CRUD_INIT, CRUD_FORMAT or
+//                CRUD_CLOSE.  Each thread has its own pipeline, which can
+//                have requests in flight to several servers at once (one
+//                connection each).  Requests to the local store complete at
+//                once.  With crud_network_uring the request waits in the
+//                pipeline, and goes out with the others queued for its
+//                server at the next poll (its payload is never coded).
 //
-// Inputs       : buf - the block to be read/written from (READ/WRITE)
-// Outputs      : server CrudResponse
+// Inputs       : ep - the server
+//                op - the request opcode for the command
+//                ext - the extension word (range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                tag - a value handed back with the response
+// Outputs      : 0 if successful, -1 if failure (pipeline full or the
+//                connection failed)
 
-CrudResponse crud_receive(void *buf)
-{
+int crud_endpoint_submit(CrudEndpoint *ep, CrudRequest op, CrudRequestExt ext, void *buf, void *tag) {
     // Declare variables
-    CrudResponse response_host_order;
-    int response_length = sizeof(CrudResponse), response_read;
-    CrudResponse *response = malloc(response_length);
-    int buf_length, buf_read;
-    int response_req;
+    CrudPipelineEntry *entry;
+    CrudPipelineLink *link;
+    CrudEndpoint *list;
+    uint32_t bytes = CRUD_RESPONSE_BYTES(op), shard = 0;
 
-    // Receive response value
-    response_read = read(socket_fd, response, response_length);
-    while (response_read < response_length)
+    if (crud_pipe.count == CRUD_PIPELINE_DEPTH)
     {
-        response_read += read(socket_fd, &((char *)response)[response_read], response_length - response_read);
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : pipeline full, poll before submitting.");
+        return -1;
     }
+    if (ep == NULL || (ep->nshards > 0 && crud_shard_broadcast(op)))
+        return -1;
+
+    // Requests to a list of servers go to the one owning the object
+    list = ep;
+    if (ep->nshards > 0 && (ep = crud_shard_route(ep, &op, -1, &shard)) == NULL)
+        return -1;
+    entry = &crud_pipe.entries[(crud_pipe.head + crud_pipe.count) % CRUD_PIPELINE_DEPTH];
+    entry->op = op;
+    entry->buf = buf;
+    entry->tag = tag;
+    entry->shard = shard;
+    entry->sharded = (ep != list);
+    entry->conn = NULL;
 
-    // Convert received value into host byte order
-    response_host_order = ntohll64(*response);
-    free(response);
+    // The local store answers at once
+    if (ep->local)
+    {
+        entry->response = crud_store_request(op, ext, buf, 0, UINT32_MAX);
+        crud_pipe.count++;
+        return 0;
+    }
 
-    // Extract request type and length from converted response
-    response_req = ((response_host_order >> 28) & 0xf);
-    buf_length = ((response_host_order >> 4) & 0xffffff);
+    // Collect responses first if the reads in flight could fill the socket
+    if ((link = crud_pipe_link(ep)) == NULL)
+        return -1;
+    while (link->count > 0 && link->bytes + bytes > CRUD_PIPELINE_MAX_BYTES)
+    {
+        if (crud_pipe_receive(link) != 0)
+            return -1;
+    }
+    if (link->conn == NULL && (link = crud_pipe_link(ep)) == NULL)
+        return -1;
 
-    // Check if you need to receive buffer
-    if (response_req == CRUD_READ)
+    // Send the request and queue it (on a ring it waits for the link to send)
+    if (crud_ring_ready())
     {
-        buf_read = read(socket_fd, buf, buf_length);
-        while (buf_read < buf_length)
-        {
-            buf_read += read(socket_fd, &((char *)buf)[buf_read], buf_length - buf_read);
-        }
+        entry->ext = ext;
+        entry->queued = 1;
+        link->queued++;
+    }
+    else if (crud_send(link->conn->fd, op, ext, buf, crud_network_compress &&
+                (crud_endpoint_capabilities(ep) & CRUD_CAP_COMPRESS)) != 0)
+    {
+        crud_pipe_fail(link);
+        return -1;
     }
+    entry->conn = link->conn;
+    link->count++;
+    link->bytes += bytes;
+    crud_pipe.count++;
+    return 0;
+}
 
-    return response_host_order;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_poll
+// Description  : Get the response of the oldest request this thread
+//                submitted, waiting for it if needed.  If the connection was
+//                lost the response has the result bit set (like
+//                crud_client_operation's -1).
+//
+// Inputs       : response - the place to put the response
+//                tag - the place to put the tag of the request (may be NULL)
+// Outputs      : 1 if a response was returned, 0 if nothing is outstanding,
+//                -1 if the oldest request has no connection to wait on
+
+int crud_client_poll(CrudResponse *response, void **tag) {
+    // Declare variables
+    CrudPipelineEntry *entry;
+    int i;
+
+    if (crud_pipe.count == 0)
+        return 0;
+
+    // Receive on its connection until the oldest entry is answered
+    entry = &crud_pipe.entries[crud_pipe.head];
+    while (entry->conn != NULL)
+    {
+        for (i = 0; i < CRUD_PIPELINE_LINKS && crud_pipe.links[i].conn != entry->conn; i++)
+            ;
+        if (i == CRUD_PIPELINE_LINKS)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : pipelined request has no connection.");
+            return -1;
+        }
+        crud_pipe_receive(&crud_pipe.links[i]);
+    }
+
+    // Hand back the oldest entry
+    *response = entry->response;
+    if (tag != NULL)
+        *tag = entry->tag;
+    crud_pipe.head = (crud_pipe.head + 1) % CRUD_PIPELINE_DEPTH;
+    crud_pipe.count--;
+    return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pipe_link
+// Description  : Get the pipeline connection to a server, taking one from
+//                the pool if there is none
+//
+// Inputs       : ep - the server (not a list)
+// Outputs      : the link, or NULL if failure
+
+CrudPipelineLink *crud_pipe_link(CrudEndpoint *ep) {
+    // Declare variables
+    CrudPipelineLink *link = NULL;
+    int i;
+
+    for (i = 0; i < CRUD_PIPELINE_LINKS; i++)
+    {
+        if (crud_pipe.links[i].conn != NULL && crud_pipe.links[i].conn->ep == ep &&
+                !crud_pipe.links[i].failed)
+            return &crud_pipe.links[i];
+        if (crud_pipe.links[i].conn == NULL && link == NULL)
+            link = &crud_pipe.links[i];
+    }
+    if (link == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : pipeline busy with %d servers.", CRUD_PIPELINE_LINKS);
+        return NULL;
+    }
+    if ((link->conn = crud_pool_acquire(ep, 1)) == NULL)
+        return NULL;
+    link->count = 0;
+    link->bytes = 0;
+    link->queued = 0;
+    link->sending = link->receiving = link->failed = link->reading = 0;
+    link->fill = 0;
+    return link;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pipe_receive
+// Description  : Receive the response of the oldest request in flight on a
+//                pipeline connection (which goes back to the pool once
+//                nothing is left in flight on it)
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : 0 if successful, -1 if the connection failed
+
+int crud_pipe_receive(CrudPipelineLink *link) {
+    // Declare variables
+    CrudPipelineEntry *entry = NULL;
+    int i;
+
+    if (crud_ring_ready())
+        return crud_ring_receive(link);
+    for (i = 0; i < crud_pipe.count && entry == NULL; i++)
+    {
+        if (crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH].conn == link->conn)
+            entry = &crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH];
+    }
+
+    crud_pipe_quickack(link, entry);
+    if (crud_receive(link->conn->fd, &entry->response, entry->buf) != 0)
+    {
+        crud_pipe_fail(link);
+        return -1;
+    }
+    if (entry->sharded)
+        entry->response = crud_shard_tag(entry->response, entry->shard);
+    entry->conn = NULL;
+    link->bytes -= CRUD_RESPONSE_BYTES(entry->op);
+    if (--link->count == 0)
+    {
+        crud_pool_release(link->conn);
+        link->conn = NULL;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pipe_fail
+// Description  : Drop a pipeline connection after a failure, failing every
+//                request still in flight on it (they are not retried, since
+//                the server may or may not have executed them)
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : none
+
+void crud_pipe_fail(CrudPipelineLink *link) {
+    // Declare variables
+    CrudPipelineEntry *entry;
+    int i;
+
+    logMessage(LOG_ERROR_LEVEL, "CRUD client : connection lost, failing %d pipelined requests.",
+            link->count);
+    for (i = 0; i < crud_pipe.count; i++)
+    {
+        entry = &crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH];
+        if (entry->conn == link->conn)
+        {
+            entry->response = -1;
+            entry->conn = NULL;
+        }
+    }
+    crud_pool_drop(link->conn);
+    link->conn = NULL;
+    link->count = 0;
+    link->bytes = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pipe_quickack
+// Description  : Acknowledge at once what arrives on a pipeline connection
+//                while more than one response is due on it, a server holding
+//                back small responses until the last one is acknowledged
+//                (Nagle) would otherwise stall the pipeline for a delayed ACK
+//                (the socket goes back to delayed ACKs on its own, and with a
+//                single response due there is nothing to hold back)
+//
+// Inputs       : link - the pipeline connection
+//                entry - the request answered next (for the wire statistics)
+// Outputs      : none
+
+void crud_pipe_quickack(CrudPipelineLink *link, CrudPipelineEntry *entry) {
+    // Declare variables
+    int on = 1;
+
+    if (link->count - link->queued <= 1)
+        return;
+    setsockopt(link->conn->fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    crud_wire_count(&crud_wire[(entry != NULL) ? CRUD_HEADER_REQ(entry->op) : CRUD_UNKNOWN],
+            0, 0, 1, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_ready
+// Description  : Check whether the pipeline of this thread goes through a
+//                ring, setting the ring up on first use (crud_network_uring).
+//                Without io_uring the pipeline stays on blocking sockets.
+//
+// Inputs       : none
+// Outputs      : 1 if the ring is in use, 0 if not
+
+int crud_ring_ready(void) {
+    if (crud_ring_state == 0)
+    {
+        crud_ring_state = -1;
+        if (!crud_network_uring)
+            return 0;
+        if ((crud_ring_buffer = malloc(CRUD_PIPELINE_LINKS * CRUD_RING_INBOX_BYTES)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : failed allocating ring inboxes.");
+            return 0;
+        }
+        if ((crud_ring = crud_uring_new(CRUD_RING_ENTRIES)) == NULL)
+        {
+            logMessage(LOG_WARNING_LEVEL, "CRUD client : no io_uring, pipelining on blocking sockets.");
+            free(crud_ring_buffer);
+            crud_ring_buffer = NULL;
+            return 0;
+        }
+
+        // Unregistered inboxes still work, with plain receives
+        crud_ring_fixed = (crud_uring_register(crud_ring, crud_ring_buffer,
+                CRUD_PIPELINE_LINKS * CRUD_RING_INBOX_BYTES) == 0);
+        pthread_once(&crud_ring_once, crud_ring_key_init);
+        pthread_setspecific(crud_ring_key, crud_ring);
+        crud_ring_state = 1;
+    }
+    return crud_ring_state == 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_key_init
+// Description  : Make the key that releases the ring of a thread as it exits
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_ring_key_init(void) {
+    pthread_key_create(&crud_ring_key, crud_ring_release);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_release
+// Description  : Release the ring and inboxes of an exiting thread
+//
+// Inputs       : ring - the ring of the thread
+// Outputs      : none
+
+void crud_ring_release(void *ring) {
+    crud_uring_free(ring);
+    free(crud_ring_buffer);
+    crud_ring_buffer = NULL;
+    crud_ring = NULL;
+    crud_ring_state = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_receive
+// Description  : crud_pipe_receive on the ring: run the ring until the
+//                oldest request in flight on a link is answered (answers
+//                on the other links are taken as they come)
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : 0 if successful, -1 if the connection failed
+
+int crud_ring_receive(CrudPipelineLink *link) {
+    // Declare variables
+    CrudPipelineEntry *entry = crud_ring_oldest(link);
+
+    if (entry == NULL)
+        return -1;
+    while (entry->conn != NULL)
+    {
+        if (crud_ring_step() != 0)
+            return -1;
+    }
+    return (entry->response == (CrudResponse) -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_step
+// Description  : Post the sends and receives the links need, hand them to
+//                the kernel and wait, all in one system call, then take
+//                every completion there is.  If the ring itself fails the
+//                requests in flight all fail, and the thread goes back to
+//                blocking sockets.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if the ring failed
+
+int crud_ring_step(void) {
+    // Declare variables
+    CrudPipelineLink *link;
+    CrudPipelineEntry *entry;
+    uint64_t start, tag;
+    int32_t result;
+    int i, outstanding = 0;
+
+    for (i = 0; i < CRUD_PIPELINE_LINKS; i++)
+    {
+        link = &crud_pipe.links[i];
+        if (link->conn != NULL && !link->failed && crud_ring_post(link) != 0)
+            crud_ring_fail(link);
+        if (link->conn != NULL)
+            outstanding += link->sending + link->receiving;
+    }
+
+    // The call is counted against the oldest request still in flight
+    for (i = 0, entry = NULL; i < crud_pipe.count && entry == NULL; i++)
+    {
+        if (crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH].conn != NULL)
+            entry = &crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH];
+    }
+    start = getMonotonicNanos();
+    if (outstanding == 0 || crud_uring_enter(crud_ring, 1) != 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : ring failed, back to blocking sockets.");
+        for (i = 0; i < CRUD_PIPELINE_LINKS; i++)
+        {
+            link = &crud_pipe.links[i];
+            link->sending = link->receiving = 0;
+            if (link->conn != NULL)
+                crud_ring_fail(link);
+        }
+        crud_ring_state = -1;
+        return -1;
+    }
+    crud_wire_count(&crud_wire[(entry != NULL) ? CRUD_HEADER_REQ(entry->op) : CRUD_UNKNOWN],
+            0, 0, 1, getMonotonicNanos() - start);
+
+    while (crud_uring_complete(crud_ring, &tag, &result))
+        crud_ring_complete(tag, result);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_post
+// Description  : Queue what a link needs on the ring: one sendmsg of every
+//                request waiting to be sent, and a receive if responses are
+//                due (into the inbox, or straight into the buffer of a
+//                large read payload)
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : 0 if successful, -1 if the ring is full
+
+int crud_ring_post(CrudPipelineLink *link) {
+    // Declare variables
+    CrudPipelineEntry *entry;
+    char *inbox = CRUD_RING_INBOX_OF(link);
+    uint32_t length;
+    uint64_t payload;
+    int i, req, pieces = 0, result;
+
+    if (link->queued > 0 && !link->sending)
+    {
+        for (i = 0; i < crud_pipe.count; i++)
+        {
+            entry = &crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH];
+            if (entry->conn != link->conn || !entry->queued)
+                continue;
+            payload = 0;
+            pieces += crud_pack(&link->iov[pieces], entry->op, entry->ext, entry->buf,
+                    &entry->header, &entry->ext_word, &payload);
+            entry->queued = 0;
+            req = CRUD_HEADER_REQ(entry->op);
+            __atomic_fetch_add(&crud_wire[req].requests, 1, __ATOMIC_RELAXED);
+            crud_wire_count(&crud_wire[req], payload, 0, 0, 0);
+        }
+        link->queued = 0;
+        memset(&link->msg, 0, sizeof(link->msg));
+        link->msg.msg_iov = link->iov;
+        link->msg.msg_iovlen = pieces;
+        if (crud_uring_sendmsg(crud_ring, link->conn->fd, &link->msg, MSG_NOSIGNAL | MSG_WAITALL,
+                CRUD_RING_TAG(link, CRUD_RING_SEND)) != 0)
+            return -1;
+        link->sending = 1;
+    }
+
+    if (link->count > link->queued && !link->receiving)
+    {
+        crud_pipe_quickack(link, crud_ring_oldest(link));
+        length = CRUD_HEADER_LENGTH(link->response) - link->got;
+        if (link->reading && link->fill == 0 && length >= CRUD_RING_DIRECT_BYTES)
+            result = crud_uring_recv(crud_ring, link->conn->fd, (char *) crud_ring_oldest(link)->buf +
+                    link->got, length, MSG_WAITALL, CRUD_RING_TAG(link, CRUD_RING_PAYLOAD));
+        else if (crud_ring_fixed)
+            result = crud_uring_read_fixed(crud_ring, link->conn->fd, inbox + link->fill,
+                    CRUD_RING_INBOX_BYTES - link->fill, CRUD_RING_TAG(link, CRUD_RING_INBOX));
+        else
+            result = crud_uring_recv(crud_ring, link->conn->fd, inbox + link->fill,
+                    CRUD_RING_INBOX_BYTES - link->fill, 0, CRUD_RING_TAG(link, CRUD_RING_INBOX));
+        if (result != 0)
+            return -1;
+        link->receiving = 1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_complete
+// Description  : Handle a completion of the ring: a short send goes out
+//                again for the rest, bytes received are matched to the
+//                requests in flight on the link
+//
+// Inputs       : tag - the tag of the operation (link and kind)
+//                result - its result (bytes, or -errno)
+// Outputs      : none
+
+void crud_ring_complete(uint64_t tag, int32_t result) {
+    // Declare variables
+    CrudPipelineLink *link = &crud_pipe.links[tag >> 8];
+
+    switch (tag & 0xff)
+    {
+    case CRUD_RING_SEND:
+        link->sending = 0;
+        if (link->failed)
+            break;
+        if (result <= 0)
+        {
+            crud_ring_fail(link);
+            break;
+        }
+        crud_msg_advance(&link->msg, result);
+        if (link->msg.msg_iovlen == 0)
+            break;
+        if (crud_uring_sendmsg(crud_ring, link->conn->fd, &link->msg, MSG_NOSIGNAL | MSG_WAITALL,
+                CRUD_RING_TAG(link, CRUD_RING_SEND)) != 0)
+            crud_ring_fail(link);
+        else
+            link->sending = 1;
+        break;
+
+    case CRUD_RING_INBOX:
+        link->receiving = 0;
+        if (link->failed)
+            break;
+        if (result <= 0)
+        {
+            crud_ring_fail(link);
+            break;
+        }
+        link->fill += result;
+        if (crud_ring_take(link) != 0)
+            crud_ring_fail(link);
+        break;
+
+    case CRUD_RING_PAYLOAD:
+        link->receiving = 0;
+        if (link->failed)
+            break;
+        if (result <= 0)
+        {
+            crud_ring_fail(link);
+            break;
+        }
+        link->got += result;
+        if (link->got == CRUD_HEADER_LENGTH(link->response))
+        {
+            link->reading = 0;
+            crud_ring_finish(link, crud_ring_oldest(link), link->response);
+        }
+        break;
+    }
+
+    crud_ring_idle(link);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_take
+// Description  : Take the responses in the inbox of a link, in order, each
+//                answering the oldest request in flight there.  Read
+//                payloads are copied to their buffers; a partial header is
+//                kept for the next receive.
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : 0 if successful, -1 if the bytes make no sense
+
+int crud_ring_take(CrudPipelineLink *link) {
+    // Declare variables
+    CrudPipelineEntry *entry;
+    CrudResponse response;
+    char *inbox = CRUD_RING_INBOX_OF(link);
+    uint32_t used = 0, length, bytes;
+    int req;
+
+    while (used < link->fill)
+    {
+        if ((entry = crud_ring_oldest(link)) == NULL || entry->queued)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : response with no request in flight.");
+            return -1;
+        }
+
+        // The payload of a read goes to its buffer
+        if (link->reading)
+        {
+            length = CRUD_HEADER_LENGTH(link->response);
+            bytes = (link->fill - used < length - link->got) ? link->fill - used : length - link->got;
+            memcpy((char *) entry->buf + link->got, &inbox[used], bytes);
+            used += bytes;
+            link->got += bytes;
+            if (link->got < length)
+                break;
+            link->reading = 0;
+            crud_ring_finish(link, entry, link->response);
+            continue;
+        }
+
+        // Otherwise the header of the next response
+        if (link->fill - used < sizeof(CrudResponse))
+            break;
+        memcpy(&response, &inbox[used], sizeof(CrudResponse));
+        response = ntohll64(response);
+        used += sizeof(CrudResponse);
+        if (CRUD_HEADER_FLAGS(response) & CRUD_COMPRESSED_FLAG)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : coded response to an uncoded request.");
+            return -1;
+        }
+        req = CRUD_HEADER_REQ(response);
+        if ((req == CRUD_READ || req == CRUD_READ_RANGE) && CRUD_HEADER_LENGTH(response) > 0)
+        {
+            link->response = response;
+            link->got = 0;
+            link->reading = 1;
+        }
+        else
+            crud_ring_finish(link, entry, response);
+    }
+
+    memmove(inbox, &inbox[used], link->fill - used);
+    link->fill -= used;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_finish
+// Description  : Hand a response to the request it answers
+//
+// Inputs       : link - the pipeline connection
+//                entry - the request (the oldest in flight on the link)
+//                response - the response (host byte order)
+// Outputs      : none
+
+void crud_ring_finish(CrudPipelineLink *link, CrudPipelineEntry *entry, CrudResponse response) {
+    // Declare variables
+    int req = CRUD_HEADER_REQ(response);
+
+    if (req >= CRUD_MAXVAL)
+        req = CRUD_UNKNOWN;
+    if (req == CRUD_READ || req == CRUD_READ_RANGE)
+        crud_wire_count(&crud_wire[req], 0, CRUD_HEADER_LENGTH(response), 0, 0);
+    entry->response = entry->sharded ? crud_shard_tag(response, entry->shard) : response;
+    entry->conn = NULL;
+    link->bytes -= CRUD_RESPONSE_BYTES(entry->op);
+    link->count--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_oldest
+// Description  : Find the oldest request in flight on a link (the one the
+//                next response there answers)
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : the entry, or NULL if none
+
+CrudPipelineEntry *crud_ring_oldest(CrudPipelineLink *link) {
+    // Declare variables
+    int i;
+
+    for (i = 0; i < crud_pipe.count; i++)
+    {
+        if (crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH].conn == link->conn)
+            return &crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH];
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_fail
+// Description  : crud_pipe_fail on the ring: fail every request in flight
+//                on a link and shut the connection down, so the operations
+//                still on the ring complete at once (the connection is
+//                dropped when they have)
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : none
+
+void crud_ring_fail(CrudPipelineLink *link) {
+    // Declare variables
+    CrudPipelineEntry *entry;
+    int i;
+
+    if (!link->failed)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : connection lost, failing %d pipelined requests.",
+                link->count);
+        for (i = 0; i < crud_pipe.count; i++)
+        {
+            entry = &crud_pipe.entries[(crud_pipe.head + i) % CRUD_PIPELINE_DEPTH];
+            if (entry->conn == link->conn)
+            {
+                entry->response = -1;
+                entry->conn = NULL;
+                entry->queued = 0;
+            }
+        }
+        link->count = link->queued = 0;
+        link->bytes = link->fill = 0;
+        link->reading = 0;
+        link->failed = 1;
+        shutdown(link->conn->fd, SHUT_RDWR);
+    }
+    crud_ring_idle(link);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_ring_idle
+// Description  : Give a link's connection back once nothing is on the ring
+//                for it: to the pool when all its requests are answered, or
+//                dropped if it failed
+//
+// Inputs       : link - the pipeline connection
+// Outputs      : none
+
+void crud_ring_idle(CrudPipelineLink *link) {
+    if (link->conn == NULL || link->sending || link->receiving)
+        return;
+    if (link->failed)
+        crud_pool_drop(link->conn);
+    else if (link->count == 0)
+        crud_pool_release(link->conn);
+    else
+        return;
+    link->conn = NULL;
+    link->failed = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_acquire
+// Description  : Get an idle connection to a server out of the pool, or set
+//                up a new one if they are all in use
+//
+// Inputs       : ep - the server
+//                handshake - if set, a new connection is sent a CRUD_INIT
+// Outputs      : the connection, or NULL if failure
+
+CrudConnection *crud_pool_acquire(CrudEndpoint *ep, int handshake) {
+    // Declare variables
+    CrudConnection *conn = NULL;
+    int i;
+
+    // Use an idle connection to the server if there is one, otherwise
+    //  claim an unused slot
+    pthread_mutex_lock(&crud_pool_lock);
+    for (i = 0; i < CRUD_POOL_MAX_CONNECTIONS; i++)
+    {
+        if (crud_pool[i].fd == -1)
+        {
+            if (conn == NULL && !crud_pool[i].busy)
+                conn = &crud_pool[i];
+        }
+        else if (!crud_pool[i].busy && crud_pool[i].ep == ep)
+        {
+            crud_pool[i].busy = 1;
+            pthread_mutex_unlock(&crud_pool_lock);
+            return &crud_pool[i];
+        }
+    }
+    if (conn != NULL)
+        conn->busy = 1;
+    pthread_mutex_unlock(&crud_pool_lock);
+
+    // Otherwise connect (outside the lock, the slot is ours)
+    if (conn == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : connection pool exhausted [%d].",
+                CRUD_POOL_MAX_CONNECTIONS);
+        return NULL;
+    }
+    if (crud_connect(conn, ep) != 0)
+    {
+        crud_pool_drop(conn);
+        return NULL;
+    }
+    if (handshake && crud_handshake(conn) != 0)
+    {
+        crud_pool_drop(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_release
+// Description  : Return a connection to the pool after an operation
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void crud_pool_release(CrudConnection *conn) {
+    pthread_mutex_lock(&crud_pool_lock);
+    conn->busy = 0;
+    pthread_mutex_unlock(&crud_pool_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_drop
+// Description  : Close a connection and remove it from the pool
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void crud_pool_drop(CrudConnection *conn) {
+    if (conn->fd != -1)
+        close(conn->fd);
+    pthread_mutex_lock(&crud_pool_lock);
+    conn->fd = -1;
+    conn->busy = 0;
+    pthread_mutex_unlock(&crud_pool_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_connect
+// Description  : Open a connection to a CRUD server.  Requests are small and
+//                latency bound, so Nagle is turned off, and the socket buffers
+//                are sized to hold a whole object.
+//
+// Inputs       : conn - the (claimed) pool slot for the connection
+//                ep - the server
+// Outputs      : 0 if successful, -1 if error
+
+int crud_connect(CrudConnection *conn, CrudEndpoint *ep) {
+    // Declare variables
+    struct sockaddr_in v4;
+    int fd, on = 1, bufsize = CRUD_NET_SOCKET_BUFFER;
+
+    // Specify address to connect to
+    v4.sin_family = AF_INET;
+    v4.sin_port = htons(ep->port);
+    if (inet_aton(ep->address, &(v4.sin_addr)) == 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : bad server address [%s].", ep->address);
+        return(-1);
+    }
+
+    // Create socket
+    fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : socket() failed [%s].", strerror(errno));
+        return(-1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    // Connect
+    if (connect(fd, (const struct sockaddr *)&v4, sizeof(v4)) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : connect to %s:%u failed [%s].",
+                ep->address, ep->port, strerror(errno));
+        close(fd);
+        return(-1);
+    }
+
+    // The slot is ours, but others look at it while scanning the pool
+    pthread_mutex_lock(&crud_pool_lock);
+    conn->ep = ep;
+    conn->fd = fd;
+    pthread_mutex_unlock(&crud_pool_lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_handshake
+// Description  : Send the CRUD_INIT on a new connection on behalf of the file
+//                system (which only sends it once, for the first connection)
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if error
+
+int crud_handshake(CrudConnection *conn) {
+    // Declare variables
+    CrudRequest init;
+    CrudResponse response;
+
+    init = construct_crud_request(0, CRUD_INIT, 0, CRUD_EXT_PROBE_FLAG, 0);
+    if (crud_send(conn->fd, init, 0, NULL, 0) != 0 ||
+            crud_receive(conn->fd, &response, NULL) != 0 || CRUD_HEADER_RESULT(response))
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : CRUD_INIT on new connection failed.");
+        return -1;
+    }
+
+    __atomic_store_n(&conn->ep->caps, CRUD_HEADER_LENGTH(response), __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_send
+// Description  : This is the function that sends the client CrudRequest to the
+//                  server (and buffer if necessary).  The header, extension
+//                  word and buffer go out in a single sendmsg where possible.
+//                  If the server takes coded payloads a payload that shrinks
+//                  goes out coded, and reads ask for coded bytes back.
+//
+// Inputs       : fd - the socket of the connection
+//                request - the request opcode for the command
+//                ext - the extension word (sent for range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                compress - if set, the payload may be coded
+// Outputs      : 0 if successful, -1 if error 
+
+int crud_send(int fd, CrudRequest request, CrudRequestExt ext, void *buf, int compress)
+{
+    // Declare variables
+    CrudRequest request_network_order;
+    CrudRequestExt ext_network_order;
+    struct iovec iov[3];
+    int req = CRUD_HEADER_REQ(request), count;
+    uint64_t payload = 0, calls = 0;
+    uint32_t coded = 0;
+
+    // Reads only need the flag, a payload must shrink to be sent coded
+    if (compress && (req == CRUD_READ || req == CRUD_READ_RANGE))
+        request = CRUD_HEADER_SET_FLAGS(request, CRUD_COMPRESSED_FLAG);
+    else if (compress && (req == CRUD_CREATE || req == CRUD_UPDATE || req == CRUD_UPDATE_RANGE) &&
+            (coded = crud_code_payload(buf, CRUD_HEADER_LENGTH(request))) > 0)
+        request = CRUD_HEADER_SET_FLAGS(request, CRUD_COMPRESSED_FLAG);
+
+    // The coded bytes (with their size word) stand in for the buffer
+    count = crud_pack(iov, request, ext, buf, &request_network_order, &ext_network_order, &payload);
+    if (coded > 0)
+    {
+        iov[count - 1].iov_base = crud_coded;
+        iov[count - 1].iov_len = coded;
+        payload = coded;
+    }
+    if (crud_send_iov(fd, iov, count, &calls) != 0)
+    {
+        crud_wire_count(&crud_wire[req], 0, 0, calls, 0);
+        return -1;
+    }
+
+    __atomic_fetch_add(&crud_wire[req].requests, 1, __ATOMIC_RELAXED);
+    crud_wire_count(&crud_wire[req], payload, 0, calls, 0);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_code_payload
+// Description  : Code a request payload into the coded buffer of the thread,
+//                after its size word, if it shrinks by at least a sixteenth
+//
+// Inputs       : buf - the payload
+//                length - the bytes of the payload
+// Outputs      : the bytes to send (size word and coded bytes), or 0 if it
+//                is to go out as it is
+
+uint32_t crud_code_payload(void *buf, uint32_t length)
+{
+    // Declare variables
+    uint32_t coded;
+
+    if (length < CRUD_COMPRESS_MIN_BYTES || crud_coded_buffer(CRUD_COMPRESS_BOUND(length) +
+            sizeof(coded)) == NULL)
+        return 0;
+    coded = crud_compress(buf, length, crud_coded + sizeof(coded), length - length / 16 - sizeof(coded));
+    if (coded == 0)
+        return 0;
+    *(uint32_t *) crud_coded = htonl(coded);
+    return sizeof(coded) + coded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_coded_buffer
+// Description  : Get the coded buffer of the thread, growing it if needed
+//
+// Inputs       : bytes - the bytes it must hold
+// Outputs      : the buffer, or NULL if failure
+
+char *crud_coded_buffer(uint32_t bytes)
+{
+    // Declare variables
+    char *coded;
+
+    if (bytes > crud_coded_size)
+    {
+        if ((coded = realloc(crud_coded, bytes)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : failed growing coded buffer to %u.", bytes);
+            return NULL;
+        }
+        crud_coded = coded;
+        crud_coded_size = bytes;
+    }
+    return crud_coded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack
+// Description  : Lay out a request as it goes on the wire: the header, the
+//                  extension word (range requests) and the buffer (requests
+//                  that carry a payload)
+//
+// Inputs       : iov - the place to put the pieces (at least 3)
+//                request - the request opcode for the command
+//                ext - the extension word (range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                header - the place to put the header in network byte order
+//                ext_word - the place to put the extension word in network
+//                           byte order
+//                payload - the payload bytes (added to)
+// Outputs      : the number of pieces
+
+int crud_pack(struct iovec *iov, CrudRequest request, CrudRequestExt ext, void *buf,
+        CrudRequest *header, CrudRequestExt *ext_word, uint64_t *payload)
+{
+    // Declare variables
+    int req = CRUD_HEADER_REQ(request);
+    int buf_length = CRUD_HEADER_LENGTH(request);
+    int count = 0;
+
+    // Convert request value to network byte order 
+    *header = htonll64(request);
+    iov[count].iov_base = header;
+    iov[count++].iov_len = sizeof(CrudRequest);
+
+    // Range requests carry the extension word next
+    if (req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE)
+    {
+        *ext_word = htonll64(ext);
+        iov[count].iov_base = ext_word;
+        iov[count++].iov_len = sizeof(CrudRequestExt);
+    }
+
+    // Check if you need to send buffer as well
+    if ((req == CRUD_CREATE || req == CRUD_UPDATE || req == CRUD_UPDATE_RANGE) && buf_length > 0)
+    {
+        iov[count].iov_base = buf;
+        iov[count++].iov_len = buf_length;
+        *payload += buf_length;
+    }
+
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_send_iov
+// Description  : Send pieces of a message, making sure all bytes are sent
+//
+// Inputs       : fd - the socket of the connection
+//                iov - the pieces (changed as they are sent)
+//                count - the number of pieces
+//                calls - the count of sendmsg calls (added to)
+// Outputs      : 0 if successful, -1 if error 
+
+int crud_send_iov(int fd, struct iovec *iov, int count, uint64_t *calls)
+{
+    // Declare variables
+    struct msghdr msg;
+    ssize_t written;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    // Send it all, make sure all bytes are sent
+    while (msg.msg_iovlen > 0)
+    {
+        written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        (*calls)++;
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        crud_msg_advance(&msg, written);
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_msg_advance
+// Description  : Skip the pieces of a message past what was written
+//
+// Inputs       : msg - the message (its pieces are changed)
+//                written - the bytes written
+// Outputs      : none
+
+void crud_msg_advance(struct msghdr *msg, size_t written)
+{
+    while (msg->msg_iovlen > 0 && written >= msg->msg_iov->iov_len)
+    {
+        written -= msg->msg_iov->iov_len;
+        msg->msg_iov++;
+        msg->msg_iovlen--;
+    }
+    if (msg->msg_iovlen > 0)
+    {
+        msg->msg_iov->iov_base = (char *) msg->msg_iov->iov_base + written;
+        msg->msg_iov->iov_len -= written;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_send_compound
+// Description  : Send a CRUD_COMPOUND holding several sub-requests, in a
+//                  single sendmsg where possible
+//
+// Inputs       : fd - the socket of the connection
+//                ops - the sub-requests
+//                count - the number of sub-requests (at most
+//                        CRUD_COMPOUND_MAX_OPS)
+// Outputs      : 0 if successful, -1 if error 
+
+int crud_send_compound(int fd, CrudCompoundOp *ops, int count)
+{
+    // Declare variables
+    CrudRequest headers[CRUD_COMPOUND_MAX_OPS + 1];
+    CrudRequestExt exts[CRUD_COMPOUND_MAX_OPS];
+    struct iovec iov[3 * CRUD_COMPOUND_MAX_OPS + 1];
+    uint64_t payload = 0, calls = 0, body = 0;
+    int i, j, pieces = 1;
+
+    // Lay out the sub-requests after the compound header
+    for (i = 0; i < count; i++)
+        pieces += crud_pack(&iov[pieces], ops[i].op, ops[i].ext, ops[i].buf,
+                &headers[i + 1], &exts[i], &payload);
+    for (j = 1; j < pieces; j++)
+        body += iov[j].iov_len;
+    if (body > CRUD_COMPOUND_MAX_BYTES)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : compound request too large [%lu bytes].", body);
+        return -1;
+    }
+    headers[0] = htonll64(construct_crud_request((CrudOID) count, CRUD_COMPOUND, body,
+            CRUD_NULL_FLAG, 0));
+    iov[0].iov_base = &headers[0];
+    iov[0].iov_len = sizeof(CrudRequest);
+
+    if (crud_send_iov(fd, iov, pieces, &calls) != 0)
+    {
+        crud_wire_count(&crud_wire[CRUD_COMPOUND], 0, 0, calls, 0);
+        return -1;
+    }
+
+    __atomic_fetch_add(&crud_wire[CRUD_COMPOUND].requests, 1, __ATOMIC_RELAXED);
+    crud_wire_count(&crud_wire[CRUD_COMPOUND], payload, 0, calls, 0);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_receive
+// Description  : This is the function that receives the server response (and
+//                  buffer if necessary).
+//
+// Inputs       : fd - the socket of the connection
+//                response - the place to put the server CrudResponse
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : 0 if successful, -1 if error (e.g., connection closed)
+
+int crud_receive(int fd, CrudResponse *response, void *buf)
+{
+    return crud_receive_range(fd, response, buf, 0, UINT32_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_receive_range
+// Description  : Receive the server response, putting only part of any read
+//                buffer in place (the rest goes to the sink)
+//
+// Inputs       : fd - the socket of the connection
+//                response - the place to put the server CrudResponse
+//                buf - the place to put the wanted read bytes
+//                skip - the number of read bytes to drop first
+//                take - the most read bytes to put in buf
+// Outputs      : 0 if successful, -1 if error (e.g., connection closed)
+
+int crud_receive_range(int fd, CrudResponse *response, void *buf, uint32_t skip, uint32_t take)
+{
+    // Declare variables
+    CrudResponse response_network_order;
+    uint32_t buf_length, received;
+    uint64_t start = getMonotonicNanos(), calls = 0;
+    int response_req;
+
+    // Receive response value, convert it into host byte order
+    if (crud_recv_all(fd, &response_network_order, sizeof(CrudResponse), &calls) != 0)
+    {
+        crud_wire_count(&crud_wire[CRUD_UNKNOWN], 0, 0, calls, getMonotonicNanos() - start);
+        return -1;
+    }
+    *response = ntohll64(response_network_order);
+
+    // Extract request type and length from converted response
+    response_req = CRUD_HEADER_REQ(*response);
+    buf_length = CRUD_HEADER_LENGTH(*response);
+    if (response_req >= CRUD_MAXVAL)
+        response_req = CRUD_UNKNOWN;
+
+    // Check if you need to receive buffer, dropping any unwanted bytes
+    received = 0;
+    if (response_req == CRUD_READ || response_req == CRUD_READ_RANGE)
+    {
+        if (skip > buf_length)
+            skip = buf_length;
+        if (take > buf_length - skip)
+            take = buf_length - skip;
+        if (CRUD_HEADER_FLAGS(*response) & CRUD_COMPRESSED_FLAG)
+        {
+            // Coded bytes, the caller sees the response as if they were not
+            *response = CRUD_HEADER_CLEAR_FLAGS(*response, CRUD_COMPRESSED_FLAG);
+            if (crud_receive_coded(fd, buf_length, buf, skip, take, &received, &calls) != 0)
+            {
+                crud_wire_count(&crud_wire[response_req], 0, 0, calls, getMonotonicNanos() - start);
+                return -1;
+            }
+        }
+        else
+        {
+            if (crud_discard(fd, skip, &calls) != 0 || crud_recv_all(fd, buf, take, &calls) != 0 ||
+                    crud_discard(fd, buf_length - skip - take, &calls) != 0)
+            {
+                crud_wire_count(&crud_wire[response_req], 0, 0, calls, getMonotonicNanos() - start);
+                return -1;
+            }
+            received = buf_length;
+        }
+    }
+
+    crud_wire_count(&crud_wire[response_req], 0, received, calls, getMonotonicNanos() - start);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_receive_coded
+// Description  : Receive coded read bytes (size word, then the bytes) and
+//                decode the wanted part of them into place
+//
+// Inputs       : fd - the socket of the connection
+//                length - the read bytes they decode to
+//                buf - the place to put the wanted read bytes
+//                skip - the number of read bytes to drop first
+//                take - the most read bytes to put in buf
+//                received - the place to put the bytes received
+//                calls - the count of recv calls (added to)
+// Outputs      : 0 if successful, -1 if error (connection closed or bad
+//                coded bytes)
+
+int crud_receive_coded(int fd, uint32_t length, void *buf, uint32_t skip, uint32_t take,
+        uint32_t *received, uint64_t *calls)
+{
+    // Declare variables
+    uint32_t coded, whole = (skip == 0 && take == length);
+
+    if (crud_recv_all(fd, &coded, sizeof(coded), calls) != 0)
+        return -1;
+    coded = ntohl(coded);
+    if (coded > CRUD_COMPRESS_BOUND(length))
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : bad coded read [%u bytes coded for %u].", coded, length);
+        return -1;
+    }
+
+    // Decode all of it in place, or just the wanted part out of the buffer
+    if (crud_coded_buffer(coded + (whole ? 0 : length)) == NULL ||
+            crud_recv_all(fd, crud_coded, coded, calls) != 0)
+        return -1;
+    if (crud_decompress(crud_coded, coded, whole ? buf : crud_coded + coded, length) != 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD client : bad coded read bytes [%u bytes coded].", coded);
+        return -1;
+    }
+    if (!whole && take > 0)
+        memcpy(buf, crud_coded + coded + skip, take);
+    *received = sizeof(coded) + coded;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_receive_compound
+// Description  : Receive the response to a CRUD_COMPOUND, putting the
+//                sub-responses (and read bytes) in place
+//
+// Inputs       : fd - the socket of the connection
+//                response - the place to put the compound CrudResponse
+//                ops - the sub-requests sent
+//                count - the number of sub-requests sent
+// Outputs      : 0 if successful, -1 if error (connection closed, or the
+//                response does not match the request)
+
+int crud_receive_compound(int fd, CrudResponse *response, CrudCompoundOp *ops, int count)
+{
+    // Declare variables
+    CrudResponse response_network_order;
+    uint32_t body, length, take, executed, got = 0;
+    uint64_t start = getMonotonicNanos(), calls = 0, received = 0;
+    int i, req, result = 0;
+
+    // Receive the compound header, check it answers what was sent
+    if (crud_recv_all(fd, &response_network_order, sizeof(CrudResponse), &calls) != 0)
+        result = -1;
+    else
+    {
+        *response = ntohll64(response_network_order);
+        executed = CRUD_HEADER_OID(*response);
+        body = CRUD_HEADER_LENGTH(*response);
+        if (CRUD_HEADER_REQ(*response) != CRUD_COMPOUND || executed > (uint32_t) count)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : bad compound response [%lx].", *response);
+            result = -1;
+        }
+
+        // Receive each sub-response, read bytes go to the sub-request buffer
+        for (i = 0; result == 0 && i < (int) executed; i++)
+        {
+            if (crud_recv_all(fd, &response_network_order, sizeof(CrudResponse), &calls) != 0)
+            {
+                result = -1;
+                break;
+            }
+            ops[i].response = ntohll64(response_network_order);
+            got += sizeof(CrudResponse);
+            req = CRUD_HEADER_REQ(ops[i].response);
+            if (req != CRUD_READ && req != CRUD_READ_RANGE)
+                continue;
+
+            // The buffer only holds what the sub-request asked for
+            length = CRUD_HEADER_LENGTH(ops[i].response);
+            take = CRUD_HEADER_LENGTH(ops[i].op);
+            take = (take < length) ? take : length;
+            if (got + length > body || crud_recv_all(fd, ops[i].buf, take, &calls) != 0 ||
+                    crud_discard(fd, length - take, &calls) != 0)
+            {
+                result = -1;
+                break;
+            }
+            got += length;
+            received += length;
+        }
+        if (result == 0 && got != body)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD client : compound response length mismatch [%u!=%u].",
+                    got, body);
+            result = -1;
+        }
+    }
+
+    crud_wire_count(&crud_wire[CRUD_COMPOUND], 0, received, calls, getMonotonicNanos() - start);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_discard
+// Description  : Receive and drop bytes from a connection
+//
+// Inputs       : fd - the socket of the connection
+//                length - the number of bytes to drop
+//                calls - the count of recv calls (added to)
+// Outputs      : 0 if successful, -1 if error (e.g., connection closed)
+
+int crud_discard(int fd, uint32_t length, uint64_t *calls)
+{
+    // Declare variables
+    uint32_t bytes;
+
+    while (length > 0)
+    {
+        bytes = (length < CRUD_SINK_SIZE) ? length : CRUD_SINK_SIZE;
+        if (crud_recv_all(fd, crud_sink, bytes, calls) != 0)
+            return -1;
+        length -= bytes;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_recv_all
+// Description  : Receive exactly "length" bytes from a connection
+//
+// Inputs       : fd - the socket of the connection
+//                buf - the place to put the bytes
+//                length - the number of bytes
+//                calls - the count of recv calls (added to)
+// Outputs      : 0 if successful, -1 if error (e.g., connection closed)
+
+int crud_recv_all(int fd, void *buf, size_t length, uint64_t *calls)
+{
+    // Declare variables
+    size_t got = 0;
+    ssize_t bytes;
+
+    // MSG_WAITALL gets it all in one call unless interrupted
+    while (got < length)
+    {
+        bytes = recv(fd, &((char *)buf)[got], length - got, MSG_WAITALL);
+        (*calls)++;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        got += bytes;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_wire_count
+// Description  : Add to the wire statistics of a request type
+//
+// Inputs       : stats - the statistics of the request type
+//                bytes_sent - payload bytes sent
+//                bytes_received - payload bytes received
+//                syscalls - sendmsg/recv calls made
+//                wait_ns - time spent receiving
+// Outputs      : none
+
+void crud_wire_count(CrudWireStats *stats, uint64_t bytes_sent, uint64_t bytes_received,
+        uint64_t syscalls, uint64_t wait_ns)
+{
+    if (bytes_sent > 0)
+        __atomic_fetch_add(&stats->bytes_sent, bytes_sent, __ATOMIC_RELAXED);
+    if (bytes_received > 0)
+        __atomic_fetch_add(&stats->bytes_received, bytes_received, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->syscalls, syscalls, __ATOMIC_RELAXED);
+    if (wait_ns > 0)
+        __atomic_fetch_add(&stats->wait_ns, wait_ns, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_wire_stats
+// Description  : Get the wire statistics of every request type
+//
+// Inputs       : stats - the place to put them (indexed by CRUD_REQUEST_TYPES)
+// Outputs      : none
+
+void crud_client_wire_stats(CrudWireStats stats[CRUD_MAXVAL])
+{
+    // Declare variables
+    int i;
+
+    for (i = 0; i < CRUD_MAXVAL; i++)
+    {
+        stats[i].requests = __atomic_load_n(&crud_wire[i].requests, __ATOMIC_RELAXED);
+        stats[i].bytes_sent = __atomic_load_n(&crud_wire[i].bytes_sent, __ATOMIC_RELAXED);
+        stats[i].bytes_received = __atomic_load_n(&crud_wire[i].bytes_received, __ATOMIC_RELAXED);
+        stats[i].syscalls = __atomic_load_n(&crud_wire[i].syscalls, __ATOMIC_RELAXED);
+        stats[i].wait_ns = __atomic_load_n(&crud_wire[i].wait_ns, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_wire_reset
+// Description  : Zero the wire statistics
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_client_wire_reset(void)
+{
+    // Declare variables
+    int i;
+
+    for (i = 0; i < CRUD_MAXVAL; i++)
+    {
+        __atomic_store_n(&crud_wire[i].requests, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&crud_wire[i].bytes_sent, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&crud_wire[i].bytes_received, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&crud_wire[i].syscalls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&crud_wire[i].wait_ns, 0, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_wire_report
+// Description  : Log the wire statistics of each request type used, and the
+//                totals
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_client_wire_report(void)
+{
+    // Declare variables
+    CrudWireStats stats[CRUD_MAXVAL], total;
+    int i;
+
+    crud_client_wire_stats(stats);
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < CRUD_MAXVAL; i++)
+    {
+        if (stats[i].requests == 0 && stats[i].syscalls == 0)
+            continue;
+        logMessage(LOG_OUTPUT_LEVEL, "CRUD wire %-17s : %lu requests, %lu bytes sent, %lu bytes received, "
+                "%lu syscalls, %.3f ms waiting.", CRUD_REQUEST_TYPE_LABLES[i], stats[i].requests,
+                stats[i].bytes_sent, stats[i].bytes_received, stats[i].syscalls, stats[i].wait_ns / 1e6);
+        total.requests += stats[i].requests;
+        total.bytes_sent += stats[i].bytes_sent;
+        total.bytes_received += stats[i].bytes_received;
+        total.syscalls += stats[i].syscalls;
+        total.wait_ns += stats[i].wait_ns;
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "CRUD wire %-17s : %lu requests, %lu bytes sent, %lu bytes received, "
+            "%lu syscalls, %.3f ms waiting.", "total", total.requests, total.bytes_sent,
+            total.bytes_received, total.syscalls, total.wait_ns / 1e6);
 }
@@ -0,0 +1,344 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_compress.c
+//  Description    : This is the implementation of the payload codec.  The
+//                   coded bytes are a run of LZ4 sequences: a token (literal
+//                   count in the high nibble, match length less 4 in the
+//                   low), any extra length bytes, the literals and a 2-byte
+//                   little endian offset back to the match.  The last
+//                   sequence has only literals.  The coder finds matches
+//                   through a table of the last position of each hashed
+//                   4-byte string, skipping ahead faster the longer it goes
+//                   without one (so incompressible bytes cost little).
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Tue Dec  2 09:40:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <crud_compress.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_COMPRESS_HASH_BITS 12      // Match table of 4096 positions
+#define CRUD_COMPRESS_MIN_MATCH 4       // Shortest match coded
+#define CRUD_COMPRESS_MAX_OFFSET 65535  // Farthest back a match may be
+#define CRUD_COMPRESS_LAST_LITERALS 5   // Bytes at the end always sent as literals
+#define CRUD_COMPRESS_MATCH_LIMIT 12    // No match starts this close to the end
+#define CRUD_COMPRESS_SKIP_SHIFT 6      // Misses before the search step grows
+
+// Module local functions
+static uint32_t crud_compress_slot(const unsigned char *p);
+static unsigned char *crud_compress_sequence(unsigned char *op, unsigned char *end,
+        const unsigned char *literals, uint32_t count, uint32_t offset, uint32_t match);
+static unsigned char *crud_compress_length(unsigned char *op, uint32_t length);
+static int crud_decompress_length(const unsigned char **ip, const unsigned char *end, uint32_t *length);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_compress
+// Description  : Code bytes in the LZ4 block format
+//
+// Inputs       : src - the bytes
+//                length - the number of bytes
+//                dst - the place to put the coded bytes
+//                capacity - the most coded bytes wanted
+// Outputs      : the coded size, or 0 if it would be more than capacity
+
+uint32_t crud_compress(const void *src, uint32_t length, void *dst, uint32_t capacity) {
+    // Declare variables
+    const unsigned char *in = src, *ip = in, *anchor = in, *ref, *end = in + length, *limit;
+    unsigned char *out = dst, *op = out;
+    uint32_t table[1 << CRUD_COMPRESS_HASH_BITS], slot, match;
+
+    // Look for matches up to where none may start
+    memset(table, 0, sizeof(table));
+    limit = (length > CRUD_COMPRESS_MATCH_LIMIT) ? end - CRUD_COMPRESS_MATCH_LIMIT : in;
+    while (ip < limit)
+    {
+        slot = crud_compress_slot(ip);
+        ref = in + table[slot];
+        table[slot] = (uint32_t) (ip - in);
+        if (ref >= ip || ip - ref > CRUD_COMPRESS_MAX_OFFSET || memcmp(ref, ip, CRUD_COMPRESS_MIN_MATCH) != 0)
+        {
+            ip += 1 + ((ip - anchor) >> CRUD_COMPRESS_SKIP_SHIFT);
+            continue;
+        }
+
+        // Take the match as far as it goes, short of the last literals
+        match = CRUD_COMPRESS_MIN_MATCH;
+        while (ip + match < end - CRUD_COMPRESS_LAST_LITERALS && ref[match] == ip[match])
+            match++;
+        op = crud_compress_sequence(op, out + capacity, anchor, (uint32_t) (ip - anchor),
+                (uint32_t) (ip - ref), match);
+        if (op == NULL)
+            return 0;
+        ip += match;
+        anchor = ip;
+    }
+
+    // The rest goes out as the literals of the last sequence
+    op = crud_compress_sequence(op, out + capacity, anchor, (uint32_t) (end - anchor), 0, 0);
+    return (op != NULL) ? (uint32_t) (op - out) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_decompress
+// Description  : Decode bytes coded by crud_compress, checking every length
+//                and offset against the buffers (the bytes come off the
+//                wire)
+//
+// Inputs       : src - the coded bytes
+//                length - the number of coded bytes
+//                dst - the place to put the bytes
+//                size - the number of bytes they must decode to
+// Outputs      : 0 if successful, -1 if the coded bytes are bad
+
+int crud_decompress(const void *src, uint32_t length, void *dst, uint32_t size) {
+    // Declare variables
+    const unsigned char *ip = src, *end = ip + length, *ref;
+    unsigned char *out = dst, *op = out, *oend = out + size;
+    uint32_t token, count, offset, match, i;
+
+    while (ip < end)
+    {
+        // Copy out the literals
+        token = *ip++;
+        count = token >> 4;
+        if (crud_decompress_length(&ip, end, &count) != 0 ||
+                count > (uint32_t) (end - ip) || count > (uint32_t) (oend - op))
+            return -1;
+        memcpy(op, ip, count);
+        ip += count;
+        op += count;
+
+        // Only the last sequence has no match
+        if (ip == end)
+            break;
+        if (end - ip < 2)
+            return -1;
+        offset = (uint32_t) ip[0] | ((uint32_t) ip[1] << 8);
+        ip += 2;
+        match = token & 0xf;
+        if (crud_decompress_length(&ip, end, &match) != 0)
+            return -1;
+        match += CRUD_COMPRESS_MIN_MATCH;
+        if (offset == 0 || offset > (uint32_t) (op - out) || match > (uint32_t) (oend - op))
+            return -1;
+
+        // A match may overlap the bytes it makes (a repeating run)
+        ref = op - offset;
+        if (offset >= match)
+            memcpy(op, ref, match);
+        else
+        {
+            for (i = 0; i < match; i++)
+                op[i] = ref[i];
+        }
+        op += match;
+    }
+
+    return (op == oend) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudCompressUnitTest
+// Description  : Round trip buffers of several kinds through the codec, and
+//                check that bad coded bytes are refused
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudCompressUnitTest(void) {
+
+	// Local variables
+	static const char *words[] = { "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog\n" };
+	uint32_t sizes[] = { 0, 1, 11, 12, 13, 100, 4096, 65536, 200000 };
+	unsigned char *raw, *coded, *back;
+	uint32_t i, j, kind, size, pos, len, coded_size;
+	int result = 0;
+
+	// Get the buffers
+	raw = malloc(200000);
+	coded = malloc(CRUD_COMPRESS_BOUND(200000));
+	back = malloc(200000);
+	if ((raw == NULL) || (coded == NULL) || (back == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "Compress unit test failed allocating buffers.");
+		free(raw);
+		free(coded);
+		free(back);
+		return(-1);
+	}
+
+	// Zeros, text, random bytes and short repeating runs, at every size
+	for (kind = 0; (kind < 4) && (result == 0); kind++) {
+		for (i = 0; (i < sizeof(sizes) / sizeof(sizes[0])) && (result == 0); i++) {
+			size = sizes[i];
+			for (pos = 0; pos < size; pos += len) {
+				if (kind == 0) {
+					len = size - pos;
+					memset(&raw[pos], 0, len);
+				} else if (kind == 1) {
+					j = getRandomValue(0, 7);
+					len = (strlen(words[j]) < size - pos) ? strlen(words[j]) : size - pos;
+					memcpy(&raw[pos], words[j], len);
+				} else if (kind == 2) {
+					len = 1;
+					raw[pos] = (unsigned char)getRandomValue(0, 255);
+				} else {
+					len = 1;
+					raw[pos] = (unsigned char)(pos % 3);
+				}
+			}
+
+			// Code it, decode it and compare
+			coded_size = crud_compress(raw, size, coded, CRUD_COMPRESS_BOUND(size));
+			if ((coded_size == 0) || crud_decompress(coded, coded_size, back, size) ||
+					(memcmp(raw, back, size) != 0)) {
+				logMessage(LOG_ERROR_LEVEL, "Compress unit test failed round trip [kind %u, %u bytes].",
+						kind, size);
+				result = -1;
+			}
+
+			// Text and runs must shrink, and truncated bytes must be refused
+			if ((result == 0) && (size >= 4096) && (kind != 2) && (coded_size * 4 > size * 3)) {
+				logMessage(LOG_ERROR_LEVEL, "Compress unit test failed, poor ratio [kind %u, %u->%u].",
+						kind, size, coded_size);
+				result = -1;
+			}
+			if ((result == 0) && (size > 0) && (crud_decompress(coded, coded_size - 1, back, size) == 0)) {
+				logMessage(LOG_ERROR_LEVEL, "Compress unit test failed, truncation not detected.");
+				result = -1;
+			}
+			if ((result == 0) && (size >= 4096) && (kind == 2) &&
+					(crud_compress(raw, size, coded, size - 1) != 0)) {
+				logMessage(LOG_ERROR_LEVEL, "Compress unit test failed, random bytes fit in less.");
+				result = -1;
+			}
+		}
+	}
+
+	// Release the buffers, log and return
+	free(raw);
+	free(coded);
+	free(back);
+	if (result == 0) {
+		logMessage(LOG_INFO_LEVEL, "Compress unit test completed successfully.");
+	}
+	return(result);
+}
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_compress_slot
+// Description  : Get the match table slot of the 4-byte string at a place
+//
+// Inputs       : p - the place
+// Outputs      : the slot
+
+static uint32_t crud_compress_slot(const unsigned char *p) {
+    // Declare variables
+    uint32_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return (word * 2654435761U) >> (32 - CRUD_COMPRESS_HASH_BITS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_compress_sequence
+// Description  : Add a sequence to the coded bytes
+//
+// Inputs       : op - the place to put it
+//                end - the end of the coded bytes buffer
+//                literals - the literal bytes
+//                count - the number of literal bytes
+//                offset - how far back the match is
+//                match - the length of the match (0 for the last sequence)
+// Outputs      : the end of the sequence, or NULL if it does not fit
+
+static unsigned char *crud_compress_sequence(unsigned char *op, unsigned char *end,
+        const unsigned char *literals, uint32_t count, uint32_t offset, uint32_t match) {
+    // Declare variables
+    unsigned char *token;
+
+    // Make sure the longest coding of it fits
+    if ((uint64_t) (end - op) < 1 + count / 255 + 1 + count + 2 + match / 255 + 1)
+        return NULL;
+
+    token = op++;
+    *token = (unsigned char) (((count < 15) ? count : 15) << 4);
+    if (count >= 15)
+        op = crud_compress_length(op, count - 15);
+    memcpy(op, literals, count);
+    op += count;
+    if (match == 0)
+        return op;
+
+    *op++ = (unsigned char) (offset & 0xff);
+    *op++ = (unsigned char) (offset >> 8);
+    match -= CRUD_COMPRESS_MIN_MATCH;
+    *token |= (unsigned char) ((match < 15) ? match : 15);
+    if (match >= 15)
+        op = crud_compress_length(op, match - 15);
+    return op;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_compress_length
+// Description  : Add the extra bytes of a length past its nibble (255 for
+//                each whole 255, then the rest)
+//
+// Inputs       : op - the place to put them
+//                length - the length past the nibble
+// Outputs      : the end of the bytes
+
+static unsigned char *crud_compress_length(unsigned char *op, uint32_t length) {
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char) length;
+    return op;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_decompress_length
+// Description  : Read the extra bytes of a length whose nibble is full
+//
+// Inputs       : ip - the place of the bytes (moved past them)
+//                end - the end of the coded bytes
+//                length - the nibble (the bytes are added to it)
+// Outputs      : 0 if successful, -1 if the bytes run out
+
+static int crud_decompress_length(const unsigned char **ip, const unsigned char *end, uint32_t *length) {
+    // Declare variables
+    uint32_t byte = 255;
+
+    if (*length != 15)
+        return 0;
+    while (byte == 255)
+    {
+        if (*ip == end || *length > UINT32_MAX / 2)
+            return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    }
+    return 0;
+}
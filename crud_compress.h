@@ -0,0 +1,39 @@
+#ifndef CRUD_COMPRESS_INCLUDED
+#define CRUD_COMPRESS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_compress.h
+//  Description    : This is the header file for the payload codec used on the
+//                   wire (see CRUD_CAP_COMPRESS in crud_driver.h).  Payloads
+//                   are coded in the LZ4 block format: a fast greedy coder,
+//                   meant to save bandwidth on text-like objects rather
+//                   than to squeeze out every byte.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Tue Dec  2 09:40:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_COMPRESS_MIN_BYTES 512 // Smaller payloads are always sent raw
+#define CRUD_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16) // Most bytes n bytes code to
+
+//
+// Codec interface
+
+uint32_t crud_compress(const void *src, uint32_t length, void *dst, uint32_t capacity);
+	// Code bytes, returning the coded size (0 if they do not fit in capacity)
+
+int crud_decompress(const void *src, uint32_t length, void *dst, uint32_t size);
+	// Decode bytes, which must come to exactly size bytes
+
+//
+// Unit testing for the module
+
+int crudCompressUnitTest(void);
+	// Round trip buffers of several kinds through the codec
+
+#endif
@@ -0,0 +1,546 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_dedup.c
+//  Description    : This is the implementation of the content index.  The
+//                   chunks are kept in a dense array, found through two hash
+//                   tables of array positions: one on the content hash (to
+//                   find a duplicate of a new chunk) and one on the OID (to
+//                   find the references of a chunk being written).  Both use
+//                   open addressing with linear probing, and a dropped chunk
+//                   is replaced by the last one of the array.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Mon Nov 24 08:15:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <crud_dedup.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_DEDUP_MIN_CHUNKS 64   // Initial size of the chunk array
+#define CRUD_DEDUP_PRIME1 0x9e3779b185ebca87ULL
+#define CRUD_DEDUP_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define CRUD_DEDUP_PRIME3 0x165667b19e3779f9ULL
+#define CRUD_DEDUP_PRIME4 0x85ebca77c2b2ae63ULL
+#define CRUD_DEDUP_PRIME5 0x27d4eb2f165667c5ULL
+#define CRUD_DEDUP_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+// Type definitions
+
+// This is a content index
+struct crud_dedup {
+    CrudDedupEntry *entries;     // The chunks indexed
+    uint32_t        count;       // Chunks in the array
+    uint32_t        capacity;    // Chunks the array holds
+    uint32_t       *by_hash;     // Table on the content hash (position+1, 0 if empty)
+    uint32_t       *by_oid;      // Table on the OID (position+1, 0 if empty)
+    uint32_t        slots;       // Slots of each table (power of 2, twice capacity)
+};
+
+// Module local functions
+static uint64_t crud_dedup_round(uint64_t acc, uint64_t word);
+static uint64_t crud_dedup_word(const unsigned char *p);
+static uint32_t crud_dedup_oid_slot(CrudOID oid);
+static int crud_dedup_grow(CrudDedup *dd, uint32_t capacity);
+static void crud_dedup_insert(uint32_t *table, uint32_t slots, uint32_t home, uint32_t pos);
+static uint32_t crud_dedup_lookup(CrudDedup *dd, CrudOID oid);
+static void crud_dedup_remove(CrudDedup *dd, uint32_t *table, uint32_t slot, int by_hash);
+static uint32_t crud_dedup_slot_of(CrudDedup *dd, uint32_t *table, uint32_t pos, int by_hash);
+static uint32_t crud_dedup_home(CrudDedup *dd, uint32_t pos, int by_hash);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_hash
+// Description  : Hash the contents of a chunk.  The bytes are taken 8 at a
+//                time in four independent lanes (the xxHash64 scheme), so it
+//                runs at memory speed rather than one multiply per byte.
+//
+// Inputs       : buf - the contents
+//                length - the number of bytes
+// Outputs      : the hash
+
+uint64_t crud_dedup_hash(const void *buf, uint32_t length) {
+    // Declare variables
+    const unsigned char *p = buf, *end = p + length;
+    uint64_t h, v1, v2, v3, v4;
+
+    if (length >= 32)
+    {
+        v1 = CRUD_DEDUP_PRIME1 + CRUD_DEDUP_PRIME2;
+        v2 = CRUD_DEDUP_PRIME2;
+        v3 = 0;
+        v4 = -CRUD_DEDUP_PRIME1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = crud_dedup_round(v1, crud_dedup_word(p));
+            v2 = crud_dedup_round(v2, crud_dedup_word(p + 8));
+            v3 = crud_dedup_round(v3, crud_dedup_word(p + 16));
+            v4 = crud_dedup_round(v4, crud_dedup_word(p + 24));
+        }
+        h = CRUD_DEDUP_ROTL(v1, 1) + CRUD_DEDUP_ROTL(v2, 7) +
+            CRUD_DEDUP_ROTL(v3, 12) + CRUD_DEDUP_ROTL(v4, 18);
+        h = (h ^ crud_dedup_round(0, v1)) * CRUD_DEDUP_PRIME1 + CRUD_DEDUP_PRIME4;
+        h = (h ^ crud_dedup_round(0, v2)) * CRUD_DEDUP_PRIME1 + CRUD_DEDUP_PRIME4;
+        h = (h ^ crud_dedup_round(0, v3)) * CRUD_DEDUP_PRIME1 + CRUD_DEDUP_PRIME4;
+        h = (h ^ crud_dedup_round(0, v4)) * CRUD_DEDUP_PRIME1 + CRUD_DEDUP_PRIME4;
+    }
+    else
+        h = CRUD_DEDUP_PRIME5;
+    h += length;
+
+    // The rest, a word and then a byte at a time
+    for (; p + 8 <= end; p += 8)
+        h = CRUD_DEDUP_ROTL(h ^ crud_dedup_round(0, crud_dedup_word(p)), 27) *
+            CRUD_DEDUP_PRIME1 + CRUD_DEDUP_PRIME4;
+    for (; p < end; p++)
+        h = CRUD_DEDUP_ROTL(h ^ (*p * CRUD_DEDUP_PRIME5), 11) * CRUD_DEDUP_PRIME1;
+
+    // Mix the last bits in
+    h ^= h >> 33;
+    h *= CRUD_DEDUP_PRIME2;
+    h ^= h >> 29;
+    h *= CRUD_DEDUP_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_new
+// Description  : Make a new (empty) content index
+//
+// Inputs       : none
+// Outputs      : the index, or NULL if failure
+
+CrudDedup *crud_dedup_new(void) {
+    // Declare variables
+    CrudDedup *dd = calloc(1, sizeof(CrudDedup));
+
+    if (dd == NULL || crud_dedup_grow(dd, CRUD_DEDUP_MIN_CHUNKS) != 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD dedup : failed allocating content index.");
+        crud_dedup_free(dd);
+        return NULL;
+    }
+    return dd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_free
+// Description  : Release a content index
+//
+// Inputs       : dd - the index (may be NULL)
+// Outputs      : none
+
+void crud_dedup_free(CrudDedup *dd) {
+    if (dd == NULL)
+        return;
+    free(dd->entries);
+    free(dd->by_hash);
+    free(dd->by_oid);
+    free(dd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_reset
+// Description  : Drop all of the chunks of an index (keeping its memory)
+//
+// Inputs       : dd - the index
+// Outputs      : none
+
+void crud_dedup_reset(CrudDedup *dd) {
+    dd->count = 0;
+    memset(dd->by_hash, 0, dd->slots * sizeof(uint32_t));
+    memset(dd->by_oid, 0, dd->slots * sizeof(uint32_t));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_find
+// Description  : Find an indexed chunk with a given hash and length.  The
+//                caller has to compare the contents, a hash match alone does
+//                not make the chunks equal.
+//
+// Inputs       : dd - the index
+//                hash - the hash of the contents
+//                length - the length of the chunk
+// Outputs      : the chunk object, or CRUD_NO_OBJECT if none
+
+CrudOID crud_dedup_find(CrudDedup *dd, uint64_t hash, uint32_t length) {
+    // Declare variables
+    uint32_t slot = (uint32_t) hash & (dd->slots - 1), pos;
+
+    for (; (pos = dd->by_hash[slot]) != 0; slot = (slot + 1) & (dd->slots - 1))
+    {
+        if (dd->entries[pos-1].hash == hash && dd->entries[pos-1].length == length)
+            return dd->entries[pos-1].oid;
+    }
+    return CRUD_NO_OBJECT;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_add
+// Description  : Index a chunk with a single reference
+//
+// Inputs       : dd - the index
+//                hash - the hash of the contents
+//                length - the length of the chunk
+//                oid - the chunk object (not indexed yet)
+// Outputs      : 0 if successful, -1 if failure (index full)
+
+int crud_dedup_add(CrudDedup *dd, uint64_t hash, uint32_t length, CrudOID oid) {
+    // Declare variables
+    CrudDedupEntry *entry;
+
+    if (dd->count == dd->capacity)
+    {
+        if (dd->capacity == CRUD_DEDUP_MAX_CHUNKS ||
+                crud_dedup_grow(dd, (dd->capacity * 2 < CRUD_DEDUP_MAX_CHUNKS) ?
+                    dd->capacity * 2 : (uint32_t) CRUD_DEDUP_MAX_CHUNKS) != 0)
+            return -1;
+    }
+
+    entry = &dd->entries[dd->count];
+    entry->hash = hash;
+    entry->oid = oid;
+    entry->length = length;
+    entry->refs = 1;
+    entry->reserved = 0;
+    crud_dedup_insert(dd->by_hash, dd->slots, (uint32_t) hash, dd->count);
+    crud_dedup_insert(dd->by_oid, dd->slots, crud_dedup_oid_slot(oid), dd->count);
+    dd->count++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_refs
+// Description  : Get the number of references to a chunk
+//
+// Inputs       : dd - the index
+//                oid - the chunk object
+// Outputs      : the references, 0 if the chunk is not indexed
+
+uint32_t crud_dedup_refs(CrudDedup *dd, CrudOID oid) {
+    uint32_t slot = crud_dedup_lookup(dd, oid);
+    return (slot == UINT32_MAX) ? 0 : dd->entries[dd->by_oid[slot]-1].refs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_ref
+// Description  : Add a reference to an indexed chunk
+//
+// Inputs       : dd - the index
+//                oid - the chunk object
+// Outputs      : 0 if successful, -1 if the chunk is not indexed
+
+int crud_dedup_ref(CrudDedup *dd, CrudOID oid) {
+    uint32_t slot = crud_dedup_lookup(dd, oid);
+
+    if (slot == UINT32_MAX)
+        return -1;
+    dd->entries[dd->by_oid[slot]-1].refs++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_unref
+// Description  : Drop a reference to a chunk.  The last one drops the chunk
+//                from the index (but leaves the object alone).
+//
+// Inputs       : dd - the index
+//                oid - the chunk object
+// Outputs      : the references left (0 if none, or if it was not indexed)
+
+uint32_t crud_dedup_unref(CrudDedup *dd, CrudOID oid) {
+    // Declare variables
+    uint32_t slot = crud_dedup_lookup(dd, oid), pos, last;
+
+    if (slot == UINT32_MAX)
+        return 0;
+    pos = dd->by_oid[slot] - 1;
+    if (--dd->entries[pos].refs > 0)
+        return dd->entries[pos].refs;
+
+    // Take it out of both tables, and move the last chunk into its place
+    crud_dedup_remove(dd, dd->by_oid, slot, 0);
+    crud_dedup_remove(dd, dd->by_hash, crud_dedup_slot_of(dd, dd->by_hash, pos, 1), 1);
+    last = --dd->count;
+    if (pos != last)
+    {
+        dd->by_hash[crud_dedup_slot_of(dd, dd->by_hash, last, 1)] = pos + 1;
+        dd->by_oid[crud_dedup_slot_of(dd, dd->by_oid, last, 0)] = pos + 1;
+        dd->entries[pos] = dd->entries[last];
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_count
+// Description  : Get the number of chunks indexed
+//
+// Inputs       : dd - the index
+// Outputs      : the number of chunks
+
+uint32_t crud_dedup_count(CrudDedup *dd) {
+    return dd->count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_save
+// Description  : Copy the chunks of an index out, to be stored
+//
+// Inputs       : dd - the index
+//                entries - the place to put them (crud_dedup_count entries)
+// Outputs      : the number of chunks copied
+
+uint32_t crud_dedup_save(CrudDedup *dd, CrudDedupEntry *entries) {
+    memcpy(entries, dd->entries, dd->count * sizeof(CrudDedupEntry));
+    return dd->count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_load
+// Description  : Replace the chunks of an index with saved ones
+//
+// Inputs       : dd - the index
+//                entries - the saved chunks
+//                count - the number of saved chunks
+// Outputs      : 0 if successful, -1 if failure (the index is left empty)
+
+int crud_dedup_load(CrudDedup *dd, const CrudDedupEntry *entries, uint32_t count) {
+    // Declare variables
+    uint32_t capacity = dd->capacity, i;
+
+    crud_dedup_reset(dd);
+    if (count > CRUD_DEDUP_MAX_CHUNKS)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD dedup : bad content index [%u chunks].", count);
+        return -1;
+    }
+    while (capacity < count)
+        capacity *= 2;
+    if (capacity > CRUD_DEDUP_MAX_CHUNKS)
+        capacity = CRUD_DEDUP_MAX_CHUNKS;
+    if (capacity > dd->capacity && crud_dedup_grow(dd, capacity) != 0)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        if (entries[i].refs == 0 || entries[i].oid == CRUD_NO_OBJECT)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD dedup : bad content index entry [%u].", i);
+            crud_dedup_reset(dd);
+            return -1;
+        }
+        dd->entries[i] = entries[i];
+        crud_dedup_insert(dd->by_hash, dd->slots, (uint32_t) entries[i].hash, i);
+        crud_dedup_insert(dd->by_oid, dd->slots, crud_dedup_oid_slot(entries[i].oid), i);
+    }
+    dd->count = count;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_round
+// Description  : Mix a word into a lane of the hash
+//
+// Inputs       : acc - the lane
+//                word - the word
+// Outputs      : the new lane
+
+static uint64_t crud_dedup_round(uint64_t acc, uint64_t word) {
+    acc += word * CRUD_DEDUP_PRIME2;
+    acc = CRUD_DEDUP_ROTL(acc, 31);
+    return acc * CRUD_DEDUP_PRIME1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_word
+// Description  : Load 8 (possibly unaligned) bytes
+//
+// Inputs       : p - the bytes
+// Outputs      : the word
+
+static uint64_t crud_dedup_word(const unsigned char *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_oid_slot
+// Description  : Hash an OID for the OID table (OIDs are handed out in
+//                sequence, so they are scrambled first)
+//
+// Inputs       : oid - the object
+// Outputs      : the hash
+
+static uint32_t crud_dedup_oid_slot(CrudOID oid) {
+    return (uint32_t) (((uint64_t) oid * CRUD_DEDUP_PRIME1) >> 32);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_grow
+// Description  : Make room for more chunks, rebuilding the tables
+//
+// Inputs       : dd - the index
+//                capacity - the number of chunks to hold
+// Outputs      : 0 if successful, -1 if failure (the index is unchanged)
+
+static int crud_dedup_grow(CrudDedup *dd, uint32_t capacity) {
+    // Declare variables
+    CrudDedupEntry *entries;
+    uint32_t *by_hash, *by_oid, slots = 1, i;
+
+    while (slots < capacity * 2)
+        slots *= 2;
+    entries = realloc(dd->entries, capacity * sizeof(CrudDedupEntry));
+    if (entries == NULL)
+        return -1;
+    dd->entries = entries;
+    by_hash = calloc(slots, sizeof(uint32_t));
+    by_oid = calloc(slots, sizeof(uint32_t));
+    if (by_hash == NULL || by_oid == NULL)
+    {
+        free(by_hash);
+        free(by_oid);
+        return -1;
+    }
+
+    for (i = 0; i < dd->count; i++)
+    {
+        crud_dedup_insert(by_hash, slots, (uint32_t) entries[i].hash, i);
+        crud_dedup_insert(by_oid, slots, crud_dedup_oid_slot(entries[i].oid), i);
+    }
+    free(dd->by_hash);
+    free(dd->by_oid);
+    dd->by_hash = by_hash;
+    dd->by_oid = by_oid;
+    dd->slots = slots;
+    dd->capacity = capacity;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_insert
+// Description  : Put an array position in the first free slot from its home
+//
+// Inputs       : table - the table
+//                slots - the slots of the table
+//                home - the hash of the chunk
+//                pos - the array position
+// Outputs      : none
+
+static void crud_dedup_insert(uint32_t *table, uint32_t slots, uint32_t home, uint32_t pos) {
+    uint32_t slot = home & (slots - 1);
+
+    while (table[slot] != 0)
+        slot = (slot + 1) & (slots - 1);
+    table[slot] = pos + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_lookup
+// Description  : Find the slot of a chunk in the OID table
+//
+// Inputs       : dd - the index
+//                oid - the chunk object
+// Outputs      : the slot, or UINT32_MAX if it is not indexed
+
+static uint32_t crud_dedup_lookup(CrudDedup *dd, CrudOID oid) {
+    uint32_t slot = crud_dedup_oid_slot(oid) & (dd->slots - 1), pos;
+
+    for (; (pos = dd->by_oid[slot]) != 0; slot = (slot + 1) & (dd->slots - 1))
+    {
+        if (dd->entries[pos-1].oid == oid)
+            return slot;
+    }
+    return UINT32_MAX;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_slot_of
+// Description  : Find the slot of an array position in a table
+//
+// Inputs       : dd - the index
+//                table - the table
+//                pos - the array position (which is in the table)
+//                by_hash - set for the hash table, clear for the OID table
+// Outputs      : the slot
+
+static uint32_t crud_dedup_slot_of(CrudDedup *dd, uint32_t *table, uint32_t pos, int by_hash) {
+    uint32_t slot = crud_dedup_home(dd, pos, by_hash);
+
+    while (table[slot] != pos + 1)
+        slot = (slot + 1) & (dd->slots - 1);
+    return slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_home
+// Description  : Get the slot a chunk hashes to in a table
+//
+// Inputs       : dd - the index
+//                pos - the array position of the chunk
+//                by_hash - set for the hash table, clear for the OID table
+// Outputs      : the slot
+
+static uint32_t crud_dedup_home(CrudDedup *dd, uint32_t pos, int by_hash) {
+    return (by_hash ? (uint32_t) dd->entries[pos].hash :
+            crud_dedup_oid_slot(dd->entries[pos].oid)) & (dd->slots - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_remove
+// Description  : Empty a slot of a table, shifting back the slots after it
+//                that would no longer be found (so no tombstones are needed)
+//
+// Inputs       : dd - the index
+//                table - the table
+//                slot - the slot to empty
+//                by_hash - set for the hash table, clear for the OID table
+// Outputs      : none
+
+static void crud_dedup_remove(CrudDedup *dd, uint32_t *table, uint32_t slot, int by_hash) {
+    // Declare variables
+    uint32_t mask = dd->slots - 1, next, home;
+
+    table[slot] = 0;
+    for (next = (slot + 1) & mask; table[next] != 0; next = (next + 1) & mask)
+    {
+        // Move it into the hole unless its home lies after the hole
+        home = crud_dedup_home(dd, table[next] - 1, by_hash);
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            table[slot] = table[next];
+            table[next] = 0;
+            slot = next;
+        }
+    }
+}
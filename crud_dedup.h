@@ -0,0 +1,80 @@
+#ifndef CRUD_DEDUP_INCLUDED
+#define CRUD_DEDUP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_dedup.h
+//  Description    : This is the header file for the content index of the file
+//                   system, which lets files share chunk objects of identical
+//                   contents.  Full chunks are indexed by a hash of their
+//                   contents, with a count of the references to each; a
+//                   shared chunk is copied before it is written.  An index is
+//                   not thread safe, the file system locks it.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Mon Nov 24 08:15:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_DEDUP_MAX_CHUNKS (CRUD_MAX_OBJECT_SIZE / sizeof(CrudDedupEntry)) // Chunks indexed (fits one object)
+
+// Type definitions
+
+// This is an indexed chunk, as stored in the index object
+typedef struct {
+    uint64_t  hash;          // Hash of the contents (crud_dedup_hash)
+    CrudOID   oid;           // The chunk object
+    uint32_t  length;        // The length of the chunk
+    uint32_t  refs;          // The extent map slots referring to it
+    uint32_t  reserved;      // Unused (zero)
+} CrudDedupEntry;
+
+// This is a content index (opaque)
+typedef struct crud_dedup CrudDedup;
+
+//
+// Content index interface
+
+uint64_t crud_dedup_hash(const void *buf, uint32_t length);
+	// Hash the contents of a chunk
+
+CrudDedup *crud_dedup_new(void);
+	// Make a new (empty) content index
+
+void crud_dedup_free(CrudDedup *dd);
+	// Release a content index
+
+void crud_dedup_reset(CrudDedup *dd);
+	// Drop all of the chunks of an index
+
+CrudOID crud_dedup_find(CrudDedup *dd, uint64_t hash, uint32_t length);
+	// Find an indexed chunk with a hash and length (CRUD_NO_OBJECT if none)
+
+int crud_dedup_add(CrudDedup *dd, uint64_t hash, uint32_t length, CrudOID oid);
+	// Index a chunk with a single reference
+
+uint32_t crud_dedup_refs(CrudDedup *dd, CrudOID oid);
+	// Get the references to a chunk (0 if it is not indexed)
+
+int crud_dedup_ref(CrudDedup *dd, CrudOID oid);
+	// Add a reference to an indexed chunk
+
+uint32_t crud_dedup_unref(CrudDedup *dd, CrudOID oid);
+	// Drop a reference to a chunk, returning the ones left (0 drops it)
+
+uint32_t crud_dedup_count(CrudDedup *dd);
+	// Get the number of chunks indexed
+
+uint32_t crud_dedup_save(CrudDedup *dd, CrudDedupEntry *entries);
+	// Copy the chunks of an index out (crud_dedup_count entries)
+
+int crud_dedup_load(CrudDedup *dd, const CrudDedupEntry *entries, uint32_t count);
+	// Replace the chunks of an index with saved ones
+
+#endif
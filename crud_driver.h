@@ -33,9 +33,12 @@ typedef enum {
 	CRUD_DELETE  = 5, // Delete an object
 	CRUD_CLOSE   = 6, // Close the CRUD device
 	CRUD_UNKNOWN = 7, // Unknown type
-	CRUD_MAXVAL  = 8, // Max value
+	CRUD_READ_RANGE   = 8, // Read part of an object (extension, CRUD_CAP_RANGE)
+	CRUD_UPDATE_RANGE = 9, // Update part of an object (extension, CRUD_CAP_RANGE)
+	CRUD_COMPOUND = 10, // Several requests in one message (extension, CRUD_CAP_COMPOUND)
+	CRUD_MAXVAL  = 11, // Max value
 } CRUD_REQUEST_TYPES;
-const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL];
+extern const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL];
 
 // These are the CRUD flags
 typedef enum {
@@ -43,11 +46,39 @@ typedef enum {
 	CRUD_PRIORITY_OBJECT = 1,  // Flag indicating that object is a "priority object"
 	CRUD_FLAGMAX         = 2,  // Max value
 } CRUD_FLAG_TYPES;
-const char *CRUD_FLAG_TYPE_LABLES[CRUD_FLAGMAX];
+extern const char *CRUD_FLAG_TYPE_LABLES[CRUD_FLAGMAX];
 
 // CRUD request and response types
 typedef uint64_t CrudRequest;
 typedef uint64_t CrudResponse;
+typedef uint64_t CrudRequestExt;
+
+// Protocol extensions, negotiated at CRUD_INIT (see below)
+#define CRUD_EXT_PROBE_FLAG 0x4 // INIT flag asking the server for its capabilities
+#define CRUD_COMPRESSED_FLAG 0x2 // Payload is coded (see CRUD_CAP_COMPRESS below)
+#define CRUD_CAP_RANGE      0x1 // Server supports CRUD_READ_RANGE/CRUD_UPDATE_RANGE
+#define CRUD_CAP_GROW       0x2 // Range updates may extend the object past its end
+#define CRUD_CAP_COMPOUND   0x4 // Server supports CRUD_COMPOUND
+#define CRUD_CAP_COMPRESS   0x8 // Server takes and sends coded payloads
+
+// Header fields, as shifts and masks of the 64-bit value (see below)
+#define CRUD_HEADER_OID_SHIFT    32
+#define CRUD_HEADER_REQ_SHIFT    28
+#define CRUD_HEADER_LENGTH_SHIFT 4
+#define CRUD_HEADER_FLAGS_SHIFT  1
+#define CRUD_HEADER_REQ_MASK     0xfU
+#define CRUD_HEADER_LENGTH_MASK  0xffffffU
+#define CRUD_HEADER_FLAGS_MASK   0x7U
+#define CRUD_HEADER_RES_MASK     0x1U
+#define CRUD_HEADER_OID(h)    ((CrudOID) ((h) >> CRUD_HEADER_OID_SHIFT))
+#define CRUD_HEADER_REQ(h)    ((uint8_t) (((h) >> CRUD_HEADER_REQ_SHIFT) & CRUD_HEADER_REQ_MASK))
+#define CRUD_HEADER_LENGTH(h) ((uint32_t) (((h) >> CRUD_HEADER_LENGTH_SHIFT) & CRUD_HEADER_LENGTH_MASK))
+#define CRUD_HEADER_FLAGS(h)  ((uint8_t) (((h) >> CRUD_HEADER_FLAGS_SHIFT) & CRUD_HEADER_FLAGS_MASK))
+#define CRUD_HEADER_RESULT(h) ((uint8_t) ((h) & CRUD_HEADER_RES_MASK))
+#define CRUD_HEADER_SET_OID(h, oid) (((CrudRequest) (oid) << CRUD_HEADER_OID_SHIFT) | \
+		((h) & ((1ULL << CRUD_HEADER_OID_SHIFT) - 1)))
+#define CRUD_HEADER_SET_FLAGS(h, f) (((h) | ((CrudRequest) (f) << CRUD_HEADER_FLAGS_SHIFT)))
+#define CRUD_HEADER_CLEAR_FLAGS(h, f) (((h) & ~((CrudRequest) (f) << CRUD_HEADER_FLAGS_SHIFT)))
 
 /*
 
@@ -69,6 +100,58 @@ typedef uint64_t CrudResponse;
   60-62 - Flags - these are flags for commands (UNUSED)
      63 - R - this is the result bit (0 success, 1 is failure)
 
+ Protocol Extensions
+
+  A client that understands the extensions sets CRUD_EXT_PROBE_FLAG in the
+  flags of its CRUD_INIT request.  A server that supports them answers with
+  a mask of CRUD_CAP_* bits in the Length field of the INIT response; older
+  servers echo a zero length, and the client must then stay with the basic
+  request types (unknown request types are fatal to them).
+
+  The range requests (CRUD_READ_RANGE/CRUD_UPDATE_RANGE) are followed by a
+  64-bit extension word, in network byte order, before any payload:
+
+  0                   1                   2                   3
+  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                           Reserved                            |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                            Offset                             |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+  Bits    Description
+  -----   -------------------------------------------------------------
+   0-31 - Reserved - must be zero
+  32-63 - Offset - byte offset into the object of the first byte accessed
+
+  The Length field of the header is the number of bytes in the range.  A
+  range read answers with the bytes actually available (Length in the
+  response), a range update must lie entirely within the object.  If the
+  server also offers CRUD_CAP_GROW, a range update may start anywhere up to
+  the end of the object and run past it, growing the object to Offset +
+  Length bytes (an append sends only the appended bytes).
+
+  If the server offers CRUD_CAP_COMPOUND, a CRUD_COMPOUND request carries
+  several sub-requests in one message.  Its OID field is the number of
+  sub-requests and its Length the number of bytes that follow, which are
+  the sub-requests exactly as they would be sent alone (header, extension
+  word, payload).  Sub-requests may not be CRUD_INIT or CRUD_COMPOUND, and
+  a CRUD_CLOSE must be the last one.  The server executes them in order,
+  stopping after the first that fails, and answers with one CRUD_COMPOUND
+  response: OID is the number of sub-requests executed, Length the number
+  of bytes that follow (the sub-responses as they would be sent alone), and
+  R is set if any sub-request failed.
+
+  If the server offers CRUD_CAP_COMPRESS, the payload of a CRUD_CREATE,
+  CRUD_UPDATE or CRUD_UPDATE_RANGE may be coded (see crud_compress.h).  The
+  request then has CRUD_COMPRESSED_FLAG set, its Length is still the size of
+  the object bytes, and the payload is a 32-bit coded size, in network byte
+  order, followed by that many coded bytes.  A CRUD_READ or CRUD_READ_RANGE
+  with CRUD_COMPRESSED_FLAG set lets the server answer the same way: if the
+  response has the flag set, the read bytes follow coded, after their size.
+  Either side sends small or incompressible payloads as they are, and the
+  sub-requests of a CRUD_COMPOUND are never coded.
+
 */
 
 //
@@ -90,15 +173,51 @@ int crud_unit_test( void );
 	// This is a function used to test the CRUD interfaces and code.
 
 //
-// Utility functions (see crud_util.c)
+// Utility functions (inline, so a header of constant fields folds to a constant)
 
-CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
-		uint32_t length, uint8_t flags, uint8_t res);
-    // Create a 64-bit bus request buffer
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : construct_crud_request
+// Description  : Construct the CRUD command from the request fields
+//
+// Inputs       : oid - the object ID
+//                req - the request type
+//                length - the size of the object in bytes
+//                flags - the flags associated with the response
+//                res - the result flag
+// Outputs      : the request (64 bits, see above)
+
+static inline CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
+		uint32_t length, uint8_t flags, uint8_t res) {
+	return (((CrudRequest) oid << CRUD_HEADER_OID_SHIFT) |
+		((CrudRequest) (req & CRUD_HEADER_REQ_MASK) << CRUD_HEADER_REQ_SHIFT) |
+		((CrudRequest) (length & CRUD_HEADER_LENGTH_MASK) << CRUD_HEADER_LENGTH_SHIFT) |
+		((CrudRequest) (flags & CRUD_HEADER_FLAGS_MASK) << CRUD_HEADER_FLAGS_SHIFT) |
+		((CrudRequest) (res & CRUD_HEADER_RES_MASK)));
+}
 
-int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deconstruct_crud_request
+// Description  : Extract the CRUD command fields from the request
+//
+// Inputs       : request - the request (64 bits, see above)
+//                oid - the place to put the object ID
+//                req - the place to put the request type
+//                length - the size of the object in bytes
+//                flags - the flags associated
+//                res - the result flag
+// Outputs      : 0 (always successful)
+
+static inline int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
 		CRUD_REQUEST_TYPES *req, uint32_t *length, uint8_t *flags,
-		uint8_t *res);
-    // Extract values from a 64-bit bus request buffer
+		uint8_t *res) {
+	*oid = CRUD_HEADER_OID(request);
+	*req = (CRUD_REQUEST_TYPES) CRUD_HEADER_REQ(request);
+	*length = CRUD_HEADER_LENGTH(request);
+	*flags = CRUD_HEADER_FLAGS(request);
+	*res = CRUD_HEADER_RESULT(request);
+	return (0);
+}
 
 #endif
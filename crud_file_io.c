@@ -4,6 +4,14 @@
 //  Description    : This is the implementation of the standardized IO functions
 //                   for used to access the CRUD storage system.
 //
+//                   All of the state of a device is kept in its file system
+//                   context (crud_fs_t), so a program can use several devices
+//                   from several threads.  Files are locked individually, so
+//                   different files of a device can be used concurrently; the
+//                   context lock covers the file table index and open/close.
+//                   Format, mount and unmount must not run while other
+//                   threads are using files of the same device.
+//
 //  Author         : Ryan Geiger 
 //  Last Modified  : Sunday November 9 5:00:00 EST 2014
 //
@@ -11,19 +19,38 @@
 // Includes
 #include <malloc.h>
 #include <string.h>
+#include <pthread.h>
 
 // Project Includes
 #include <crud_file_io.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <crud_network.h>
+#include <crud_cache.h>
+#include <crud_dedup.h>
+#include <crud_journal.h>
+#include <crud_slab.h>
+
+// Unmount pipelines the updates of all of the file table pages
+#if CRUD_FILE_TABLE_PAGES > CRUD_PIPELINE_DEPTH
+#error "file table has more pages than the client pipeline holds"
+#endif
 
-// Global Variables
-int InitFlag = 0;  // Set to 1 once CRUD_INIT request is called
+// Format (and unmount) send all of the file table pages in one compound
+//  request, with the format and journal create (the superblock and close)
+#if CRUD_FILE_TABLE_PAGES + 2 > CRUD_COMPOUND_MAX_OPS
+#error "file table has more pages than a compound request holds"
+#endif
 
 // Defines
 #define CIO_UNIT_TEST_MAX_WRITE_SIZE 1024
 #define CRUD_IO_UNIT_TEST_ITERATIONS 10240
+#define CIO_UNIT_TEST_CHUNK_SIZE 4096 // Small chunks, so the test file spans many
+#define CIO_UNIT_TEST_DEDUP_CHUNKS 4  // Chunks of the files of the dedup test
+#define CIO_UNIT_TEST_AHEAD_CHUNKS 16 // Chunks of the file of the read-ahead test
+#define CIO_UNIT_TEST_AHEAD_READ 1000 // Size of the reads of the read-ahead test
+#define CIO_UNIT_TEST_JOURNAL_FILES 3 // Files of the journal test
+#define CRUD_FILE_HASH_BUCKETS 2048   // Buckets of the filename index (power of 2)
 
 // Other definitions
 
@@ -35,184 +62,462 @@ typedef enum {
 	CIO_UNIT_TEST_SEEK   = 3,
 } CRUD_UNIT_TEST_TYPE;
 
-// File system Static Data
-// This the definition of the file table
-CrudFileAllocationType crud_file_table[CRUD_MAX_TOTAL_FILES]; // The file handle table
-
-// Pick up these definitions from the unit test of the crud driver
-CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
-		uint32_t length, uint8_t flags, uint8_t res);
-int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
-		CRUD_REQUEST_TYPES *req, uint32_t *length, uint8_t *flags,
-		uint8_t *res);
+// In-memory extent map of an open file (the chunk OIDs in file order)
+typedef struct {
+    CrudOID  *chunks;    // The OIDs of the chunk objects
+    uint32_t  capacity;  // The number of OIDs allocated
+    uint32_t  stored;    // The number of chunks the stored table entry describes
+    uint8_t   dirty;     // Flag indicating the map changed since it was stored
+    char     *scratch;   // Reused read-modify-write buffer (one chunk)
+    CrudOID   tail;      // The last chunk of the file as journaled
+    CrudOID  *stale;     // Objects dropped since the file was journaled
+    uint32_t  nstale;    // The number of objects dropped
+} CrudFileExtents;
+
+// Write buffer of an open file, gathering small writes to a window of it
+typedef struct {
+    char     *data;      // The buffered bytes (write_buffer_size)
+    uint32_t  start;     // File offset of the first buffered byte
+    uint32_t  count;     // Number of bytes buffered (0 if empty)
+    uint32_t  stored;    // Length of the file before the buffered bytes
+} CrudWriteBuffer;
 
-// Type for parameters of CrudRequest and CrudResponse
+// Read-ahead state of an open file
 typedef struct {
-    uint32_t oID;       // Object ID
-    uint8_t req;        // Command or Request type
-    uint32_t length;    // Size of object
-    uint8_t flags;
-    uint8_t res;        // Result - 0 if success, 1 if failure
-} CRParsed;
+    uint32_t  next;      // File offset a sequential read would start at
+    uint32_t  fetched;   // First chunk past the ones read ahead
+    uint32_t  window;    // Chunks read ahead at a time (0 until reads are sequential)
+    uint8_t   advice;    // Access pattern hint (CRUD_ACCESS_ADVICE)
+} CrudReadAhead;
+
+// This is a CRUD file system, the state of one device
+struct crud_fs {
+    CrudEndpoint *ep;                                        // The server of the device
+    CrudCache *cache;                                        // The object cache of the device
+    CrudSlab *slab;                                          // The allocator of object sized buffers
+    pthread_mutex_t lock;                                    // Held while changing the index or open files
+    int initialized;                                         // Set once CRUD_INIT request is called
+
+    // This the definition of the file table
+    CrudFileAllocationType table[CRUD_MAX_TOTAL_FILES];      // The file handle table
+    CrudFileExtents extents[CRUD_MAX_TOTAL_FILES];           // The extent maps of open files
+    CrudWriteBuffer write_buffers[CRUD_MAX_TOTAL_FILES];     // Write buffers of open files
+    CrudReadAhead read_ahead[CRUD_MAX_TOTAL_FILES];          // Read-ahead state of open files
+    pthread_mutex_t file_locks[CRUD_MAX_TOTAL_FILES];        // Held while a file is in use
+    uint32_t write_buffer_size;                              // Largest write that is buffered
+    uint64_t buffered_writes;                                // Writes gathered in write buffers
+    uint64_t buffer_flushes;                                 // Write buffers written to files
+    uint32_t read_ahead_size;                                // Most bytes read ahead of sequential reads
+    uint64_t read_ahead_runs;                                // Read-aheads sent
+    uint64_t read_ahead_chunks;                              // Chunks they read into the cache
+    uint64_t bytes_written;                                  // Bytes callers wrote to files
+    uint64_t bytes_read;                                     // Bytes callers read from files
+
+    // In-memory index of the file table pages read so far, reset on format
+    //  and mount
+    int16_t hash[CRUD_FILE_HASH_BUCKETS];                    // First slot of each filename bucket
+    int16_t hnext[CRUD_MAX_TOTAL_FILES];                     // Next slot in the same bucket
+    uint8_t table_loaded[CRUD_FILE_TABLE_PAGES];             // Pages read (or formatted)
+    uint8_t table_free[CRUD_FILE_TABLE_PAGES];               // Unused slots of each page read
+
+    // The superblock and the file table pages changed since mount
+    CrudSuperblock superblock;
+    uint8_t table_dirty[CRUD_FILE_TABLE_PAGES];
+
+    // The content index of the full chunks (used to find shared chunks even
+    //  if dedup is off, a chunk shared by a file stays shared until written)
+    CrudDedup *dedup;                                        // The chunks indexed
+    pthread_mutex_t dedup_lock;                              // Held while using the index
+    char *dedup_buf;                                         // A stored chunk compared with a new one
+    uint8_t dedup_enabled;                                   // Flag indicating new chunks are indexed
+    uint8_t dedup_dirty;                                     // Flag indicating the index changed since mount
+    uint64_t dedup_chunks;                                   // Chunks found already stored
+    uint64_t dedup_bytes;                                    // Bytes of the chunks found already stored
+
+    // The metadata journal (crud_set_journal).  Entries are journaled as
+    //  their files are closed, the closes waiting for the batch they are in
+    //  to be stored; one of them stores it while later ones gather the next.
+    //  Objects a change made unused are only deleted once it is stored.
+    pthread_mutex_t journal_lock;                            // Held while using the batches and copies
+    pthread_cond_t journal_cond;                             // Signalled as each batch is stored
+    CrudJournal *journal;                                    // The batch being gathered
+    CrudJournal *journal_spare;                              // The batch to gather next
+    CrudFileAllocationType committed[CRUD_MAX_TOTAL_FILES];  // The entries as journaled
+    uint64_t journal_batch[CRUD_MAX_TOTAL_FILES];            // The batch with the last change of each
+    uint8_t journal_dirty[CRUD_FILE_TABLE_PAGES];            // Pages journaled since the last checkpoint
+    uint64_t journal_next;                                   // The number of the batch being gathered
+    uint64_t journal_done;                                   // The number of the last batch stored
+    uint32_t journal_tail;                                   // The end of the batches in the journal
+    uint8_t journal_enabled;                                 // Flag indicating changes are journaled
+    uint8_t journal_busy;                                    // Flag indicating a batch is being stored
+    uint8_t journal_error;                                   // Flag indicating a batch was lost
+    uint64_t journal_records;                                // Changes journaled
+    uint64_t journal_batches;                                // Batches stored
+};
+
+// File system Static Data
+uint32_t crud_chunk_size = CRUD_DEFAULT_CHUNK_SIZE;           // Chunk size for new files
+uint32_t crud_write_buffer_size = CRUD_WRITE_BUFFER_SIZE;     // Write buffer size for mounts
+uint32_t crud_read_ahead_size = CRUD_READ_AHEAD_SIZE;         // Read-ahead size for mounts
+int crud_dedup_enabled = 0;                                   // Content dedup for mounts
+int crud_journal_enabled = 0;                                 // Metadata journal for mounts
+crud_fs_t *crud_default_fs = NULL;                            // The device of the crud_* calls
+pthread_once_t crud_default_once = PTHREAD_ONCE_INIT;
+
+// Module local functions
+static void crud_make_default_fs(void);
+static int crud_fs_init(crud_fs_t *fs);
+static int crud_file_lock(crud_fs_t *fs, int16_t fd);
+static uint32_t crud_file_chunks(crud_fs_t *fs, int16_t fd);
+static uint32_t crud_chunk_length(crud_fs_t *fs, int16_t fd, uint32_t chunk);
+static int crud_reserve_extents(crud_fs_t *fs, int16_t fd, uint32_t count);
+static int crud_load_extents(crud_fs_t *fs, int16_t fd);
+static int crud_save_extents(crud_fs_t *fs, int16_t fd);
+static void crud_free_extents(crud_fs_t *fs);
+static void crud_index_files(crud_fs_t *fs, int loaded);
+static void crud_index_page(crud_fs_t *fs, int page);
+static int crud_load_page(crud_fs_t *fs, int page);
+static int16_t crud_find_file(crud_fs_t *fs, char *path, int *page);
+static int16_t crud_alloc_file(crud_fs_t *fs, char *path, int page);
+static void crud_touch_file(crud_fs_t *fs, int16_t fd);
+static int crud_write_chunk(crud_fs_t *fs, int16_t fd, uint32_t chunk, uint32_t offset,
+        uint32_t count, char *buf);
+static char *crud_scratch_buffer(crud_fs_t *fs, int16_t fd, uint32_t size);
+static int crud_write_through(crud_fs_t *fs, int16_t fd, char *buf, uint32_t count);
+static int crud_flush_write_buffer(crud_fs_t *fs, int16_t fd);
+static void crud_free_write_buffers(crud_fs_t *fs);
+static void crud_read_ahead(crud_fs_t *fs, int16_t fd, uint32_t chunk);
+static int crudDedupUnitTest(void);
+static int crudDedupUnitCheck(int16_t fh, char *expected, char *tbuf);
+static int crudReadAheadUnitTest(void);
+static int crudReadAheadUnitCheck(int16_t fh, char *expected, char *tbuf);
+static int crud_dedup_write(crud_fs_t *fs, int16_t fd, uint32_t chunk, uint32_t offset,
+        uint32_t count, char *buf, uint32_t length);
+static CrudOID crud_dedup_store(crud_fs_t *fs, uint32_t length, char *buf);
+static CrudOID crud_dedup_match(crud_fs_t *fs, uint64_t hash, uint32_t length, char *buf);
+static int crud_dedup_sealed(crud_fs_t *fs, int16_t fd, uint32_t offset, uint32_t count,
+        uint32_t length);
+static int crud_load_dedup(crud_fs_t *fs);
+static int crud_save_dedup(crud_fs_t *fs);
+static int crud_grow_in_place(crud_fs_t *fs, int16_t fd, CrudOID oid);
+static CrudOID crud_replace_object(crud_fs_t *fs, int16_t fd, CrudOID oid, uint32_t length, char *buf);
+static int crud_drop_object(crud_fs_t *fs, int16_t fd, CrudOID oid);
+static void crud_release_objects(crud_fs_t *fs, const CrudOID *oids, uint32_t count);
+static void crud_journal_start(crud_fs_t *fs);
+static int crud_journal_note(crud_fs_t *fs, int16_t fd);
+static int crud_journal_file(crud_fs_t *fs, int16_t fd);
+static int crud_journal_commit(crud_fs_t *fs, uint64_t batch);
+static int crud_journal_write(crud_fs_t *fs, CrudJournal *jn);
+static int crud_journal_checkpoint(crud_fs_t *fs);
+static int crud_journal_replay(crud_fs_t *fs);
+static int crudJournalUnitTest(void);
+static int crudJournalUnitCrash(crud_fs_t **fs, crud_fs_t **replayed, char *buf, char *tbuf);
 
 //
 // Implementation
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : convert_to_CrudRequest
-// Description  : This function converts five separate fields needed for a 
-//                CrudRequest and combines them into a single 64-bit CrudRequest
-//                value
+// Function     : crud_fs_new
+// Description  : Make a new file system context for the device on a server
+//                (format or mount it before use)
 //
-// Inputs       : oID - 32-bit object identifier of the object being executed on
-//                req - 4-bit request type of the command being executed 
-//                length - 24-bit length object or buffer
-//                flags - 3-bits, unused for now
-//                res - 1-bit result code, 0 signifies success of command execution,
-//                    1 failure
-// Outputs      : 64-bit CrudRequest value 
-
-CrudRequest convert_to_CrudRequest(uint32_t oID, uint8_t req, uint32_t length, 
-        uint8_t flags, uint8_t res){
+// Inputs       : address - the IP address of the server (NULL for default)
+//                port - the port of the server (0 for default)
+// Outputs      : the context, or NULL if failure
 
-    // Initialize
-    CrudRequest convertedValue = 0;
-    uint32_t bitWork = 0;
+crud_fs_t *crud_fs_new(const char *address, uint16_t port) {
+    // Declare variables
+    crud_fs_t *fs;
+    int i;
 
-    // Wipe extra bits of each parameter
-    bitWork = (~bitWork) >> 8; // gives 1 in 24 least significant bits 
-    length = length & bitWork; // only take 24 least signficant bits of length
-    req = req & 15;            // only takes 4 least signficant bits of req
-    flags = flags & 7;         // only takes 3 least signficant bits of flags
-    res = res & 1;                 // only takes least significant bit of r
+    if ((fs = calloc(1, sizeof(crud_fs_t))) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed allocating file system.");
+        return NULL;
+    }
 
-    // Shift parameters into proper positions in convertedValue
-    convertedValue = (CrudRequest) oID << 32;
-    convertedValue = convertedValue | ((CrudRequest) req << 28);
-    convertedValue = convertedValue | ((CrudRequest) length << 4);
-    convertedValue = convertedValue | ((CrudRequest) flags << 1);
-    convertedValue = convertedValue | (CrudRequest) res;
+    // Find the server and set up the cache of its objects
+    if ((fs->slab = crud_slab_new()) == NULL)
+    {
+        free(fs);
+        return NULL;
+    }
+    if ((fs->ep = crud_client_endpoint(address, port)) == NULL ||
+            (fs->cache = crud_cache_new(fs->ep, fs->slab)) == NULL)
+    {
+        crud_slab_free(fs->slab);
+        free(fs);
+        return NULL;
+    }
+    if ((fs->dedup = crud_dedup_new()) == NULL)
+    {
+        crud_cache_free(fs->cache);
+        crud_slab_free(fs->slab);
+        free(fs);
+        return NULL;
+    }
+    if ((fs->journal = crud_journal_new()) == NULL || (fs->journal_spare = crud_journal_new()) == NULL)
+    {
+        crud_journal_free(fs->journal);
+        crud_dedup_free(fs->dedup);
+        crud_cache_free(fs->cache);
+        crud_slab_free(fs->slab);
+        free(fs);
+        return NULL;
+    }
 
-    return convertedValue;
+    pthread_mutex_init(&fs->lock, NULL);
+    pthread_mutex_init(&fs->dedup_lock, NULL);
+    pthread_mutex_init(&fs->journal_lock, NULL);
+    pthread_cond_init(&fs->journal_cond, NULL);
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+        pthread_mutex_init(&fs->file_locks[i], NULL);
+    fs->write_buffer_size = crud_write_buffer_size;
+    fs->read_ahead_size = crud_read_ahead_size;
+    crud_index_files(fs, 1);
+    return fs;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : parse_CrudResponse
-// Description  : This function parses 64-bit CrudResponse value for five   
-//                different fields
+// Function     : crud_fs_free
+// Description  : Release a file system context (unmount it first, anything
+//                not yet stored is lost)
 //
-// Inputs       : parseThis - 64-bit CrudResponse value to be parsed 
-// Outputs      : CRParsed structure containing five fields 
+// Inputs       : fs - the file system
+// Outputs      : none
 
-CRParsed parse_CrudResponse(CrudResponse parseThis) {
-    // Initialize
-    CRParsed parsedValues;
-    uint32_t lengthBits = 0;
-    lengthBits = (~lengthBits) >> 8; // Obtain 1 in 24 least significant bits 
+void crud_fs_free(crud_fs_t *fs) {
+    int i;
+
+    if (fs == NULL)
+        return;
+
+    crud_free_extents(fs);
+    crud_free_write_buffers(fs);
+    crud_cache_free(fs->cache);
+    crud_dedup_free(fs->dedup);
+    crud_journal_free(fs->journal);
+    crud_journal_free(fs->journal_spare);
+    crud_slab_release(fs->slab, fs->dedup_buf);
+    crud_slab_free(fs->slab);
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+        pthread_mutex_destroy(&fs->file_locks[i]);
+    pthread_cond_destroy(&fs->journal_cond);
+    pthread_mutex_destroy(&fs->journal_lock);
+    pthread_mutex_destroy(&fs->dedup_lock);
+    pthread_mutex_destroy(&fs->lock);
+    free(fs);
+}
 
-    // Parse parseThis for each of five fields 
-    parsedValues.oID = (uint32_t) (parseThis >> 32); // obtain bits 32-63 
-    parsedValues.req = (uint8_t) ((parseThis >> 28) & 15); // obtain bits 28-31 
-    parsedValues.length = (uint32_t) ((parseThis >> 4) & lengthBits); // obtain bits 4-27 
-    parsedValues.flags = (uint8_t) ((parseThis >> 1) & 7); // obtain bits 1-3 
-    parsedValues.res = (uint8_t) (parseThis & 1); // obtain bit 0 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_default
+// Description  : Get the file system used by the crud_* calls (the device on
+//                the configured server), making it on first use
+//
+// Inputs       : none
+// Outputs      : the context, or NULL if failure
 
-    return parsedValues;
+crud_fs_t *crud_fs_default(void) {
+    pthread_once(&crud_default_once, crud_make_default_fs);
+    return crud_default_fs;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_format
+// Function     : crud_fs_format
 // Description  : This function formats the crud drive, and adds the file
 //                allocation table.
 //
-// Inputs       : none
+// Inputs       : fs - the file system
 // Outputs      : 0 if successful, -1 if failure
 
-uint16_t crud_format(void) {
+uint16_t crud_fs_format(crud_fs_t *fs) {
     // Declare variables
-    int i;
+    CrudCompoundOp ops[CRUD_FILE_TABLE_PAGES + 2];
+    char *zeros = NULL;
+    int i, compound, journal, nops = CRUD_FILE_TABLE_PAGES + 1;
 
     // Initialize
-    if (InitFlag == 0)
+    if (crud_fs_init(fs) != 0)
+        return -1;
+    pthread_mutex_lock(&fs->lock);
+
+    // Format (a server with compound requests gets it with the page creates)
+    CrudRequest format = construct_crud_request(0, CRUD_FORMAT, 0, CRUD_NULL_FLAG, 0);
+    compound = (crud_endpoint_capabilities(fs->ep) & CRUD_CAP_COMPOUND) != 0;
+    if (!compound)
     {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
+        CrudResponse formatted = crud_endpoint_operation(fs->ep, format, NULL);
+        // Check if CRUD_FORMAT was successful
+        if (CRUD_HEADER_RESULT(formatted) == 1)
+        {
+            pthread_mutex_unlock(&fs->lock);
             return -1;
-
-        InitFlag = 1;
+        }
     }
 
-    // Format
-    CrudRequest format = convert_to_CrudRequest(0, CRUD_FORMAT, 0, CRUD_NULL_FLAG, 0);
-    CrudResponse formatted = crud_client_operation(format, NULL);
-    CRParsed formatParsed = parse_CrudResponse(formatted);
-    // Check if CRUD_FORMAT was successful
-    if (formatParsed.res == 1)
-        return -1;
+    // Anything cached from before the format is gone
+    crud_cache_invalidate(fs->cache);
+    crud_free_extents(fs);
+    crud_free_write_buffers(fs);
+    fs->write_buffer_size = crud_write_buffer_size;
+    fs->read_ahead_size = crud_read_ahead_size;
+    crud_dedup_reset(fs->dedup);
+    fs->dedup_enabled = (uint8_t) crud_dedup_enabled;
+    fs->dedup_dirty = 0;
 
     // Initialize file allocation table with zeros (signifying slots are unused)
     for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
     {
-        strcpy(crud_file_table[i].filename, "");
-        crud_file_table[i].object_id = 0;
-        crud_file_table[i].position = 0;
-        crud_file_table[i].length = 0;
-        crud_file_table[i].open = 0;
+        strcpy(fs->table[i].filename, "");
+        fs->table[i].object_id = 0;
+        fs->table[i].position = 0;
+        fs->table[i].length = 0;
+        fs->table[i].chunk_size = 0;
+        fs->table[i].open = 0;
     }
-
-    // Create priority object storing file allocation table
-    CrudRequest create = convert_to_CrudRequest(0, CRUD_CREATE, 
-            CRUD_MAX_TOTAL_FILES*sizeof(CrudFileAllocationType), CRUD_PRIORITY_OBJECT, 0);
-    CrudResponse created = crud_client_operation(create, crud_file_table);
-    CRParsed createParsed = parse_CrudResponse(created);
+    crud_index_files(fs, 1);
+
+    // Create the objects storing the (empty) file allocation table pages,
+    //  and the (empty) journal if the server can append to it by range
+    fs->superblock.magic = CRUD_SUPERBLOCK_MAGIC;
+    fs->superblock.version = CRUD_SUPERBLOCK_VERSION;
+    fs->superblock.page_entries = CRUD_FILE_TABLE_PAGE_ENTRIES;
+    fs->superblock.pages = CRUD_FILE_TABLE_PAGES;
+    fs->superblock.dedup_oid = 0;
+    fs->superblock.dedup_chunks = 0;
+    fs->superblock.journal_oid = 0;
+    fs->superblock.journal_epoch = 1;
+    journal = (crud_endpoint_capabilities(fs->ep) & CRUD_CAP_RANGE) != 0;
+    if (journal)
+    {
+        if ((zeros = crud_slab_alloc(fs->slab, CRUD_JOURNAL_BYTES)) == NULL)
+        {
+            pthread_mutex_unlock(&fs->lock);
+            return -1;
+        }
+        memset(zeros, 0, CRUD_JOURNAL_BYTES);
+        ops[nops].op = construct_crud_request(0, CRUD_CREATE, CRUD_JOURNAL_BYTES, CRUD_NULL_FLAG, 0);
+        ops[nops].ext = 0;
+        ops[nops++].buf = zeros;
+    }
+    ops[0].op = format;
+    ops[0].ext = 0;
+    ops[0].buf = NULL;
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+    {
+        ops[i+1].op = construct_crud_request(0, CRUD_CREATE,
+                CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType), CRUD_NULL_FLAG, 0);
+        ops[i+1].ext = 0;
+        ops[i+1].buf = &fs->table[i*CRUD_FILE_TABLE_PAGE_ENTRIES];
+    }
+    if (compound && crud_endpoint_compound(fs->ep, ops, nops) != 0)
+    {
+        crud_slab_release(fs->slab, zeros);
+        pthread_mutex_unlock(&fs->lock);
+        return -1;
+    }
+    for (i = 1; i < nops; i++)
+    {
+        if (!compound)
+            ops[i].response = crud_endpoint_operation(fs->ep, ops[i].op, ops[i].buf);
+        // Check if CRUD_CREATE was successful
+        if (CRUD_HEADER_RESULT(ops[i].response) == 1)
+        {
+            crud_slab_release(fs->slab, zeros);
+            pthread_mutex_unlock(&fs->lock);
+            return -1;
+        }
+        if (i <= CRUD_FILE_TABLE_PAGES)
+        {
+            fs->superblock.page_oid[i-1] = CRUD_HEADER_OID(ops[i].response);
+            fs->table_dirty[i-1] = 0;
+        }
+        else
+            fs->superblock.journal_oid = CRUD_HEADER_OID(ops[i].response);
+    }
+    crud_slab_release(fs->slab, zeros);
+    crud_journal_start(fs);
+
+    // Create priority object storing the superblock (it holds the page OIDs,
+    //  so it cannot go out with the page creates)
+    CrudRequest create = construct_crud_request(0, CRUD_CREATE, 
+            sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0);
+    CrudResponse created = crud_endpoint_operation(fs->ep, create, &fs->superblock);
+    pthread_mutex_unlock(&fs->lock);
     // Check if CRUD_CREATE was successful
-    if (createParsed.res == 1)
+    if (CRUD_HEADER_RESULT(created) == 1)
         return -1;
 
-	// Log, return successfully
-	logMessage(LOG_INFO_LEVEL, "... formatting complete.");
-	return(0);
+    // Log, return successfully
+    logMessage(LOG_INFO_LEVEL, "... formatting complete.");
+    return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_mount
+// Function     : crud_fs_mount
 // Description  : This function mount the current crud file system and loads
-//                the file allocation table.
+//                the superblock (the file allocation table pages are loaded
+//                on demand, see crud_find_file).
 //
-// Inputs       : none
+// Inputs       : fs - the file system
 // Outputs      : 0 if successful, -1 if failure
 
-uint16_t crud_mount(void) {
+uint16_t crud_fs_mount(crud_fs_t *fs) {
     // Initialize
-    if (InitFlag == 0)
+    if (crud_fs_init(fs) != 0)
+        return -1;
+    pthread_mutex_lock(&fs->lock);
+
+    // Read priority object, load the superblock
+    crud_free_extents(fs);
+    crud_free_write_buffers(fs);
+    fs->write_buffer_size = crud_write_buffer_size;
+    fs->read_ahead_size = crud_read_ahead_size;
+    CrudRequest read = construct_crud_request(0, CRUD_READ, 
+            sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0);
+    CrudResponse readResponse = crud_endpoint_operation(fs->ep, read, &fs->superblock);
+    // Check if CRUD_READ was successful
+    if (CRUD_HEADER_RESULT(readResponse) == 1)
     {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
-            return -1;
+        pthread_mutex_unlock(&fs->lock);
+        return -1;
+    }
+    if (CRUD_HEADER_LENGTH(readResponse) != sizeof(CrudSuperblock) ||
+            fs->superblock.magic != CRUD_SUPERBLOCK_MAGIC ||
+            fs->superblock.version != CRUD_SUPERBLOCK_VERSION ||
+            fs->superblock.page_entries != CRUD_FILE_TABLE_PAGE_ENTRIES ||
+            fs->superblock.pages != CRUD_FILE_TABLE_PAGES)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : bad superblock, reformat needed.");
+        pthread_mutex_unlock(&fs->lock);
+        return -1;
+    }
 
-        InitFlag = 1;
+    // Load the content index of the shared chunks
+    fs->dedup_enabled = (uint8_t) crud_dedup_enabled;
+    if (crud_load_dedup(fs) != 0)
+    {
+        pthread_mutex_unlock(&fs->lock);
+        return -1;
     }
 
-    // Read priority object, load file allocation table 
-    CrudRequest read = convert_to_CrudRequest(0, CRUD_READ, 
-            CRUD_MAX_TOTAL_FILES*sizeof(CrudFileAllocationType), CRUD_PRIORITY_OBJECT, 0);
-    CrudResponse readResponse = crud_client_operation(read, crud_file_table);
-    CRParsed parsedReadResponse = parse_CrudResponse(readResponse);
-    // Check if CRUD_READ was successful
-    if (parsedReadResponse.res == 1)
+    // The file allocation table pages are read as lookups need them (but
+    //  the ones changed in the journal are read now, to replay it)
+    memset(fs->table, 0, sizeof(fs->table));
+    memset(fs->table_dirty, 0, sizeof(fs->table_dirty));
+    crud_index_files(fs, 0);
+    crud_journal_start(fs);
+    if (crud_journal_replay(fs) != 0)
+    {
+        pthread_mutex_unlock(&fs->lock);
         return -1;
+    }
+    pthread_mutex_unlock(&fs->lock);
 
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... mount complete.");
@@ -221,35 +526,151 @@ uint16_t crud_mount(void) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_unmount
+// Function     : crud_fs_unmount
 // Description  : This function unmounts the current crud file system and
 //                saves the file allocation table.
 //
-// Inputs       : none
+// Inputs       : fs - the file system
 // Outputs      : 0 if successful, -1 if failure
 
-uint16_t crud_unmount(void) {
+uint16_t crud_fs_unmount(crud_fs_t *fs) {
+    // Declare variables
+    CrudCompoundOp ops[CRUD_FILE_TABLE_PAGES + 2];
+    const CrudOID *drops;
+    uint32_t ndrops, j;
+    int i, failed = 0, compound, epoch, nops = 0, polled;
+
     // Check that CRUD_INIT has already been called
-    if (InitFlag == 0)
+    if (fs == NULL || fs->initialized == 0)
+        return -1;
+    pthread_mutex_lock(&fs->lock);
+
+    // Store the buffered writes and extent maps of any files still open
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES && !failed; i++)
+    {
+        if (crud_flush_write_buffer(fs, i) != 0)
+            failed = 1;
+        else if (fs->extents[i].dirty && crud_save_extents(fs, i) != 0)
+            failed = 1;
+
+        // The objects the file dropped are deleted once the table is stored
+        for (j = 0; j < fs->extents[i].nstale && !failed; j++)
+        {
+            if (crud_journal_drop(fs->journal, fs->extents[i].stale[j]) != 0)
+                failed = 1;
+        }
+        fs->extents[i].nstale = 0;
+    }
+    if (!failed)
+    {
+        crud_free_extents(fs);
+        crud_free_write_buffers(fs);
+    }
+
+    // Store the content index if it changed
+    if (!failed && crud_save_dedup(fs) != 0)
+        failed = 1;
+
+    // Write back the cached objects and report the cache statistics
+    if (failed || crud_cache_close(fs->cache) != 0)
+    {
+        pthread_mutex_unlock(&fs->lock);
         return -1;
+    }
+
+    // Update the objects of the file allocation table pages that changed
+    //  (the superblock only changes with the content index, or to empty the
+    //  journal once the pages hold what it does), with all of the updates
+    //  in flight at once (there are no more pages than pipeline slots), or
+    //  in one compound request together with the CRUD_CLOSE (unless objects
+    //  are left to delete after them)
+    compound = (crud_endpoint_capabilities(fs->ep) & CRUD_CAP_COMPOUND) != 0;
+    epoch = (fs->journal_tail > 0);
+    drops = crud_journal_drops(fs->journal, &ndrops);
+    if (epoch)
+        fs->superblock.journal_epoch++;
+    CrudRequest close = construct_crud_request(0, CRUD_CLOSE, 0, CRUD_NULL_FLAG, 0);
+    CrudRequest superblock = construct_crud_request(0, CRUD_UPDATE,
+            sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0);
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+    {
+        if (fs->table_dirty[i] == 0)
+            continue;
+
+        CrudRequest update = construct_crud_request(fs->superblock.page_oid[i], CRUD_UPDATE,
+                CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType), CRUD_NULL_FLAG, 0);
+        if (compound)
+        {
+            ops[nops].op = update;
+            ops[nops].ext = 0;
+            ops[nops++].buf = &fs->table[i*CRUD_FILE_TABLE_PAGE_ENTRIES];
+        }
+        else if (crud_endpoint_submit(fs->ep, update, 0, &fs->table[i*CRUD_FILE_TABLE_PAGE_ENTRIES], NULL) != 0)
+            failed = 1;
+    }
 
-    // Update priority object with contents of file allocation table
-    CrudRequest update = convert_to_CrudRequest(0, CRUD_UPDATE, 
-            CRUD_MAX_TOTAL_FILES*sizeof(CrudFileAllocationType), CRUD_PRIORITY_OBJECT, 0);
-    CrudResponse updated = crud_client_operation(update, crud_file_table);
-    CRParsed updatedObject = parse_CrudResponse(updated);
-    // Check if CRUD_UPDATE was successful
-    if (updatedObject.res == 1)
+    // Check that each CRUD_UPDATE (and the CRUD_CLOSE) was successful
+    CrudResponse updated;
+    if (compound)
+    {
+        if (epoch)
+        {
+            ops[nops].op = superblock;
+            ops[nops].ext = 0;
+            ops[nops++].buf = &fs->superblock;
+        }
+        if (ndrops == 0)
+        {
+            ops[nops].op = close;
+            ops[nops].ext = 0;
+            ops[nops++].buf = NULL;
+        }
+        if (nops > 0 && crud_endpoint_compound(fs->ep, ops, nops) != 0)
+            failed = 1;
+    }
+    while ((polled = crud_client_poll(&updated, NULL)) > 0)
+    {
+        if (CRUD_HEADER_RESULT(updated) == 1)
+            failed = 1;
+    }
+    if (polled < 0)
+        failed = 1;
+    if (!failed && !compound && epoch &&
+            CRUD_HEADER_RESULT(crud_endpoint_operation(fs->ep, superblock, &fs->superblock)) == 1)
+        failed = 1;
+    if (!failed)
+    {
+        // The journal is empty now, and nothing names the dropped objects
+        memset(fs->table_dirty, 0, sizeof(fs->table_dirty));
+        fs->journal_tail = 0;
+        crud_release_objects(fs, drops, ndrops);
+        crud_journal_reset(fs->journal);
+    }
+    pthread_mutex_unlock(&fs->lock);
+    if (failed)
         return -1;
     
     // Issue CRUD_CLOSE request to write to state file and
     //  shut down virtual hardware
-    CrudRequest close = convert_to_CrudRequest(0, CRUD_CLOSE, 0, CRUD_NULL_FLAG, 0);
-    CrudResponse closed = crud_client_operation(close, NULL);
-    CRParsed parsedCloseResponse = parse_CrudResponse(closed);
-    // Check if CRUD_CLOSE was successful
-    if (parsedCloseResponse.res == 1)
-        return -1;
+    if (!compound || ndrops > 0)
+    {
+        CrudResponse closed = crud_endpoint_operation(fs->ep, close, NULL);
+        // Check if CRUD_CLOSE was successful
+        if (CRUD_HEADER_RESULT(closed) == 1)
+            return -1;
+    }
+
+    // Report the traffic so far, and how much of it each byte written cost
+    CrudWireStats wire[CRUD_MAXVAL];
+    uint64_t moved = 0, written = __atomic_load_n(&fs->bytes_written, __ATOMIC_RELAXED);
+    crud_client_wire_report();
+    crud_client_wire_stats(wire);
+    for (i = 0; i < CRUD_MAXVAL; i++)
+        moved += wire[i].bytes_sent + wire[i].bytes_received;
+    logMessage(LOG_OUTPUT_LEVEL, "CRUD IO : %lu bytes written and %lu bytes read by callers, "
+            "%.2f bytes on the wire per byte written.", written,
+            __atomic_load_n(&fs->bytes_read, __ATOMIC_RELAXED),
+            (written == 0) ? 0.0 : (double) moved / written);
 
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... unmount complete.");
@@ -258,354 +679,2237 @@ uint16_t crud_unmount(void) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_open
+// Function     : crud_fs_open
 // Description  : This function opens the file and returns a file handle
 //
-// Inputs       : path - the path "in the storage array"
+// Inputs       : fs - the file system
+//                path - the path "in the storage array"
 // Outputs      : file handle if successful, -1 if failure
 
-int16_t crud_open(char *path) {
+int16_t crud_fs_open(crud_fs_t *fs, char *path) {
     // Initialize variables
-    int fh = 0;
+    int16_t fh;
+    int load, loaded = 0, page;
 
     // Check if CRUD_INIT request has been called
-    if (InitFlag == 0)
-    {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
-            return -1;
-
-        InitFlag = 1;
-    }
+    if (crud_fs_init(fs) != 0)
+        return -1;
 
-    // Validate parameters
-    if (strlen(path) > CRUD_MAX_PATH_LENGTH || strlen(path) <= 0)
+    // Validate parameters (the name and its terminator must fit the table)
+    if (strlen(path) >= CRUD_MAX_PATH_LENGTH || strlen(path) <= 0)
         return -1;
 
-    // Search for filename in table
-    while (fh < CRUD_MAX_TOTAL_FILES && strcmp(crud_file_table[fh].filename, path) != 0)
+    // Look up filename in the table index (reading its page if need be)
+    pthread_mutex_lock(&fs->lock);
+    fh = crud_find_file(fs, path, &page);
+    if (fh == -2)
     {
-        fh++;
+        pthread_mutex_unlock(&fs->lock);
+        return -1;
     }
 
     // Check if file does not exist 
-    if (fh == CRUD_MAX_TOTAL_FILES)
+    if (fh == -1)
     {
-        // Assign file new slot in crud_file_table
-
-        fh = 0;
-        // Search through file table until an empty slot is found
-        while (strcmp(crud_file_table[fh].filename, "") != 0)
-            fh++;
-
-        // Check to make sure table is not full
-        if (fh == CRUD_MAX_TOTAL_FILES)
+        // Assign file new slot in file table (fails if table is full)
+        fh = crud_alloc_file(fs, path, page);
+        if (fh == -1)
+        {
+            pthread_mutex_unlock(&fs->lock);
             return -1;
-        // Copy path into table filename 
-        strcpy(crud_file_table[fh].filename, path);
-        
+        }
+
         // Set initial contents to empty
-        crud_file_table[fh].object_id = 0;
-        crud_file_table[fh].position = 0;
-        crud_file_table[fh].length = 0;
-        crud_file_table[fh].open = 1;
+        fs->table[fh].object_id = 0;
+        fs->table[fh].position = 0;
+        fs->table[fh].length = 0;
+        fs->table[fh].chunk_size = crud_chunk_size;
+        fs->table[fh].open = 1;
+        fs->extents[fh].stored = 0;
+        fs->extents[fh].dirty = 0;
+        fs->extents[fh].tail = CRUD_NO_OBJECT;
+        load = 0;
+
+        // The new name is journaled with the next batch (not waited for
+        //  here), so no file placed after it in the table is stored first
+        if (fs->journal_enabled)
+        {
+            pthread_mutex_lock(&fs->journal_lock);
+            crud_journal_note(fs, fh);
+            pthread_mutex_unlock(&fs->journal_lock);
+        }
     }
     // else file does already exist
     else
     {
         // Check to make sure file is not already open
-        if (crud_file_table[fh].open == 1)
+        if (fs->table[fh].open == 1)
+        {
+            pthread_mutex_unlock(&fs->lock);
             return -1;
+        }
 
-        // Open file
+        // Open file (claimed here, the chunks are loaded outside the lock)
         // Set position = 0, open = 1
-        crud_file_table[fh].position = 0;
-        crud_file_table[fh].open = 1;
+        fs->table[fh].position = 0;
+        fs->table[fh].open = 1;
+        load = 1;
+    }
+    memset(&fs->read_ahead[fh], 0, sizeof(CrudReadAhead));
+    pthread_mutex_unlock(&fs->lock);
+
+    // Load the chunks of the file
+    if (load)
+    {
+        pthread_mutex_lock(&fs->file_locks[fh]);
+        loaded = crud_load_extents(fs, fh);
+        if (loaded != 0)
+        {
+            pthread_mutex_lock(&fs->lock);
+            fs->table[fh].open = 0;
+            pthread_mutex_unlock(&fs->lock);
+        }
+        pthread_mutex_unlock(&fs->file_locks[fh]);
+    }
+    if (loaded != 0)
+        return -1;
+
+    return fh; 
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_close
+// Description  : This function closes the file
+//
+// Inputs       : fs - the file system
+//                fh - the file handle of the object to close
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t crud_fs_close(crud_fs_t *fs, int16_t fh) {
+    // Declare variables
+    int16_t result = 0;
+
+    // Validate parameters, get the file
+    if (crud_fs_init(fs) != 0 || crud_file_lock(fs, fh) != 0)
+        return -1;
+
+    // Write out any buffered bytes and the extent map if it changed (and
+    //  journal the entry), then close file
+    if (crud_flush_write_buffer(fs, fh) != 0)
+        result = -1;
+    else if (fs->extents[fh].dirty && crud_save_extents(fs, fh) != 0)
+        result = -1;
+    else if (fs->journal_enabled && crud_journal_file(fs, fh) != 0)
+        result = -1;
+    else
+    {
+        pthread_mutex_lock(&fs->lock);
+        fs->table[fh].open = 0;
+        pthread_mutex_unlock(&fs->lock);
+    }
+
+    pthread_mutex_unlock(&fs->file_locks[fh]);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_read
+// Description  : Reads up to "count" bytes from the file handle "fh" into the
+//                buffer  "buf".
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_fs_read(crud_fs_t *fs, int16_t fd, void *buf, int32_t count) {
+    // Validate parameters, get the file
+	if (count < 0)
+		return -1;
+    if (crud_fs_init(fs) != 0 || crud_file_lock(fs, fd) != 0)
+        return -1;
+    CrudFileAllocationType *file = &fs->table[fd];
+
+    // Nothing to read at end of file (or before the object exists)
+    if (file->position >= file->length)
+    {
+        pthread_mutex_unlock(&fs->file_locks[fd]);
+        return 0;
+    }
+
+	// If the number of bytes to be read is greater than bytes left in file,
+	//  then just read as many as are available, otherwise read count bytes
+	if (count > file->length - file->position)
+		count = file->length - file->position;
+
+    // Write out buffered bytes the read would see
+    CrudWriteBuffer *wb = &fs->write_buffers[fd];
+    if (wb->count > 0 && file->position < wb->start + wb->count &&
+            file->position + count > wb->start)
+    {
+        if (crud_flush_write_buffer(fs, fd) != 0)
+        {
+            pthread_mutex_unlock(&fs->file_locks[fd]);
+            return -1;
+        }
+    }
+
+    // A read carrying on where the last one stopped is sequential (any
+    //  other starts the read-ahead window over, unless told otherwise)
+    CrudReadAhead *ra = &fs->read_ahead[fd];
+    if (file->position != ra->next)
+    {
+        ra->fetched = 0;
+        if (ra->advice != CRUD_ADVICE_SEQUENTIAL)
+            ra->window = 0;
+    }
+    int sequential = (ra->advice == CRUD_ADVICE_SEQUENTIAL) ||
+            (ra->advice == CRUD_ADVICE_NORMAL && file->position == ra->next);
+
+    // Read the bytes at position one chunk at a time (through the cache,
+    //  by range if possible), reading ahead as sequential reads reach
+    //  chunks not yet read ahead
+    int32_t bytesRead = 0;
+    while (bytesRead < count)
+    {
+        uint32_t chunk = file->position / file->chunk_size;
+        uint32_t offset = file->position % file->chunk_size;
+        uint32_t bytes = file->chunk_size - offset;
+        if (bytes > count - bytesRead)
+            bytes = count - bytesRead;
+        if (sequential && chunk >= ra->fetched)
+            crud_read_ahead(fs, fd, chunk);
+
+        if (crud_cache_read(fs->cache, fs->extents[fd].chunks[chunk], crud_chunk_length(fs, fd, chunk),
+                    offset, bytes, &((char *)buf)[bytesRead]) != bytes)
+        {
+            bytesRead = -1;
+            break;
+        }
+
+        // Update position
+        file->position += bytes;
+        bytesRead += bytes;
+    }
+
+    // Return number of bytes read
+    if (bytesRead > 0)
+        __atomic_add_fetch(&fs->bytes_read, bytesRead, __ATOMIC_RELAXED);
+    ra->next = file->position;
+    pthread_mutex_unlock(&fs->file_locks[fd]);
+    return bytesRead;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Description  : Writes "count" bytes to the file handle "fh" from the
+//                buffer  "buf"
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor for the file to write to
+//                buf - the buffer to write
+//                count - the number of bytes to write
+// Outputs      : the number of bytes written or -1 if failure
+
+int32_t crud_fs_write(crud_fs_t *fs, int16_t fd, void *buf, int32_t count) {
+    // Validate parameters - good fh, buf != NULL, good length
+    if (buf == NULL)
+        return -1;
+    if (count < 0)
+        return -1;
+    if (crud_fs_init(fs) != 0 || crud_file_lock(fs, fd) != 0)
+        return -1;
+
+    if (count == 0)
+    {
+        pthread_mutex_unlock(&fs->file_locks[fd]);
+        return 0;
+    }
+
+    // Small writes are gathered in the handle's write buffer
+    CrudFileAllocationType *file = &fs->table[fd];
+    CrudWriteBuffer *wb = &fs->write_buffers[fd];
+    uint32_t position = file->position;
+    if (count <= fs->write_buffer_size)
+    {
+        // Start over if this write does not touch or extend the buffered
+        //  bytes, or if it would make the buffer too big
+        if (wb->count > 0 && (position < wb->start || position > wb->start + wb->count ||
+                    position + count - wb->start > fs->write_buffer_size))
+        {
+            if (crud_flush_write_buffer(fs, fd) != 0)
+            {
+                pthread_mutex_unlock(&fs->file_locks[fd]);
+                return -1;
+            }
+        }
+        if (wb->count == 0)
+        {
+            if (wb->data == NULL && (wb->data = crud_slab_alloc(fs->slab, fs->write_buffer_size)) == NULL)
+            {
+                pthread_mutex_unlock(&fs->file_locks[fd]);
+                return -1;
+            }
+            wb->start = position;
+            wb->stored = file->length;
+        }
+
+        // Copy the bytes in, the file is only updated on flush
+        memcpy(&wb->data[position - wb->start], buf, count);
+        if (position + count - wb->start > wb->count)
+            wb->count = position + count - wb->start;
+        file->position += count;
+        if (file->position > file->length)
+            file->length = file->position;
+        __atomic_add_fetch(&fs->buffered_writes, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&fs->bytes_written, count, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&fs->file_locks[fd]);
+        return count;
+    }
+
+    // Large writes go straight to the file (after anything buffered)
+    if (crud_flush_write_buffer(fs, fd) != 0 || crud_write_through(fs, fd, buf, count) != 0)
+        count = -1;
+    else
+        __atomic_add_fetch(&fs->bytes_written, count, __ATOMIC_RELAXED);
+
+    // return number of bytes written to file
+    pthread_mutex_unlock(&fs->file_locks[fd]);
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_seek
+// Description  : Seek to specific point in the file
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor for the file to seek
+//                loc - offset from beginning of file to seek to
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_fs_seek(crud_fs_t *fs, int16_t fd, uint32_t loc) {
+    // Declare variables
+    int32_t result = 0;
+
+    // Validate parameters, get the file
+    if (crud_fs_init(fs) != 0 || crud_file_lock(fs, fd) != 0)
+        return -1;
+    if (loc > fs->table[fd].length)
+    {
+        pthread_mutex_unlock(&fs->file_locks[fd]);
+        return -1;
+    }
+
+    // Write out the buffered bytes if leaving the buffered window
+    CrudWriteBuffer *wb = &fs->write_buffers[fd];
+    if (wb->count > 0 && (loc < wb->start || loc > wb->start + wb->count))
+    {
+        if (crud_flush_write_buffer(fs, fd) != 0)
+            result = -1;
+    }
+
+    // Set position to loc
+    if (result == 0)
+        fs->table[fd].position = loc;
+
+    pthread_mutex_unlock(&fs->file_locks[fd]);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_advise
+// Description  : Give the access pattern of an open file (like fadvise).
+//                Sequential files are read ahead the whole window from the
+//                first read, random ones never; normal files are read ahead
+//                once reads carry on where the last one stopped, the window
+//                growing while they do.
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                advice - the access pattern
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_fs_advise(crud_fs_t *fs, int16_t fd, CRUD_ACCESS_ADVICE advice) {
+    // Validate parameters, get the file
+    if (advice != CRUD_ADVICE_NORMAL && advice != CRUD_ADVICE_SEQUENTIAL &&
+            advice != CRUD_ADVICE_RANDOM)
+        return -1;
+    if (crud_fs_init(fs) != 0 || crud_file_lock(fs, fd) != 0)
+        return -1;
+
+    // The window starts over under the new pattern
+    fs->read_ahead[fd].advice = (uint8_t) advice;
+    fs->read_ahead[fd].window = 0;
+    fs->read_ahead[fd].fetched = 0;
+    pthread_mutex_unlock(&fs->file_locks[fd]);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_read_ahead_stats
+// Description  : Get the read-ahead statistics of a file system.  Each
+//                read-ahead read its chunks in one round trip, which the
+//                reads of those chunks would otherwise have taken one each.
+//
+// Inputs       : fs - the file system
+//                runs - the place to put the number of read-aheads
+//                chunks - the place to put the number of chunks read in
+// Outputs      : none
+
+void crud_fs_read_ahead_stats(crud_fs_t *fs, uint64_t *runs, uint64_t *chunks) {
+    *runs = (fs != NULL) ? __atomic_load_n(&fs->read_ahead_runs, __ATOMIC_RELAXED) : 0;
+    *chunks = (fs != NULL) ? __atomic_load_n(&fs->read_ahead_chunks, __ATOMIC_RELAXED) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_buffer_stats
+// Description  : Get the buffer allocation statistics of a file system (the
+//                buffers of its files and cache, and how many were reused
+//                rather than allocated)
+//
+// Inputs       : fs - the file system
+//                allocations - the place to put the number of buffers taken
+//                recycled - the place to put the number reused
+// Outputs      : none
+
+void crud_fs_buffer_stats(crud_fs_t *fs, uint64_t *allocations, uint64_t *recycled) {
+    *allocations = *recycled = 0;
+    if (fs != NULL)
+        crud_slab_stats(fs->slab, allocations, recycled);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_write_buffer_stats
+// Description  : Get the write buffering statistics of a file system.  Each
+//                buffered write avoided its own backend update, at the cost
+//                of one update per flush.
+//
+// Inputs       : fs - the file system
+//                writes - the place to put the number of buffered writes
+//                flushes - the place to put the number of buffer flushes
+// Outputs      : none
+
+void crud_fs_write_buffer_stats(crud_fs_t *fs, uint64_t *writes, uint64_t *flushes) {
+    *writes = (fs != NULL) ? __atomic_load_n(&fs->buffered_writes, __ATOMIC_RELAXED) : 0;
+    *flushes = (fs != NULL) ? __atomic_load_n(&fs->buffer_flushes, __ATOMIC_RELAXED) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_dedup_stats
+// Description  : Get the content dedup statistics of a file system: the full
+//                chunks that were found already stored, so that their bytes
+//                were neither sent nor stored again
+//
+// Inputs       : fs - the file system
+//                chunks - the place to put the number of chunks
+//                bytes - the place to put the number of bytes of those chunks
+// Outputs      : none
+
+void crud_fs_dedup_stats(crud_fs_t *fs, uint64_t *chunks, uint64_t *bytes) {
+    *chunks = (fs != NULL) ? __atomic_load_n(&fs->dedup_chunks, __ATOMIC_RELAXED) : 0;
+    *bytes = (fs != NULL) ? __atomic_load_n(&fs->dedup_bytes, __ATOMIC_RELAXED) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_journal_stats
+// Description  : Get the journal statistics of a file system: the file table
+//                changes journaled as files were closed, and the batches
+//                (each one ranged update) they were stored in
+//
+// Inputs       : fs - the file system
+//                records - the place to put the number of changes
+//                batches - the place to put the number of batches
+// Outputs      : none
+
+void crud_fs_journal_stats(crud_fs_t *fs, uint64_t *records, uint64_t *batches) {
+    *records = (fs != NULL) ? __atomic_load_n(&fs->journal_records, __ATOMIC_RELAXED) : 0;
+    *batches = (fs != NULL) ? __atomic_load_n(&fs->journal_batches, __ATOMIC_RELAXED) : 0;
+}
+
+//
+// Default file system interface (the device on the configured server)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_format
+// Description  : This function formats the crud drive, and adds the file
+//                allocation table.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_format(void) {
+    return crud_fs_format(crud_fs_default());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_mount
+// Description  : This function mount the current crud file system and loads
+//                the file allocation table.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_mount(void) {
+    return crud_fs_mount(crud_fs_default());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_unmount
+// Description  : This function unmounts the current crud file system and
+//                saves the file allocation table.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_unmount(void) {
+    return crud_fs_unmount(crud_fs_default());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_open
+// Description  : This function opens the file and returns a file handle
+//
+// Inputs       : path - the path "in the storage array"
+// Outputs      : file handle if successful, -1 if failure
+
+int16_t crud_open(char *path) {
+    return crud_fs_open(crud_fs_default(), path);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_close
+// Description  : This function closes the file
+//
+// Inputs       : fh - the file handle of the object to close
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t crud_close(int16_t fh) {
+    return crud_fs_close(crud_fs_default(), fh);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read
+// Description  : Reads up to "count" bytes from the file handle "fh" into the
+//                buffer  "buf".
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_read(int16_t fd, void *buf, int32_t count) {
+    return crud_fs_read(crud_fs_default(), fd, buf, count);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Description  : Writes "count" bytes to the file handle "fh" from the
+//                buffer  "buf"
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                buf - the buffer to write
+//                count - the number of bytes to write
+// Outputs      : the number of bytes written or -1 if failure
+
+int32_t crud_write(int16_t fd, void *buf, int32_t count) {
+    return crud_fs_write(crud_fs_default(), fd, buf, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_seek
+// Description  : Seek to specific point in the file
+//
+// Inputs       : fd - the file descriptor for the file to seek
+//                loc - offset from beginning of file to seek to
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_seek(int16_t fd, uint32_t loc) {
+    return crud_fs_seek(crud_fs_default(), fd, loc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_advise
+// Description  : Give the access pattern of an open file (see crud_fs_advise)
+//
+// Inputs       : fd - the file descriptor of the file
+//                advice - the access pattern
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_advise(int16_t fd, CRUD_ACCESS_ADVICE advice) {
+    return crud_fs_advise(crud_fs_default(), fd, advice);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_chunk_size
+// Description  : Set the size of the chunk objects used for files created
+//                from now on (existing files keep the size they were made with)
+//
+// Inputs       : size - the chunk size in bytes
+// Outputs      : 0 if successful or -1 if failure
+
+int crud_set_chunk_size(uint32_t size) {
+    // Chunks have to fit in a single object
+    if (size == 0 || size > CRUD_MAX_OBJECT_SIZE)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : bad chunk size [%u], must be 1..%u.",
+                size, CRUD_MAX_OBJECT_SIZE);
+        return -1;
+    }
+
+    crud_chunk_size = size;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_write_buffer_size
+// Description  : Set the largest write that is gathered in the per-file write
+//                buffers (0 sends every write straight to the file).  File
+//                systems take the size when they are next formatted or
+//                mounted.
+//
+// Inputs       : size - the write buffer size in bytes
+// Outputs      : 0 if successful or -1 if failure
+
+int crud_set_write_buffer_size(uint32_t size) {
+    crud_write_buffer_size = size;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_buffer_stats
+// Description  : Get the write buffering statistics of the default file
+//                system (see crud_fs_write_buffer_stats)
+//
+// Inputs       : writes - the place to put the number of buffered writes
+//                flushes - the place to put the number of buffer flushes
+// Outputs      : none
+
+void crud_write_buffer_stats(uint64_t *writes, uint64_t *flushes) {
+    crud_fs_write_buffer_stats(crud_fs_default(), writes, flushes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_read_ahead
+// Description  : Set the most bytes read ahead of sequential reads (0, or
+//                less than two chunks, turns read-ahead off).  File systems
+//                take the size when they are next formatted or mounted.
+//
+// Inputs       : size - the read-ahead size in bytes
+// Outputs      : 0 if successful or -1 if failure
+
+int crud_set_read_ahead(uint32_t size) {
+    crud_read_ahead_size = size;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_ahead_stats
+// Description  : Get the read-ahead statistics of the default file system
+//                (see crud_fs_read_ahead_stats)
+//
+// Inputs       : runs - the place to put the number of read-aheads
+//                chunks - the place to put the number of chunks read in
+// Outputs      : none
+
+void crud_read_ahead_stats(uint64_t *runs, uint64_t *chunks) {
+    crud_fs_read_ahead_stats(crud_fs_default(), runs, chunks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_buffer_stats
+// Description  : Get the buffer allocation statistics of the default file
+//                system (see crud_fs_buffer_stats)
+//
+// Inputs       : allocations - the place to put the number of buffers taken
+//                recycled - the place to put the number reused
+// Outputs      : none
+
+void crud_buffer_stats(uint64_t *allocations, uint64_t *recycled) {
+    crud_fs_buffer_stats(crud_fs_default(), allocations, recycled);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_dedup
+// Description  : Turn content dedup on or off.  Full chunks are then hashed
+//                as they are written, and one with the contents of a stored
+//                chunk refers to that chunk instead of being sent.  File
+//                systems take the setting when they are next formatted or
+//                mounted (chunks already shared stay shared either way).
+//
+// Inputs       : enable - non-zero to dedup chunks
+// Outputs      : 0 if successful or -1 if failure
+
+int crud_set_dedup(int enable) {
+    crud_dedup_enabled = (enable != 0);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_stats
+// Description  : Get the content dedup statistics of the default file system
+//                (see crud_fs_dedup_stats)
+//
+// Inputs       : chunks - the place to put the number of chunks
+//                bytes - the place to put the number of bytes of those chunks
+// Outputs      : none
+
+void crud_dedup_stats(uint64_t *chunks, uint64_t *bytes) {
+    crud_fs_dedup_stats(crud_fs_default(), chunks, bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_journal
+// Description  : Turn the journal on or off.  A file closed is then durable
+//                once its file table entry is appended to the journal, and
+//                not only once the file system is unmounted.  File systems
+//                take the setting when they are next formatted or mounted,
+//                and need a server that can update objects by range.
+//
+// Inputs       : enable - non-zero to journal file table changes
+// Outputs      : 0 if successful or -1 if failure
+
+int crud_set_journal(int enable) {
+    crud_journal_enabled = (enable != 0);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_stats
+// Description  : Get the journal statistics of the default file system (see
+//                crud_fs_journal_stats)
+//
+// Inputs       : records - the place to put the number of changes
+//                batches - the place to put the number of batches
+// Outputs      : none
+
+void crud_journal_stats(uint64_t *records, uint64_t *batches) {
+    crud_fs_journal_stats(crud_fs_default(), records, batches);
+}
+
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_make_default_fs
+// Description  : Make the default file system (run once)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_make_default_fs(void) {
+    crud_default_fs = crud_fs_new(NULL, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fs_init
+// Description  : Send the CRUD_INIT request for a file system the first time
+//                it is used
+//
+// Inputs       : fs - the file system
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_fs_init(crud_fs_t *fs) {
+    // Declare variables
+    int result = 0;
+
+    if (fs == NULL)
+        return -1;
+    if (__atomic_load_n(&fs->initialized, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_mutex_lock(&fs->lock);
+    if (fs->initialized == 0)
+    {
+        // Obtain CRUD_INIT CrudRequest code and pass to crud_endpoint_operation
+        CrudRequest initialize = construct_crud_request(0, CRUD_INIT, 0, 0, 0); 
+        CrudResponse initialized = crud_endpoint_operation(fs->ep, initialize, NULL);
+        // Check if CRUD_INIT was successful
+        if (CRUD_HEADER_RESULT(initialized) == 1)
+            result = -1;
+        else
+            __atomic_store_n(&fs->initialized, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&fs->lock);
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_file_lock
+// Description  : Check a file handle and lock the file (which must be open)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : 0 if successful (file locked) or -1 if failure
+
+static int crud_file_lock(crud_fs_t *fs, int16_t fd) {
+    if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0)
+        return -1;
+
+    pthread_mutex_lock(&fs->file_locks[fd]);
+    if (fs->table[fd].open == 0)
+    {
+        pthread_mutex_unlock(&fs->file_locks[fd]);
+        return -1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_file_chunks
+// Description  : Get the number of chunks holding the contents of a file
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : the number of chunks
+
+static uint32_t crud_file_chunks(crud_fs_t *fs, int16_t fd) {
+    uint32_t size = fs->table[fd].chunk_size;
+    return (fs->table[fd].length + size - 1) / size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_chunk_length
+// Description  : Get the length of one chunk of a file (only the last chunk
+//                can be shorter than the chunk size)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                chunk - the index of the chunk
+// Outputs      : the length of the chunk (0 if it does not exist yet)
+
+static uint32_t crud_chunk_length(crud_fs_t *fs, int16_t fd, uint32_t chunk) {
+    uint32_t size = fs->table[fd].chunk_size;
+    uint32_t start = chunk * size;
+
+    if (start >= fs->table[fd].length)
+        return 0;
+    if (fs->table[fd].length - start < size)
+        return fs->table[fd].length - start;
+    return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_reserve_extents
+// Description  : Make room for "count" chunks in the extent map of a file
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                count - the number of chunks needed
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_reserve_extents(crud_fs_t *fs, int16_t fd, uint32_t count) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    CrudOID *chunks;
+    uint32_t capacity;
+
+    if (count <= ext->capacity)
+        return 0;
+
+    // Grow geometrically, so appending chunks is cheap
+    capacity = (ext->capacity == 0) ? 16 : ext->capacity;
+    while (capacity < count)
+        capacity *= 2;
+    chunks = crud_slab_resize(fs->slab, ext->chunks, capacity * sizeof(CrudOID));
+    if (chunks == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed allocating extent map [%u chunks].", capacity);
+        return -1;
+    }
+
+    ext->chunks = chunks;
+    ext->capacity = capacity;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_extents
+// Description  : Load the extent map of a file being opened from its table
+//                entry (and the extent map object, for multi-chunk files)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_load_extents(crud_fs_t *fs, int16_t fd) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    uint32_t count;
+
+    // Entries from before chunking (or a bad table) are unusable
+    if (fs->table[fd].chunk_size == 0 ||
+            fs->table[fd].chunk_size > CRUD_MAX_OBJECT_SIZE)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : file [%s] has bad chunk size [%u], reformat needed.",
+                fs->table[fd].filename, fs->table[fd].chunk_size);
+        return -1;
+    }
+
+    count = crud_file_chunks(fs, fd);
+    if (crud_reserve_extents(fs, fd, count) != 0)
+        return -1;
+
+    if (count == 1)
+    {
+        // The only chunk is stored directly in the table
+        ext->chunks[0] = fs->table[fd].object_id;
+    }
+    else if (count > 1)
+    {
+        // Read the chunk OIDs from the extent map object
+        uint32_t size = count * sizeof(CrudOID);
+        if (crud_cache_read(fs->cache, fs->table[fd].object_id, size, 0, size,
+                    (char *)ext->chunks) != size)
+            return -1;
+    }
+
+    ext->stored = count;
+    ext->dirty = 0;
+    ext->tail = (count > 0) ? ext->chunks[count-1] : CRUD_NO_OBJECT;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_extents
+// Description  : Store the extent map of a file, updating the table entry
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_save_extents(crud_fs_t *fs, int16_t fd) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    uint32_t count = crud_file_chunks(fs, fd);
+    uint32_t size = count * sizeof(CrudOID);
+
+    if (count <= 1)
+    {
+        // A single chunk needs no map (files never shrink, so no old map)
+        fs->table[fd].object_id = (count == 1) ? ext->chunks[0] : 0;
+    }
+    else if (ext->stored == count)
+    {
+        // Chunks were replaced, same size map
+        if (crud_cache_put(fs->cache, fs->table[fd].object_id, size, (char *)ext->chunks) != 0)
+            return -1;
+    }
+    else if (ext->stored > 1 && crud_grow_in_place(fs, fd, fs->table[fd].object_id))
+    {
+        // Grow the map object in place
+        if (crud_cache_extend(fs->cache, fs->table[fd].object_id, ext->stored * sizeof(CrudOID),
+                    0, size, (char *)ext->chunks) != 0)
+            return -1;
+    }
+    else
+    {
+        // Store the map in a new object, replacing the old one
+        CrudOID map = (ext->stored > 1) ?
+            crud_replace_object(fs, fd, fs->table[fd].object_id, size, (char *)ext->chunks) :
+            crud_cache_create(fs->cache, size, (char *)ext->chunks);
+        if (map == CRUD_NO_OBJECT)
+            return -1;
+        fs->table[fd].object_id = map;
+    }
+
+    crud_touch_file(fs, fd);
+    ext->stored = count;
+    ext->dirty = 0;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_free_extents
+// Description  : Release the extent maps (and scratch buffers) of all files,
+//                and forget the objects they dropped
+//
+// Inputs       : fs - the file system
+// Outputs      : none
+
+static void crud_free_extents(crud_fs_t *fs) {
+    int i;
+
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        crud_slab_release(fs->slab, fs->extents[i].chunks);
+        crud_slab_release(fs->slab, fs->extents[i].scratch);
+        crud_slab_release(fs->slab, fs->extents[i].stale);
+        fs->extents[i].chunks = NULL;
+        fs->extents[i].scratch = NULL;
+        fs->extents[i].stale = NULL;
+        fs->extents[i].capacity = 0;
+        fs->extents[i].stored = 0;
+        fs->extents[i].dirty = 0;
+        fs->extents[i].nstale = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_free_write_buffers
+// Description  : Release the write buffers of all files (dropping contents)
+//
+// Inputs       : fs - the file system
+// Outputs      : none
+
+static void crud_free_write_buffers(crud_fs_t *fs) {
+    int i;
+
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        crud_slab_release(fs->slab, fs->write_buffers[i].data);
+        fs->write_buffers[i].data = NULL;
+        fs->write_buffers[i].count = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_index_files
+// Description  : Reset the filename index, either to all of the file table
+//                (formatted, so in memory) or to none of it (mounted, the
+//                pages are read on demand)
+//
+// Inputs       : fs - the file system
+//                loaded - flag indicating the pages are in memory
+// Outputs      : none
+
+static void crud_index_files(crud_fs_t *fs, int loaded) {
+    int i;
+
+    for (i = 0; i < CRUD_FILE_HASH_BUCKETS; i++)
+        fs->hash[i] = -1;
+
+    memset(fs->table_loaded, 0, sizeof(fs->table_loaded));
+    memset(fs->table_free, 0, sizeof(fs->table_free));
+    if (loaded)
+    {
+        for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+            crud_index_page(fs, i);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_index_page
+// Description  : Add the files of a file table page in memory to the
+//                filename index, and count its unused slots
+//
+// Inputs       : fs - the file system
+//                page - the page
+// Outputs      : none
+
+static void crud_index_page(crud_fs_t *fs, int page) {
+    int i;
+    uint32_t bucket;
+
+    // Walk backwards, so the lowest slots end up first in the buckets
+    for (i = (page + 1) * CRUD_FILE_TABLE_PAGE_ENTRIES - 1; i >= page * CRUD_FILE_TABLE_PAGE_ENTRIES; i--)
+    {
+        if (fs->table[i].filename[0] == '\0')
+        {
+            fs->table_free[page]++;
+        }
+        else
+        {
+            bucket = hashString(fs->table[i].filename) & (CRUD_FILE_HASH_BUCKETS - 1);
+            fs->hnext[i] = fs->hash[bucket];
+            fs->hash[bucket] = i;
+        }
+    }
+    fs->table_loaded[page] = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_page
+// Description  : Read a file table page from its object (if not yet in
+//                memory) and index it.  Files are all closed and rewound on
+//                mount, so the entries are too.  What was read is also what
+//                the journal has for them.
+//
+// Inputs       : fs - the file system
+//                page - the page
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_load_page(crud_fs_t *fs, int page) {
+    CrudFileAllocationType *entries = &fs->table[page*CRUD_FILE_TABLE_PAGE_ENTRIES];
+    int i;
+
+    if (fs->table_loaded[page])
+        return 0;
+
+    CrudRequest read = construct_crud_request(fs->superblock.page_oid[page], CRUD_READ,
+            CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType), CRUD_NULL_FLAG, 0);
+    CrudResponse readResponse = crud_endpoint_operation(fs->ep, read, entries);
+    // Check if CRUD_READ was successful
+    if (CRUD_HEADER_RESULT(readResponse) == 1 ||
+            CRUD_HEADER_LENGTH(readResponse) != CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType))
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed reading file table page %d.", page);
+        memset(entries, 0, CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType));
+        return -1;
+    }
+
+    for (i = 0; i < CRUD_FILE_TABLE_PAGE_ENTRIES; i++)
+    {
+        entries[i].position = 0;
+        entries[i].open = 0;
+    }
+    pthread_mutex_lock(&fs->journal_lock);
+    memcpy(&fs->committed[page*CRUD_FILE_TABLE_PAGE_ENTRIES], entries,
+            CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType));
+    pthread_mutex_unlock(&fs->journal_lock);
+    crud_index_page(fs, page);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_find_file
+// Description  : Find the file table slot holding a filename.  A file is
+//                created in the first page with room, starting from the page
+//                its filename hashes to (see crud_alloc_file), and only
+//                format frees slots, so it can only be in the pages up to the
+//                first one that still has room.  Those are read in as needed.
+//
+// Inputs       : fs - the file system
+//                path - the filename to look for
+//                page - the place to put the page a new file with the name
+//                       goes in (-1 if the table is full)
+// Outputs      : the slot, -1 if there is no such file, -2 if failure
+
+static int16_t crud_find_file(crud_fs_t *fs, char *path, int *page) {
+    uint32_t hash = hashString(path);
+    int16_t fh;
+    int i, p;
+
+    // Bring in the pages the file could be in
+    *page = -1;
+    for (i = 0, p = hash % CRUD_FILE_TABLE_PAGES; i < CRUD_FILE_TABLE_PAGES; i++)
+    {
+        if (crud_load_page(fs, p) != 0)
+            return -2;
+        if (fs->table_free[p] > 0)
+        {
+            *page = p;
+            break;
+        }
+        p = (p + 1) % CRUD_FILE_TABLE_PAGES;
+    }
+
+    for (fh = fs->hash[hash & (CRUD_FILE_HASH_BUCKETS - 1)]; fh != -1; fh = fs->hnext[fh])
+    {
+        if (strcmp(fs->table[fh].filename, path) == 0)
+            return fh;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_file
+// Description  : Take an unused file table slot for a new filename
+//
+// Inputs       : fs - the file system
+//                path - the filename of the new file
+//                page - the page to put it in (from crud_find_file)
+// Outputs      : the slot, or -1 if the table is full
+
+static int16_t crud_alloc_file(crud_fs_t *fs, char *path, int page) {
+    uint32_t bucket = hashString(path) & (CRUD_FILE_HASH_BUCKETS - 1);
+    int16_t fh;
+
+    if (page == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : file table full, cannot create [%s].", path);
+        return -1;
+    }
+
+    // Take the lowest unused slot of the page
+    for (fh = page * CRUD_FILE_TABLE_PAGE_ENTRIES; fs->table[fh].filename[0] != '\0'; fh++)
+        ;
+    fs->table_free[page]--;
+
+    // Copy path into table filename and add it to the index
+    strcpy(fs->table[fh].filename, path);
+    fs->hnext[fh] = fs->hash[bucket];
+    fs->hash[bucket] = fh;
+    crud_touch_file(fs, fh);
+    return fh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_touch_file
+// Description  : Note that the stored fields of a file table entry changed,
+//                so its page is updated on unmount
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : none
+
+static void crud_touch_file(crud_fs_t *fs, int16_t fd) {
+    __atomic_store_n(&fs->table_dirty[fd / CRUD_FILE_TABLE_PAGE_ENTRIES], 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_ahead
+// Description  : Read the chunks from the one a sequential read has reached
+//                into the cache, in one round trip.  The window starts at two
+//                chunks (all of it for sequential files) and doubles each
+//                time up to the read-ahead size (or half of the cache).
+//                Chunks holding bytes still in the write buffer are left out.
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the (locked) file
+//                chunk - the chunk the read has reached
+// Outputs      : none (if it fails the reads just miss)
+
+static void crud_read_ahead(crud_fs_t *fs, int16_t fd, uint32_t chunk) {
+    // Declare variables
+    CrudFileAllocationType *file = &fs->table[fd];
+    CrudReadAhead *ra = &fs->read_ahead[fd];
+    CrudWriteBuffer *wb = &fs->write_buffers[fd];
+    CrudOID oids[CRUD_CACHE_PREFETCH_MAX];
+    uint32_t lengths[CRUD_CACHE_PREFETCH_MAX], most, limit, chunks, count = 0;
+    int fetched;
+
+    // A window of one chunk is just the read itself, and chunks read ahead
+    //  must not push each other out of the cache before they are read
+    most = fs->read_ahead_size / file->chunk_size;
+    if (most > CRUD_CACHE_PREFETCH_MAX)
+        most = CRUD_CACHE_PREFETCH_MAX;
+    if (most > crud_cache_lines(fs->cache) / 2)
+        most = crud_cache_lines(fs->cache) / 2;
+    if (most < 2)
+        return;
+    if (ra->window == 0)
+        ra->window = (ra->advice == CRUD_ADVICE_SEQUENTIAL) ? most : 2;
+    else
+        ra->window = (ra->window * 2 < most) ? ra->window * 2 : most;
+    ra->fetched = chunk + ra->window;
+
+    // Take the chunks of the window that are stored as they are
+    limit = (wb->count > 0) ? wb->start : file->length;
+    chunks = crud_file_chunks(fs, fd);
+    while (count < ra->window && chunk + count < chunks &&
+            (chunk + count) * file->chunk_size + crud_chunk_length(fs, fd, chunk + count) <= limit)
+    {
+        oids[count] = fs->extents[fd].chunks[chunk + count];
+        lengths[count] = crud_chunk_length(fs, fd, chunk + count);
+        count++;
+    }
+    if (count < 2)
+        return;
+
+    if ((fetched = crud_cache_prefetch(fs->cache, oids, lengths, count)) > 0)
+    {
+        __atomic_add_fetch(&fs->read_ahead_runs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&fs->read_ahead_chunks, fetched, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_through
+// Description  : Write bytes at the position of a file to its chunks
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                buf - the bytes to write
+//                count - the number of bytes to write
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_write_through(crud_fs_t *fs, int16_t fd, char *buf, uint32_t count) {
+    // Write the bytes at position one chunk at a time
+    uint32_t bytesWritten = 0;
+    while (bytesWritten < count)
+    {
+        uint32_t chunk = fs->table[fd].position / fs->table[fd].chunk_size;
+        uint32_t offset = fs->table[fd].position % fs->table[fd].chunk_size;
+        uint32_t bytes = fs->table[fd].chunk_size - offset;
+        if (bytes > count - bytesWritten)
+            bytes = count - bytesWritten;
+
+        if (crud_write_chunk(fs, fd, chunk, offset, bytes, &((char *)buf)[bytesWritten]) != 0)
+            return -1;
+
+        // Update file information
+        fs->table[fd].position += bytes;
+        if (fs->table[fd].position > fs->table[fd].length)
+        {
+            fs->table[fd].length = fs->table[fd].position;
+            crud_touch_file(fs, fd);
+        }
+        bytesWritten += bytes;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_write_buffer
+// Description  : Write the bytes gathered in a file's write buffer to its
+//                chunks (leaving the position of the file alone)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_flush_write_buffer(crud_fs_t *fs, int16_t fd) {
+    CrudWriteBuffer *wb = &fs->write_buffers[fd];
+    uint32_t position = fs->table[fd].position;
+    uint32_t length = fs->table[fd].length;
+    int result;
+
+    if (wb->count == 0)
+        return 0;
+
+    // Write as if the buffered bytes had never been seen
+    fs->table[fd].length = wb->stored;
+    fs->table[fd].position = wb->start;
+    result = crud_write_through(fs, fd, wb->data, wb->count);
+    fs->table[fd].position = position;
+    if (result != 0)
+    {
+        // The length is left at what actually got written
+        wb->count = 0;
+        return -1;
+    }
+
+    // Now the file holds everything written
+    if (fs->table[fd].length != length)
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : write buffer flush length mismatch [%u!=%u].",
+                fs->table[fd].length, length);
+    wb->count = 0;
+    __atomic_add_fetch(&fs->buffer_flushes, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_chunk
+// Description  : Write bytes within a single chunk of a file, creating or
+//                growing the chunk as needed (shared and full chunks go
+//                through the content index, see crud_dedup_write)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                chunk - the index of the chunk
+//                offset - the offset within the chunk
+//                count - the number of bytes (offset + count <= chunk size)
+//                buf - the bytes to write
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_write_chunk(crud_fs_t *fs, int16_t fd, uint32_t chunk, uint32_t offset,
+        uint32_t count, char *buf) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    uint32_t length = crud_chunk_length(fs, fd, chunk);
+
+    // Case 1 - chunk does not yet exist (writes are contiguous, so offset is 0)
+    if (chunk >= crud_file_chunks(fs, fd))
+    {
+        if (crud_reserve_extents(fs, fd, chunk + 1) != 0)
+            return -1;
+
+        // No object_id, create object (a full one may be stored already)
+        CrudOID newObject = crud_dedup_sealed(fs, fd, 0, count, 0) ?
+            crud_dedup_store(fs, count, buf) : crud_cache_create(fs->cache, count, buf);
+        // Check if CRUD_CREATE was successful
+        if (newObject == CRUD_NO_OBJECT)
+            return -1;
+
+        ext->chunks[chunk] = newObject;
+        ext->dirty = 1;
+        return 0;
+    }
+
+    // A chunk shared with other files, or one filled by the write
+    int result = crud_dedup_write(fs, fd, chunk, offset, count, buf, length);
+    if (result <= 0)
+        return result;
+
+    // Case 2 - writing past end of the (last) chunk
+    if (offset + count > length)
+    {
+        // Grow the object in place if the server supports it
+        if (crud_grow_in_place(fs, fd, ext->chunks[chunk]))
+            return crud_cache_extend(fs->cache, ext->chunks[chunk], length, offset, count, buf);
+
+        // Otherwise copy the object into a new, larger one
+        // Get a (reused) buffer of appropriate size
+        char *newBuf = crud_scratch_buffer(fs, fd, offset + count);
+        if (newBuf == NULL)
+            return -1;
+        // Read object into newBuf (through the cache)
+        if (length > 0 && crud_cache_read(fs->cache, ext->chunks[chunk], length, 0, length, newBuf) != length)
+            return -1;
+        // Copy new bytes into newBuf at offset
+        memcpy(&newBuf[offset], buf, count);
+
+        // Create new object, delete old object (one round trip if the
+        //  server takes compound requests)
+        CrudOID newObject = crud_replace_object(fs, fd, ext->chunks[chunk], offset + count, newBuf);
+        // Check if CRUD_CREATE/CRUD_DELETE were successful
+        if (newObject == CRUD_NO_OBJECT)
+            return -1;
+
+        ext->chunks[chunk] = newObject;
+        ext->dirty = 1;
+        return 0;
+    }
+
+    // Case 3 - chunk not changing size
+    // Update bytes at offset (through the cache, by range if possible)
+    return crud_cache_write(fs->cache, ext->chunks[chunk], length, offset, count, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_scratch_buffer
+// Description  : Get the scratch buffer of a file used to build new objects
+//                (it is kept until the file system is unmounted, not freed)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                size - the number of bytes needed
+// Outputs      : the buffer, or NULL if failure
+
+static char *crud_scratch_buffer(crud_fs_t *fs, int16_t fd, uint32_t size) {
+    CrudFileExtents *ext = &fs->extents[fd];
+
+    // Chunks are bounded, so just size for the largest one of the file
+    if (size > fs->table[fd].chunk_size)
+        return NULL;
+    if (ext->scratch == NULL)
+    {
+        ext->scratch = crud_slab_alloc(fs->slab, fs->table[fd].chunk_size);
+        if (ext->scratch == NULL)
+            logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed allocating scratch buffer.");
+    }
+
+    return ext->scratch;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_write
+// Description  : Write a chunk through the content index, if it has to be.
+//                A chunk shared with other files gets a copy of its own
+//                (it is never changed in place), and a chunk the write leaves
+//                full is looked up by contents: if it is stored already, the
+//                file refers to the stored one and nothing is sent.  Other
+//                writes drop the chunk from the index (its contents change)
+//                and are left to the caller.
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                chunk - the index of the chunk (which exists)
+//                offset - the offset within the chunk
+//                count - the number of bytes
+//                buf - the bytes to write
+//                length - the length of the chunk before the write
+// Outputs      : 0 if written, 1 if left to the caller, -1 if failure
+
+static int crud_dedup_write(crud_fs_t *fs, int16_t fd, uint32_t chunk, uint32_t offset,
+        uint32_t count, char *buf, uint32_t length) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    CrudOID old = ext->chunks[chunk], found = CRUD_NO_OBJECT, newObject;
+    uint32_t size = (offset + count > length) ? offset + count : length, refs;
+    int sealed = crud_dedup_sealed(fs, fd, offset, count, length), result = 0;
+    uint64_t hash = 0;
+    char *contents = buf;
+
+    pthread_mutex_lock(&fs->dedup_lock);
+    refs = crud_dedup_refs(fs->dedup, old);
+    if (refs <= 1 && !sealed)
+    {
+        // The file has the only reference, it is written in place
+        if (refs == 1)
+        {
+            crud_dedup_unref(fs->dedup, old);
+            fs->dedup_dirty = 1;
+        }
+        pthread_mutex_unlock(&fs->dedup_lock);
+        return 1;
+    }
+
+    // Build the new contents of the chunk (unless all of it is written)
+    if (offset > 0 || count < size)
+    {
+        contents = crud_scratch_buffer(fs, fd, size);
+        if (contents == NULL || crud_cache_read(fs->cache, old, length, 0, length, contents) != length)
+        {
+            pthread_mutex_unlock(&fs->dedup_lock);
+            return -1;
+        }
+        memcpy(&contents[offset], buf, count);
+    }
+    if (sealed)
+    {
+        hash = crud_dedup_hash(contents, size);
+        found = crud_dedup_match(fs, hash, size, contents);
+    }
+
+    if (found == old)
+    {
+        // Written with the contents it has already
+    }
+    else if (found != CRUD_NO_OBJECT)
+    {
+        // Refer to the stored copy, dropping the old chunk if nobody else has it
+        crud_dedup_ref(fs->dedup, found);
+        if (crud_dedup_unref(fs->dedup, old) == 0 && crud_drop_object(fs, fd, old) != 0)
+            result = -1;
+        ext->chunks[chunk] = found;
+        ext->dirty = 1;
+        fs->dedup_dirty = 1;
+        __atomic_add_fetch(&fs->dedup_chunks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&fs->dedup_bytes, size, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        // Store the new contents, a copy of a shared chunk in a new object
+        if (refs > 1)
+            newObject = crud_cache_create(fs->cache, size, contents);
+        else if (size == length)
+            newObject = (crud_cache_write(fs->cache, old, length, offset, count, buf) == 0) ?
+                old : CRUD_NO_OBJECT;
+        else if (crud_grow_in_place(fs, fd, old))
+            newObject = (crud_cache_extend(fs->cache, old, length, offset, count, buf) == 0) ?
+                old : CRUD_NO_OBJECT;
+        else
+            newObject = crud_replace_object(fs, fd, old, size, contents);
+
+        if (newObject == CRUD_NO_OBJECT)
+            result = -1;
+        else
+        {
+            // The old chunk keeps its other references, the new one is indexed if full
+            crud_dedup_unref(fs->dedup, old);
+            if (sealed)
+                crud_dedup_add(fs->dedup, hash, size, newObject);
+            ext->chunks[chunk] = newObject;
+            ext->dirty |= (newObject != old);
+            fs->dedup_dirty = 1;
+        }
+    }
+    pthread_mutex_unlock(&fs->dedup_lock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_store
+// Description  : Store a new full chunk, or refer to a stored chunk of the
+//                same contents
+//
+// Inputs       : fs - the file system
+//                length - the length of the chunk
+//                buf - the contents
+// Outputs      : the chunk object, or CRUD_NO_OBJECT if failure
+
+static CrudOID crud_dedup_store(crud_fs_t *fs, uint32_t length, char *buf) {
+    CrudOID oid;
+    uint64_t hash = crud_dedup_hash(buf, length);
+
+    pthread_mutex_lock(&fs->dedup_lock);
+    if ((oid = crud_dedup_match(fs, hash, length, buf)) != CRUD_NO_OBJECT)
+    {
+        crud_dedup_ref(fs->dedup, oid);
+        __atomic_add_fetch(&fs->dedup_chunks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&fs->dedup_bytes, length, __ATOMIC_RELAXED);
+    }
+    else if ((oid = crud_cache_create(fs->cache, length, buf)) != CRUD_NO_OBJECT)
+        crud_dedup_add(fs->dedup, hash, length, oid);
+    fs->dedup_dirty = 1;
+    pthread_mutex_unlock(&fs->dedup_lock);
+    return oid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_match
+// Description  : Find a stored chunk with the given contents.  The candidate
+//                the index has for the hash is compared byte for byte (read
+//                through the cache, which usually has it), so a hash
+//                collision never joins different chunks.  Called with the
+//                index locked.
+//
+// Inputs       : fs - the file system
+//                hash - the hash of the contents
+//                length - the length of the chunk
+//                buf - the contents
+// Outputs      : the chunk object, or CRUD_NO_OBJECT if none
+
+static CrudOID crud_dedup_match(crud_fs_t *fs, uint64_t hash, uint32_t length, char *buf) {
+    CrudOID oid = crud_dedup_find(fs->dedup, hash, length);
+
+    if (oid == CRUD_NO_OBJECT)
+        return CRUD_NO_OBJECT;
+    if (fs->dedup_buf == NULL && (fs->dedup_buf = crud_slab_alloc(fs->slab, CRUD_MAX_OBJECT_SIZE)) == NULL)
+        return CRUD_NO_OBJECT;
+    if (crud_cache_read(fs->cache, oid, length, 0, length, fs->dedup_buf) != length ||
+            memcmp(fs->dedup_buf, buf, length) != 0)
+        return CRUD_NO_OBJECT;
+    return oid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_sealed
+// Description  : Check whether a write leaves a chunk full, having filled it
+//                or written all of it, so the chunk is worth indexing (a
+//                partial write to a full chunk is not, it would hash the
+//                whole chunk for a few bytes)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+//                offset - the offset within the chunk
+//                count - the number of bytes
+//                length - the length of the chunk before the write
+// Outputs      : 1 if it does (and dedup is on), 0 if not
+
+static int crud_dedup_sealed(crud_fs_t *fs, int16_t fd, uint32_t offset, uint32_t count,
+        uint32_t length) {
+    return fs->dedup_enabled && offset + count == fs->table[fd].chunk_size &&
+        (length < offset + count || offset == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_dedup
+// Description  : Load the content index named by the superblock (on mount)
+//
+// Inputs       : fs - the file system
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_load_dedup(crud_fs_t *fs) {
+    CrudDedupEntry *entries;
+    uint32_t size = fs->superblock.dedup_chunks * sizeof(CrudDedupEntry);
+    int result = 0;
+
+    crud_dedup_reset(fs->dedup);
+    fs->dedup_dirty = 0;
+    if (fs->superblock.dedup_chunks == 0)
+        return 0;
+    if (fs->superblock.dedup_chunks > CRUD_DEDUP_MAX_CHUNKS || (entries = crud_slab_alloc(fs->slab, size)) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : bad content index [%u chunks].",
+                fs->superblock.dedup_chunks);
+        return -1;
+    }
+    if (crud_cache_read(fs->cache, fs->superblock.dedup_oid, size, 0, size, (char *)entries) != size ||
+            crud_dedup_load(fs->dedup, entries, fs->superblock.dedup_chunks) != 0)
+        result = -1;
+    crud_slab_release(fs->slab, entries);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_dedup
+// Description  : Store the content index if it changed since it was last
+//                stored, and the superblock naming it (on unmount, and with
+//                each journal batch).  An index that moves to a new object
+//                only has the old one deleted once the superblock no longer
+//                names it.  Called with the index locked, or on unmount.
+//
+// Inputs       : fs - the file system
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_save_dedup(crud_fs_t *fs) {
+    CrudDedupEntry *entries = NULL;
+    CrudOID oid = fs->superblock.dedup_oid, old = CRUD_NO_OBJECT;
+    uint32_t count = crud_dedup_count(fs->dedup);
+    uint32_t size = count * sizeof(CrudDedupEntry);
+    int failed;
+
+    if (!fs->dedup_dirty)
+        return 0;
+    if (count > 0)
+    {
+        if ((entries = crud_slab_alloc(fs->slab, size)) == NULL)
+            return -1;
+        crud_dedup_save(fs->dedup, entries);
+    }
+
+    // Same size is updated in place, otherwise it moves to a new object
+    if (count == 0)
+    {
+        old = oid;
+        oid = CRUD_NO_OBJECT;
+        failed = 0;
+    }
+    else if (oid != CRUD_NO_OBJECT && count == fs->superblock.dedup_chunks)
+        failed = (crud_cache_put(fs->cache, oid, size, (char *)entries) != 0);
+    else
+    {
+        old = oid;
+        oid = crud_cache_create(fs->cache, size, (char *)entries);
+        failed = (oid == CRUD_NO_OBJECT);
+    }
+    crud_slab_release(fs->slab, entries);
+    if (failed)
+        return -1;
+
+    // Name it in the superblock (the priority object)
+    if (oid != fs->superblock.dedup_oid || count != fs->superblock.dedup_chunks)
+    {
+        fs->superblock.dedup_oid = oid;
+        fs->superblock.dedup_chunks = count;
+        CrudRequest update = construct_crud_request(0, CRUD_UPDATE,
+                sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0);
+        if (CRUD_HEADER_RESULT(crud_endpoint_operation(fs->ep, update, &fs->superblock)) == 1)
+            return -1;
+    }
+    if (old != CRUD_NO_OBJECT && crud_cache_delete(fs->cache, old) != 0)
+        return -1;
+    fs->dedup_dirty = 0;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_grow_in_place
+// Description  : Check whether an object of a file can be grown in place.
+//                The server has to support it, and with the journal on the
+//                object must not be one the journaled entry names (its map
+//                or last chunk), as the entry, if replayed, would then read
+//                it with its old length.
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the (locked) file
+//                oid - the object to grow
+// Outputs      : 1 if it can, 0 if it has to be replaced
+
+static int crud_grow_in_place(crud_fs_t *fs, int16_t fd, CrudOID oid) {
+    if (!(crud_endpoint_capabilities(fs->ep) & CRUD_CAP_GROW))
+        return 0;
+    return !fs->journal_enabled ||
+        (oid != fs->extents[fd].tail && oid != fs->committed[fd].object_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_replace_object
+// Description  : Store new contents of an object of a file in a new object,
+//                replacing the old one (see crud_drop_object)
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the (locked) file
+//                oid - the object being replaced
+//                length - the length of the new object
+//                buf - the contents of the new object
+// Outputs      : the new object, or CRUD_NO_OBJECT if failure
+
+static CrudOID crud_replace_object(crud_fs_t *fs, int16_t fd, CrudOID oid, uint32_t length, char *buf) {
+    CrudOID replaced;
+
+    if (!fs->journal_enabled)
+        return crud_cache_replace(fs->cache, oid, length, buf);
+
+    replaced = crud_cache_create(fs->cache, length, buf);
+    if (replaced == CRUD_NO_OBJECT || crud_drop_object(fs, fd, oid) != 0)
+        return CRUD_NO_OBJECT;
+    return replaced;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_drop_object
+// Description  : Delete an object a file no longer uses.  With the journal
+//                on, the journaled entry may still name it, so it is only
+//                deleted once the file is journaled again (the cached copy
+//                goes now, nothing reads it any more).
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the (locked) file
+//                oid - the object
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_drop_object(crud_fs_t *fs, int16_t fd, CrudOID oid) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    CrudOID *stale;
+
+    if (!fs->journal_enabled)
+        return crud_cache_delete(fs->cache, oid);
+
+    if ((stale = crud_slab_resize(fs->slab, ext->stale, (ext->nstale + 1) * sizeof(CrudOID))) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed allocating dropped objects [%u].", ext->nstale + 1);
+        return -1;
+    }
+    ext->stale = stale;
+    ext->stale[ext->nstale++] = oid;
+    crud_cache_forget(fs->cache, oid);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_release_objects
+// Description  : Delete objects nothing stored names any more, in compound
+//                requests if the server has them and pipelined ones if not.
+//                A failure only leaves objects behind, so it is just logged.
+//
+// Inputs       : fs - the file system
+//                oids - the objects
+//                count - the number of objects
+// Outputs      : none
+
+static void crud_release_objects(crud_fs_t *fs, const CrudOID *oids, uint32_t count) {
+    // Declare variables
+    CrudCompoundOp ops[CRUD_COMPOUND_MAX_OPS];
+    CrudResponse deleted;
+    uint32_t i, n, most;
+    int compound, failed = 0, polled;
+
+    compound = (crud_endpoint_capabilities(fs->ep) & CRUD_CAP_COMPOUND) != 0;
+    most = compound ? CRUD_COMPOUND_MAX_OPS : CRUD_PIPELINE_DEPTH;
+    for (i = 0; i < count; i += n)
+    {
+        for (n = 0; n < most && i + n < count; n++)
+        {
+            crud_cache_forget(fs->cache, oids[i+n]);
+            ops[n].op = construct_crud_request(oids[i+n], CRUD_DELETE, 0, CRUD_NULL_FLAG, 0);
+            ops[n].ext = 0;
+            ops[n].buf = NULL;
+            if (!compound && crud_endpoint_submit(fs->ep, ops[n].op, 0, NULL, NULL) != 0)
+                failed = 1;
+        }
+        if (compound && crud_endpoint_compound(fs->ep, ops, n) != 0)
+            failed = 1;
+        while ((polled = crud_client_poll(&deleted, NULL)) > 0)
+        {
+            if (CRUD_HEADER_RESULT(deleted) == 1)
+                failed = 1;
+        }
+        if (polled < 0)
+            failed = 1;
+    }
+
+    if (failed)
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed deleting unused objects, left in the store.");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_start
+// Description  : Start the journal over (on format or mount): nothing is
+//                gathered or journaled yet, and changes are journaled if the
+//                journal is enabled and the device has a journal object
+//
+// Inputs       : fs - the file system
+// Outputs      : none
+
+static void crud_journal_start(crud_fs_t *fs) {
+    memset(fs->committed, 0, sizeof(fs->committed));
+    memset(fs->journal_batch, 0, sizeof(fs->journal_batch));
+    memset(fs->journal_dirty, 0, sizeof(fs->journal_dirty));
+    crud_journal_reset(fs->journal);
+    crud_journal_reset(fs->journal_spare);
+    fs->journal_next = 1;
+    fs->journal_done = 0;
+    fs->journal_tail = 0;
+    fs->journal_busy = 0;
+    fs->journal_error = 0;
+
+    fs->journal_enabled = crud_journal_enabled && fs->superblock.journal_oid != CRUD_NO_OBJECT;
+    if (crud_journal_enabled && !fs->journal_enabled)
+        logMessage(LOG_WARNING_LEVEL, "CRUD IO : no journal (the server cannot update by range), "
+                "the file table is only stored on unmount.");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_note
+// Description  : Add a record of a file table entry to the batch being
+//                gathered, if it changed since it was last journaled (a
+//                record that cannot be added loses the journal).  Called
+//                with the journal locked.
+//
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the file
+// Outputs      : 1 if a record was added, 0 if unchanged, -1 if failure
+
+static int crud_journal_note(crud_fs_t *fs, int16_t fd) {
+    CrudFileAllocationType *file = &fs->table[fd], *committed = &fs->committed[fd];
+    CrudJournalRecord rec;
+    int named = strcmp(file->filename, committed->filename) != 0;
+
+    if (!named && file->object_id == committed->object_id && file->length == committed->length &&
+            file->chunk_size == committed->chunk_size)
+        return 0;
+
+    rec.slot = (uint16_t) fd;
+    rec.name_length = named ? (uint16_t) strlen(file->filename) : 0;
+    rec.object_id = file->object_id;
+    rec.length = file->length;
+    rec.chunk_size = file->chunk_size;
+    if (crud_journal_add(fs->journal, &rec, file->filename) != 0)
+    {
+        fs->journal_error = 1;
+        return -1;
     }
 
-    return fh; 
+    if (named)
+        strcpy(committed->filename, file->filename);
+    committed->object_id = file->object_id;
+    committed->length = file->length;
+    committed->chunk_size = file->chunk_size;
+    fs->journal_dirty[fd / CRUD_FILE_TABLE_PAGE_ENTRIES] = 1;
+    fs->journal_batch[fd] = fs->journal_next;
+    fs->journal_records++;
+    return 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_close
-// Description  : This function closes the file
+// Function     : crud_journal_file
+// Description  : Journal a file being closed: its entry (if it changed) and
+//                the objects it dropped join the batch being gathered, and
+//                the close waits for the batch (or the earlier one with the
+//                last change of the file) to be stored
 //
-// Inputs       : fh - the file handle of the object to close
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : fs - the file system
+//                fd - the file descriptor of the (locked) file
+// Outputs      : 0 if successful or -1 if failure
 
-int16_t crud_close(int16_t fh) {
-    // Check if CRUD_INIT request has been called
-    if (InitFlag == 0)
-    {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
-            return -1;
+static int crud_journal_file(crud_fs_t *fs, int16_t fd) {
+    CrudFileExtents *ext = &fs->extents[fd];
+    uint32_t i, count;
+    int result = 0;
 
-        InitFlag = 1;       
+    pthread_mutex_lock(&fs->journal_lock);
+    if (crud_journal_note(fs, fd) < 0)
+        result = -1;
+    for (i = 0; i < ext->nstale && result == 0; i++)
+    {
+        if (crud_journal_drop(fs->journal, ext->stale[i]) != 0)
+            result = -1;
     }
-
-    // Validate parameters
-    if (fh >= CRUD_MAX_TOTAL_FILES || fh < 0) 
-        return -1;
-    if (crud_file_table[fh].open == 0)
-        return -1;
-
-    // Close file
-    crud_file_table[fh].open = 0;
-
-    return 0;
+    if (ext->nstale > 0)
+        fs->journal_batch[fd] = fs->journal_next;
+    ext->nstale = 0;
+    if (result == 0)
+        result = crud_journal_commit(fs, fs->journal_batch[fd]);
+    pthread_mutex_unlock(&fs->journal_lock);
+
+    // What is journaled now is what the file has
+    count = crud_file_chunks(fs, fd);
+    if (result == 0)
+        ext->tail = (count > 0) ? ext->chunks[count-1] : CRUD_NO_OBJECT;
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_read
-// Description  : Reads up to "count" bytes from the file handle "fh" into the
-//                buffer  "buf".
+// Function     : crud_journal_commit
+// Description  : Wait for a batch to be stored (group commit).  If no batch
+//                is being stored, the caller stores the one being gathered,
+//                and the next caller to wait for a later one stores the next
+//                (gathered meanwhile).  Called with the journal locked.
 //
-// Inputs       : fd - the file descriptor for the read
-//                buf - the buffer to place the bytes into
-//                count - the number of bytes to read
-// Outputs      : the number of bytes read or -1 if failures
-
-int32_t crud_read(int16_t fd, void *buf, int32_t count) {
-    // Check if CRUD_INIT request has been called
-    if (InitFlag == 0)
-    {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
-            return -1;
+// Inputs       : fs - the file system
+//                batch - the number of the batch
+// Outputs      : 0 if successful or -1 if failure (the journal is lost)
 
-        InitFlag = 1;       
-    }      
+static int crud_journal_commit(crud_fs_t *fs, uint64_t batch) {
+    CrudJournal *jn;
+    uint64_t number;
+    int lost, failed;
 
-    // Validate parameters
-    if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0) 
-        return -1;
-	if (count < 0)
-		return -1;
-    if (crud_file_table[fd].open == 0)
-        return -1;
+    if (fs->journal_done >= batch)
+        return 0;
 
-    // Read object
-    CrudRequest read = convert_to_CrudRequest(crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length, 0, 0);
-    char *readBuf = malloc(crud_file_table[fd].length); 
-    CrudResponse readResponse = crud_client_operation(read, readBuf);
-    CRParsed parsedReadResponse = parse_CrudResponse(readResponse);
-    // Check if CRUD_READ was successful
-    if (parsedReadResponse.res == 1)
+    while (fs->journal_done < batch)
     {
-        free(readBuf);
-        return -1;
+        if (fs->journal_busy)
+        {
+            pthread_cond_wait(&fs->journal_cond, &fs->journal_lock);
+            continue;
+        }
+
+        // Take the batch being gathered, and store it unlocked (once a
+        //  batch is lost, the later ones cannot be stored after it)
+        jn = fs->journal;
+        number = fs->journal_next++;
+        fs->journal = fs->journal_spare;
+        fs->journal_busy = 1;
+        lost = fs->journal_error;
+        pthread_mutex_unlock(&fs->journal_lock);
+        failed = lost || crud_journal_write(fs, jn) != 0;
+        pthread_mutex_lock(&fs->journal_lock);
+
+        crud_journal_reset(jn);
+        fs->journal_spare = jn;
+        if (failed && !lost)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed storing journal batch %lu, "
+                    "file table changes are only stored on unmount.", number);
+            fs->journal_error = 1;
+        }
+        fs->journal_done = number;
+        fs->journal_busy = 0;
+        fs->journal_batches++;
+        pthread_cond_broadcast(&fs->journal_cond);
     }
-    
-	// Copy bytes from readBuf at position into buf
-	// If the number of bytes to be read is greater than bytes left in file,
-	//  then just read as many as are available, otherwise read count bytes
-	if (count > crud_file_table[fd].length - crud_file_table[fd].position)
-		memcpy(buf, &readBuf[crud_file_table[fd].position], crud_file_table[fd].length - crud_file_table[fd].position);
-	else
-		memcpy(buf, &readBuf[crud_file_table[fd].position], count);
-    // Free memory
-    free(readBuf);
 
-    // Update position and return number of bytes read
-	if (count > crud_file_table[fd].length - crud_file_table[fd].position)
-	{
-        // read to end of file
-		int bytesRead = crud_file_table[fd].length - crud_file_table[fd].position;
-		crud_file_table[fd].position = crud_file_table[fd].length;
-		return bytesRead;
-	}
-	else
-	{
-		crud_file_table[fd].position += count;
-    	return count;
-	}
+    return fs->journal_error ? -1 : 0;
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////
-// Description  : Writes "count" bytes to the file handle "fh" from the
-//                buffer  "buf"
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : fd - the file descriptor for the file to write to
-//                buf - the buffer to write
-//                count - the number of bytes to write
-// Outputs      : the number of bytes written or -1 if failure
-
-int32_t crud_write(int16_t fd, void *buf, int32_t count) {
-    // Check if CRUD_INIT request has been called
-    if (InitFlag == 0)
-    {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
-            return -1;
+// Function     : crud_journal_write
+// Description  : Store a batch.  What its records name is stored first:
+//                the dirty cache lines, and the content index if it changed.
+//                The records are then appended to the journal in one ranged
+//                update (or, if the journal is full, are stored with the
+//                pages by a checkpoint), and the objects the batch made
+//                unused are deleted.
+//
+// Inputs       : fs - the file system
+//                jn - the batch
+// Outputs      : 0 if successful or -1 if failure
 
-        InitFlag = 1; 
-    }
+static int crud_journal_write(crud_fs_t *fs, CrudJournal *jn) {
+    const CrudOID *drops;
+    const void *batch;
+    uint32_t size, count;
+    int failed;
 
-    // Validate parameters - good fh, buf != NULL, good length
-    if (buf == NULL)
-        return -1;
-    if (count < 0)
-        return -1;
-    if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0)
+    if (crud_cache_flush(fs->cache) != 0)
         return -1;
-    if (crud_file_table[fd].open == 0)
+    pthread_mutex_lock(&fs->dedup_lock);
+    failed = (crud_save_dedup(fs) != 0);
+    pthread_mutex_unlock(&fs->dedup_lock);
+    if (failed)
         return -1;
 
-    // Case 1 - Object does not yet exist
-    if (crud_file_table[fd].object_id == 0)
+    if (crud_journal_records(jn) > 0)
     {
-        // No object_id, create object
-        CrudRequest create = convert_to_CrudRequest(0, CRUD_CREATE, count, 0, 0);
-        CrudResponse created = crud_client_operation(create, buf);
-        CRParsed newObject = parse_CrudResponse(created);
-        // Check if CRUD_CREATE was successful
-        if (newObject.res == 1)
-            return -1;
-
-        // Update file information
-        crud_file_table[fd].object_id = newObject.oID;
-        crud_file_table[fd].length = count;
-        crud_file_table[fd].position = count; 
-
-        // return number of bytes written to file
-        return count; 
-    }
-    else // Object already exists
-    {
-        // Read object
-        CrudRequest read = convert_to_CrudRequest(crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length, 0, 0);
-        char *readBuf = malloc(crud_file_table[fd].length); 
-        CrudResponse readResponse = crud_client_operation(read, readBuf);
-        CRParsed parsedReadResponse = parse_CrudResponse(readResponse);
-        // Check if CRUD_READ was successful
-        if (parsedReadResponse.res == 1)
-        {
-            free(readBuf);
-            return -1;
-        }
-      
-        // Case 2 - writing past end of object
-        if (crud_file_table[fd].position + count > crud_file_table[fd].length) 
+        batch = crud_journal_seal(jn, fs->superblock.journal_epoch, &size);
+        if (fs->journal_tail + size > CRUD_JOURNAL_BYTES)
         {
-            // Allocate new buffer of appropriate size
-            char *newBuf = malloc(crud_file_table[fd].position + count);
-            // Copy old memory into newBuf
-            memcpy(newBuf, readBuf, crud_file_table[fd].length);
-            // Copy new bytes into newBuf at position 
-            memcpy(&newBuf[crud_file_table[fd].position], buf, count);
-
-            // Create new object
-            CrudRequest create = convert_to_CrudRequest(0, CRUD_CREATE, crud_file_table[fd].position + count, 0, 0);
-            CrudResponse created = crud_client_operation(create, newBuf);
-            CRParsed newObject = parse_CrudResponse(created);
-            // Free memory
-            free(newBuf);
-            free(readBuf);
-            // Check if CRUD_CREATE was successful
-            if (newObject.res == 1)
+            // The pages as journaled hold the records already
+            if (crud_journal_checkpoint(fs) != 0)
                 return -1;
-
-            // Delete old object
-            CrudRequest delete = convert_to_CrudRequest(crud_file_table[fd].object_id, CRUD_DELETE, 0, 0, 0);
-            CrudResponse deleted = crud_client_operation(delete, NULL);
-            CRParsed deletedObject = parse_CrudResponse(deleted);
-            // Check if CRUD_DELETE was successful
-            if (deletedObject.res == 1)
-                return -1;
-            
-            // Update file information
-            crud_file_table[fd].object_id = newObject.oID;
-            crud_file_table[fd].length = crud_file_table[fd].position + count;
-            crud_file_table[fd].position += count;
-
-            // return number of bytes written to file
-            return count;
         }
-        
-        // Case 3 - object not changing size
-        else 
+        else
         {
-            // Copy bytes into buffer at position 
-            memcpy(&readBuf[crud_file_table[fd].position], buf, count);
-
-            // Update object
-            CrudRequest update = convert_to_CrudRequest(crud_file_table[fd].object_id, CRUD_UPDATE, crud_file_table[fd].length, 0, 0);
-            CrudResponse updated = crud_client_operation(update, readBuf);
-            CRParsed updatedObject = parse_CrudResponse(updated);
-            // Free memory
-            free(readBuf);
-            // Check if CRUD_UPDATE was successful
-            if (updatedObject.res == 1)
+            CrudRequest append = construct_crud_request(fs->superblock.journal_oid, CRUD_UPDATE_RANGE,
+                    size, CRUD_NULL_FLAG, 0);
+            if (CRUD_HEADER_RESULT(crud_endpoint_range_operation(fs->ep, append, fs->journal_tail,
+                            (void *) batch)) == 1)
                 return -1;
-
-            // Update file information
-            crud_file_table[fd].position += count;
-
-            // return number of bytes written to file
-            return count;
+            fs->journal_tail += size;
         }
     }
+
+    drops = crud_journal_drops(jn, &count);
+    crud_release_objects(fs, drops, count);
+    return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_seek
-// Description  : Seek to specific point in the file
+// Function     : crud_journal_checkpoint
+// Description  : Store the file table pages changed in the journal since the
+//                last checkpoint (as journaled, not as the open files have
+//                them now), then move the journal epoch on in the superblock,
+//                which empties the journal
 //
-// Inputs       : fd - the file descriptor for the file to seek
-//                loc - offset from beginning of file to seek to
+// Inputs       : fs - the file system
 // Outputs      : 0 if successful or -1 if failure
 
-int32_t crud_seek(int16_t fd, uint32_t loc) {
-    // Check if CRUD_INIT request has been called
-    if (InitFlag == 0)
+static int crud_journal_checkpoint(crud_fs_t *fs) {
+    // Declare variables
+    CrudCompoundOp ops[CRUD_FILE_TABLE_PAGES];
+    CrudFileAllocationType *pages;
+    CrudResponse updated;
+    uint32_t size = CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType);
+    int i, nops = 0, failed = 0, compound, polled;
+
+    // Copy the pages out, the entries keep changing meanwhile
+    if ((pages = crud_slab_alloc(fs->slab, CRUD_FILE_TABLE_PAGES * size)) == NULL)
+        return -1;
+    pthread_mutex_lock(&fs->journal_lock);
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
     {
-        // Obtain CRUD_INIT CrudRequest code and pass to crud_client_operation
-        CrudRequest initialize = convert_to_CrudRequest(0, CRUD_INIT, 0, 0, 0); 
-        CrudResponse initialized = crud_client_operation(initialize, NULL);
-        CRParsed initParsed = parse_CrudResponse(initialized);
-        // Check if CRUD_INIT was successful
-        if (initParsed.res == 1)
-            return -1;
+        if (fs->journal_dirty[i] == 0)
+            continue;
+        memcpy(&pages[nops*CRUD_FILE_TABLE_PAGE_ENTRIES], &fs->committed[i*CRUD_FILE_TABLE_PAGE_ENTRIES], size);
+        fs->journal_dirty[i] = 0;
+        ops[nops].op = construct_crud_request(fs->superblock.page_oid[i], CRUD_UPDATE, size, CRUD_NULL_FLAG, 0);
+        ops[nops].ext = 0;
+        ops[nops].buf = &pages[nops*CRUD_FILE_TABLE_PAGE_ENTRIES];
+        nops++;
+    }
+    pthread_mutex_unlock(&fs->journal_lock);
 
-        InitFlag = 1; 
+    // Update them all at once, as on unmount
+    compound = (crud_endpoint_capabilities(fs->ep) & CRUD_CAP_COMPOUND) != 0;
+    if (compound && nops > 0 && crud_endpoint_compound(fs->ep, ops, nops) != 0)
+        failed = 1;
+    for (i = 0; i < nops && !compound; i++)
+    {
+        if (crud_endpoint_submit(fs->ep, ops[i].op, 0, ops[i].buf, NULL) != 0)
+            failed = 1;
+    }
+    while ((polled = crud_client_poll(&updated, NULL)) > 0)
+    {
+        if (CRUD_HEADER_RESULT(updated) == 1)
+            failed = 1;
     }
+    if (polled < 0)
+        failed = 1;
+    crud_slab_release(fs->slab, pages);
 
-    // Validate parameters
-    if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0)
+    // Then the journal is no longer needed
+    if (!failed)
+    {
+        fs->superblock.journal_epoch++;
+        CrudRequest update = construct_crud_request(0, CRUD_UPDATE,
+                sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0);
+        if (CRUD_HEADER_RESULT(crud_endpoint_operation(fs->ep, update, &fs->superblock)) == 1)
+            failed = 1;
+    }
+    if (failed)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : journal checkpoint failed.");
         return -1;
-    if (crud_file_table[fd].open == 0)
+    }
+
+    fs->journal_tail = 0;
+    logMessage(LOG_INFO_LEVEL, "CRUD IO : journal checkpoint stored %d file table pages.", nops);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_replay
+// Description  : Replay the journal on mount.  The records of the batches of
+//                the current epoch are applied in order to the entries they
+//                are for (reading in their pages), and the pages are then
+//                stored by a checkpoint, so the journal starts out empty.
+//                Called with the context locked.
+//
+// Inputs       : fs - the file system
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_journal_replay(crud_fs_t *fs) {
+    // Declare variables
+    CrudFileAllocationType *file;
+    CrudJournalRecord rec;
+    uint8_t loaded[CRUD_FILE_TABLE_PAGES];
+    uint32_t offset = 0, size, next, records = 0;
+    const char *name;
+    char *log;
+    int i, more = 0;
+
+    if (fs->superblock.journal_oid == CRUD_NO_OBJECT)
+        return 0;
+
+    // Read the whole journal
+    if ((log = crud_slab_alloc(fs->slab, CRUD_JOURNAL_BYTES)) == NULL)
         return -1;
-    if (loc > crud_file_table[fd].length || loc < 0)
+    CrudRequest read = construct_crud_request(fs->superblock.journal_oid, CRUD_READ,
+            CRUD_JOURNAL_BYTES, CRUD_NULL_FLAG, 0);
+    CrudResponse readResponse = crud_endpoint_operation(fs->ep, read, log);
+    if (CRUD_HEADER_RESULT(readResponse) == 1 || CRUD_HEADER_LENGTH(readResponse) != CRUD_JOURNAL_BYTES)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed reading journal.");
+        crud_slab_release(fs->slab, log);
         return -1;
+    }
 
-    // Set position to loc
-    crud_file_table[fd].position = loc;
+    // Apply the records of each batch
+    while (more >= 0 && (size = crud_journal_check(log, CRUD_JOURNAL_BYTES, offset,
+                    fs->superblock.journal_epoch)) > 0)
+    {
+        next = 0;
+        while ((more = crud_journal_next(&log[offset], &next, &rec, &name)) == 1)
+        {
+            if (rec.slot >= CRUD_MAX_TOTAL_FILES || rec.name_length >= CRUD_MAX_PATH_LENGTH ||
+                    crud_load_page(fs, rec.slot / CRUD_FILE_TABLE_PAGE_ENTRIES) != 0)
+            {
+                more = -1;
+                break;
+            }
+
+            file = &fs->table[rec.slot];
+            if (rec.name_length > 0)
+            {
+                memcpy(file->filename, name, rec.name_length);
+                file->filename[rec.name_length] = '\0';
+            }
+            file->object_id = rec.object_id;
+            file->length = rec.length;
+            file->chunk_size = rec.chunk_size;
+            fs->committed[rec.slot] = *file;
+            fs->journal_dirty[rec.slot / CRUD_FILE_TABLE_PAGE_ENTRIES] = 1;
+            records++;
+        }
+        offset += size;
+    }
+    crud_slab_release(fs->slab, log);
+    if (more < 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD IO : bad journal record, reformat needed.");
+        return -1;
+    }
+    if (records == 0)
+        return 0;
 
-    return 0;
+    // Index the pages again under the names replayed, then store them
+    memcpy(loaded, fs->table_loaded, sizeof(loaded));
+    crud_index_files(fs, 0);
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+    {
+        if (loaded[i])
+            crud_index_page(fs, i);
+    }
+    logMessage(LOG_INFO_LEVEL, "CRUD IO : replayed %u file table changes from the journal.", records);
+    return crud_journal_checkpoint(fs);
 }
 
-// Module local methods
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : crudIOUnitTest
@@ -631,6 +2935,12 @@ int crudIOUnitTest(void) {
 	cio_utest_length = 0;
 	cio_utest_position = 0;
 
+	// Use small chunks so that reads and writes cross chunk boundaries
+	if (crud_set_chunk_size(CIO_UNIT_TEST_CHUNK_SIZE)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure setting chunk size.");
+		return(-1);
+	}
+
 	// Format and mount the file system
 	if (crud_format() || crud_mount()) {
 		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on format or mount operation.");
@@ -756,28 +3066,34 @@ int crudIOUnitTest(void) {
 		}
 
 #if DEEP_DEBUG
-		// VALIDATION STEP: ENSURE OUR LOCAL IS LIKE OBJECT STORE
+		// VALIDATION STEP: ENSURE THE OBJECT STORE IS LIKE OUR LOCAL, CHUNK BY CHUNK
+		crud_fs_t *fs = crud_fs_default();
 		CrudRequest request;
 		CrudResponse response;
-		CrudOID oid;
-		CRUD_REQUEST_TYPES req;
-		uint32_t length;
-		uint8_t res, flags;
-
-		// Make a fake request to get file handle, then check it
-		request = construct_crud_request(crud_file_table[0].object_id, CRUD_READ, CRUD_MAX_OBJECT_SIZE, CRUD_NULL_FLAG, 0);
-		response = crud_client_operation(request, tbuf);
-		if ((deconstruct_crud_request(response, &oid, &req, &length, &flags, &res) != 0) || (res != 0))  {
-			logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
+		uint32_t chunk, length, offset;
+
+		// Push buffered and cached writes out, then read each chunk the extent map names
+		if (crud_flush_write_buffer(fs, fh) || crud_cache_flush(fs->cache) || (fs->table[fh].length != cio_utest_length)) {
+			logMessage(LOG_ERROR_LEVEL, "Flush failure or bad file length [%u]", fs->table[fh].length);
 			return(-1);
 		}
-		if ( (cio_utest_length != length) || (memcmp(cio_utest_buffer, tbuf, length)) ) {
-			logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed [%x]", response);
-			bufToString((unsigned char *)tbuf, length, (unsigned char *)lstr, 1024 );
-			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VR: %s", lstr);
-			bufToString((unsigned char *)cio_utest_buffer, length, (unsigned char *)lstr, 1024 );
-			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VU: %s", lstr);
-			return(-1);
+		for (chunk = 0; chunk < crud_file_chunks(fs, fh); chunk++) {
+			offset = chunk * fs->table[fh].chunk_size;
+			request = construct_crud_request(fs->extents[fh].chunks[chunk], CRUD_READ, crud_chunk_length(fs, fh, chunk), CRUD_NULL_FLAG, 0);
+			response = crud_endpoint_operation(fs->ep, request, tbuf);
+			length = CRUD_HEADER_LENGTH(response);
+			if (CRUD_HEADER_RESULT(response) != 0) {
+				logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%llx]", (unsigned long long)response);
+				return(-1);
+			}
+			if ( (crud_chunk_length(fs, fh, chunk) != length) || (memcmp(&cio_utest_buffer[offset], tbuf, length)) ) {
+				logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed, chunk %u [%llx]", chunk, (unsigned long long)response);
+				bufToString((unsigned char *)tbuf, length, (unsigned char *)lstr, 1024 );
+				logMessage(LOG_INFO_LEVEL, "CIO_UTEST VR: %s", lstr);
+				bufToString((unsigned char *)&cio_utest_buffer[offset], length, (unsigned char *)lstr, 1024 );
+				logMessage(LOG_INFO_LEVEL, "CIO_UTEST VU: %s", lstr);
+				return(-1);
+			}
 		}
 
 		// Print out the buffer
@@ -795,6 +3111,21 @@ int crudIOUnitTest(void) {
 	free(cio_utest_buffer);
 	free(tbuf);
 
+	// Now check that files can share chunks
+	if (crudDedupUnitTest()) {
+		return(-1);
+	}
+
+	// And that sequential reads are read ahead of
+	if (crudReadAheadUnitTest()) {
+		return(-1);
+	}
+
+	// And that closed files survive a crash
+	if (crudJournalUnitTest()) {
+		return(-1);
+	}
+
 	// Format and mount the file system
 	if (crud_unmount()) {
 		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on unmount operation.");
@@ -805,35 +3136,355 @@ int crudIOUnitTest(void) {
 	return(0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudDedupUnitTest
+// Description  : Test the content dedup of the CRUD IO implementation: two
+//                files of the same contents (with a repeated chunk) share
+//                their chunks, and writes to one of them, before and after a
+//                remount, leave the other alone
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
 
+static int crudDedupUnitTest(void) {
 
+	// Local variables
+	int32_t size = CIO_UNIT_TEST_DEDUP_CHUNKS * CIO_UNIT_TEST_CHUNK_SIZE, i;
+	uint64_t before, after, bytes;
+	char *a, *b, *tbuf;
+	int16_t fa, fb;
+
+	// Remount with dedup on
+	crud_set_dedup(1);
+	if (crud_unmount() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup remount failed.");
+		return(-1);
+	}
 
+	// Chunks 0 and 2 are the same
+	a = malloc(size);
+	b = malloc(size);
+	tbuf = malloc(size);
+	for (i = 0; i < size; i++) {
+		a[i] = (char) (i % 251);
+	}
+	memset(&a[CIO_UNIT_TEST_CHUNK_SIZE], 'x', CIO_UNIT_TEST_CHUNK_SIZE);
+	memcpy(&a[2*CIO_UNIT_TEST_CHUNK_SIZE], a, CIO_UNIT_TEST_CHUNK_SIZE);
+	memset(&a[3*CIO_UNIT_TEST_CHUNK_SIZE], 'y', CIO_UNIT_TEST_CHUNK_SIZE);
+	memcpy(b, a, size);
+
+	// Write both files (reading them back flushes the write buffers), the
+	//  repeated chunk of the first and all of the second are found stored
+	crud_dedup_stats(&before, &bytes);
+	fa = crud_open("dedup_a.txt");
+	fb = crud_open("dedup_b.txt");
+	if ((fa == -1) || (fb == -1) || (crud_write(fa, a, size) != size) ||
+			(crud_write(fb, b, size) != size)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup file write failed.");
+		return(-1);
+	}
+	if (crudDedupUnitCheck(fa, a, tbuf) || crudDedupUnitCheck(fb, b, tbuf)) {
+		return(-1);
+	}
+	crud_dedup_stats(&after, &bytes);
+	if (after - before < 2*CIO_UNIT_TEST_DEDUP_CHUNKS - 3) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : only %lu chunks shared.", after - before);
+		return(-1);
+	}
 
+	// Write into the chunk held four times
+	memset(&b[2*CIO_UNIT_TEST_CHUNK_SIZE+5], 'z', 10);
+	if (crud_seek(fb, 2*CIO_UNIT_TEST_CHUNK_SIZE+5) ||
+			(crud_write(fb, &b[2*CIO_UNIT_TEST_CHUNK_SIZE+5], 10) != 10) ||
+			crudDedupUnitCheck(fa, a, tbuf) || crudDedupUnitCheck(fb, b, tbuf)) {
+		return(-1);
+	}
 
+	// The index survives a remount
+	if (crud_close(fa) || crud_close(fb) || crud_unmount() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup remount failed.");
+		return(-1);
+	}
+	fa = crud_open("dedup_a.txt");
+	fb = crud_open("dedup_b.txt");
+	memset(&a[100], 'q', 20);
+	if ((fa == -1) || (fb == -1) || crud_seek(fa, 100) || (crud_write(fa, &a[100], 20) != 20) ||
+			crudDedupUnitCheck(fa, a, tbuf) || crudDedupUnitCheck(fb, b, tbuf) ||
+			crud_close(fa) || crud_close(fb)) {
+		return(-1);
+	}
 
+	// Cleanup, turn dedup back off
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : dedup shared %lu chunks", after - before);
+	crud_set_dedup(0);
+	free(a);
+	free(b);
+	free(tbuf);
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudDedupUnitCheck
+// Description  : Check the contents of a file of the dedup test
+//
+// Inputs       : fh - the file
+//                expected - the contents it should have
+//                tbuf - a buffer to read it into
+// Outputs      : 0 if successful or -1 if failure
 
+static int crudDedupUnitCheck(int16_t fh, char *expected, char *tbuf) {
+	int32_t size = CIO_UNIT_TEST_DEDUP_CHUNKS * CIO_UNIT_TEST_CHUNK_SIZE;
 
+	if (crud_seek(fh, 0) || (crud_read(fh, tbuf, size) != size) || memcmp(tbuf, expected, size)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup file mismatch [%d].", fh);
+		return(-1);
+	}
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudJournalUnitTest
+// Description  : Test the journal of the CRUD IO implementation: after a
+//                "crash" (a file system dropped without unmounting, and a
+//                new one mounting the device from what was stored), files
+//                closed read back as they were closed, even as appends to
+//                them were in flight, and the contents of a file never
+//                closed are not there
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
 
+static int crudJournalUnitTest(void) {
 
+	// Local variables
+	int32_t size = 4*CIO_UNIT_TEST_CHUNK_SIZE, result;
+	crud_fs_t *fs = NULL, *replayed = NULL;
+	char *buf, *tbuf;
 
+	// Unmount the default file system, the test crashes one of its own
+	if (crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal unmount failed.");
+		return(-1);
+	}
+	crud_set_journal(1);
+	buf = malloc(size);
+	tbuf = malloc(size);
+	result = crudJournalUnitCrash(&fs, &replayed, buf, tbuf);
+
+	// Cleanup, whether or not the test passed: unmount the file systems
+	//  still live (never the crashed one), turn the journal back off and
+	//  mount the default file system again
+	if ((fs != NULL) && crud_fs_unmount(fs)) {
+		result = -1;
+	}
+	if ((replayed != NULL) && crud_fs_unmount(replayed)) {
+		result = -1;
+	}
+	crud_fs_free(fs);
+	crud_fs_free(replayed);
+	crud_set_journal(0);
+	free(buf);
+	free(tbuf);
+	if (crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal test remount failed.");
+		result = -1;
+	}
+	return(result);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudJournalUnitCrash
+// Description  : Write the files of the journal test, crash the file system
+//                and check them on the one mounting the device again
+//
+// Inputs       : fs - the place to put the file system crashed (NULL once
+//                     it is)
+//                replayed - the place to put the one mounting the device
+//                           after the crash
+//                buf, tbuf - buffers of 4 chunks
+// Outputs      : 0 if successful or -1 if failure
 
+static int crudJournalUnitCrash(crud_fs_t **fs, crud_fs_t **replayed, char *buf, char *tbuf) {
 
+	// Local variables
+	const char *names[CIO_UNIT_TEST_JOURNAL_FILES] = { "journal_a.txt", "journal_b.txt", "journal_c.txt" };
+	int32_t lengths[CIO_UNIT_TEST_JOURNAL_FILES] = { 3*CIO_UNIT_TEST_CHUNK_SIZE, CIO_UNIT_TEST_CHUNK_SIZE/2, 0 };
+	int32_t size = 4*CIO_UNIT_TEST_CHUNK_SIZE, i, j;
+	int16_t fh;
+	uint64_t records, batches;
+
+	// Mount with the journal on (if the server can hold one)
+	if (((*fs = crud_fs_new(NULL, 0)) == NULL) || crud_fs_mount(*fs)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal mount failed.");
+		crud_fs_free(*fs);
+		*fs = NULL;
+		return(-1);
+	}
+	if (!(*fs)->journal_enabled) {
+		logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : no journal on this server, skipped.");
+		return(0);
+	}
 
+	// Write and close the first two files (a whole number of chunks, and
+	//  less than one)
+	for (i = 0; i < size; i++) {
+		buf[i] = (char) (i % 253);
+	}
+	for (i = 0; i < 2; i++) {
+		fh = crud_fs_open(*fs, (char *) names[i]);
+		if ((fh == -1) || (crud_fs_write(*fs, fh, buf, lengths[i]) != lengths[i]) || crud_fs_close(*fs, fh)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal file write failed.");
+			return(-1);
+		}
+	}
 
+	// Append to both and write the third without closing any of them
+	//  (reading them back flushes the write buffers)
+	memset(tbuf, 'n', size);
+	for (i = 0; i < CIO_UNIT_TEST_JOURNAL_FILES; i++) {
+		j = (i == 2) ? size : CIO_UNIT_TEST_CHUNK_SIZE;
+		fh = crud_fs_open(*fs, (char *) names[i]);
+		if ((fh == -1) || crud_fs_seek(*fs, fh, lengths[i]) || (crud_fs_write(*fs, fh, tbuf, j) != j) ||
+				crud_fs_seek(*fs, fh, 0) || (crud_fs_read(*fs, fh, tbuf, size) != lengths[i] + j)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal file append failed.");
+			return(-1);
+		}
+		memset(tbuf, 'n', size);
+	}
 
+	// Crash: drop the file system with the files open (nothing more is
+	//  stored), so the next mount has only the stored journal to replay
+	crud_fs_journal_stats(*fs, &records, &batches);
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : journaled %lu changes in %lu batches", records, batches);
+	crud_fs_free(*fs);
+	*fs = NULL;
+
+	// Mount again (replaying the journal) and read the files back
+	if (((*replayed = crud_fs_new(NULL, 0)) == NULL) || crud_fs_mount(*replayed)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal replay mount failed.");
+		crud_fs_free(*replayed);
+		*replayed = NULL;
+		return(-1);
+	}
+	for (i = 0; i < CIO_UNIT_TEST_JOURNAL_FILES; i++) {
+		fh = crud_fs_open(*replayed, (char *) names[i]);
+		if ((fh == -1) || (crud_fs_read(*replayed, fh, tbuf, size) != lengths[i]) ||
+				memcmp(tbuf, buf, lengths[i]) || crud_fs_close(*replayed, fh)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : journal replay mismatch [%s].", names[i]);
+			return(-1);
+		}
+	}
 
+	// Return successfully
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudReadAheadUnitTest
+// Description  : Test the read-ahead of the CRUD IO implementation: a file
+//                read in order (with writes to chunks already read ahead,
+//                and bytes still in the write buffer) reads back what was
+//                written, and one advised random is never read ahead
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
 
+static int crudReadAheadUnitTest(void) {
 
+	// Local variables
+	int32_t size = CIO_UNIT_TEST_AHEAD_CHUNKS * CIO_UNIT_TEST_CHUNK_SIZE, i;
+	uint64_t runs, before, after;
+	char *expected, *tbuf;
+	int16_t fh;
+
+	// Write the file, remount so none of it is cached
+	expected = malloc(size);
+	tbuf = malloc(size);
+	for (i = 0; i < size; i++) {
+		expected[i] = (char)getRandomValue(0, 255);
+	}
+	fh = crud_open("ahead.txt");
+	if ((fh == -1) || (crud_write(fh, expected, size) != size) || crud_close(fh) ||
+			crud_unmount() || crud_mount() || ((fh = crud_open("ahead.txt")) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read-ahead file setup failed.");
+		return(-1);
+	}
 
+	// Read it in order, then again after writing into a chunk read ahead of
+	//  and leaving bytes in the write buffer
+	crud_read_ahead_stats(&runs, &before);
+	if (crudReadAheadUnitCheck(fh, expected, tbuf)) {
+		return(-1);
+	}
+	memset(&expected[5*CIO_UNIT_TEST_CHUNK_SIZE+7], 'a', 30);
+	memset(&expected[11*CIO_UNIT_TEST_CHUNK_SIZE+3], 'b', 30);
+	if (crud_seek(fh, 5*CIO_UNIT_TEST_CHUNK_SIZE+7) ||
+			(crud_write(fh, &expected[5*CIO_UNIT_TEST_CHUNK_SIZE+7], 30) != 30) ||
+			crud_seek(fh, 11*CIO_UNIT_TEST_CHUNK_SIZE+3) ||
+			(crud_write(fh, &expected[11*CIO_UNIT_TEST_CHUNK_SIZE+3], 30) != 30) ||
+			crudReadAheadUnitCheck(fh, expected, tbuf)) {
+		return(-1);
+	}
+	crud_read_ahead_stats(&runs, &after);
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read ahead %lu chunks", after - before);
+
+	// Reads of a random file are never read ahead
+	before = after;
+	if (crud_close(fh) || crud_unmount() || crud_mount() || ((fh = crud_open("ahead.txt")) == -1) ||
+			crud_advise(fh, CRUD_ADVICE_RANDOM) || crudReadAheadUnitCheck(fh, expected, tbuf)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read-ahead random read failed.");
+		return(-1);
+	}
+	crud_read_ahead_stats(&runs, &after);
+	if (after != before) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : random file read ahead [%lu chunks].",
+				after - before);
+		return(-1);
+	}
 
+	// Cleanup
+	if (crud_advise(fh, CRUD_ADVICE_SEQUENTIAL) || crudReadAheadUnitCheck(fh, expected, tbuf) ||
+			crud_close(fh)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read-ahead sequential read failed.");
+		return(-1);
+	}
+	free(expected);
+	free(tbuf);
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudReadAheadUnitCheck
+// Description  : Read the file of the read-ahead test in order, in reads
+//                that straddle the chunks, and check its contents
+//
+// Inputs       : fh - the file
+//                expected - the contents it should have
+//                tbuf - a buffer to read it into
+// Outputs      : 0 if successful or -1 if failure
 
+static int crudReadAheadUnitCheck(int16_t fh, char *expected, char *tbuf) {
+	int32_t size = CIO_UNIT_TEST_AHEAD_CHUNKS * CIO_UNIT_TEST_CHUNK_SIZE, pos, bytes;
 
-
-
-
-
+	if (crud_seek(fh, 0)) {
+		return(-1);
+	}
+	for (pos = 0; pos < size; pos += bytes) {
+		bytes = (size - pos < CIO_UNIT_TEST_AHEAD_READ) ? size - pos : CIO_UNIT_TEST_AHEAD_READ;
+		if (crud_read(fh, &tbuf[pos], bytes) != bytes) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read-ahead read failed at %d.", pos);
+			return(-1);
+		}
+	}
+	if (memcmp(tbuf, expected, size)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read-ahead file mismatch [%d].", fh);
+		return(-1);
+	}
+	return(0);
+}
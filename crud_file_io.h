@@ -20,18 +20,122 @@
 // Defines
 #define CRUD_MAX_TOTAL_FILES 1024
 #define CRUD_MAX_PATH_LENGTH 128
+#define CRUD_DEFAULT_CHUNK_SIZE 65536 // Default size of the chunk objects of a file
+#define CRUD_WRITE_BUFFER_SIZE 65536 // Default size of the per-file write buffers
+#define CRUD_READ_AHEAD_SIZE 262144 // Default most bytes read ahead of sequential reads
+#define CRUD_FILE_TABLE_PAGE_ENTRIES 32 // File table entries stored per page object
+#define CRUD_FILE_TABLE_PAGES (CRUD_MAX_TOTAL_FILES/CRUD_FILE_TABLE_PAGE_ENTRIES)
+#define CRUD_SUPERBLOCK_MAGIC 0x43524446 // "CRDF"
+#define CRUD_SUPERBLOCK_VERSION 4 // 2 - files are placed in pages by filename, 3 - content index, 4 - journal
 
 // Type definitions
 
 // This is the basic file handle structure (note: index into file table is fh)
+//
+// The contents of a file are split into chunk objects of chunk_size bytes
+// (the last one may be short).  A file of a single chunk keeps the chunk in
+// object_id, larger files keep an extent map object there instead, holding
+// the OIDs of the chunks in file order.  With content dedup (crud_set_dedup)
+// full chunks of the same contents are stored once, the extent maps of all
+// of the files holding them referring to the same object.
 typedef struct {
 	char      filename[CRUD_MAX_PATH_LENGTH]; // The filename of the data to be manipulated
-	CrudOID   object_id;                      // The handle of the object
+	CrudOID   object_id;                      // The only chunk, or the extent map object
 	uint32_t  position;                       // This is the position of the file
 	uint32_t  length;                         // This is the length of the file
+	uint32_t  chunk_size;                     // The size of each chunk of the file
 	uint8_t   open;                           // Flag indicating the file is currently open
 } CrudFileAllocationType;
 
+// These are the access pattern hints of an open file (crud_fs_advise)
+typedef enum {
+	CRUD_ADVICE_NORMAL     = 0, // Read ahead once the reads are seen to be sequential
+	CRUD_ADVICE_SEQUENTIAL = 1, // Read ahead the whole window from the first read
+	CRUD_ADVICE_RANDOM     = 2, // Never read ahead
+} CRUD_ACCESS_ADVICE;
+
+// This is the superblock, stored in the priority object.  The file table is
+// stored in pages of CRUD_FILE_TABLE_PAGE_ENTRIES entries, each page in its
+// own object, so that unmount only has to update the pages that changed.
+// Mount only reads the superblock.  A file goes in the first page with room
+// from the one its filename hashes to, so a lookup reads pages from there up
+// to the first one with a free slot (usually just the one) as it needs them.
+// The content index of the chunks shared between files is kept in one more
+// object, read on mount.  Changes to the file table since the pages were
+// last stored are in the journal object (crud_set_journal), replayed on
+// mount; the pages are stored again and the epoch moved on (which empties
+// the journal) when it fills up, on unmount and after a replay.
+typedef struct {
+	uint32_t  magic;                          // CRUD_SUPERBLOCK_MAGIC
+	uint32_t  version;                        // CRUD_SUPERBLOCK_VERSION
+	uint32_t  page_entries;                   // File table entries per page
+	uint32_t  pages;                          // Number of file table pages
+	CrudOID   page_oid[CRUD_FILE_TABLE_PAGES]; // The objects holding the pages
+	CrudOID   dedup_oid;                      // The object holding the content index (0 if none)
+	uint32_t  dedup_chunks;                   // The number of chunks indexed
+	CrudOID   journal_oid;                    // The journal object (0 if none)
+	uint32_t  journal_epoch;                  // The epoch of the batches in the journal
+} CrudSuperblock;
+
+// This is a CRUD file system, one device and its open files (opaque).  The
+// functions taking one are thread safe, different files can be used from
+// different threads at once.
+typedef struct crud_fs crud_fs_t;
+
+//
+// File system context operations
+
+crud_fs_t *crud_fs_new(const char *address, uint16_t port);
+	// Make a file system context for the device on a server (NULL/0 for default)
+
+void crud_fs_free(crud_fs_t *fs);
+	// Release a file system context (unmount it first)
+
+crud_fs_t *crud_fs_default(void);
+	// Get the file system used by the crud_* functions below
+
+uint16_t crud_fs_format(crud_fs_t *fs);
+	// Format the device and add the file allocation table
+
+uint16_t crud_fs_mount(crud_fs_t *fs);
+	// Mount the device and load the file allocation table
+
+uint16_t crud_fs_unmount(crud_fs_t *fs);
+	// Unmount the device and save the file allocation table
+
+int16_t crud_fs_open(crud_fs_t *fs, char *path);
+	// Open a file and return a file handle
+
+int16_t crud_fs_close(crud_fs_t *fs, int16_t fd);
+	// Close a file
+
+int32_t crud_fs_read(crud_fs_t *fs, int16_t fd, void *buf, int32_t count);
+	// Read "count" bytes from the file handle "fd" into the buffer "buf"
+
+int32_t crud_fs_write(crud_fs_t *fs, int16_t fd, void *buf, int32_t count);
+	// Write "count" bytes to the file handle "fd" from the buffer "buf"
+
+int32_t crud_fs_seek(crud_fs_t *fs, int16_t fd, uint32_t loc);
+	// Seek to specific point in the file
+
+int32_t crud_fs_advise(crud_fs_t *fs, int16_t fd, CRUD_ACCESS_ADVICE advice);
+	// Give the access pattern of an open file, for read-ahead
+
+void crud_fs_read_ahead_stats(crud_fs_t *fs, uint64_t *runs, uint64_t *chunks);
+	// Get the number of read-aheads (and chunks they read in) of a file system
+
+void crud_fs_buffer_stats(crud_fs_t *fs, uint64_t *allocations, uint64_t *recycled);
+	// Get the number of buffers a file system took (and how many were reused)
+
+void crud_fs_write_buffer_stats(crud_fs_t *fs, uint64_t *writes, uint64_t *flushes);
+	// Get the number of buffered writes and buffer flushes of a file system
+
+void crud_fs_dedup_stats(crud_fs_t *fs, uint64_t *chunks, uint64_t *bytes);
+	// Get the number of chunks (and bytes) found already stored by a file system
+
+void crud_fs_journal_stats(crud_fs_t *fs, uint64_t *records, uint64_t *batches);
+	// Get the number of file table changes journaled (and batches they went in)
+
 //
 // Management operations
 
@@ -62,6 +166,39 @@ int32_t crud_write(int16_t fd, void *buf, int32_t count);
 int32_t crud_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int32_t crud_advise(int16_t fd, CRUD_ACCESS_ADVICE advice);
+	// Give the access pattern of an open file, for read-ahead
+
+int crud_set_chunk_size(uint32_t size);
+	// Set the chunk size used for files created from now on
+
+int crud_set_write_buffer_size(uint32_t size);
+	// Set the size of the per-file write buffers from the next mount (0 disables buffering)
+
+void crud_write_buffer_stats(uint64_t *writes, uint64_t *flushes);
+	// Get the number of buffered writes and buffer flushes
+
+int crud_set_read_ahead(uint32_t size);
+	// Set the most bytes read ahead of sequential reads from the next mount (0 disables it)
+
+void crud_read_ahead_stats(uint64_t *runs, uint64_t *chunks);
+	// Get the number of read-aheads and the chunks they read in
+
+void crud_buffer_stats(uint64_t *allocations, uint64_t *recycled);
+	// Get the number of buffers taken and the ones reused
+
+int crud_set_dedup(int enable);
+	// Store full chunks of the same contents once, from the next format or mount
+
+void crud_dedup_stats(uint64_t *chunks, uint64_t *bytes);
+	// Get the number of chunks (and bytes) found already stored
+
+int crud_set_journal(int enable);
+	// Make file table changes durable as files are closed, from the next format or mount
+
+void crud_journal_stats(uint64_t *records, uint64_t *batches);
+	// Get the number of file table changes journaled and the batches they went in
+
 //
 // Unit testing for the module
 
@@ -0,0 +1,989 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_fsck.c
+//  Description    : This is the implementation of the device checker.  Each
+//                   pass (the file table pages, the extent maps, the chunks,
+//                   the probes) is a list of reads the threads take windows
+//                   of CRUD_PIPELINE_DEPTH from, submitting a whole window
+//                   before polling it.  A thread only fills in the results of
+//                   the reads it took; they are checked after the pass by the
+//                   caller alone, so nothing is locked.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Fri Dec 12 11:05:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_fsck.h>
+#include <crud_file_io.h>
+#include <crud_journal.h>
+#include <crud_dedup.h>
+#include <crud_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_FSCK_FAILED UINT32_MAX // Length of a read that failed
+
+// Type definitions
+
+// This is one read of a pass
+typedef struct {
+    CrudOID   oid;           // The object
+    uint32_t  length;        // The length it should have (the bytes asked for)
+    int32_t   file;          // The file table slot (-1 if none)
+    void     *buf;           // Where to read it (NULL for the scratch of the thread)
+    uint32_t  got;           // The length read (CRUD_FSCK_FAILED if the read failed)
+    uint64_t  hash;          // The hash of the contents (if hashed)
+} CrudFsckRead;
+
+// This is a check being made
+typedef struct {
+    CrudEndpoint           *ep;         // The server
+    const CrudFsckOptions  *options;    // The settings
+    CrudFsckReport         *report;     // What was found
+    uint64_t                start;      // When the check started (ns)
+    uint64_t                asked;      // Bytes asked for so far (paced against the rate)
+    CrudSuperblock          superblock; // The superblock
+    CrudFileAllocationType *table;      // The file table
+    CrudOID               **chunks;     // The chunks of each file (NULL if not known)
+    uint8_t                *bad;        // The files found damaged
+    CrudDedupEntry         *index;      // The content index, by OID
+    uint32_t                nindex;     // Chunks in the content index
+} CrudFsck;
+
+// This is a pass, a list of reads shared out between the threads
+typedef struct {
+    CrudFsck      *fsck;     // The check
+    CrudFsckRead  *reads;    // The reads
+    uint32_t       count;    // Number of reads
+    uint32_t       next;     // The next read to take (atomic)
+    uint8_t        req;      // CRUD_READ, or CRUD_READ_RANGE (probes)
+    uint32_t       slot;     // Bytes of scratch per read in flight
+    uint32_t       slots;    // Scratch slots (1 if the contents are not kept)
+    uint8_t        hash;     // Hash the contents read
+    uint8_t        probe;    // Reads only look for objects (not counted as read)
+    uint8_t        failed;   // A thread could not go on (atomic)
+} CrudFsckPass;
+
+//
+// Functional prototypes
+
+static void crud_fsck_pace(CrudFsck *fsck, uint32_t bytes);
+static void *crud_fsck_worker(void *arg);
+static int crud_fsck_run(CrudFsckPass *pass);
+static int crud_fsck_load(CrudFsck *fsck);
+static void crud_fsck_replay(CrudFsck *fsck);
+static int crud_fsck_files(CrudFsck *fsck, CrudOID **held, uint32_t *nheld);
+static int crud_fsck_names(CrudFsck *fsck, CrudOID *held, uint32_t nheld, CrudOID **names, uint32_t *count);
+static int crud_fsck_orphans(CrudFsck *fsck, const CrudOID *names, uint32_t count);
+static uint32_t crud_fsck_chunks(const CrudFileAllocationType *file);
+static CrudDedupEntry *crud_fsck_indexed(CrudFsck *fsck, CrudOID oid);
+static int crud_fsck_compare_oid(const void *a, const void *b);
+static int crud_fsck_compare_entry(const void *a, const void *b);
+static int crud_fsck_compare_name(const void *a, const void *b);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck
+// Description  : Check the device on the configured server.  What is wrong
+//                is logged as it is found (a checksum of each file, too, if
+//                asked), and summed up in the report.
+//
+// Inputs       : options - the settings of the check
+//                report - the place to put what was found
+// Outputs      : 0 if the device is clean, 1 if not, -1 if it could not be checked
+
+int crud_fsck(const CrudFsckOptions *options, CrudFsckReport *report) {
+    // Declare variables
+    CrudOID *held = NULL, *names = NULL;
+    uint32_t nheld = 0, nnames = 0, i;
+    CrudFsck fsck;
+    double rate;
+    int result = -1;
+
+    memset(report, 0, sizeof(CrudFsckReport));
+    memset(&fsck, 0, sizeof(CrudFsck));
+    fsck.options = options;
+    fsck.report = report;
+    fsck.start = getMonotonicNanos();
+    fsck.table = calloc(CRUD_MAX_TOTAL_FILES, sizeof(CrudFileAllocationType));
+    fsck.chunks = calloc(CRUD_MAX_TOTAL_FILES, sizeof(CrudOID *));
+    fsck.bad = calloc(CRUD_MAX_TOTAL_FILES, sizeof(uint8_t));
+    if (fsck.table == NULL || fsck.chunks == NULL || fsck.bad == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : failed allocating the file table.");
+        goto done;
+    }
+
+    // Find the server, then check what is on it
+    if ((fsck.ep = crud_client_endpoint(NULL, 0)) == NULL)
+        goto done;
+    CrudRequest initialize = construct_crud_request(0, CRUD_INIT, 0, 0, 0);
+    if (CRUD_HEADER_RESULT(crud_endpoint_operation(fsck.ep, initialize, NULL)) == 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : failed initializing the device.");
+        goto done;
+    }
+    if (crud_fsck_load(&fsck) == 0 && crud_fsck_files(&fsck, &held, &nheld) == 0 &&
+            crud_fsck_names(&fsck, held, nheld, &names, &nnames) == 0 &&
+            crud_fsck_orphans(&fsck, names, nnames) == 0)
+        result = (report->damaged || report->inconsistent || report->orphans) ? 1 : 0;
+
+done:
+    report->seconds = (double) (getMonotonicNanos() - fsck.start) / 1e9;
+    if (result >= 0)
+    {
+        rate = (report->seconds > 0) ? (double) report->bytes / report->seconds / 1e6 : 0;
+        logMessage(LOG_OUTPUT_LEVEL, "CRUD fsck : %lu files, %lu objects (%lu bytes) read in %.3f seconds "
+                "(%.1f MB/s, target %.1f), %lu OIDs probed.", report->files, report->objects, report->bytes,
+                report->seconds, rate, (double) options->rate / 1e6, report->probes);
+        logMessage(LOG_OUTPUT_LEVEL, "CRUD fsck : %lu damaged, %lu inconsistent, %lu orphaned objects.",
+                report->damaged, report->inconsistent, report->orphans);
+    }
+    for (i = 0; fsck.chunks != NULL && i < CRUD_MAX_TOTAL_FILES; i++)
+        free(fsck.chunks[i]);
+    free(fsck.chunks);
+    free(fsck.table);
+    free(fsck.bad);
+    free(fsck.index);
+    free(held);
+    free(names);
+    return result;
+}
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_pace
+// Description  : Hold a read back until the bytes asked for by all of the
+//                threads are within the rate of the check
+//
+// Inputs       : fsck - the check
+//                bytes - the bytes the read asks for
+// Outputs      : none
+
+static void crud_fsck_pace(CrudFsck *fsck, uint32_t bytes) {
+    // Declare variables
+    struct timespec wait;
+    uint64_t asked, due, now;
+
+    if (fsck->options->rate == 0 || bytes == 0)
+        return;
+    asked = __atomic_add_fetch(&fsck->asked, bytes, __ATOMIC_RELAXED);
+    due = fsck->start + (uint64_t) ((double) asked * 1e9 / (double) fsck->options->rate);
+    if ((now = getMonotonicNanos()) < due)
+    {
+        wait.tv_sec = (due - now) / 1000000000ULL;
+        wait.tv_nsec = (due - now) % 1000000000ULL;
+        nanosleep(&wait, NULL);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_worker
+// Description  : Take windows of the reads of a pass until there are none
+//                left, pipelining each one (a thread of the pass)
+//
+// Inputs       : arg - the pass
+// Outputs      : NULL
+
+static void *crud_fsck_worker(void *arg) {
+    // Declare variables
+    CrudFsckPass *pass = arg;
+    CrudFsckRead *rd;
+    CrudResponse response;
+    char *scratch = NULL, *buf;
+    uint32_t first, n, i;
+    int polled;
+    void *tag;
+
+    if (pass->slot > 0 && (scratch = malloc((size_t) pass->slot * pass->slots)) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : failed allocating read buffers.");
+        __atomic_store_n(&pass->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    while (!__atomic_load_n(&pass->failed, __ATOMIC_RELAXED) &&
+            (first = __atomic_fetch_add(&pass->next, CRUD_PIPELINE_DEPTH, __ATOMIC_RELAXED)) < pass->count)
+    {
+        // Send the whole window, then take the responses in order
+        n = (pass->count - first < CRUD_PIPELINE_DEPTH) ? pass->count - first : CRUD_PIPELINE_DEPTH;
+        for (i = 0; i < n; i++)
+        {
+            rd = &pass->reads[first+i];
+            rd->got = CRUD_FSCK_FAILED;
+            buf = (rd->buf != NULL || scratch == NULL) ? rd->buf : &scratch[(i % pass->slots) * pass->slot];
+            crud_fsck_pace(pass->fsck, rd->length);
+            CrudRequest read = construct_crud_request(rd->oid, pass->req, rd->length, CRUD_NULL_FLAG, 0);
+            if (crud_endpoint_submit(pass->fsck->ep, read, 0, buf, rd) != 0)
+            {
+                __atomic_store_n(&pass->failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+        while ((polled = crud_client_poll(&response, &tag)) > 0)
+        {
+            rd = tag;
+            if (CRUD_HEADER_RESULT(response) == 1)
+                continue;
+            rd->got = CRUD_HEADER_LENGTH(response);
+            if (pass->hash)
+            {
+                i = (uint32_t) (rd - &pass->reads[first]);
+                rd->hash = crud_dedup_hash((rd->buf != NULL) ? rd->buf :
+                        &scratch[(i % pass->slots) * pass->slot], rd->got);
+            }
+        }
+        if (polled < 0)
+        {
+            __atomic_store_n(&pass->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    free(scratch);
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_run
+// Description  : Make the reads of a pass on the threads of the check (or
+//                on this one, if it has one thread or one window of reads)
+//
+// Inputs       : pass - the pass
+// Outputs      : 0 if successful (whatever the reads found), -1 if failure
+
+static int crud_fsck_run(CrudFsckPass *pass) {
+    // Declare variables
+    pthread_t threads[CRUD_FSCK_MAX_THREADS];
+    uint32_t windows = (pass->count + CRUD_PIPELINE_DEPTH - 1) / CRUD_PIPELINE_DEPTH;
+    uint32_t n = pass->fsck->options->threads, i, started = 0;
+
+    if (n > CRUD_FSCK_MAX_THREADS)
+        n = CRUD_FSCK_MAX_THREADS;
+    if (n > windows)
+        n = windows;
+    pass->next = 0;
+    pass->failed = 0;
+    for (i = 0; n > 1 && i < n; i++)
+    {
+        if (pthread_create(&threads[i], NULL, crud_fsck_worker, pass) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        crud_fsck_worker(pass);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (pass->failed)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : reads to the server failed, check abandoned.");
+        return -1;
+    }
+    for (i = 0; i < pass->count && !pass->probe; i++)
+    {
+        if (pass->reads[i].got == CRUD_FSCK_FAILED)
+            continue;
+        pass->fsck->report->objects++;
+        pass->fsck->report->bytes += pass->reads[i].got;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_load
+// Description  : Read the superblock, the pages of the file table (all at
+//                once), the content index and the journal
+//
+// Inputs       : fsck - the check
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_fsck_load(CrudFsck *fsck) {
+    // Declare variables
+    CrudFsckRead reads[CRUD_FILE_TABLE_PAGES];
+    CrudFsckPass pass;
+    CrudSuperblock *sb = &fsck->superblock;
+    uint32_t size = CRUD_FILE_TABLE_PAGE_ENTRIES*sizeof(CrudFileAllocationType), i;
+
+    // The superblock first, everything else is found from it
+    CrudRequest read = construct_crud_request(0, CRUD_READ, sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0);
+    CrudResponse readResponse = crud_endpoint_operation(fsck->ep, read, sb);
+    if (CRUD_HEADER_RESULT(readResponse) == 1 || CRUD_HEADER_LENGTH(readResponse) != sizeof(CrudSuperblock) ||
+            sb->magic != CRUD_SUPERBLOCK_MAGIC || sb->version != CRUD_SUPERBLOCK_VERSION ||
+            sb->page_entries != CRUD_FILE_TABLE_PAGE_ENTRIES || sb->pages != CRUD_FILE_TABLE_PAGES)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : no superblock of this version, not a CRUD device "
+                "(or one needing a reformat).");
+        return -1;
+    }
+
+    // Then the pages of the file table
+    memset(&pass, 0, sizeof(pass));
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+    {
+        reads[i].oid = sb->page_oid[i];
+        reads[i].length = size;
+        reads[i].file = -1;
+        reads[i].buf = &fsck->table[i*CRUD_FILE_TABLE_PAGE_ENTRIES];
+    }
+    pass.fsck = fsck;
+    pass.reads = reads;
+    pass.count = CRUD_FILE_TABLE_PAGES;
+    pass.req = CRUD_READ;
+    pass.slots = 1;
+    if (crud_fsck_run(&pass) != 0)
+        return -1;
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+    {
+        if (reads[i].got == size)
+            continue;
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : file table page %u (object %u) missing or short, "
+                "its files are lost.", i, reads[i].oid);
+        memset(reads[i].buf, 0, size);
+        fsck->report->damaged++;
+    }
+
+    // The content index, by OID
+    if (sb->dedup_oid != CRUD_NO_OBJECT)
+    {
+        size = sb->dedup_chunks * sizeof(CrudDedupEntry);
+        if (sb->dedup_chunks > CRUD_DEDUP_MAX_CHUNKS || (fsck->index = malloc(size + 1)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : bad content index [%u chunks].", sb->dedup_chunks);
+            return -1;
+        }
+        read = construct_crud_request(sb->dedup_oid, CRUD_READ, size, CRUD_NULL_FLAG, 0);
+        readResponse = crud_endpoint_operation(fsck->ep, read, fsck->index);
+        if (CRUD_HEADER_RESULT(readResponse) == 1 || CRUD_HEADER_LENGTH(readResponse) != size)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : content index (object %u) missing or short.", sb->dedup_oid);
+            fsck->report->inconsistent++;
+        }
+        else
+        {
+            fsck->nindex = sb->dedup_chunks;
+            qsort(fsck->index, fsck->nindex, sizeof(CrudDedupEntry), crud_fsck_compare_entry);
+        }
+    }
+
+    // And the changes to the table since it was stored
+    crud_fsck_replay(fsck);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_replay
+// Description  : Apply the journal to the file table read, as a mount would
+//                (but only in memory)
+//
+// Inputs       : fsck - the check
+// Outputs      : none
+
+static void crud_fsck_replay(CrudFsck *fsck) {
+    // Declare variables
+    CrudFileAllocationType *file;
+    CrudJournalRecord rec;
+    uint32_t offset = 0, size, next;
+    const char *name;
+    char *log;
+    int more = 0;
+
+    if (fsck->superblock.journal_oid == CRUD_NO_OBJECT)
+        return;
+    if ((log = malloc(CRUD_JOURNAL_BYTES)) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : failed allocating the journal.");
+        fsck->report->damaged++;
+        return;
+    }
+    CrudRequest read = construct_crud_request(fsck->superblock.journal_oid, CRUD_READ,
+            CRUD_JOURNAL_BYTES, CRUD_NULL_FLAG, 0);
+    CrudResponse readResponse = crud_endpoint_operation(fsck->ep, read, log);
+    if (CRUD_HEADER_RESULT(readResponse) == 1 || CRUD_HEADER_LENGTH(readResponse) != CRUD_JOURNAL_BYTES)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : journal (object %u) missing or short, "
+                "the file table may be out of date.", fsck->superblock.journal_oid);
+        fsck->report->damaged++;
+        free(log);
+        return;
+    }
+
+    // The records of each batch of the epoch, in order
+    while (more >= 0 && (size = crud_journal_check(log, CRUD_JOURNAL_BYTES, offset,
+                    fsck->superblock.journal_epoch)) > 0)
+    {
+        next = 0;
+        while ((more = crud_journal_next(&log[offset], &next, &rec, &name)) == 1)
+        {
+            if (rec.slot >= CRUD_MAX_TOTAL_FILES || rec.name_length >= CRUD_MAX_PATH_LENGTH)
+            {
+                more = -1;
+                break;
+            }
+            file = &fsck->table[rec.slot];
+            if (rec.name_length > 0)
+            {
+                memcpy(file->filename, name, rec.name_length);
+                file->filename[rec.name_length] = '\0';
+            }
+            file->object_id = rec.object_id;
+            file->length = rec.length;
+            file->chunk_size = rec.chunk_size;
+            fsck->report->replayed++;
+        }
+        offset += size;
+    }
+    free(log);
+
+    if (more < 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : bad journal record at %u, the rest is not replayed.", offset);
+        fsck->report->damaged++;
+    }
+    if (fsck->report->replayed > 0)
+        logMessage(LOG_INFO_LEVEL, "CRUD fsck : %u journal records replayed over the file table.",
+                fsck->report->replayed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_files
+// Description  : Check the files of the table: their entries, then their
+//                extent maps (all at once), then all of their chunks.  A
+//                file with a chunk missing, or not of the length the file
+//                needs, is damaged.  With checksums, shared chunks are also
+//                checked against the content index, and the checksum of each
+//                file is logged (the hash of the hashes of its chunks, the
+//                same for the same contents split the same way).
+//
+// Inputs       : fsck - the check
+//                held - the place to put the chunks the files hold (sorted,
+//                       once for each extent map slot)
+//                nheld - the place to put the number of them
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_fsck_files(CrudFsck *fsck, CrudOID **held, uint32_t *nheld) {
+    // Declare variables
+    CrudFileAllocationType *file;
+    CrudFsckRead *maps = NULL, *reads = NULL, *rd;
+    CrudDedupEntry *entry;
+    CrudFsckPass pass;
+    const char **names = NULL;
+    uint32_t i, k, count, nmaps = 0, total = 0, nnames = 0, n, slot = 0;
+    uint64_t pair[2];
+    int result = -1;
+
+    // Check the entries, and count the chunks
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        file = &fsck->table[i];
+        if (file->filename[0] == '\0')
+            continue;
+        fsck->report->files++;
+        if (memchr(file->filename, '\0', CRUD_MAX_PATH_LENGTH) == NULL || file->chunk_size == 0 ||
+                file->chunk_size > CRUD_MAX_OBJECT_SIZE ||
+                (file->length > 0 && file->object_id == CRUD_NO_OBJECT) ||
+                crud_fsck_chunks(file) * sizeof(CrudOID) > CRUD_MAX_OBJECT_SIZE)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : file table entry %u is bad (length %u, chunk size %u).",
+                    i, file->length, file->chunk_size);
+            fsck->bad[i] = 1;
+            continue;
+        }
+        count = crud_fsck_chunks(file);
+        nmaps += (count > 1);
+        total += count;
+    }
+
+    // No two files of the same name (only the first could be found)
+    if ((names = malloc((fsck->report->files + 1) * sizeof(char *))) == NULL)
+        goto done;
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        if (fsck->table[i].filename[0] != '\0' && !fsck->bad[i])
+            names[nnames++] = fsck->table[i].filename;
+    }
+    qsort(names, nnames, sizeof(char *), crud_fsck_compare_name);
+    for (i = 1; i < nnames; i++)
+    {
+        if (strcmp(names[i-1], names[i]) != 0)
+            continue;
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : file [%s] is in the file table twice.", names[i]);
+        fsck->report->inconsistent++;
+    }
+
+    // Find the chunks of the files, reading the extent maps
+    if ((maps = calloc(nmaps + 1, sizeof(CrudFsckRead))) == NULL ||
+            (reads = calloc(total + 1, sizeof(CrudFsckRead))) == NULL)
+        goto done;
+    for (i = 0, n = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        file = &fsck->table[i];
+        if (file->filename[0] == '\0' || fsck->bad[i] || (count = crud_fsck_chunks(file)) == 0)
+            continue;
+        if ((fsck->chunks[i] = malloc(count * sizeof(CrudOID))) == NULL)
+            goto done;
+        fsck->chunks[i][0] = file->object_id;
+        if (count > 1)
+        {
+            maps[n].oid = file->object_id;
+            maps[n].length = count * sizeof(CrudOID);
+            maps[n].file = i;
+            maps[n++].buf = fsck->chunks[i];
+        }
+        if (file->chunk_size > slot)
+            slot = file->chunk_size;
+    }
+    memset(&pass, 0, sizeof(pass));
+    pass.fsck = fsck;
+    pass.reads = maps;
+    pass.count = nmaps;
+    pass.req = CRUD_READ;
+    pass.slots = 1;
+    if (crud_fsck_run(&pass) != 0)
+        goto done;
+    for (i = 0; i < nmaps; i++)
+    {
+        if (maps[i].got == maps[i].length)
+            continue;
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : extent map (object %u) of [%s] missing or short.",
+                maps[i].oid, fsck->table[maps[i].file].filename);
+        fsck->bad[maps[i].file] = 1;
+        free(fsck->chunks[maps[i].file]);
+        fsck->chunks[maps[i].file] = NULL;
+    }
+
+    // Then read every chunk of every file, each the length the file needs
+    for (i = 0, n = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        if (fsck->chunks[i] == NULL)
+            continue;
+        file = &fsck->table[i];
+        count = crud_fsck_chunks(file);
+        for (k = 0; k < count; k++, n++)
+        {
+            reads[n].oid = fsck->chunks[i][k];
+            reads[n].length = (k < count - 1) ? file->chunk_size : file->length - k * file->chunk_size;
+            reads[n].file = i;
+        }
+    }
+    pass.reads = reads;
+    pass.count = n;
+    pass.slot = slot;
+    pass.slots = CRUD_PIPELINE_DEPTH;
+    pass.hash = fsck->options->checksums;
+    if (crud_fsck_run(&pass) != 0)
+        goto done;
+    for (i = 0; i < pass.count; i++)
+    {
+        rd = &reads[i];
+        if (rd->got != rd->length)
+        {
+            if (!fsck->bad[rd->file])
+                logMessage(LOG_ERROR_LEVEL, "CRUD fsck : chunk (object %u) of [%s] missing or not %u bytes.",
+                        rd->oid, fsck->table[rd->file].filename, rd->length);
+            fsck->bad[rd->file] = 1;
+        }
+        else if (fsck->options->checksums && (entry = crud_fsck_indexed(fsck, rd->oid)) != NULL &&
+                entry->length == rd->got && entry->hash != rd->hash)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : shared chunk (object %u) of [%s] does not match the "
+                    "content index.", rd->oid, fsck->table[rd->file].filename);
+            fsck->report->inconsistent++;
+        }
+    }
+
+    // Sum up each file (the reads are in file order)
+    for (i = 0, n = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        file = &fsck->table[i];
+        if (file->filename[0] == '\0')
+            continue;
+        count = (fsck->chunks[i] != NULL) ? crud_fsck_chunks(file) : 0;
+        for (k = 0, pair[0] = 0; k < count; k++, n++)
+        {
+            pair[1] = reads[n].hash;
+            pair[0] = crud_dedup_hash(pair, sizeof(pair));
+        }
+        if (fsck->bad[i])
+            fsck->report->damaged++;
+        else if (fsck->options->checksums)
+            logMessage(LOG_OUTPUT_LEVEL, "CRUD fsck : [%s] %u bytes, checksum %016lx.",
+                    file->filename, file->length, pair[0]);
+    }
+
+    // Give back the chunks held, to count how often each one is
+    if ((*held = malloc((n + 1) * sizeof(CrudOID))) == NULL)
+        goto done;
+    for (i = 0; i < n; i++)
+        (*held)[i] = reads[i].oid;
+    qsort(*held, n, sizeof(CrudOID), crud_fsck_compare_oid);
+    *nheld = n;
+    result = 0;
+
+done:
+    if (result != 0)
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : failed checking the files.");
+    free(names);
+    free(maps);
+    free(reads);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_names
+// Description  : Check that no object is named twice (a chunk may only be
+//                held by several extent map slots if the content index has
+//                it, with that many references), then give back every OID
+//                the device names
+//
+// Inputs       : fsck - the check
+//                held - the chunks the files hold (sorted)
+//                nheld - the number of them
+//                names - the place to put the OIDs named (sorted, once each)
+//                count - the place to put the number of them
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_fsck_names(CrudFsck *fsck, CrudOID *held, uint32_t nheld, CrudOID **names, uint32_t *count) {
+    // Declare variables
+    CrudSuperblock *sb = &fsck->superblock;
+    CrudDedupEntry *entry;
+    CrudOID *meta;
+    uint32_t i, j, n = 0, run, total;
+
+    // The objects that are not chunks: the pages, index, journal and maps
+    if ((meta = malloc((CRUD_FILE_TABLE_PAGES + 2 + CRUD_MAX_TOTAL_FILES) * sizeof(CrudOID))) == NULL)
+        return -1;
+    for (i = 0; i < CRUD_FILE_TABLE_PAGES; i++)
+        meta[n++] = sb->page_oid[i];
+    if (sb->dedup_oid != CRUD_NO_OBJECT)
+        meta[n++] = sb->dedup_oid;
+    if (sb->journal_oid != CRUD_NO_OBJECT)
+        meta[n++] = sb->journal_oid;
+    for (i = 0; i < CRUD_MAX_TOTAL_FILES; i++)
+    {
+        if (fsck->table[i].filename[0] != '\0' && crud_fsck_chunks(&fsck->table[i]) > 1)
+            meta[n++] = fsck->table[i].object_id;
+    }
+    qsort(meta, n, sizeof(CrudOID), crud_fsck_compare_oid);
+    for (i = 0; i < n; i++)
+    {
+        if ((i > 0 && meta[i] == meta[i-1]) ||
+                bsearch(&meta[i], held, nheld, sizeof(CrudOID), crud_fsck_compare_oid) != NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : object %u is named twice.", meta[i]);
+            fsck->report->inconsistent++;
+        }
+    }
+
+    // Each chunk is held once, or as often as the content index says
+    for (i = 0; i < nheld; i += run)
+    {
+        for (run = 1; i + run < nheld && held[i+run] == held[i]; run++)
+            ;
+        entry = crud_fsck_indexed(fsck, held[i]);
+        if (entry != NULL && entry->refs != run)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : shared chunk (object %u) is held %u times, "
+                    "the content index says %u.", held[i], run, entry->refs);
+            fsck->report->inconsistent++;
+        }
+        else if (entry == NULL && run > 1)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD fsck : chunk (object %u) is held %u times, "
+                    "but is not in the content index.", held[i], run);
+            fsck->report->inconsistent++;
+        }
+    }
+    for (i = 0; i < fsck->nindex; i++)
+    {
+        if (bsearch(&fsck->index[i].oid, held, nheld, sizeof(CrudOID), crud_fsck_compare_oid) != NULL)
+            continue;
+        logMessage(LOG_ERROR_LEVEL, "CRUD fsck : content index has object %u, which no file holds.",
+                fsck->index[i].oid);
+        fsck->report->inconsistent++;
+    }
+
+    // Everything named, once each
+    total = n + nheld + fsck->nindex;
+    if ((*names = malloc((total + 1) * sizeof(CrudOID))) == NULL)
+    {
+        free(meta);
+        return -1;
+    }
+    memcpy(*names, meta, n * sizeof(CrudOID));
+    memcpy(*names + n, held, nheld * sizeof(CrudOID));
+    for (i = 0; i < fsck->nindex; i++)
+        (*names)[n + nheld + i] = fsck->index[i].oid;
+    qsort(*names, total, sizeof(CrudOID), crud_fsck_compare_oid);
+    for (i = 0, j = 0; i < total; i++)
+    {
+        if (j == 0 || (*names)[i] != (*names)[j-1])
+            (*names)[j++] = (*names)[i];
+    }
+    *count = j;
+    free(meta);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_orphans
+// Description  : Probe the OIDs nothing names for objects.  Servers number
+//                objects in order, so the OIDs from the first up to the last
+//                one named are probed, then CRUD_FSCK_PROBE_GAP past the last
+//                named or found, until a gap that long turns up nothing (on
+//                a list of servers, each server that holds something named).
+//                A probe is a ranged read of no bytes, so servers without
+//                ranged reads (which may not take reads of objects that do
+//                not exist, either) are not probed.
+//
+// Inputs       : fsck - the check
+//                names - the OIDs named (sorted, once each)
+//                count - the number of them
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_fsck_orphans(CrudFsck *fsck, const CrudOID *names, uint32_t count) {
+    // Declare variables
+    uint32_t top[CRUD_MAX_SHARDS], low, high, found, local, n, i, limit = (1u << CRUD_SHARD_SHIFT) - 1;
+    uint8_t seen[CRUD_MAX_SHARDS];
+    CrudFsckRead *reads;
+    CrudFsckPass pass;
+    CrudOID oid;
+    int shard;
+
+    memset(top, 0, sizeof(top));
+    memset(seen, 0, sizeof(seen));
+    seen[0] = 1;
+    for (i = 0; i < count; i++)
+    {
+        shard = CRUD_SHARD_OF(names[i]);
+        seen[shard] = 1;
+        if (CRUD_SHARD_LOCAL(names[i]) > top[shard])
+            top[shard] = CRUD_SHARD_LOCAL(names[i]);
+    }
+
+    if (!(crud_endpoint_capabilities(fsck->ep) & CRUD_CAP_RANGE))
+    {
+        logMessage(LOG_WARNING_LEVEL, "CRUD fsck : the server cannot be probed (no ranged reads), "
+                "orphaned objects not looked for.");
+        return 0;
+    }
+    memset(&pass, 0, sizeof(pass));
+    pass.fsck = fsck;
+    pass.req = CRUD_READ_RANGE;
+    pass.slots = 1;
+    pass.probe = 1;
+    for (shard = 0; shard < CRUD_MAX_SHARDS; shard++)
+    {
+        if (!seen[shard])
+            continue;
+        low = 1;
+        high = (top[shard] < limit - CRUD_FSCK_PROBE_GAP) ? top[shard] + CRUD_FSCK_PROBE_GAP : limit;
+        while (low <= high)
+        {
+            if ((reads = calloc(high - low + 1, sizeof(CrudFsckRead))) == NULL)
+                return -1;
+            for (local = low, n = 0; local <= high; local++)
+            {
+                oid = ((CrudOID) shard << CRUD_SHARD_SHIFT) | local;
+                if (bsearch(&oid, names, count, sizeof(CrudOID), crud_fsck_compare_oid) != NULL)
+                    continue;
+                reads[n].oid = oid;
+                reads[n++].file = -1;
+            }
+            pass.reads = reads;
+            pass.count = n;
+            if (crud_fsck_run(&pass) != 0)
+            {
+                free(reads);
+                return -1;
+            }
+
+            // Report what was found, and look further past it
+            for (i = 0, found = 0; i < n; i++)
+            {
+                if (reads[i].got == CRUD_FSCK_FAILED)
+                    continue;
+                logMessage(LOG_WARNING_LEVEL, "CRUD fsck : object %u is not named by anything (orphaned).",
+                        reads[i].oid);
+                fsck->report->orphans++;
+                found = CRUD_SHARD_LOCAL(reads[i].oid);
+            }
+            fsck->report->probes += n;
+            free(reads);
+            if (found + CRUD_FSCK_PROBE_GAP <= high || high == limit)
+                break;
+            low = high + 1;
+            high = (found < limit - CRUD_FSCK_PROBE_GAP) ? found + CRUD_FSCK_PROBE_GAP : limit;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_chunks
+// Description  : Get the number of chunks of a file
+//
+// Inputs       : file - the file table entry (with a good chunk size)
+// Outputs      : the number of chunks
+
+static uint32_t crud_fsck_chunks(const CrudFileAllocationType *file) {
+    if (file->chunk_size == 0)
+        return 0;
+    return (uint32_t) (((uint64_t) file->length + file->chunk_size - 1) / file->chunk_size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_indexed
+// Description  : Find a chunk in the content index
+//
+// Inputs       : fsck - the check
+//                oid - the chunk
+// Outputs      : the index entry, or NULL if the chunk is not indexed
+
+static CrudDedupEntry *crud_fsck_indexed(CrudFsck *fsck, CrudOID oid) {
+    CrudDedupEntry key;
+
+    key.oid = oid;
+    return bsearch(&key, fsck->index, fsck->nindex, sizeof(CrudDedupEntry), crud_fsck_compare_entry);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_compare_oid
+// Description  : Order OIDs (for qsort and bsearch)
+//
+// Inputs       : a, b - the OIDs
+// Outputs      : less than, equal to or greater than 0
+
+static int crud_fsck_compare_oid(const void *a, const void *b) {
+    CrudOID x = *(const CrudOID *) a, y = *(const CrudOID *) b;
+    return (x > y) - (x < y);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_compare_entry
+// Description  : Order content index entries by OID (for qsort and bsearch)
+//
+// Inputs       : a, b - the entries
+// Outputs      : less than, equal to or greater than 0
+
+static int crud_fsck_compare_entry(const void *a, const void *b) {
+    return crud_fsck_compare_oid(&((const CrudDedupEntry *) a)->oid, &((const CrudDedupEntry *) b)->oid);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsck_compare_name
+// Description  : Order filenames (for qsort)
+//
+// Inputs       : a, b - the filenames
+// Outputs      : less than, equal to or greater than 0
+
+static int crud_fsck_compare_name(const void *a, const void *b) {
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+//
+// Unit testing for the module
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudFsckUnitTest
+// Description  : Check the device the IO unit test left (unmounted), which
+//                should be clean but for objects already left behind, then
+//                again with an object nothing names (found if the server
+//                can be probed), and at a throughput target it must keep to
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudFsckUnitTest(void) {
+
+	// Local variables
+	CrudFsckOptions options = { 4, 0, 1 };
+	CrudFsckReport before, after;
+	CrudEndpoint *ep;
+	char buf[100];
+	CrudOID oid;
+	double achieved;
+	int probing;
+
+	// A server without ranged reads (the stock one) takes one connection at
+	//  a time and cannot be probed for objects left behind
+	ep = crud_client_endpoint(NULL, 0);
+	probing = (crud_endpoint_capabilities(ep) & CRUD_CAP_RANGE) != 0;
+	if (!probing) {
+		options.threads = 1;
+	}
+
+	// The files the IO test made are all there
+	if ((crud_fsck(&options, &before) == -1) || (before.files == 0) || before.damaged || before.inconsistent) {
+		logMessage(LOG_ERROR_LEVEL, "Fsck unit test failed, device not clean.");
+		return(-1);
+	}
+
+	// An object nothing names is found (the stock server is not probed, and
+	//  drops objects created since it last stored the device on each
+	//  CRUD_INIT, which every check sends)
+	if (probing) {
+		memset(buf, 'o', sizeof(buf));
+		CrudRequest create = construct_crud_request(0, CRUD_CREATE, sizeof(buf), CRUD_NULL_FLAG, 0);
+		CrudResponse created = crud_endpoint_operation(ep, create, buf);
+		if (CRUD_HEADER_RESULT(created) == 1) {
+			logMessage(LOG_ERROR_LEVEL, "Fsck unit test failed creating an object.");
+			return(-1);
+		}
+		oid = CRUD_HEADER_OID(created);
+		if ((crud_fsck(&options, &after) != 1) || (after.orphans != before.orphans + 1) ||
+				(after.files != before.files)) {
+			logMessage(LOG_ERROR_LEVEL, "Fsck unit test failed, object %u not found orphaned.", oid);
+			return(-1);
+		}
+		CrudRequest deleted = construct_crud_request(oid, CRUD_DELETE, 0, CRUD_NULL_FLAG, 0);
+		if (CRUD_HEADER_RESULT(crud_endpoint_operation(ep, deleted, NULL)) == 1) {
+			return(-1);
+		}
+	}
+
+	// Allowed four times the bytes each second, the check reads them at
+	//  about that rate (never above it), taking about a quarter second
+	options.rate = before.bytes * 4;
+	if ((crud_fsck(&options, &after) == -1) || (after.orphans != before.orphans) || (after.seconds <= 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Fsck unit test failed at a throughput target.");
+		return(-1);
+	}
+	achieved = (double) after.bytes / after.seconds;
+	if ((achieved > options.rate * 1.02) || (achieved < options.rate * 0.8)) {
+		logMessage(LOG_ERROR_LEVEL, "Fsck unit test failed, read %.0f bytes/s against a target of %lu.",
+				achieved, options.rate);
+		return(-1);
+	}
+
+	// Return successfully
+	logMessage(LOG_INFO_LEVEL, "Fsck unit test completed successfully.");
+	return(0);
+}
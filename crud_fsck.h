@@ -0,0 +1,62 @@
+#ifndef CRUD_FSCK_INCLUDED
+#define CRUD_FSCK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_fsck.h
+//  Description    : This is the header file for the checker of a CRUD device.
+//                   It reads the superblock and the file table (with the
+//                   journal replayed over it, in memory only), then every
+//                   object the files name, many requests in flight on each
+//                   of several threads, checking that each one is there with
+//                   the length the file needs and that shared chunks agree
+//                   with the content index.  Last, it probes the OIDs nothing
+//                   names for objects left behind (by a crash, say).  The
+//                   device is only read; it should not be mounted meanwhile.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Fri Dec 12 11:05:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_FSCK_MAX_THREADS 32 // Most threads reading at once
+#define CRUD_FSCK_PROBE_GAP 64   // OIDs probed past the last object found
+
+// Type definitions
+
+// These are the settings of a check
+typedef struct {
+    uint32_t  threads;       // Threads reading (each with its own pipeline)
+    uint64_t  rate;          // Most bytes read per second (0 for no limit)
+    uint8_t   checksums;     // Hash the contents: check shared chunks, report file checksums
+} CrudFsckOptions;
+
+// This is what a check found
+typedef struct {
+    uint64_t  files;         // Files checked
+    uint64_t  objects;       // Objects read (a shared chunk once per file)
+    uint64_t  bytes;         // Bytes read
+    uint64_t  probes;        // OIDs probed for orphaned objects
+    uint64_t  damaged;       // Files (or table pages) with a bad entry or a missing or short object
+    uint64_t  inconsistent;  // Objects named twice, or disagreeing with the content index
+    uint64_t  orphans;       // Objects nothing names
+    uint32_t  replayed;      // Journal records applied to the file table
+    double    seconds;       // Time the check took
+} CrudFsckReport;
+
+//
+// Checker interface
+
+int crud_fsck(const CrudFsckOptions *options, CrudFsckReport *report);
+	// Check the device on the configured server (0 if clean, 1 if not, -1 if failure)
+
+//
+// Unit testing for the module
+
+int crudFsckUnitTest(void);
+	// Check the device the IO unit test left, then with an object left behind
+
+#endif
@@ -0,0 +1,279 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_journal.c
+//  Description    : This is the implementation of the journal batches.  A
+//                   batch is built in place in the form it is stored in,
+//                   the header space ahead of the records filled in when it
+//                   is sealed, so it goes out without another copy.  Records
+//                   are packed one after the other (a record with a filename
+//                   is followed by it, unterminated), and are copied in and
+//                   out rather than read in place, as they are not aligned.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Wed Dec 10 16:40:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <crud_journal.h>
+#include <crud_dedup.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_JOURNAL_MIN_BYTES 4096 // Initial size of the record buffer
+#define CRUD_JOURNAL_MIN_DROPS 64   // Initial size of the object array
+
+// Type definitions
+
+// This is a batch being gathered
+struct crud_journal {
+    char      *data;         // The header space, then the records
+    uint32_t   used;         // Bytes of data used (header space included)
+    uint32_t   capacity;     // Bytes of data allocated
+    uint32_t   records;      // Number of records
+    CrudOID   *drops;        // The objects to delete once stored
+    uint32_t   ndrops;       // Number of objects
+    uint32_t   drop_capacity; // Objects the array holds
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_new
+// Description  : Make a new (empty) batch
+//
+// Inputs       : none
+// Outputs      : the batch, or NULL if failure
+
+CrudJournal *crud_journal_new(void) {
+    // Declare variables
+    CrudJournal *jn = calloc(1, sizeof(CrudJournal));
+
+    if (jn == NULL || (jn->data = malloc(CRUD_JOURNAL_MIN_BYTES)) == NULL ||
+            (jn->drops = malloc(CRUD_JOURNAL_MIN_DROPS * sizeof(CrudOID))) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD journal : failed allocating batch.");
+        crud_journal_free(jn);
+        return NULL;
+    }
+    jn->capacity = CRUD_JOURNAL_MIN_BYTES;
+    jn->drop_capacity = CRUD_JOURNAL_MIN_DROPS;
+    crud_journal_reset(jn);
+    return jn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_free
+// Description  : Release a batch
+//
+// Inputs       : jn - the batch (may be NULL)
+// Outputs      : none
+
+void crud_journal_free(CrudJournal *jn) {
+    if (jn == NULL)
+        return;
+    free(jn->data);
+    free(jn->drops);
+    free(jn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_reset
+// Description  : Drop the records and objects of a batch (keeping its memory)
+//
+// Inputs       : jn - the batch
+// Outputs      : none
+
+void crud_journal_reset(CrudJournal *jn) {
+    jn->used = sizeof(CrudJournalBatch);
+    jn->records = 0;
+    jn->ndrops = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_add
+// Description  : Add a record to a batch, followed by its filename if it
+//                has one
+//
+// Inputs       : jn - the batch
+//                rec - the record
+//                name - the filename (rec->name_length bytes, unterminated)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_journal_add(CrudJournal *jn, const CrudJournalRecord *rec, const char *name) {
+    // Declare variables
+    uint32_t size = sizeof(CrudJournalRecord) + rec->name_length, capacity;
+    char *data;
+
+    // Grow geometrically, a batch is reused for the life of the file system
+    if (jn->used + size > jn->capacity)
+    {
+        for (capacity = jn->capacity; capacity < jn->used + size; capacity *= 2)
+            ;
+        if ((data = realloc(jn->data, capacity)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD journal : failed growing batch [%u bytes].", capacity);
+            return -1;
+        }
+        jn->data = data;
+        jn->capacity = capacity;
+    }
+
+    memcpy(&jn->data[jn->used], rec, sizeof(CrudJournalRecord));
+    memcpy(&jn->data[jn->used + sizeof(CrudJournalRecord)], name, rec->name_length);
+    jn->used += size;
+    jn->records++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_drop
+// Description  : Add an object to delete once the batch is stored (it is
+//                still named by what is stored until then)
+//
+// Inputs       : jn - the batch
+//                oid - the object
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_journal_drop(CrudJournal *jn, CrudOID oid) {
+    // Declare variables
+    CrudOID *drops;
+
+    if (jn->ndrops == jn->drop_capacity)
+    {
+        if ((drops = realloc(jn->drops, 2 * jn->drop_capacity * sizeof(CrudOID))) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD journal : failed growing batch [%u objects].",
+                    2 * jn->drop_capacity);
+            return -1;
+        }
+        jn->drops = drops;
+        jn->drop_capacity *= 2;
+    }
+
+    jn->drops[jn->ndrops++] = oid;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_records
+// Description  : Get the number of records of a batch
+//
+// Inputs       : jn - the batch
+// Outputs      : the number of records
+
+uint32_t crud_journal_records(CrudJournal *jn) {
+    return jn->records;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_drops
+// Description  : Get the objects to delete once a batch is stored
+//
+// Inputs       : jn - the batch
+//                count - the place to put the number of objects
+// Outputs      : the objects
+
+const CrudOID *crud_journal_drops(CrudJournal *jn, uint32_t *count) {
+    *count = jn->ndrops;
+    return jn->drops;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_seal
+// Description  : Fill in the header of a batch for the epoch it is stored
+//                in, giving the batch as stored
+//
+// Inputs       : jn - the batch
+//                epoch - the journal epoch
+//                size - the place to put the size of the stored batch
+// Outputs      : the stored batch (valid until the batch changes)
+
+const void *crud_journal_seal(CrudJournal *jn, uint32_t epoch, uint32_t *size) {
+    // Declare variables
+    CrudJournalBatch header;
+
+    header.magic = CRUD_JOURNAL_MAGIC;
+    header.epoch = epoch;
+    header.bytes = jn->used - sizeof(CrudJournalBatch);
+    header.records = jn->records;
+    header.checksum = crud_dedup_hash(&jn->data[sizeof(CrudJournalBatch)], header.bytes);
+    memcpy(jn->data, &header, sizeof(CrudJournalBatch));
+
+    *size = jn->used;
+    return jn->data;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_check
+// Description  : Check for a stored batch of an epoch at an offset of the
+//                journal.  A batch of another epoch was left from before the
+//                last checkpoint, and one that does not fit or whose records
+//                do not hash to its checksum was never completely stored;
+//                either means the journal ends there.
+//
+// Inputs       : log - the journal contents
+//                size - the bytes of the journal
+//                offset - the offset of the batch
+//                epoch - the current journal epoch
+// Outputs      : the size of the batch (header and records), 0 if none
+
+uint32_t crud_journal_check(const void *log, uint32_t size, uint32_t offset, uint32_t epoch) {
+    // Declare variables
+    const char *p = (const char *) log + offset;
+    CrudJournalBatch header;
+
+    if (offset + sizeof(CrudJournalBatch) > size)
+        return 0;
+    memcpy(&header, p, sizeof(CrudJournalBatch));
+    if (header.magic != CRUD_JOURNAL_MAGIC || header.epoch != epoch ||
+            header.bytes > size - offset - sizeof(CrudJournalBatch) ||
+            header.checksum != crud_dedup_hash(p + sizeof(CrudJournalBatch), header.bytes))
+        return 0;
+
+    return sizeof(CrudJournalBatch) + header.bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_journal_next
+// Description  : Take the next record of a checked batch
+//
+// Inputs       : batch - the stored batch (see crud_journal_check)
+//                offset - the offset of the record past the header (0 for
+//                         the first), moved on to the next one
+//                rec - the place to put the record
+//                name - the place to put the filename (rec->name_length bytes)
+// Outputs      : 1 if a record was taken, 0 at the end, -1 if failure
+
+int crud_journal_next(const void *batch, uint32_t *offset, CrudJournalRecord *rec, const char **name) {
+    // Declare variables
+    const char *records = (const char *) batch + sizeof(CrudJournalBatch);
+    CrudJournalBatch header;
+
+    memcpy(&header, batch, sizeof(CrudJournalBatch));
+    if (*offset == header.bytes)
+        return 0;
+    if (*offset + sizeof(CrudJournalRecord) > header.bytes)
+        return -1;
+    memcpy(rec, &records[*offset], sizeof(CrudJournalRecord));
+    if (*offset + sizeof(CrudJournalRecord) + rec->name_length > header.bytes)
+        return -1;
+
+    *name = &records[*offset + sizeof(CrudJournalRecord)];
+    *offset += sizeof(CrudJournalRecord) + rec->name_length;
+    return 1;
+}
@@ -0,0 +1,90 @@
+#ifndef CRUD_JOURNAL_INCLUDED
+#define CRUD_JOURNAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_journal.h
+//  Description    : This is the header file for the metadata journal of the
+//                   file system.  Changes to file table entries are gathered
+//                   into batches of small records, each batch appended to
+//                   the journal object in one ranged update, and replayed
+//                   over the stored file table pages on mount.  A batch
+//                   also carries the objects the changes made unused, which
+//                   are only deleted once the batch is stored.  A batch is
+//                   not thread safe, the file system locks it.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Wed Dec 10 16:40:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_JOURNAL_MAGIC 0x43524a4c // "CRJL"
+#define CRUD_JOURNAL_BYTES 65536 // Size of the journal object
+
+// Type definitions
+
+// This is the header of a batch as stored in the journal, followed by its
+// records.  Batches of an epoch are stored one after the other from the
+// start of the journal; the first one that is not of the current epoch (or
+// does not check out) ends it.
+typedef struct {
+    uint32_t  magic;         // CRUD_JOURNAL_MAGIC
+    uint32_t  epoch;         // The journal epoch the batch was stored in
+    uint32_t  bytes;         // Bytes of records following the header
+    uint32_t  records;       // Number of records
+    uint64_t  checksum;      // Hash of the records (crud_dedup_hash)
+} CrudJournalBatch;
+
+// This is a record, the stored fields of a file table entry after a change,
+// followed by the filename if the record sets it
+typedef struct {
+    uint16_t  slot;          // The file table slot
+    uint16_t  name_length;   // Bytes of filename following (0 if unchanged)
+    CrudOID   object_id;     // The only chunk, or the extent map object
+    uint32_t  length;        // The length of the file
+    uint32_t  chunk_size;    // The size of each chunk of the file
+} CrudJournalRecord;
+
+// This is a batch being gathered (opaque)
+typedef struct crud_journal CrudJournal;
+
+//
+// Journal interface
+
+CrudJournal *crud_journal_new(void);
+	// Make a new (empty) batch
+
+void crud_journal_free(CrudJournal *jn);
+	// Release a batch
+
+void crud_journal_reset(CrudJournal *jn);
+	// Drop the records and objects of a batch
+
+int crud_journal_add(CrudJournal *jn, const CrudJournalRecord *rec, const char *name);
+	// Add a record (and rec->name_length bytes of name) to a batch
+
+int crud_journal_drop(CrudJournal *jn, CrudOID oid);
+	// Add an object to delete once the batch is stored
+
+uint32_t crud_journal_records(CrudJournal *jn);
+	// Get the number of records of a batch
+
+const CrudOID *crud_journal_drops(CrudJournal *jn, uint32_t *count);
+	// Get the objects to delete once the batch is stored
+
+const void *crud_journal_seal(CrudJournal *jn, uint32_t epoch, uint32_t *size);
+	// Get a batch as stored (header and records) for an epoch
+
+uint32_t crud_journal_check(const void *log, uint32_t size, uint32_t offset, uint32_t epoch);
+	// Get the size of the stored batch of an epoch at offset (0 if none)
+
+int crud_journal_next(const void *batch, uint32_t *offset, CrudJournalRecord *rec, const char **name);
+	// Walk the records of a checked batch (1 if one was taken, 0 at the end)
+
+#endif
@@ -16,10 +16,49 @@
 #include <crud_driver.h>
 
 // Defines
-#define CRUD_MAX_BACKLOG 5
+#define CRUD_MAX_BACKLOG 128 // Connections waiting to be accepted (per server listener)
 #define CRUD_NET_HEADER_SIZE sizeof(CrudResponse)
 #define CRUD_DEFAULT_IP "127.0.0.1"
 #define CRUD_DEFAULT_PORT 19876
+#define CRUD_LOCAL_ADDRESS "local" // Address of the endpoint of the local store (crud_network_store)
+#define CRUD_NET_SOCKET_BUFFER (CRUD_MAX_OBJECT_SIZE+2*CRUD_NET_HEADER_SIZE) // Holds a whole object
+#define CRUD_PIPELINE_DEPTH 32 // Maximum requests submitted but not yet polled
+#define CRUD_PIPELINE_MAX_BYTES 65536 // Maximum read bytes in flight (so a busy server never blocks)
+#define CRUD_COMPOUND_MAX_OPS 64 // Maximum sub-requests in one CRUD_COMPOUND
+#define CRUD_COMPOUND_MAX_BYTES CRUD_MAX_OBJECT_SIZE // Maximum bytes following a CRUD_COMPOUND header
+#define CRUD_SHARD_BITS 4 // High OID bits naming the server of an object (sharded endpoints)
+#define CRUD_MAX_SHARDS (1 << CRUD_SHARD_BITS) // Maximum servers of a sharded endpoint
+#define CRUD_SHARD_SHIFT (32 - CRUD_SHARD_BITS)
+#define CRUD_SHARD_OF(oid) ((uint32_t) (oid) >> CRUD_SHARD_SHIFT) // Server (list index) of an object
+#define CRUD_SHARD_LOCAL(oid) ((uint32_t) (oid) & ((1u << CRUD_SHARD_SHIFT) - 1)) // OID on its server
+#define CRUD_SHARD_VNODES 64 // Points of each server on the placement ring
+
+// Type definitions
+
+// This is a CRUD server the client talks to (opaque, see crud_client_endpoint).
+// An endpoint can also stand for a list of servers sharing the objects: each
+// new object goes to the server a consistent hash ring picks, and the list
+// index of that server is kept in the high CRUD_SHARD_BITS of its OID.
+// CRUD_INIT, CRUD_FORMAT and CRUD_CLOSE go to every server.  Servers may be
+// added at the end of a list, but not removed or reordered.
+typedef struct crud_endpoint CrudEndpoint;
+
+// This is one sub-request of a compound request (crud_client_compound)
+typedef struct {
+    CrudRequest     op;       // The request
+    CrudRequestExt  ext;      // The extension word (range requests only)
+    void           *buf;      // The block to be read/written from (READ/WRITE)
+    CrudResponse    response; // The response (result bit set if not executed)
+} CrudCompoundOp;
+
+// These are the wire statistics of the client for one request type
+typedef struct {
+    uint64_t requests;       // Requests sent
+    uint64_t bytes_sent;     // Payload bytes sent (after the header/extension word)
+    uint64_t bytes_received; // Payload bytes received (after the header)
+    uint64_t syscalls;       // sendmsg/recv calls made
+    uint64_t wait_ns;        // Time spent receiving responses (nanoseconds)
+} CrudWireStats;
 
 //
 // Functional Prototypes
@@ -27,6 +66,56 @@
 CrudResponse crud_client_operation(CrudRequest op, void *buf);
     // This is the implementation of the client operation (crud_client.c)
 
+CrudResponse crud_client_range_operation(CrudRequest op, uint32_t offset, void *buf);
+    // This is the client operation for the range extension requests
+
+CrudResponse crud_client_read_operation(CrudRequest op, uint32_t offset, uint32_t count, void *buf);
+    // Read part of an object with CRUD_READ, receiving only that part into buf
+
+uint32_t crud_client_capabilities(void);
+    // Get the protocol extensions (CRUD_CAP_*) negotiated at CRUD_INIT
+
+int crud_client_compound(CrudCompoundOp *ops, int count);
+    // Send several requests in one CRUD_COMPOUND (needs CRUD_CAP_COMPOUND)
+
+int crud_client_submit(CrudRequest op, CrudRequestExt ext, void *buf, void *tag);
+    // Send a request without waiting for its response (pipelined)
+
+int crud_client_poll(CrudResponse *response, void **tag);
+    // Wait for the oldest submitted request (of this thread) to complete
+
+CrudEndpoint *crud_client_endpoint(const char *address, uint16_t port);
+    // Get the handle of a server or of a "ip[:port],..." list of servers
+    // (NULL/0 for the configured or default one)
+
+CrudResponse crud_endpoint_operation(CrudEndpoint *ep, CrudRequest op, void *buf);
+    // crud_client_operation on a given server
+
+CrudResponse crud_endpoint_range_operation(CrudEndpoint *ep, CrudRequest op, uint32_t offset, void *buf);
+    // crud_client_range_operation on a given server
+
+CrudResponse crud_endpoint_read_operation(CrudEndpoint *ep, CrudRequest op, uint32_t offset,
+        uint32_t count, void *buf);
+    // crud_client_read_operation on a given server
+
+uint32_t crud_endpoint_capabilities(CrudEndpoint *ep);
+    // crud_client_capabilities of a given server
+
+int crud_endpoint_compound(CrudEndpoint *ep, CrudCompoundOp *ops, int count);
+    // crud_client_compound on a given server
+
+int crud_endpoint_submit(CrudEndpoint *ep, CrudRequest op, CrudRequestExt ext, void *buf, void *tag);
+    // crud_client_submit to a given server
+
+void crud_client_wire_stats(CrudWireStats stats[CRUD_MAXVAL]);
+    // Get the wire statistics of every request type (indexed by CRUD_REQUEST_TYPES)
+
+void crud_client_wire_reset(void);
+    // Zero the wire statistics
+
+void crud_client_wire_report(void);
+    // Log the wire statistics of the request types used
+
 int crud_server( void );
     // This is the implementation of the server application (crud_server.c)
 
@@ -36,5 +125,8 @@ int crud_server( void );
 extern int            crud_network_shutdown; // Flag indicating shutdown
 extern unsigned char *crud_network_address;  // Address of CRUD server 
 extern unsigned short crud_network_port;     // Port of CRUD server
+extern char          *crud_network_store;    // Local store file used instead (NULL for none)
+extern int            crud_network_compress; // Code payloads for servers that take them
+extern int            crud_network_uring;    // Pipeline through an io_uring ring (if there is one)
 
 #endif
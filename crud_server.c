@@ -0,0 +1,879 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_server.c
+//  Description   : This is the server side of the CRUD communication
+//                  protocol, serving the objects of a local store file (see
+//                  crud_store.h) to any number of clients.  Each worker
+//                  thread runs its own epoll loop over non-blocking
+//                  connections, with its own listening socket on the same
+//                  port (SO_REUSEPORT spreads new connections over them).
+//                  Requests are received in place into the connection's
+//                  input buffer and executed from there; responses for
+//                  everything received in one go leave in one send.
+//                  Coded payloads are decoded (and read bytes coded) with
+//                  a scratch buffer of the worker thread.
+//
+//   Author       : Ryan Geiger
+//  Last Modified : Sat Nov 29 10:05:00 EST 2014
+//
+
+// Include Files
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <crud_network.h>
+#include <crud_store.h>
+#include <crud_compress.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_SERVER_ARGUMENTS "hvl:a:p:s:j:"
+#define USAGE \
+    "USAGE: crud_serverd [-h] [-v] [-l <logfile>] [-a <ip addr>] [-p <port>] [-s <store>] [-j <n>]\n" \
+    "\n" \
+    "where:\n" \
+    "    -h - help mode (display this message)\n" \
+    "    -v - verbose output\n" \
+    "    -l - write log messages to the filename <logfile>\n" \
+    "    -a - IP address to listen on (default all)\n" \
+    "    -p - port number to listen on\n" \
+    "    -s - the store file holding the objects (default " CRUD_SERVER_DEFAULT_STORE ")\n" \
+    "    -j - number of worker threads (default one per CPU)\n" \
+    "\n"
+#define CRUD_SERVER_DEFAULT_STORE "crud_store.crd"
+#define CRUD_SERVER_MAX_WORKERS 64
+#define CRUD_SERVER_EVENTS 64           // Events taken per epoll_wait
+#define CRUD_SERVER_BUFFER 65536        // Initial size of the connection buffers
+#define CRUD_SERVER_MAX_PENDING 0x400000 // Unsent response bytes before reading stops
+
+// Type definitions
+
+// This is a client connection
+typedef struct {
+    int       fd;        // Socket of the connection
+    char     *in;        // Bytes received
+    uint32_t  in_start;  // First byte not yet executed
+    uint32_t  in_len;    // Bytes in the input buffer
+    uint32_t  in_cap;    // Size of the input buffer
+    char     *out;       // Response bytes
+    uint32_t  out_sent;  // Response bytes already sent
+    uint32_t  out_len;   // Response bytes in the output buffer
+    uint32_t  out_cap;   // Size of the output buffer
+    uint8_t   closing;   // Close once the responses are sent
+    uint8_t   writing;   // Waiting for the socket to take more (EPOLLOUT)
+} CrudServerConnection;
+
+// This is a worker thread
+typedef struct {
+    pthread_t  thread;   // The thread
+    int        epfd;     // Its epoll instance
+    int        listener; // Its listening socket
+    uint64_t   accepted; // Connections accepted
+    uint64_t   requests; // Requests executed
+} CrudServerWorker;
+
+// Global variables
+int            crud_network_shutdown = 0; // Flag indicating shutdown
+unsigned char *crud_network_address = NULL; // Address to listen on
+unsigned short crud_network_port = 0; // Port to listen on
+char          *crud_network_store = NULL; // Store file served
+
+// The workers and the event that wakes them for shutdown
+static CrudServerWorker crud_workers[CRUD_SERVER_MAX_WORKERS];
+static int crud_nworkers = 0;
+static int crud_shutdown_event = -1;
+
+// The scratch buffer of each worker, for coding payloads
+static __thread char *crud_scratch = NULL;
+static __thread uint32_t crud_scratch_size = 0;
+
+//
+// Functions
+
+static void *crud_server_worker(void *arg);
+static int crud_server_listen(void);
+static void crud_server_accept(CrudServerWorker *worker);
+static void crud_server_input(CrudServerWorker *worker, CrudServerConnection *conn);
+static void crud_server_process(CrudServerWorker *worker, CrudServerConnection *conn);
+static int crud_server_output(CrudServerWorker *worker, CrudServerConnection *conn);
+static void crud_server_close(CrudServerWorker *worker, CrudServerConnection *conn);
+static uint32_t crud_server_needed(char *msg, uint32_t avail);
+static int crud_server_execute(CrudServerConnection *conn, char *msg, uint32_t size);
+static int crud_server_compound(CrudServerConnection *conn, char *msg, uint32_t size);
+static int crud_server_request(CrudServerConnection *conn, CrudRequest op, CrudRequestExt ext,
+        char *payload, uint32_t limit, CrudResponse *response);
+static char *crud_server_reserve(CrudServerConnection *conn, uint32_t bytes);
+static char *crud_server_scratch(uint32_t bytes);
+static void crud_server_signal(int sig);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function of the CRUD server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+    // Declare variables
+    int ch, log_initialized = 0;
+
+    crud_nworkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    while ((ch = getopt(argc, argv, CRUD_SERVER_ARGUMENTS)) != -1)
+    {
+        switch (ch)
+        {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return -1;
+
+        case 'v': // Verbose Flag
+            enableLogLevels(LOG_INFO_LEVEL);
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        case 'a': // Get the IP address
+            if (inet_addr(optarg) == INADDR_NONE)
+            {
+                logMessage(LOG_ERROR_LEVEL, "Bad  IP address [%s]", optarg);
+                return -1;
+            }
+            crud_network_address = (unsigned char *) strdup(optarg);
+            break;
+
+        case 'p': // Set the network port number
+            if (sscanf(optarg, "%hu", &crud_network_port) != 1)
+            {
+                logMessage(LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg);
+                return -1;
+            }
+            break;
+
+        case 's': // Set the store file
+            crud_network_store = optarg;
+            break;
+
+        case 'j': // Set the number of worker threads
+            if (sscanf(optarg, "%d", &crud_nworkers) != 1 || crud_nworkers < 1)
+            {
+                logMessage(LOG_ERROR_LEVEL, "Bad  worker thread count [%s]", optarg);
+                return -1;
+            }
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return -1;
+        }
+    }
+    if (!log_initialized)
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    if (crud_nworkers < 1)
+        crud_nworkers = 1;
+    if (crud_nworkers > CRUD_SERVER_MAX_WORKERS)
+        crud_nworkers = CRUD_SERVER_MAX_WORKERS;
+    if (crud_network_store == NULL)
+        crud_network_store = CRUD_SERVER_DEFAULT_STORE;
+
+    return (crud_server() == 0) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server
+// Description  : This is the implementation of the server: load the store,
+//                start the workers and serve until SIGINT/SIGTERM sets
+//                crud_network_shutdown, then save the store
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_server(void) {
+    // Declare variables
+    struct sigaction sa;
+    int i, result = 0;
+
+    if (crud_load_store(crud_network_store) != 0)
+        return -1;
+
+    // Shutdown is signalled through an event every worker waits on
+    if ((crud_shutdown_event = eventfd(0, EFD_NONBLOCK)) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD server : eventfd() failed [%s].", strerror(errno));
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = crud_server_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < crud_nworkers && result == 0; i++)
+    {
+        crud_workers[i].listener = crud_server_listen();
+        crud_workers[i].epfd = epoll_create1(0);
+        if (crud_workers[i].listener == -1 || crud_workers[i].epfd == -1 ||
+                pthread_create(&crud_workers[i].thread, NULL, crud_server_worker, &crud_workers[i]) != 0)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : starting worker %d failed.", i);
+            raise(SIGTERM);
+            result = -1;
+        }
+    }
+    if (result == 0)
+        logMessage(LOG_OUTPUT_LEVEL, "CRUD server : serving [%s] on port %u with %d workers.",
+                crud_network_store, (crud_network_port != 0) ? crud_network_port : CRUD_DEFAULT_PORT,
+                crud_nworkers);
+
+    // Wait for the workers to see the shutdown
+    while (--i >= 0)
+    {
+        if (crud_workers[i].thread != 0)
+            pthread_join(crud_workers[i].thread, NULL);
+        if (crud_workers[i].listener != -1)
+            close(crud_workers[i].listener);
+        if (crud_workers[i].epfd != -1)
+            close(crud_workers[i].epfd);
+        logMessage(LOG_INFO_LEVEL, "CRUD server : worker %d accepted %lu connections, executed %lu requests.",
+                i, crud_workers[i].accepted, crud_workers[i].requests);
+    }
+
+    if (crud_save_store(NULL) != 0)
+        result = -1;
+    logMessage(LOG_OUTPUT_LEVEL, "CRUD server : shut down.");
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_worker
+// Description  : The event loop of a worker thread
+//
+// Inputs       : arg - the worker
+// Outputs      : NULL
+
+static void *crud_server_worker(void *arg) {
+    // Declare variables
+    CrudServerWorker *worker = arg;
+    struct epoll_event ev, events[CRUD_SERVER_EVENTS];
+    int i, n;
+
+    // The listener and the shutdown event have no connection
+    ev.events = EPOLLIN;
+    ev.data.ptr = worker;
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->listener, &ev);
+    ev.data.ptr = NULL;
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, crud_shutdown_event, &ev);
+
+    while (!__atomic_load_n(&crud_network_shutdown, __ATOMIC_RELAXED))
+    {
+        n = epoll_wait(worker->epfd, events, CRUD_SERVER_EVENTS, -1);
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                continue;
+            if (events[i].data.ptr == worker)
+                crud_server_accept(worker);
+            else if (events[i].events & EPOLLOUT)
+            {
+                if (crud_server_output(worker, events[i].data.ptr) == 0)
+                    crud_server_process(worker, events[i].data.ptr);
+            }
+            else
+                crud_server_input(worker, events[i].data.ptr);
+        }
+    }
+
+    // Connections still open at shutdown are just closed
+    free(crud_scratch);
+    crud_scratch = NULL;
+    crud_scratch_size = 0;
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_listen
+// Description  : Open a listening socket for a worker (each worker has its
+//                own on the same port)
+//
+// Inputs       : none
+// Outputs      : the socket, or -1 if failure
+
+static int crud_server_listen(void) {
+    // Declare variables
+    struct sockaddr_in v4;
+    int fd, on = 1;
+
+    memset(&v4, 0, sizeof(v4));
+    v4.sin_family = AF_INET;
+    v4.sin_port = htons((crud_network_port != 0) ? crud_network_port : CRUD_DEFAULT_PORT);
+    v4.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (crud_network_address != NULL && inet_aton((char *) crud_network_address, &v4.sin_addr) == 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD server : bad address [%s].", crud_network_address);
+        return -1;
+    }
+
+    if ((fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD server : socket() failed [%s].", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *) &v4, sizeof(v4)) == -1 || listen(fd, CRUD_MAX_BACKLOG) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD server : bind/listen on port %u failed [%s].",
+                ntohs(v4.sin_port), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_accept
+// Description  : Accept the pending connections of a worker's listener
+//
+// Inputs       : worker - the worker
+// Outputs      : none
+
+static void crud_server_accept(CrudServerWorker *worker) {
+    // Declare variables
+    CrudServerConnection *conn;
+    struct epoll_event ev;
+    int fd, on = 1, bufsize = CRUD_NET_SOCKET_BUFFER;
+
+    while ((fd = accept4(worker->listener, NULL, NULL, SOCK_NONBLOCK)) != -1)
+    {
+        // Responses are written in batches, so Nagle only adds delay
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+        if ((conn = calloc(1, sizeof(CrudServerConnection))) == NULL ||
+                (conn->in = malloc(CRUD_SERVER_BUFFER)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : failed allocating connection.");
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->in_cap = CRUD_SERVER_BUFFER;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev);
+        worker->accepted++;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_input
+// Description  : Receive what a client sent, then execute it.  The input
+//                buffer grows to hold the largest request, which is
+//                received straight into it and executed in place.
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : none
+
+static void crud_server_input(CrudServerWorker *worker, CrudServerConnection *conn) {
+    // Declare variables
+    uint32_t need, grow;
+    ssize_t got;
+    char *in;
+
+    // Make room for the whole of the request at the front
+    need = crud_server_needed(conn->in + conn->in_start, conn->in_len - conn->in_start);
+    if (conn->in_start > 0 && (conn->in_start + need > conn->in_cap || conn->in_len == conn->in_cap))
+    {
+        memmove(conn->in, conn->in + conn->in_start, conn->in_len - conn->in_start);
+        conn->in_len -= conn->in_start;
+        conn->in_start = 0;
+    }
+    if (need > conn->in_cap || conn->in_len == conn->in_cap)
+    {
+        grow = conn->in_cap * 2;
+        while (grow < need)
+            grow *= 2;
+        if ((in = realloc(conn->in, grow)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : failed growing input buffer to %u.", grow);
+            crud_server_close(worker, conn);
+            return;
+        }
+        conn->in = in;
+        conn->in_cap = grow;
+    }
+
+    got = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+    if (got == 0 || (got == -1 && errno != EAGAIN && errno != EINTR))
+    {
+        crud_server_close(worker, conn);
+        return;
+    }
+    if (got > 0)
+        conn->in_len += (uint32_t) got;
+    crud_server_process(worker, conn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_process
+// Description  : Execute the complete requests received and send their
+//                responses, for as long as the socket takes them.  Once too
+//                many response bytes wait, the rest of the requests stay in
+//                the input until the connection is writable again.
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : none
+
+static void crud_server_process(CrudServerWorker *worker, CrudServerConnection *conn) {
+    // Declare variables
+    uint32_t need;
+
+    do {
+        while (!conn->closing && conn->out_len - conn->out_sent < CRUD_SERVER_MAX_PENDING)
+        {
+            need = crud_server_needed(conn->in + conn->in_start, conn->in_len - conn->in_start);
+            if (conn->in_len - conn->in_start < need)
+                break;
+            if (crud_server_execute(conn, conn->in + conn->in_start, need) != 0)
+                conn->closing = 1;
+            conn->in_start += need;
+            worker->requests++;
+        }
+        if (conn->in_start == conn->in_len)
+            conn->in_start = conn->in_len = 0;
+        if (crud_server_output(worker, conn) != 0)
+            return;
+    } while (conn->out_len == 0 && conn->in_len - conn->in_start >=
+            crud_server_needed(conn->in + conn->in_start, conn->in_len - conn->in_start));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_output
+// Description  : Send the responses waiting on a connection.  If the socket
+//                cannot take them all the connection waits for EPOLLOUT
+//                (and stops reading) until it can.
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : 0 if the connection is still open, -1 if it was closed
+
+static int crud_server_output(CrudServerWorker *worker, CrudServerConnection *conn) {
+    // Declare variables
+    struct epoll_event ev;
+    ssize_t sent;
+    uint8_t writing;
+
+    while (conn->out_sent < conn->out_len)
+    {
+        sent = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (sent == -1 && (errno == EAGAIN || errno == EINTR))
+            break;
+        if (sent <= 0)
+        {
+            crud_server_close(worker, conn);
+            return -1;
+        }
+        conn->out_sent += (uint32_t) sent;
+    }
+    if (conn->out_sent == conn->out_len)
+    {
+        conn->out_sent = conn->out_len = 0;
+        if (conn->closing)
+        {
+            crud_server_close(worker, conn);
+            return -1;
+        }
+    }
+
+    // Wait for room in the socket, or for more requests
+    writing = (conn->out_len > 0);
+    if (writing != conn->writing)
+    {
+        conn->writing = writing;
+        ev.events = writing ? EPOLLOUT : EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_close
+// Description  : Close a connection and release it
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : none
+
+static void crud_server_close(CrudServerWorker *worker, CrudServerConnection *conn) {
+    epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_needed
+// Description  : Work out the size of the request at the front of the input
+//                (header, extension word and payload)
+//
+// Inputs       : msg - the first byte of the request
+//                avail - the bytes of it received so far
+// Outputs      : the bytes of the whole request (just the header size if
+//                the header is not in yet, or up to the coded size word of
+//                a coded payload if that is not)
+
+static uint32_t crud_server_needed(char *msg, uint32_t avail) {
+    // Declare variables
+    CrudRequest op;
+    uint32_t need = sizeof(CrudRequest), length, coded;
+    int req;
+
+    if (avail < sizeof(CrudRequest))
+        return need;
+    memcpy(&op, msg, sizeof(op));
+    op = ntohll64(op);
+    req = CRUD_HEADER_REQ(op);
+    length = CRUD_HEADER_LENGTH(op);
+
+    if (req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE)
+        need += sizeof(CrudRequestExt);
+
+    // A coded payload is as long as its size word says
+    if ((req == CRUD_CREATE || req == CRUD_UPDATE || req == CRUD_UPDATE_RANGE) &&
+            (CRUD_HEADER_FLAGS(op) & CRUD_COMPRESSED_FLAG))
+    {
+        need += sizeof(coded);
+        if (avail < need)
+            return need;
+        memcpy(&coded, msg + need - sizeof(coded), sizeof(coded));
+        coded = ntohl(coded);
+        return need + ((coded < CRUD_COMPRESS_BOUND(length)) ? coded : CRUD_COMPRESS_BOUND(length));
+    }
+    if (req == CRUD_CREATE || req == CRUD_UPDATE || req == CRUD_UPDATE_RANGE || req == CRUD_COMPOUND)
+        need += length;
+    return need;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_execute
+// Description  : Execute a request received in full, adding its response to
+//                the output
+//
+// Inputs       : conn - the connection
+//                msg - the request (header, extension word, payload)
+//                size - the size of the request
+// Outputs      : 0 if successful, -1 if the connection must be closed (after
+//                the response is sent)
+
+static int crud_server_execute(CrudServerConnection *conn, char *msg, uint32_t size) {
+    // Declare variables
+    CrudRequest op;
+    CrudRequestExt ext = 0;
+    CrudResponse response;
+    char *payload = msg + sizeof(CrudRequest);
+    int req;
+
+    memcpy(&op, msg, sizeof(op));
+    op = ntohll64(op);
+    req = CRUD_HEADER_REQ(op);
+    if (req == CRUD_COMPOUND)
+        return crud_server_compound(conn, msg, size);
+
+    if (req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE)
+    {
+        memcpy(&ext, payload, sizeof(ext));
+        ext = ntohll64(ext);
+        payload += sizeof(ext);
+    }
+    if (crud_server_request(conn, op, ext, payload, UINT32_MAX, &response) != 0)
+        return -1;
+
+    // Unknown requests cannot be framed, and CRUD_CLOSE ends the connection
+    return (req == CRUD_CLOSE || req >= CRUD_MAXVAL || req == CRUD_UNKNOWN) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_compound
+// Description  : Execute the sub-requests of a CRUD_COMPOUND in order,
+//                stopping after the first that fails, and answer with one
+//                response holding the sub-responses (see crud_driver.h)
+//
+// Inputs       : conn - the connection
+//                msg - the request
+//                size - the size of the request
+// Outputs      : 0 if successful, -1 if the connection must be closed
+
+static int crud_server_compound(CrudServerConnection *conn, char *msg, uint32_t size) {
+    // Declare variables
+    CrudRequest op, sub;
+    CrudRequestExt ext;
+    CrudResponse response;
+    uint32_t count, executed = 0, pos = sizeof(CrudRequest), start, need, body;
+    int req, failed = 0, closing = 0;
+    char *header, *payload;
+
+    memcpy(&op, msg, sizeof(op));
+    op = ntohll64(op);
+    count = CRUD_HEADER_OID(op);
+
+    // Leave room for the compound header, the sub-responses follow it
+    if (crud_server_reserve(conn, sizeof(CrudResponse)) == NULL)
+        return -1;
+    start = conn->out_len;
+    conn->out_len += sizeof(CrudResponse);
+
+    while (executed < count && !failed)
+    {
+        // Each sub-request must lie within the body
+        need = crud_server_needed(msg + pos, size - pos);
+        if (size - pos < need)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : malformed compound request.");
+            return -1;
+        }
+        memcpy(&sub, msg + pos, sizeof(sub));
+        sub = ntohll64(sub);
+        req = CRUD_HEADER_REQ(sub);
+        ext = 0;
+        payload = msg + pos + sizeof(sub);
+        if (req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE)
+        {
+            memcpy(&ext, payload, sizeof(ext));
+            ext = ntohll64(ext);
+            payload += sizeof(ext);
+        }
+
+        // The body may only hold plain (uncoded) requests, with a CRUD_CLOSE last
+        if (req == CRUD_INIT || req == CRUD_COMPOUND || req == CRUD_UNKNOWN ||
+                req >= CRUD_MAXVAL || closing || (CRUD_HEADER_FLAGS(sub) & CRUD_COMPRESSED_FLAG))
+        {
+            header = crud_server_reserve(conn, sizeof(CrudResponse));
+            if (header == NULL)
+                return -1;
+            *(uint64_t *) header = htonll64(sub | CRUD_HEADER_RES_MASK);
+            conn->out_len += sizeof(CrudResponse);
+            failed = 1;
+        }
+        else
+        {
+            body = conn->out_len - start - sizeof(CrudResponse);
+            if (crud_server_request(conn, sub, ext, payload, 0xffffff - body, &response) != 0)
+                return -1;
+            failed = CRUD_HEADER_RESULT(response) != 0;
+            closing = (req == CRUD_CLOSE);
+        }
+        executed++;
+        pos += need;
+    }
+
+    // Fill in the compound header (the buffer may have moved)
+    body = conn->out_len - start - sizeof(CrudResponse);
+    op = construct_crud_request(executed, CRUD_COMPOUND, body, 0, (uint8_t) failed);
+    *(uint64_t *) (conn->out + start) = htonll64(op);
+    return (closing && !failed) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_request
+// Description  : Execute a plain request on the store, adding its response
+//                (and any read bytes) to the output.  Reads go straight from
+//                the store into the output buffer, and are coded there if
+//                the client allows it and they shrink.
+//
+// Inputs       : conn - the connection
+//                op - the request
+//                ext - the extension word (range requests only)
+//                payload - the request payload (CREATE/UPDATE)
+//                limit - most bytes a read may add (the rest fails it)
+//                response - the place to put the response
+// Outputs      : 0 if successful, -1 if failure (out of memory)
+
+static int crud_server_request(CrudServerConnection *conn, CrudRequest op, CrudRequestExt ext,
+        char *payload, uint32_t limit, CrudResponse *response) {
+    // Declare variables
+    uint32_t length = CRUD_HEADER_LENGTH(op), got = 0, coded;
+    int req = CRUD_HEADER_REQ(op), compressed;
+    char *out, *scratch;
+
+    // The store never sees the coding flag
+    compressed = (CRUD_HEADER_FLAGS(op) & CRUD_COMPRESSED_FLAG) != 0;
+    op = CRUD_HEADER_CLEAR_FLAGS(op, CRUD_COMPRESSED_FLAG);
+
+    // Decode a coded payload (framed by crud_server_needed)
+    if (compressed && (req == CRUD_CREATE || req == CRUD_UPDATE || req == CRUD_UPDATE_RANGE))
+    {
+        if ((scratch = crud_server_scratch(length)) == NULL ||
+                (out = crud_server_reserve(conn, sizeof(CrudResponse))) == NULL)
+            return -1;
+        memcpy(&coded, payload, sizeof(coded));
+        coded = ntohl(coded);
+        if (coded > CRUD_COMPRESS_BOUND(length) ||
+                crud_decompress(payload + sizeof(coded), coded, scratch, length) != 0)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : bad coded payload [%u bytes coded].", coded);
+            *response = op | CRUD_HEADER_RES_MASK;
+            *(uint64_t *) out = htonll64(*response);
+            conn->out_len += sizeof(CrudResponse);
+            return 0;
+        }
+        payload = scratch;
+    }
+
+    if (req == CRUD_READ || req == CRUD_READ_RANGE)
+    {
+        if ((out = crud_server_reserve(conn, sizeof(CrudResponse) + length)) == NULL)
+            return -1;
+        *response = (sizeof(CrudResponse) + length > limit) ? (op | CRUD_HEADER_RES_MASK) :
+                crud_store_request(op, ext, out + sizeof(CrudResponse), 0, UINT32_MAX);
+        if (!CRUD_HEADER_RESULT(*response))
+            got = CRUD_HEADER_LENGTH(*response);
+
+        // Code the read bytes if asked and they shrink by a sixteenth
+        if (compressed && got >= CRUD_COMPRESS_MIN_BYTES)
+        {
+            if ((scratch = crud_server_scratch(got)) == NULL)
+                return -1;
+            coded = crud_compress(out + sizeof(CrudResponse), got, scratch,
+                    got - got / 16 - sizeof(coded));
+            if (coded > 0)
+            {
+                *(uint32_t *) (out + sizeof(CrudResponse)) = htonl(coded);
+                memcpy(out + sizeof(CrudResponse) + sizeof(coded), scratch, coded);
+                *response = CRUD_HEADER_SET_FLAGS(*response, CRUD_COMPRESSED_FLAG);
+                got = sizeof(coded) + coded;
+            }
+        }
+    }
+    else if (req < CRUD_MAXVAL && req != CRUD_UNKNOWN && req != CRUD_COMPOUND)
+    {
+        if ((out = crud_server_reserve(conn, sizeof(CrudResponse))) == NULL)
+            return -1;
+        *response = crud_store_request(op, ext, payload, 0, UINT32_MAX);
+
+        // The server codes payloads on top of what the store offers
+        if (req == CRUD_INIT && (CRUD_HEADER_FLAGS(op) & CRUD_EXT_PROBE_FLAG) && !CRUD_HEADER_RESULT(*response))
+            *response |= (CrudResponse) CRUD_CAP_COMPRESS << CRUD_HEADER_LENGTH_SHIFT;
+    }
+    else
+    {
+        if ((out = crud_server_reserve(conn, sizeof(CrudResponse))) == NULL)
+            return -1;
+        logMessage(LOG_ERROR_LEVEL, "CRUD server : unknown request type [%d].", req);
+        *response = op | CRUD_HEADER_RES_MASK;
+    }
+
+    *(uint64_t *) out = htonll64(*response);
+    conn->out_len += sizeof(CrudResponse) + got;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_reserve
+// Description  : Make room for bytes at the end of the output of a
+//                connection
+//
+// Inputs       : conn - the connection
+//                bytes - the bytes to be added
+// Outputs      : the place to put them, or NULL if failure
+
+static char *crud_server_reserve(CrudServerConnection *conn, uint32_t bytes) {
+    // Declare variables
+    uint32_t grow = (conn->out_cap > 0) ? conn->out_cap : CRUD_SERVER_BUFFER;
+    char *out;
+
+    if (conn->out_len + bytes > conn->out_cap)
+    {
+        while (grow < conn->out_len + bytes)
+            grow *= 2;
+        if ((out = realloc(conn->out, grow)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : failed growing output buffer to %u.", grow);
+            return NULL;
+        }
+        conn->out = out;
+        conn->out_cap = grow;
+    }
+    return conn->out + conn->out_len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_scratch
+// Description  : Get the scratch buffer of the worker, large enough for the
+//                coding of bytes
+//
+// Inputs       : bytes - the bytes to be coded or decoded
+// Outputs      : the buffer, or NULL if failure
+
+static char *crud_server_scratch(uint32_t bytes) {
+    // Declare variables
+    uint32_t size = CRUD_COMPRESS_BOUND(bytes);
+    char *scratch;
+
+    if (size > crud_scratch_size)
+    {
+        if ((scratch = realloc(crud_scratch, size)) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD server : failed growing scratch buffer to %u.", size);
+            return NULL;
+        }
+        crud_scratch = scratch;
+        crud_scratch_size = size;
+    }
+    return crud_scratch;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_signal
+// Description  : Start the shutdown on SIGINT/SIGTERM, waking every worker
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+static void crud_server_signal(int sig) {
+    // Declare variables
+    uint64_t one = 1;
+
+    (void) sig;
+    __atomic_store_n(&crud_network_shutdown, 1, __ATOMIC_RELAXED);
+    if (write(crud_shutdown_event, &one, sizeof(one)) == -1)
+        return;
+}
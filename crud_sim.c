@@ -17,41 +17,212 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 // Project Includes
 #include <crud_driver.h>
 #include <crud_network.h>
 #include <crud_file_io.h>
+#include <crud_cache.h>
+#include <crud_bench.h>
+#include <crud_compress.h>
+#include <crud_slab.h>
+#include <crud_uring.h>
+#include <crud_fsck.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define CRUD_SIM_MAX_OPEN_FILES 128
-#define CRUD_ARGUMENTS "hvul:x:a:p:"
+#define CRUD_SIM_HASH_BUCKETS 256 // Buckets of the open file index (power of 2)
+#define CRUD_SIM_MAX_JOBS 32 // Most replay threads (each may hold a connection)
+#define CRUD_SIM_TRACE_MAGIC "CRUDTRC1" // First bytes of a binary workload trace
+#define CRUD_SIM_TRACE_ORDER 0x01020304 // Byte order mark of a trace
+#define CRUD_SIM_TRACE_MAX_NAMES 65536  // Files a trace can name (power of 2)
+#define CRUD_SIM_TRACE_ALIGN(x) (((x) + 3) & ~3) // Sections start 4-aligned
+#define CRUD_ARGUMENTS "hvuqwdzmifgl:c:k:r:j:e:t:b:x:a:p:s:"
 #define USAGE \
-	"USAGE: crud [-h] [-v] [-l <logfile>] [-c <sz>] [-x <file>] [-a <ip addr>] [-p <port>] <workload-file>\n" \
+	"USAGE: crud [-h] [-v] [-q] [-l <logfile>] [-c <sz>] [-w] [-d] [-z] [-m] [-i] [-k <sz>] [-r <sz>] [-j <n>] [-f [-g] [-e <MB/s>]] [-t <trace>] [-b <json>] [-x <file> [<file> ...]] [-a <ip addr>[:port],...] [-p <port>] [-s <store>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -u - run the unit tests instead of the simulator\n" \
 	"    -v - verbose output\n" \
+	"    -q - queue log messages for a background thread to write\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
-	"    -x - extract a file <file> from the crud filesystem\n" \
+	"    -c - size of the object cache in lines (0 disables caching)\n" \
+	"    -w - use a write-back cache (default is write-through)\n" \
+	"    -d - store full chunks of the same contents once (content dedup)\n" \
+	"    -z - code payloads on the wire, for servers that take it (compression)\n" \
+	"    -m - journal file table changes, so files are durable once closed (needs\n" \
+	"         a server that updates by range)\n" \
+	"    -i - send and receive pipelined requests through io_uring (where the\n" \
+	"         system has it, blocking sockets otherwise)\n" \
+	"    -k - size in bytes of the chunks new files are stored in\n" \
+	"    -r - most bytes read ahead of sequential reads (0 disables read-ahead)\n" \
+	"    -j - replay the files of the workload on <n> threads (needs a server\n" \
+	"         that serves concurrent connections), or check the device on them\n" \
+	"    -f - check the device instead (fsck): read every object the files name,\n" \
+	"         checking their lengths, and report the objects nothing names\n" \
+	"    -g - with -f, hash the contents too: check shared chunks against the\n" \
+	"         content index and report a checksum of each file\n" \
+	"    -e - with -f, most megabytes per second to read (the throughput target)\n" \
+	"    -t - convert the workload into the binary trace <trace> (no simulation)\n" \
+	"    -b - benchmark the workload files given (default workload-one, -two and\n" \
+	"         -three, back to back) and write the results to <json> (- is stdout)\n" \
+	"    -x - extract a file <file> from the crud filesystem (and any other files\n" \
+	"         named after the options, in one mount)\n" \
 	"    -a - IP address of server to connect to.\n" \
+	"         A list \"ip[:port],...\" shares the objects between the servers.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -s - keep the objects in the local store file <store> instead of a server\n" \
 	"\n" \
-	"    <workload-file> - file contain the workload to simulate\n" \
+	"    <workload-file> - file contain the workload to simulate (text or trace)\n" \
 	"\n" \
 
 // This is the file table
 typedef struct {
 	char     *filename;  // This is the filename for the test file
 	int16_t   fhandle;   // This is a file handle for the opened file
+	int       next;      // Next entry in the same hash bucket (-1 ends)
 } CrudSimulationTable;
 
+// The commands of a workload
+typedef enum {
+	CRUD_SIM_WRITEAT = 0, // Seek to an offset, then write
+	CRUD_SIM_WRITE   = 1, // Write at the current position
+	CRUD_SIM_SEEK    = 2, // Seek to an offset
+	CRUD_SIM_READ    = 3, // Read at the current position
+	CRUD_SIM_FORMAT  = 4, // Format the filesystem
+	CRUD_SIM_MOUNT   = 5, // Mount the filesystem
+	CRUD_SIM_UNMOUNT = 6, // Unmount the filesystem
+	CRUD_SIM_MAXCMD  = 7, // The number of commands
+} CRUD_SIM_OPERATION;
+
+// The names of the commands in text workloads (checked in this order)
+static const char *crud_sim_commands[CRUD_SIM_MAXCMD] = {
+	"WRITEAT", "WRITE", "SEEK", "READ", "FORMAT", "MOUNT", "UNMOUNT"
+};
+
+// A binary workload trace is this header, the filename table (terminated
+//  names), the operation records and then the text area the writes point
+//  into.  Repeated text is stored once and runs of one byte share the
+//  longest such run, so the text area is small.  Sections start 4-aligned
+//  and all fields are in the byte order of the host that wrote the trace.
+typedef struct {
+	char      magic[8];   // CRUD_SIM_TRACE_MAGIC
+	uint32_t  order;      // CRUD_SIM_TRACE_ORDER
+	uint32_t  nnames;     // The number of names in the filename table
+	uint32_t  nrecords;   // The number of operation records
+	uint32_t  names;      // The file offset of the filename table
+	uint32_t  names_size; // The size of the filename table
+	uint32_t  records;    // The file offset of the records
+	uint32_t  text;       // The file offset of the text area
+	uint32_t  text_size;  // The size of the text area
+} CrudSimTraceHeader;
+
+typedef struct {
+	uint16_t  op;         // The command (CRUD_SIM_OPERATION)
+	uint16_t  name;       // The filename (index in the filename table)
+	int32_t   len;        // The length field of the workload line
+	int32_t   off;        // The offset field of the workload line
+	uint32_t  text;       // Where the text is in the text area (writes)
+} CrudSimTraceRecord;
+
+// A text placed in the text area of a trace being built
+typedef struct {
+	uint32_t  off;        // Where the text is in the area
+	uint32_t  len;        // The length of the text
+	int       next;       // Next text in the same bucket (-1 ends)
+} CrudSimTraceText;
+
+// The state of a workload being converted to a trace
+typedef struct {
+	CrudSimTraceRecord *records; // The records
+	char    **wtext;       // The text of each write (in the workload mapping)
+	uint32_t  nrecords;    // The number of records
+	uint32_t  maxrecords;  // The space allocated for records
+	char    **names;       // The filenames (in the workload mapping)
+	int      *nhash;       // The filename index
+	int      *nnext;       // Next filename in the same bucket (-1 ends)
+	uint32_t  nnames;      // The number of filenames
+	uint32_t  names_size;  // The size of the filename table
+	uint32_t  runs[256];   // The longest run of each byte
+	uint32_t  runoff[256]; // Where those runs are in the text area
+	char     *area;        // The text area
+	uint32_t  size;        // The size of the text area
+	uint32_t  maxsize;     // The space allocated for the area
+	CrudSimTraceText *placed; // The texts placed in the area
+	uint32_t  nplaced;     // The number of texts placed
+	uint32_t  maxplaced;   // The space allocated for them
+	int      *buckets;     // The index of the placed texts
+	uint32_t  nbuckets;    // The number of buckets (power of 2)
+} CrudSimConversion;
+
+// A workload file mapped into memory, tokenized in place
+typedef struct {
+	char     *base;    // The start of the mapping
+	char     *cur;     // The start of the next line
+	char     *end;     // The end of the mapping
+	int       line;    // The number of the last line parsed
+
+	// Binary traces only
+	CrudSimTraceRecord *records; // The records (NULL for a text workload)
+	uint32_t  nrecords;  // The number of records
+	char    **names;     // The filename table
+	uint32_t  nnames;    // The number of filenames
+	char     *text;      // The text area
+	uint32_t  text_size; // The size of the text area
+} CrudSimWorkload;
+
+// One parsed workload line (pointing into the mapping)
+typedef struct {
+	char     *fname;   // The filename (terminated in place)
+	char     *command; // The command (terminated in place)
+	int32_t   len;     // The length field
+	int32_t   off;     // The offset field
+	char     *text;    // The text after the ':' ('*' turned into '\n')
+	int32_t   textlen; // The bytes of text on the line
+} CrudSimLine;
+
+// A file operation queued for a parallel replay
+typedef struct {
+	CRUD_SIM_OPERATION op;   // The operation to perform
+	int32_t            len;  // The length field of the workload line
+	int32_t            off;  // The offset field of the workload line
+	int32_t            line; // The workload line number (for errors)
+	char              *text; // The bytes to write (in the workload mapping)
+} CrudSimOperation;
+
+// A file of the parallel replay, with its queued operations and the contents
+//  a serial replay would have given it
+typedef struct {
+	char             *filename; // This is the filename for the test file
+	int16_t           fhandle;  // The file handle (-1 if not yet opened)
+	int               next;     // Next entry in the same hash bucket (-1 ends)
+	CrudSimOperation *ops;      // The operations queued in this segment
+	int               nops;     // The number of queued operations
+	int               maxops;   // The space allocated for operations
+	char             *model;    // The expected contents of the file
+	uint32_t          length;   // The expected length of the file
+	uint32_t          position; // The expected position in the file
+	uint32_t          size;     // The space allocated for the model
+} CrudSimReplayFile;
+
+// The state shared by the replay threads
+typedef struct {
+	CrudSimReplayFile files[CRUD_SIM_MAX_OPEN_FILES]; // The files in use
+	int               fhash[CRUD_SIM_HASH_BUCKETS];   // The filename index
+	int               nfiles;  // The number of files in use
+	int               queued;  // Operations queued in this segment
+	int               next;    // The next file to hand to a thread
+	int               failed;  // Set once any thread fails
+} CrudSimReplay;
+
 //
 // Global Data
 int verbose;
@@ -60,7 +231,12 @@ int verbose;
 // Functional Prototypes
 
 int simulate_CRUD( char *wload );
+int replay_CRUD( char *wload, int jobs );
+int convert_workload( char *wload, char *trace );
+int benchmark_CRUD( char **wloads, int count, int jobs, char *json );
 int extract_file_from_crud(char *ex_file);
+int extract_files_from_crud(char *ex_file, char **others, int count);
+int check_crud( int jobs, int checksums, double rate );
 
 //
 // Functions
@@ -76,9 +252,13 @@ int extract_file_from_crud(char *ex_file);
 
 int main( int argc, char *argv[] ) {
 	// Local variables
-	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0;
-	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
-	char *ex_file = NULL;
+	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, log_async = 0, extract_file = 0, jobs = 1;
+	int fsck = 0, checksums = 0;
+	double rate = 0;
+	uint32_t cache_size = CRUD_CACHE_DEFAULT_LINES; // Defaults to 1024 cache lines
+	uint32_t chunk_size, read_ahead;
+	CRUD_CACHE_POLICY cache_policy = CRUD_CACHE_WRITE_THROUGH;
+	char *ex_file = NULL, *trace_file = NULL, *bench_file = NULL;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CRUD_ARGUMENTS)) != -1) {
@@ -96,16 +276,43 @@ int main( int argc, char *argv[] ) {
 			unit_tests = 1;
 			break;
 
+		case 'q': // Asynchronous log flag
+			log_async = 1;
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
 			break;
 
+		case 't': // Convert the workload to a binary trace
+			trace_file = optarg;
+			break;
+
+		case 'b': // Benchmark the workloads
+			bench_file = optarg;
+			break;
+
 		case 'x': // Set the log filename
 			ex_file = optarg;
 			extract_file = 1;
 			break;
 
+		case 'f': // Check the device
+			fsck = 1;
+			break;
+
+		case 'g': // Hash the contents as the device is checked
+			checksums = 1;
+			break;
+
+		case 'e': // Set the throughput target of the check
+			if ( (sscanf( optarg, "%lf", &rate ) != 1) || (rate < 0) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  throughput target [%s]", optarg );
+                return(-1);
+			}
+			break;
+
 		case 'c': // Set cache line size
 			if ( sscanf( optarg, "%u", &cache_size ) != 1 ) {
 			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
@@ -113,9 +320,50 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
-        case 'a': // Get the IP address
-            if (inet_addr(optarg) == INADDR_NONE) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
+		case 'w': // Write-back cache
+			cache_policy = CRUD_CACHE_WRITE_BACK;
+			break;
+
+		case 'd': // Content dedup of full chunks
+			crud_set_dedup( 1 );
+			break;
+
+		case 'z': // Payload compression on the wire
+			crud_network_compress = 1;
+			break;
+
+		case 'm': // Journal of the file table
+			crud_set_journal( 1 );
+			break;
+
+		case 'i': // Pipeline through io_uring
+			crud_network_uring = 1;
+			break;
+
+		case 'k': // Set file chunk size
+			if ( (sscanf( optarg, "%u", &chunk_size ) != 1) || crud_set_chunk_size(chunk_size) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  chunk size [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'r': // Set the read-ahead size
+			if ( (sscanf( optarg, "%u", &read_ahead ) != 1) || crud_set_read_ahead(read_ahead) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  read-ahead size [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'j': // Set the number of replay threads
+			if ( (sscanf( optarg, "%d", &jobs ) != 1) || (jobs < 1) || (jobs > CRUD_SIM_MAX_JOBS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  replay thread count [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+        case 'a': // Get the IP address (or a list of servers, checked on use)
+            if (strpbrk(optarg, ",:") == NULL && inet_addr(optarg) == INADDR_NONE) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  IP address [%s]", optarg );
                 return(-1);
             } 
             crud_network_address = (unsigned char *)strdup(optarg);
@@ -128,6 +376,10 @@ int main( int argc, char *argv[] ) {
 			}
             break;
 
+		case 's': // Use a local store file
+			crud_network_store = optarg;
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -141,13 +393,24 @@ int main( int argc, char *argv[] ) {
 	if ( verbose ) {
 		enableLogLevels( LOG_INFO_LEVEL );
 	}
+	if ( log_async && enableLogAsync(LOG_ASYNC_DEFAULT_ENTRIES) ) {
+		logMessage( LOG_ERROR_LEVEL, "Asynchronous log setup failed, aborting." );
+		return( -1 );
+	}
+
+	// Setup the object cache
+	if ( crud_cache_init(cache_size, cache_policy) ) {
+		logMessage( LOG_ERROR_LEVEL, "Object cache setup failed, aborting." );
+		return( -1 );
+	}
 
 	// If we are running the unit tests, do that
 	if ( unit_tests ) {
 
 		// Enable verbose, run the tests and check the results
 		enableLogLevels( LOG_INFO_LEVEL );
-		if ( b64UnitTest() || crudIOUnitTest() ) {
+		if ( b64UnitTest() || crudCompressUnitTest() || crudSlabUnitTest() || crudUringUnitTest() ||
+				crudIOUnitTest() || crudFsckUnitTest() ) {
 			logMessage( LOG_ERROR_LEVEL, "CRUD unit tests failed.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD unit tests completed successfully.\n\n" );
@@ -155,11 +418,29 @@ int main( int argc, char *argv[] ) {
 
 	} else if (extract_file) {
 
-		// Extracting a file from the crud file systems
-		if (extract_file_from_crud(ex_file) == 0) {
-			logMessage(LOG_INFO_LEVEL, "File [%s] extracted from crud successfully.\n\n", ex_file);
+		// Extracting the file (and any others named) from the crud file system
+		if (extract_files_from_crud(ex_file, &argv[optind], argc - optind) == 0) {
+			logMessage(LOG_INFO_LEVEL, "Files extracted from crud successfully.\n\n");
+		} else {
+			logMessage(LOG_ERROR_LEVEL, "File extraction failed, aborting.\n\n");
+		}
+
+	} else if (fsck) {
+
+		// Check the device
+		if ( check_crud(jobs, checksums, rate) == 0 ) {
+			logMessage( LOG_INFO_LEVEL, "CRUD check found the device clean.\n\n" );
+		} else {
+			logMessage( LOG_ERROR_LEVEL, "CRUD check found problems (see above).\n\n" );
+		}
+
+	} else if (bench_file) {
+
+		// Time the workloads given (or the bundled ones)
+		if ( benchmark_CRUD(&argv[optind], argc - optind, jobs, bench_file) == 0 ) {
+			logMessage( LOG_INFO_LEVEL, "CRUD benchmark completed successfully.\n\n" );
 		} else {
-			logMessage(LOG_ERROR_LEVEL, "File [%s] extraction failed, aborting.\n\n");
+			logMessage( LOG_ERROR_LEVEL, "CRUD benchmark failed.\n\n" );
 		}
 
 	} else {
@@ -173,8 +454,16 @@ int main( int argc, char *argv[] ) {
 
 		}
 
-		// Run the simulation
-		if ( simulate_CRUD(argv[optind]) == 0 ) {
+		// Convert the workload, if asked to
+		if ( trace_file != NULL ) {
+			if ( convert_workload(argv[optind], trace_file) == 0 ) {
+				logMessage( LOG_INFO_LEVEL, "CRUD workload converted successfully.\n\n" );
+			} else {
+				logMessage( LOG_ERROR_LEVEL, "CRUD workload conversion failed.\n\n" );
+			}
+
+		// Run the simulation (serially or on the replay threads)
+		} else if ( ((jobs > 1) ? replay_CRUD(argv[optind], jobs) : simulate_CRUD(argv[optind])) == 0 ) {
 			logMessage( LOG_INFO_LEVEL, "CRUD simulation completed successfully.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD simulation failed.\n\n" );
@@ -185,6 +474,309 @@ int main( int argc, char *argv[] ) {
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_command
+// Description  : Find the workload command a text command names
+//
+// Inputs       : command - the command text
+// Outputs      : the command, -1 if unknown
+
+int workload_command( char *command ) {
+
+	// Local variables
+	int i;
+
+	// Prefix matches, as the simulator always has (WRITEAT before WRITE)
+	for (i=0; i<CRUD_SIM_MAXCMD; i++) {
+		if ( strncmp(command, crud_sim_commands[i], strlen(crud_sim_commands[i])) == 0 ) {
+			return( i );
+		}
+	}
+	return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_trace
+// Description  : Check the layout of a mapped binary trace and index its
+//                filename table
+//
+// Inputs       : workload - the mapped workload (base and end set)
+// Outputs      : 0 if successful, -1 if failure
+
+int workload_trace( CrudSimWorkload *workload ) {
+
+	// Local variables
+	CrudSimTraceHeader *hdr = (CrudSimTraceHeader *)workload->base;
+	uint64_t size = workload->end - workload->base;
+	char *name, *names_end;
+	uint32_t i;
+
+	// Check the byte order and that every section is inside the file
+	if ( (hdr->order != CRUD_SIM_TRACE_ORDER) || (hdr->nnames > CRUD_SIM_TRACE_MAX_NAMES) ||
+			((uint64_t)hdr->names + hdr->names_size > size) ||
+			(hdr->records % sizeof(uint32_t)) ||
+			((uint64_t)hdr->records + (uint64_t)hdr->nrecords * sizeof(CrudSimTraceRecord) > size) ||
+			((uint64_t)hdr->text + hdr->text_size > size) ) {
+		return( -1 );
+	}
+	workload->records = (CrudSimTraceRecord *)(workload->base + hdr->records);
+	workload->nrecords = hdr->nrecords;
+	workload->text = workload->base + hdr->text;
+	workload->text_size = hdr->text_size;
+
+	// Index the filename table, every name must be terminated
+	if ( (workload->names = malloc(sizeof(char *) * (hdr->nnames + 1))) == NULL ) {
+		return( -1 );
+	}
+	name = workload->base + hdr->names;
+	names_end = name + hdr->names_size;
+	for (i=0; i<hdr->nnames; i++) {
+		workload->names[i] = name;
+		if ( (name = memchr(name, 0x0, names_end - name)) == NULL ) {
+			return( -1 );
+		}
+		name ++;
+	}
+	workload->nnames = hdr->nnames;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_close
+// Description  : Unmap a workload file (the lines returned are invalid after)
+//
+// Inputs       : workload - the workload to close
+// Outputs      : none
+
+void workload_close( CrudSimWorkload *workload ) {
+	if ( workload->base != NULL ) {
+		munmap(workload->base, workload->end - workload->base);
+	}
+	free( workload->names );
+	memset(workload, 0x0, sizeof(CrudSimWorkload));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_open
+// Description  : Map a workload file into memory for parsing.  The mapping
+//                is private so the lines can be tokenized in place.
+//
+// Inputs       : workload - the workload to setup
+//                wload - the name of the workload file
+// Outputs      : 0 if successful, -1 if failure
+
+int workload_open( CrudSimWorkload *workload, char *wload ) {
+
+	// Local variables
+	struct stat st;
+	int fd;
+
+	// Open the file and get its size
+	memset(workload, 0x0, sizeof(CrudSimWorkload));
+	if ( ((fd = open(wload, O_RDONLY)) == -1) || (fstat(fd, &st) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
+			wload, strerror(errno) );
+		if ( fd != -1 ) {
+			close( fd );
+		}
+		return( -1 );
+	}
+
+	// Map it (an empty workload has nothing to map), it is read front to back
+	if ( st.st_size > 0 ) {
+		workload->base = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if ( workload->base == MAP_FAILED ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.\n",
+				wload, strerror(errno) );
+			close( fd );
+			return( -1 );
+		}
+		madvise(workload->base, st.st_size, MADV_SEQUENTIAL);
+	}
+	close( fd );
+	workload->cur = workload->base;
+	workload->end = workload->base + st.st_size;
+
+	// Binary traces are recognized by their first bytes
+	if ( ((size_t)st.st_size >= sizeof(CrudSimTraceHeader)) &&
+			(memcmp(workload->base, CRUD_SIM_TRACE_MAGIC, 8) == 0) ) {
+		if ( workload_trace(workload) ) {
+			logMessage( LOG_ERROR_LEVEL, "Bad workload trace file [%s].\n", wload );
+			workload_close( workload );
+			return( -1 );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_word
+// Description  : Find the next blank separated word of a line
+//
+// Inputs       : p - the parse position (moved to the end of the word)
+//                end - the end of the mapping
+// Outputs      : the word, NULL if the line ends first
+
+char * workload_word( char **p, char *end ) {
+
+	// Local variables
+	char *word;
+
+	// Skip the blanks, then find the end of the word
+	while ( (*p < end) && ((**p == ' ') || (**p == '\t')) ) {
+		(*p)++;
+	}
+	word = *p;
+	while ( (*p < end) && (**p != ' ') && (**p != '\t') && (**p != '\n') ) {
+		(*p)++;
+	}
+
+	// Words must be followed by more of the line
+	if ( (*p == word) || (*p == end) || (**p == '\n') ) {
+		return( NULL );
+	}
+	return( word );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_number
+// Description  : Parse the next (signed decimal) number of a line
+//
+// Inputs       : p - the parse position (moved past the number)
+//                end - the end of the mapping
+//                value - the number parsed
+// Outputs      : 0 if successful, -1 if there is no number
+
+int workload_number( char **p, char *end, int32_t *value ) {
+
+	// Local variables
+	int32_t sign = 1, digits = 0;
+
+	// Skip the blanks and the sign, then add up the digits
+	while ( (*p < end) && ((**p == ' ') || (**p == '\t')) ) {
+		(*p)++;
+	}
+	if ( (*p < end) && (**p == '-') ) {
+		sign = -1;
+		(*p)++;
+	}
+	*value = 0;
+	while ( (*p < end) && (**p >= '0') && (**p <= '9') ) {
+		*value = (*value * 10) + (**p - '0');
+		digits ++;
+		(*p)++;
+	}
+	*value *= sign;
+	return( (digits > 0) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_record
+// Description  : Get the next line of a binary trace from its record
+//
+// Inputs       : workload - the trace being read
+//                wline - the line (pointing into the mapping)
+// Outputs      : 1 if a line was read, 0 at the end, -1 if corrupt
+
+int workload_record( CrudSimWorkload *workload, CrudSimLine *wline ) {
+
+	// Local variables
+	CrudSimTraceRecord *rec;
+	int writes;
+
+	// Check for the end of the trace, then the record
+	if ( workload->line >= workload->nrecords ) {
+		return( 0 );
+	}
+	rec = &workload->records[workload->line++];
+	writes = (rec->op == CRUD_SIM_WRITE) || (rec->op == CRUD_SIM_WRITEAT);
+	if ( (rec->op >= CRUD_SIM_MAXCMD) || (rec->name >= workload->nnames) ||
+			(writes && ((rec->len < 0) || ((uint64_t)rec->text + rec->len > workload->text_size))) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD corrupt workload trace record, aborting, line %d", workload->line );
+		return( -1 );
+	}
+
+	// Fill in the line, the text is only there for writes
+	wline->fname = workload->names[rec->name];
+	wline->command = (char *)crud_sim_commands[rec->op];
+	wline->len = rec->len;
+	wline->off = rec->off;
+	wline->text = workload->text + (writes ? rec->text : 0);
+	wline->textlen = writes ? rec->len : 0;
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workload_next
+// Description  : Parse the next line of a workload ("file command len off:
+//                text") in place.  The text is left in the mapping with its
+//                '*'s turned into newlines, so it can be any length.
+//
+// Inputs       : workload - the workload being parsed
+//                wline - the parsed line (pointing into the mapping)
+// Outputs      : 1 if a line was parsed, 0 at the end, -1 if un-parsable
+
+int workload_next( CrudSimWorkload *workload, CrudSimLine *wline ) {
+
+	// Local variables
+	char *p = workload->cur, *start = workload->cur, *eol, *fend = NULL, *cend = NULL;
+
+	// Traced lines are just records
+	if ( workload->records != NULL ) {
+		return( workload_record(workload, wline) );
+	}
+
+	// Check for the end of the workload
+	if ( p >= workload->end ) {
+		return( 0 );
+	}
+	workload->line ++;
+
+	// Parse the fields, then find the start of the text
+	if ( (wline->fname = workload_word(&p, workload->end)) != NULL ) {
+		fend = p;
+		if ( (wline->command = workload_word(&p, workload->end)) != NULL ) {
+			cend = p;
+		}
+	}
+	if ( (cend == NULL) || workload_number(&p, workload->end, &wline->len) ||
+			workload_number(&p, workload->end, &wline->off) ) {
+		p = NULL;
+	}
+	while ( (p != NULL) && (p < workload->end) && (*p != ':') && (*p != '\n') ) {
+		p++;
+	}
+	if ( (p == NULL) || (p == workload->end) || (*p != ':') ) {
+		eol = memchr(start, '\n', workload->end - start);
+		logMessage( LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%.*s], line %d",
+				(int)(((eol != NULL) ? eol : workload->end) - start), start, workload->line );
+		return( -1 );
+	}
+
+	// Terminate the words, then the text lines while finding the end of the
+	//  line (one pass)
+	*fend = 0x0;
+	*cend = 0x0;
+	wline->text = ++p;
+	while ( (p < workload->end) && (*p != '\n') ) {
+		if ( *p == '*' ) {
+			*p = '\n';
+		}
+		p++;
+	}
+	wline->textlen = p - wline->text;
+	workload->cur = (p < workload->end) ? p + 1 : p;
+	return( 1 );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : simulate_CRUD
@@ -197,244 +789,1162 @@ int main( int argc, char *argv[] ) {
 int simulate_CRUD( char *wload ) {
 
 	// Local variables
-	char line[2048], fname[128], command[128], text[2048], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
+	char *fname, *command, *text, *rbuf;
+	CrudSimWorkload workload;
+	CrudSimLine wline;
+	int32_t err=0, len, off, got;
 	CrudSimulationTable ftable[CRUD_SIM_MAX_OPEN_FILES];
+	int fhash[CRUD_SIM_HASH_BUCKETS];
 	int idx, i;
+	uint64_t writes, flushes, shared, saved, records, batches, runs, ahead, buffers, reused;
+	uint32_t bucket;
 
-	// Setup the file table
+	// Setup the file table and its (empty) filename index
 	memset(ftable, 0x0, sizeof(CrudSimulationTable)*CRUD_SIM_MAX_OPEN_FILES);
+	for (i=0; i<CRUD_SIM_HASH_BUCKETS; i++) {
+		fhash[i] = -1;
+	}
 
-	// Open the workload file
-	linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
-		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
-			wload, strerror(errno) );
+	// Map the workload file
+	if ( workload_open(&workload, wload) ) {
 		return( -1 );
 	}
 
 	// While file not done
-	while (!feof(fhandle)) {
-
-		// Get the line and bail out on fail
-		if (fgets(line, 2048, fhandle) != NULL) {
-
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
-				return( -1 );
+	while ( (got = workload_next(&workload, &wline)) > 0 ) {
+
+		// Pick out the fields
+		fname = wline.fname;
+		command = wline.command;
+		len = wline.len;
+		off = wline.off;
+		text = wline.text;
+
+		// Just log the contents
+		logMessage(LOG_INFO_LEVEL, "File [%s], command [%s], len=%d, offset=%d",
+				fname, command, len, off);
+
+		// Now process the commands
+		if (strncmp(command, "FORMAT", 6) == 0) {
+
+			// Log the command executed
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+
+			// Now perform the format
+			if (CRUD_BENCH_TIMED(CRUD_BENCH_FORMAT, 0, crud_format()) != len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
+				return(-1);
 			}
 
-			// Just log the contents
-			logMessage(LOG_INFO_LEVEL, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
+		} else if (strncmp(command, "MOUNT", 5) == 0) {
 
-			// Now process the commands
-			if (strncmp(command, "FORMAT", 6) == 0) {
+			// Log the command executed
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+			// Now perform the filesystem mount
+			if (CRUD_BENCH_TIMED(CRUD_BENCH_MOUNT, 0, crud_mount()) != len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+				return(-1);
+			}
 
-				// Now perform the format
-				if (crud_format() != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
-					return(-1);
+		} else if (strncmp(command, "UNMOUNT", 5) == 0) {
+
+			// Log the command executed
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
+
+			// Finished, close all of the files
+			for (idx=0; idx<CRUD_SIM_MAX_OPEN_FILES; idx++) {
+
+				// If file in use, close if
+				if (ftable[idx].filename != NULL) {
+					// Log the file close
+					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", ftable[idx].filename);
+					if (CRUD_BENCH_TIMED(CRUD_BENCH_CLOSE, 0, crud_close(ftable[idx].fhandle)) == -1) {
+						// Failed, error out
+						logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", ftable[idx].filename);
+						return(-1);
+					}
+					free(ftable[idx].filename);
+					ftable[idx].filename = NULL;
 				}
 
-			} else if (strncmp(command, "MOUNT", 5) == 0) {
+			}
+			for (i=0; i<CRUD_SIM_HASH_BUCKETS; i++) {
+				fhash[i] = -1;
+			}
+
+			// Now perform the filesystem unmount
+			if (CRUD_BENCH_TIMED(CRUD_BENCH_UNMOUNT, 0, crud_unmount()) != len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+				return(-1);
+			}
+
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
+		} else {
+
+			//
+			// File operations
+
+			// Now look the file up in the index
+			bucket = hashString(fname) & (CRUD_SIM_HASH_BUCKETS-1);
+			idx = fhash[bucket];
+			while ( (idx != -1) && (strcmp(ftable[idx].filename,fname) != 0) ) {
+				idx = ftable[idx].next;
+			}
 
-				// Now perform the filesystem mount
-				if (crud_mount() != len) {
+			// File is not found, open the file
+			if (idx == -1) {
+
+				// Log message, find unused index and save filename for later use
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
+				idx = 0;
+				while ((idx < CRUD_SIM_MAX_OPEN_FILES) && (ftable[idx].filename != NULL)) {
+					idx++;
+				}
+				CMPSC_ASSERT1(idx<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", idx);
+				ftable[idx].filename = strdup(fname);
+				ftable[idx].next = fhash[bucket];
+				fhash[bucket] = idx;
+
+				// Now perform the open
+				ftable[idx].fhandle = CRUD_BENCH_TIMED(CRUD_BENCH_OPEN, 0, crud_open(ftable[idx].filename));
+				if (ftable[idx].fhandle == -1) {
 					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
 					return(-1);
 				}
 
-			} else if (strncmp(command, "UNMOUNT", 5) == 0) {
+			}
+
+			// Now execute the specific command
+			if (strncmp(command, "WRITEAT", 7) == 0) {
 
 				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
-
-				// Finished, close all of the files
-				for (idx=0; idx<CRUD_SIM_MAX_OPEN_FILES; idx++) {
-
-					// If file in use, close if
-					if (ftable[idx].filename != NULL) {
-						// Log the file close
-						logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", ftable[idx].filename);
-						if (crud_close(ftable[idx].fhandle) == -1) {
-							// Failed, error out
-							logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", ftable[idx].filename);
-							return(-1);
-						}
-						free(ftable[idx].filename);
-						ftable[idx].filename = NULL;
-					}
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
 
+				// First perform the seek
+				if (CRUD_BENCH_TIMED(CRUD_BENCH_SEEK, 0, crud_seek(ftable[idx].fhandle, off))) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
+					return(-1);
 				}
 
-				// Now perform the filesystem unmount
-				if (crud_unmount() != len) {
+				// Check the line has all of the text
+				CMPSC_ASSERT2((wline.textlen>=len), "Workload str [%d<%d]", wline.textlen, len);
+
+				// Now perform the write
+				if (CRUD_BENCH_TIMED(CRUD_BENCH_WRITE, len, crud_write(ftable[idx].fhandle, text, len)) != len) {
 					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
 					return(-1);
 				}
 
+			} else if (strncmp(command, "WRITE", 5) == 0) {
 
-			} else {
+				// Check the line has all of the text
+				CMPSC_ASSERT2((wline.textlen>=len), "Workload str [%d<%d]", wline.textlen, len);
 
-				//
-				// File operations
+				// Log the command executed
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", len, fname);
 
-				// Now walk the the table looking for the file
-				idx = -1;
-				i = 0;
-				while ( (i < CRUD_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-					if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-						idx = i;
-					}
-					i++;
+				// Now perform the write
+				if (CRUD_BENCH_TIMED(CRUD_BENCH_WRITE, len, crud_write(ftable[idx].fhandle, text, len)) != len) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
+					return(-1);
 				}
 
-				// File is not found, open the file
-				if (idx == -1) {
-
-					// Log message, find unused index and save filename for later use
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
-					idx = 0;
-					while ((ftable[idx].filename != NULL) && (idx < CRUD_SIM_MAX_OPEN_FILES)) {
-						idx++;
-					}
-					CMPSC_ASSERT1(idx<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", idx);
-					ftable[idx].filename = strdup(fname);
+			} else if (strncmp(command, "SEEK", 4) == 0) {
 
-					// Now perform the open
-					ftable[idx].fhandle = crud_open(ftable[idx].filename);
-					if (ftable[idx].fhandle == -1) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-						return(-1);
-					}
+				// Log the command executed
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", off, fname);
 
+				// Now perform the seek
+				if (CRUD_BENCH_TIMED(CRUD_BENCH_SEEK, 0, crud_seek(ftable[idx].fhandle, off)) != len) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
+					return(-1);
 				}
 
-				// Now execute the specific command
-				if (strncmp(command, "WRITEAT", 7) == 0) {
+			} else if (strncmp(command, "READ", 4) == 0) {
 
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
+				// Log the command executed
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", len, fname);
 
-					// First perform the seek
-					if (crud_seek(ftable[idx].fhandle, off)) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
+				// Now perform the read
+				rbuf = malloc(len);
+				if (CRUD_BENCH_TIMED(CRUD_BENCH_READ, len, crud_read(ftable[idx].fhandle, rbuf, len)) != len) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
+					return(-1);
+				}
+				free(rbuf);
+				rbuf = NULL;
 
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
+			} else {
 
-					// Now perform the write
-					if (crud_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
+				// Bomb out, don't understand the command
+				CMPSC_ASSERT1(0, "CRUD_SIM : Failed, unknown command [%s]", command);
 
-				} else if (strncmp(command, "WRITE", 5) == 0) {
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
+			}
+		}
 
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", len, fname);
+		// Check for the virtual level failing
+		if ( err ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
+			workload_close( &workload );
+			return( -1 );
+		}
+	}
+	if ( got == -1 ) {
+		workload_close( &workload );
+		return( -1 );
+	}
 
-					// Now perform the write
-					if (crud_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
+	// Report how many backend writes the write buffers saved
+	crud_write_buffer_stats( &writes, &flushes );
+	logMessage( LOG_OUTPUT_LEVEL, "CRUD write buffer : %lu writes buffered in %lu flushes, %lu backend writes saved.",
+		writes, flushes, (writes > flushes) ? writes - flushes : 0 );
+	crud_dedup_stats( &shared, &saved );
+	if ( shared > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD dedup : %lu chunks found already stored, %lu bytes not stored again.",
+			shared, saved );
+	}
+	crud_journal_stats( &records, &batches );
+	if ( records > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD journal : %lu file table changes journaled in %lu batches.",
+			records, batches );
+	}
+	crud_read_ahead_stats( &runs, &ahead );
+	if ( runs > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD read-ahead : %lu chunks read ahead of sequential reads in %lu round trips.",
+			ahead, runs );
+	}
+	crud_buffer_stats( &buffers, &reused );
+	if ( buffers > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD buffers : %lu taken, %lu (%.1f%%) reused from the free lists.",
+			buffers, reused, (100.0 * reused) / buffers );
+	}
 
-				} else if (strncmp(command, "SEEK", 4) == 0) {
+	// Release the workload file, successfully
+	workload_close( &workload );
+	return( 0 );
+}
 
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", off, fname);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_filesystem
+// Description  : Perform a FORMAT, MOUNT or UNMOUNT workload command
+//
+// Inputs       : command - the workload command
+//                len - the expected return value
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_filesystem( char *command, int32_t len ) {
+
+	// Now process the commands
+	if (strncmp(command, "FORMAT", 6) == 0) {
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+		if (CRUD_BENCH_TIMED(CRUD_BENCH_FORMAT, 0, crud_format()) != len) {
+			logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
+			return(-1);
+		}
+	} else if (strncmp(command, "MOUNT", 5) == 0) {
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
+		if (CRUD_BENCH_TIMED(CRUD_BENCH_MOUNT, 0, crud_mount()) != len) {
+			logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+			return(-1);
+		}
+	} else {
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
+		if (CRUD_BENCH_TIMED(CRUD_BENCH_UNMOUNT, 0, crud_unmount()) != len) {
+			logMessage(LOG_ERROR_LEVEL, "Unmount failed, aborting simulation.");
+			return(-1);
+		}
+	}
 
-					// Now perform the seek
-					if (crud_seek(ftable[idx].fhandle, off) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
+	// Return successfully
+	return(0);
+}
 
-				} else if (strncmp(command, "READ", 4) == 0) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_model_write
+// Description  : Apply a write to the expected contents of a replayed file
+//
+// Inputs       : file - the replayed file
+//                buf - the bytes written
+//                len - the number of bytes written
+// Outputs      : 0 if successful, -1 if failure
 
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", len, fname);
+int replay_model_write( CrudSimReplayFile *file, char *buf, uint32_t len ) {
 
-					// Now perform the read
-					rbuf = malloc(len);
-					if (crud_read(ftable[idx].fhandle, rbuf, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-					free(rbuf);
-					rbuf = NULL;
+	// Local variables
+	uint32_t size;
+	char *model;
+
+	// Grow the model as needed (doubling, so writes stay amortized)
+	if (file->position + len > file->size) {
+		size = (file->size * 2 > file->position + len) ? file->size * 2 : file->position + len;
+		if ( (model = realloc(file->model, size)) == NULL ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_SIM : out of memory for replay of [%s]", file->filename);
+			return(-1);
+		}
+		file->model = model;
+		file->size = size;
+	}
 
-				} else {
+	// Copy in the bytes and move the position along
+	memcpy(&file->model[file->position], buf, len);
+	file->position += len;
+	if (file->position > file->length) {
+		file->length = file->position;
+	}
+	return(0);
+}
 
-					// Bomb out, don't understand the command
-					CMPSC_ASSERT1(0, "CRUD_SIM : Failed, unknown command [%s]", command);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_open
+// Description  : Open a replayed file and load its current contents as the
+//                starting point of the model
+//
+// Inputs       : file - the replayed file
+// Outputs      : 0 if successful, -1 if failure
 
-				}
+int replay_open( CrudSimReplayFile *file ) {
+
+	// Local variables
+	char *buf;
+	int32_t len;
+
+	// Open the file
+	logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", file->filename);
+	if ( (file->fhandle = CRUD_BENCH_TIMED(CRUD_BENCH_OPEN, 0, crud_open(file->filename))) == -1 ) {
+		logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", file->filename);
+		return(-1);
+	}
+
+	// Read in what is already there, then go back to the start
+	if ( (buf = malloc(CRUD_MAX_OBJECT_SIZE)) == NULL ) {
+		return(-1);
+	}
+	while ( (len = crud_read(file->fhandle, buf, CRUD_MAX_OBJECT_SIZE)) > 0 ) {
+		if ( replay_model_write(file, buf, len) ) {
+			free(buf);
+			return(-1);
+		}
+	}
+	free(buf);
+	file->position = 0;
+	if ( (len == -1) || crud_seek(file->fhandle, 0) ) {
+		logMessage(LOG_ERROR_LEVEL, "Load of file [%s] failed, aborting simulation.", file->filename);
+		return(-1);
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_file
+// Description  : Run the operations queued for one file, in workload order,
+//                checking every read against the model
+//
+// Inputs       : file - the replayed file
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_file( CrudSimReplayFile *file ) {
+
+	// Local variables
+	CrudSimOperation *op;
+	char *rbuf;
+	int i, err = 0;
+
+	// Open the file on first use
+	if ( (file->fhandle == -1) && replay_open(file) ) {
+		return(-1);
+	}
+
+	// Now execute the operations
+	for (i=0; (i<file->nops) && (!err); i++) {
+		op = &file->ops[i];
+		switch (op->op) {
+		case CRUD_SIM_WRITEAT: // Seek, then write
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", op->len, op->off, file->filename);
+			if (CRUD_BENCH_TIMED(CRUD_BENCH_SEEK, 0, crud_seek(file->fhandle, op->off))) {
+				logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", file->filename, op->off);
+				err = -1;
+				break;
+			}
+			file->position = op->off;
+			// Fall through to the write
+
+		case CRUD_SIM_WRITE: // Write at the position
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", op->len, file->filename);
+			if (CRUD_BENCH_TIMED(CRUD_BENCH_WRITE, op->len, crud_write(file->fhandle, op->text, op->len)) != op->len) {
+				logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", file->filename, op->len);
+				err = -1;
+				break;
+			}
+			err = replay_model_write(file, op->text, op->len);
+			break;
+
+		case CRUD_SIM_SEEK: // Move the position
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", op->off, file->filename);
+			if (CRUD_BENCH_TIMED(CRUD_BENCH_SEEK, 0, crud_seek(file->fhandle, op->off)) != op->len) {
+				logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", file->filename, op->off);
+				err = -1;
+				break;
+			}
+			file->position = op->off;
+			break;
+
+		case CRUD_SIM_READ: // Read and check against the model
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", op->len, file->filename);
+			rbuf = malloc(op->len);
+			if ( (rbuf == NULL) || (CRUD_BENCH_TIMED(CRUD_BENCH_READ, op->len, crud_read(file->fhandle, rbuf, op->len)) != op->len) ) {
+				logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", file->filename, op->len);
+				err = -1;
+			} else if ( (file->position + op->len > file->length) ||
+					(memcmp(rbuf, &file->model[file->position], op->len) != 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Read file [%s] at line %d differs from a serial replay, aborting simulation.",
+						file->filename, op->line);
+				err = -1;
+			} else {
+				file->position += op->len;
+			}
+			free(rbuf);
+			break;
+
+		default: // Filesystem commands are never queued
+			break;
+		}
+	}
+
+	// Release the queue for the next segment
+	file->nops = 0;
+	return(err);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_worker
+// Description  : The body of a replay thread, takes files until none are left
+//
+// Inputs       : arg - the shared replay state
+// Outputs      : NULL
+
+void * replay_worker( void *arg ) {
+
+	// Local variables
+	CrudSimReplay *replay = arg;
+	int idx;
+
+	// Each file is replayed by exactly one thread, so its order is kept
+	while ( (idx = __atomic_fetch_add(&replay->next, 1, __ATOMIC_RELAXED)) < replay->nfiles ) {
+		if ( (replay->files[idx].nops > 0) && (__atomic_load_n(&replay->failed, __ATOMIC_RELAXED) == 0) &&
+				replay_file(&replay->files[idx]) ) {
+			__atomic_store_n(&replay->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_segment
+// Description  : Run the operations queued since the last filesystem command
+//                on the replay threads and wait for them all to finish
+//
+// Inputs       : replay - the replay state
+//                jobs - the number of worker threads
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_segment( CrudSimReplay *replay, int jobs ) {
+
+	// Local variables
+	pthread_t threads[CRUD_SIM_MAX_JOBS];
+	int i, started;
+
+	// Nothing to do if nothing was queued
+	if ( replay->queued == 0 ) {
+		return(0);
+	}
+
+	// Start the threads, then wait for them
+	replay->next = 0;
+	for (started=0; started<jobs; started++) {
+		if ( pthread_create(&threads[started], NULL, replay_worker, replay) != 0 ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_SIM : replay thread create failed [%s]", strerror(errno));
+			replay->failed = 1;
+			break;
+		}
+	}
+	for (i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	replay->queued = 0;
+	return(replay->failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_close
+// Description  : Check every replayed file against its model and close it
+//
+// Inputs       : replay - the replay state
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_close( CrudSimReplay *replay ) {
+
+	// Local variables
+	CrudSimReplayFile *file;
+	char *rbuf;
+	int idx, i, err = 0;
+
+	// Walk the files, read each back whole and compare
+	for (idx=0; idx<replay->nfiles; idx++) {
+		file = &replay->files[idx];
+		if ( (! err) && (file->fhandle != -1) ) {
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", file->filename);
+			rbuf = malloc(file->length + 1);
+			if ( (rbuf == NULL) || crud_seek(file->fhandle, 0) ||
+					(crud_read(file->fhandle, rbuf, file->length + 1) != file->length) ||
+					(memcmp(rbuf, file->model, file->length) != 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "File [%s] differs from a serial replay, aborting simulation.", file->filename);
+				err = -1;
+			} else if (CRUD_BENCH_TIMED(CRUD_BENCH_CLOSE, 0, crud_close(file->fhandle)) == -1) {
+				logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", file->filename);
+				err = -1;
+			}
+			free(rbuf);
+		}
+		free(file->filename);
+		free(file->ops);
+		free(file->model);
+	}
+
+	// Reset the table and its index
+	memset(replay->files, 0x0, sizeof(replay->files));
+	for (i=0; i<CRUD_SIM_HASH_BUCKETS; i++) {
+		replay->fhash[i] = -1;
+	}
+	replay->nfiles = 0;
+	return(err);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_queue
+// Description  : Queue a file operation for the next segment of the replay
+//
+// Inputs       : replay - the replay state
+//                fname - the file the operation is on
+//                command - the workload command
+//                wline - the parsed workload line
+//                line - the workload line number
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_queue( CrudSimReplay *replay, CrudSimLine *wline, int line ) {
+
+	// Local variables
+	CrudSimReplayFile *file;
+	CrudSimOperation *op, *ops;
+	char *fname = wline->fname, *command = wline->command;
+	uint32_t bucket;
+	int idx;
+
+	// Now look the file up in the index, add it if new
+	bucket = hashString(fname) & (CRUD_SIM_HASH_BUCKETS-1);
+	idx = replay->fhash[bucket];
+	while ( (idx != -1) && (strcmp(replay->files[idx].filename,fname) != 0) ) {
+		idx = replay->files[idx].next;
+	}
+	if (idx == -1) {
+		CMPSC_ASSERT1(replay->nfiles<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", replay->nfiles);
+		idx = replay->nfiles++;
+		replay->files[idx].filename = strdup(fname);
+		replay->files[idx].fhandle = -1;
+		replay->files[idx].next = replay->fhash[bucket];
+		replay->fhash[bucket] = idx;
+	}
+	file = &replay->files[idx];
+
+	// Make room for the operation
+	if (file->nops == file->maxops) {
+		file->maxops = (file->maxops == 0) ? 64 : file->maxops * 2;
+		if ( (ops = realloc(file->ops, sizeof(CrudSimOperation)*file->maxops)) == NULL ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_SIM : out of memory queueing line %d", line);
+			return(-1);
+		}
+		file->ops = ops;
+	}
+	op = &file->ops[file->nops];
+	op->len = wline->len;
+	op->off = wline->off;
+	op->line = line;
+	op->text = wline->text; // Stays mapped for the whole replay
+
+	// Decode the command, bomb out if we don't understand it
+	op->op = workload_command(command);
+	CMPSC_ASSERT1((op->op >= CRUD_SIM_WRITEAT) && (op->op <= CRUD_SIM_READ), "CRUD_SIM : Failed, unknown command [%s]", command);
+
+	// Check the line has all of the text to write
+	if ( (op->op == CRUD_SIM_WRITEAT) || (op->op == CRUD_SIM_WRITE) ) {
+		CMPSC_ASSERT2((wline->textlen>=wline->len), "Workload str [%d<%d]", wline->textlen, wline->len);
+	}
+
+	// Queued
+	file->nops ++;
+	replay->queued ++;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_CRUD
+// Description  : Replay the workload on a pool of threads.  The workload is
+//                cut at every FORMAT/MOUNT/UNMOUNT, which run on the main
+//                thread; between them the file operations are queued per
+//                file (in workload order) and each file is replayed whole by
+//                one thread over its own pooled connection.  The expected
+//                contents of each file are tracked as a serial replay would
+//                leave them, reads are checked against them and each file is
+//                read back and compared before it is closed.
+//
+// Inputs       : wload - the name of the workload file
+//                jobs - the number of replay threads
+// Outputs      : 0 if successful test, -1 if failure
+
+int replay_CRUD( char *wload, int jobs ) {
+
+	// Local variables
+	CrudSimWorkload workload;
+	CrudSimLine wline;
+	int32_t err=0, got, linecount;
+	CrudSimReplay *replay;
+	uint64_t writes, flushes, shared, saved, records, batches, runs, ahead, buffers, reused;
+	int i;
+
+	// Setup the replay state (too big for the stack)
+	if ( (replay = calloc(1, sizeof(CrudSimReplay))) == NULL ) {
+		return( -1 );
+	}
+	for (i=0; i<CRUD_SIM_HASH_BUCKETS; i++) {
+		replay->fhash[i] = -1;
+	}
+
+	// Map the workload file (the queued text points into it)
+	if ( workload_open(&workload, wload) ) {
+		free( replay );
+		return( -1 );
+	}
+
+	// Queue the file operations, replaying at each filesystem command
+	while ( (!err) && ((got = workload_next(&workload, &wline)) != 0) ) {
+
+		if ( got == -1 ) {
+			err = -1;
+		} else if ( (strncmp(wline.command, "FORMAT", 6) == 0) || (strncmp(wline.command, "MOUNT", 5) == 0) ||
+				(strncmp(wline.command, "UNMOUNT", 5) == 0) ) {
+
+			// Finish the queued operations (and files on unmount) first
+			err = replay_segment(replay, jobs);
+			if ( (!err) && (strncmp(wline.command, "UNMOUNT", 5) == 0) ) {
+				err = replay_close(replay);
+			}
+			if (!err) {
+				err = replay_filesystem(wline.command, wline.len);
+			}
+
+		} else {
+			err = replay_queue(replay, &wline, workload.line);
+		}
+	}
+
+	// Finish whatever is left
+	if (!err) {
+		err = replay_segment(replay, jobs);
+	}
+	if ( replay_close(replay) ) {
+		err = -1;
+	}
+	linecount = workload.line;
+	workload_close( &workload );
+	free( replay );
+	if ( err ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
+		return( -1 );
+	}
+
+	// Report how many backend writes the write buffers saved
+	crud_write_buffer_stats( &writes, &flushes );
+	logMessage( LOG_OUTPUT_LEVEL, "CRUD write buffer : %lu writes buffered in %lu flushes, %lu backend writes saved.",
+		writes, flushes, (writes > flushes) ? writes - flushes : 0 );
+	crud_dedup_stats( &shared, &saved );
+	if ( shared > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD dedup : %lu chunks found already stored, %lu bytes not stored again.",
+			shared, saved );
+	}
+	crud_journal_stats( &records, &batches );
+	if ( records > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD journal : %lu file table changes journaled in %lu batches.",
+			records, batches );
+	}
+	crud_read_ahead_stats( &runs, &ahead );
+	if ( runs > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD read-ahead : %lu chunks read ahead of sequential reads in %lu round trips.",
+			ahead, runs );
+	}
+	crud_buffer_stats( &buffers, &reused );
+	if ( buffers > 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CRUD buffers : %lu taken, %lu (%.1f%%) reused from the free lists.",
+			buffers, reused, (100.0 * reused) / buffers );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD_SIM : replayed %d lines on %d threads", linecount, jobs );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_run
+// Description  : Check if the text of a write is a run of one byte
+//
+// Inputs       : text - the text
+//                len - the length of the text
+// Outputs      : 1 if it is a run, 0 if not
+
+int trace_run( char *text, int32_t len ) {
+
+	// Local variables
+	int32_t i;
+
+	// Compare every byte to the first
+	for (i=1; (i<len) && (text[i] == text[0]); i++);
+	return( (len > 0) && (i == len) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_text
+// Description  : Place a text in the text area of a trace being built,
+//                reusing an identical text placed before
+//
+// Inputs       : conv - the conversion state
+//                text - the text
+//                len - the length of the text
+// Outputs      : the offset of the text in the area, -1 if failure
+
+int64_t trace_text( CrudSimConversion *conv, char *text, uint32_t len ) {
+
+	// Local variables
+	CrudSimTraceText *placed;
+	uint32_t bucket, size;
+	char *area;
+	int idx;
+
+	// Look for the same text in the index
+	bucket = hashBuffer(text, len) & (conv->nbuckets-1);
+	for (idx=conv->buckets[bucket]; idx!=-1; idx=conv->placed[idx].next) {
+		if ( (conv->placed[idx].len == len) && (memcmp(&conv->area[conv->placed[idx].off], text, len) == 0) ) {
+			return( conv->placed[idx].off );
+		}
+	}
+
+	// Not there, make room in the area and the index
+	if ( conv->size + len > conv->maxsize ) {
+		size = (conv->maxsize * 2 > conv->size + len) ? conv->maxsize * 2 : conv->size + len;
+		if ( (area = realloc(conv->area, size)) == NULL ) {
+			return( -1 );
+		}
+		conv->area = area;
+		conv->maxsize = size;
+	}
+	if ( conv->nplaced == conv->maxplaced ) {
+		conv->maxplaced = (conv->maxplaced == 0) ? 1024 : conv->maxplaced * 2;
+		if ( (placed = realloc(conv->placed, sizeof(CrudSimTraceText)*conv->maxplaced)) == NULL ) {
+			return( -1 );
+		}
+		conv->placed = placed;
+	}
+
+	// Add it to both
+	idx = conv->nplaced++;
+	memcpy(&conv->area[conv->size], text, len);
+	conv->placed[idx].off = conv->size;
+	conv->placed[idx].len = len;
+	conv->placed[idx].next = conv->buckets[bucket];
+	conv->buckets[bucket] = idx;
+	conv->size += len;
+	return( conv->placed[idx].off );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_collect
+// Description  : Turn each line of a workload into a trace record, interning
+//                the filenames and noting the longest run of each byte
+//
+// Inputs       : conv - the conversion state
+//                workload - the workload being converted
+// Outputs      : 0 if successful, -1 if failure
+
+int trace_collect( CrudSimConversion *conv, CrudSimWorkload *workload ) {
+
+	// Local variables
+	CrudSimTraceRecord *rec;
+	CrudSimLine wline;
+	uint32_t bucket;
+	char **wtext;
+	int got, idx;
+
+	// Walk the lines
+	while ( (got = workload_next(workload, &wline)) > 0 ) {
+
+		// Make room for the record
+		if ( conv->nrecords == conv->maxrecords ) {
+			conv->maxrecords = (conv->maxrecords == 0) ? 1024 : conv->maxrecords * 2;
+			if ( (rec = realloc(conv->records, sizeof(CrudSimTraceRecord)*conv->maxrecords)) == NULL ) {
+				return( -1 );
+			}
+			conv->records = rec;
+			if ( (wtext = realloc(conv->wtext, sizeof(char *)*conv->maxrecords)) == NULL ) {
+				return( -1 );
+			}
+			conv->wtext = wtext;
+		}
+		rec = &conv->records[conv->nrecords];
+		memset(rec, 0x0, sizeof(CrudSimTraceRecord));
+		conv->wtext[conv->nrecords] = NULL;
+
+		// Find (or intern) the filename
+		bucket = hashString(wline.fname) & (CRUD_SIM_TRACE_MAX_NAMES-1);
+		idx = conv->nhash[bucket];
+		while ( (idx != -1) && (strcmp(conv->names[idx], wline.fname) != 0) ) {
+			idx = conv->nnext[idx];
+		}
+		if ( idx == -1 ) {
+			if ( conv->nnames == CRUD_SIM_TRACE_MAX_NAMES ) {
+				logMessage( LOG_ERROR_LEVEL, "CRUD workload names too many files for a trace, line %d", workload->line );
+				return( -1 );
+			}
+			idx = conv->nnames++;
+			conv->names[idx] = wline.fname;
+			conv->names_size += strlen(wline.fname) + 1;
+			conv->nnext[idx] = conv->nhash[bucket];
+			conv->nhash[bucket] = idx;
+		}
+
+		// Fill in the record
+		if ( (got = workload_command(wline.command)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD unknown workload command [%s], line %d", wline.command, workload->line );
+			return( -1 );
+		}
+		rec->op = got;
+		rec->name = idx;
+		rec->len = wline.len;
+		rec->off = wline.off;
+
+		// Writes keep their text for later
+		if ( (rec->op == CRUD_SIM_WRITE) || (rec->op == CRUD_SIM_WRITEAT) ) {
+			if ( (wline.len < 0) || (wline.textlen < wline.len) ) {
+				logMessage( LOG_ERROR_LEVEL, "CRUD workload text too short [%d<%d], line %d",
+						wline.textlen, wline.len, workload->line );
+				return( -1 );
 			}
+			conv->wtext[conv->nrecords] = wline.text;
+			if ( trace_run(wline.text, wline.len) && (conv->runs[(unsigned char)wline.text[0]] < wline.len) ) {
+				conv->runs[(unsigned char)wline.text[0]] = wline.len;
+			}
+		}
+		conv->nrecords ++;
+	}
+	return( got );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_place
+// Description  : Build the text area of a trace and point the writes into it
+//
+// Inputs       : conv - the conversion state
+// Outputs      : 0 if successful, -1 if failure
+
+int trace_place( CrudSimConversion *conv ) {
+
+	// Local variables
+	uint32_t i;
+	int64_t off;
+	char *run;
+
+	// Setup the text index, a bucket per record at least
+	for (conv->nbuckets=1; conv->nbuckets<conv->nrecords; conv->nbuckets<<=1);
+	if ( (conv->buckets = malloc(sizeof(int)*conv->nbuckets)) == NULL ) {
+		return( -1 );
+	}
+	for (i=0; i<conv->nbuckets; i++) {
+		conv->buckets[i] = -1;
+	}
 
-			// Check for the virtual level failing
-			if ( err ) {
-				logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
-				fclose( fhandle );
+	// Place the longest run of each byte, the shorter ones share it
+	for (i=0; i<256; i++) {
+		if ( conv->runs[i] > 0 ) {
+			if ( (run = malloc(conv->runs[i])) == NULL ) {
+				return( -1 );
+			}
+			memset(run, i, conv->runs[i]);
+			off = trace_text(conv, run, conv->runs[i]);
+			free( run );
+			if ( off == -1 ) {
 				return( -1 );
 			}
+			conv->runoff[i] = off;
+		}
+	}
+
+	// Now point each write at its text
+	for (i=0; i<conv->nrecords; i++) {
+		if ( conv->wtext[i] == NULL ) {
+			continue;
+		}
+		if ( trace_run(conv->wtext[i], conv->records[i].len) ) {
+			conv->records[i].text = conv->runoff[(unsigned char)conv->wtext[i][0]];
+		} else if ( (off = trace_text(conv, conv->wtext[i], conv->records[i].len)) == -1 ) {
+			return( -1 );
+		} else {
+			conv->records[i].text = off;
 		}
 	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_section
+// Description  : Write a section of a trace, padded to a 4-byte boundary
+//
+// Inputs       : fh - the trace file
+//                buf - the bytes of the section
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int trace_section( FILE *fh, void *buf, uint32_t len ) {
+
+	// Local variables
+	static const char pad[sizeof(uint32_t)] = { 0 };
+	uint32_t padding = CRUD_SIM_TRACE_ALIGN(len) - len;
+
+	// Write and pad
+	if ( ((len > 0) && (fwrite(buf, len, 1, fh) != 1)) ||
+			((padding > 0) && (fwrite(pad, padding, 1, fh) != 1)) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_save
+// Description  : Write out a converted trace
+//
+// Inputs       : conv - the conversion state
+//                trace - the name of the trace file to create
+// Outputs      : 0 if successful, -1 if failure
+
+int trace_save( CrudSimConversion *conv, char *trace ) {
+
+	// Local variables
+	CrudSimTraceHeader hdr;
+	char *names, *name;
+	uint32_t i;
+	FILE *fh;
+	int err;
+
+	// Lay out the sections
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, CRUD_SIM_TRACE_MAGIC, 8);
+	hdr.order = CRUD_SIM_TRACE_ORDER;
+	hdr.nnames = conv->nnames;
+	hdr.nrecords = conv->nrecords;
+	hdr.names = CRUD_SIM_TRACE_ALIGN(sizeof(hdr));
+	hdr.names_size = conv->names_size;
+	hdr.records = hdr.names + CRUD_SIM_TRACE_ALIGN(hdr.names_size);
+	hdr.text = hdr.records + (conv->nrecords * sizeof(CrudSimTraceRecord));
+	hdr.text_size = conv->size;
+
+	// Gather the filename table
+	if ( (names = malloc(conv->names_size + 1)) == NULL ) {
+		return( -1 );
+	}
+	for (i=0, name=names; i<conv->nnames; i++) {
+		strcpy(name, conv->names[i]);
+		name += strlen(name) + 1;
+	}
+
+	// Write the sections in order
+	if ( (fh = fopen(trace, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure creating the trace file [%s], error: %s.\n", trace, strerror(errno) );
+		free( names );
+		return( -1 );
+	}
+	err = trace_section(fh, &hdr, sizeof(hdr)) || trace_section(fh, names, conv->names_size) ||
+		trace_section(fh, conv->records, conv->nrecords * sizeof(CrudSimTraceRecord)) ||
+		trace_section(fh, conv->area, conv->size);
+	free( names );
+	if ( (fclose(fh) != 0) || err ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing the trace file [%s], error: %s.\n", trace, strerror(errno) );
+		return( -1 );
+	}
 
-	// Close the workload file, successfully
-	fclose( fhandle );
+	// Say how much smaller it is
+	logMessage( LOG_OUTPUT_LEVEL, "CRUD trace : %u lines, %u files, %u text bytes, %u bytes written to [%s].",
+		conv->nrecords, conv->nnames, conv->size, hdr.text + CRUD_SIM_TRACE_ALIGN(conv->size), trace );
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : convert_workload
+// Description  : Convert a workload into a binary trace.  Filenames are
+//                interned, each line becomes a fixed size record and the
+//                texts are written once: runs of one byte all point into the
+//                longest run of that byte, other texts are shared when equal.
+//
+// Inputs       : wload - the name of the workload file (text or trace)
+//                trace - the name of the trace file to create
+// Outputs      : 0 if successful, -1 if failure
+
+int convert_workload( char *wload, char *trace ) {
+
+	// Local variables
+	CrudSimWorkload workload;
+	CrudSimConversion conv;
+	int i, err = -1;
+
+	// Map the workload, setup the filename index
+	if ( workload_open(&workload, wload) ) {
+		return( -1 );
+	}
+	memset(&conv, 0x0, sizeof(conv));
+	conv.names = malloc(sizeof(char *)*CRUD_SIM_TRACE_MAX_NAMES);
+	conv.nhash = malloc(sizeof(int)*CRUD_SIM_TRACE_MAX_NAMES);
+	conv.nnext = malloc(sizeof(int)*CRUD_SIM_TRACE_MAX_NAMES);
+	if ( (conv.names != NULL) && (conv.nhash != NULL) && (conv.nnext != NULL) ) {
+		for (i=0; i<CRUD_SIM_TRACE_MAX_NAMES; i++) {
+			conv.nhash[i] = -1;
+		}
+
+		// Now convert
+		err = trace_collect(&conv, &workload) || trace_place(&conv) || trace_save(&conv, trace);
+	}
+
+	// Cleanup (the names and texts are in the workload mapping)
+	free( conv.records );
+	free( conv.wtext );
+	free( conv.names );
+	free( conv.nhash );
+	free( conv.nnext );
+	free( conv.area );
+	free( conv.placed );
+	free( conv.buckets );
+	workload_close( &workload );
+	return( err ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchmark_CRUD
+// Description  : Run workloads back to back, timing every file system call,
+//                and report the throughput and latencies of each
+//
+// Inputs       : wloads - the names of the workload files
+//                count - the number of workloads (0 runs the bundled ones)
+//                jobs - the number of replay threads
+//                json - the file to write the JSON results to (- is stdout)
+// Outputs      : 0 if successful, -1 if failure
+
+int benchmark_CRUD( char **wloads, int count, int jobs, char *json ) {
+
+	// Local variables
+	static char *bundled[] = { "workload-one.txt", "workload-two.txt", "workload-three.txt" };
+	uint64_t start, elapsed;
+	FILE *fh;
+	int i, err = 0;
+
+	// Use the bundled workloads if none are given, open the output
+	if ( count == 0 ) {
+		wloads = bundled;
+		count = sizeof(bundled) / sizeof(char *);
+	}
+	fh = (strcmp(json, "-") == 0) ? stdout : fopen(json, "w");
+	if ( fh == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure creating the benchmark file [%s], error: %s.\n", json, strerror(errno) );
+		return( -1 );
+	}
+	fprintf( fh, "{\n  \"jobs\": %d,\n  \"workloads\": [\n", jobs );
+
+	// Run and report each workload in turn
+	crud_bench_enable( 1 );
+	for (i=0; (i<count) && (!err); i++) {
+		crud_bench_reset();
+		start = getMonotonicNanos();
+		if ( ((jobs > 1) ? replay_CRUD(wloads[i], jobs) : simulate_CRUD(wloads[i])) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD benchmark of [%s] failed.", wloads[i] );
+			err = -1;
+		}
+		elapsed = getMonotonicNanos() - start;
+		if ( (!err) && crud_bench_report(wloads[i], elapsed, fh, (i == 0)) ) {
+			err = -1;
+		}
+	}
+	crud_bench_enable( 0 );
+
+	// Finish the output
+	fprintf( fh, "\n  ]\n}\n" );
+	if ( ((fh == stdout) ? fflush(fh) : fclose(fh)) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing the benchmark file [%s], error: %s.\n", json, strerror(errno) );
+		err = -1;
+	}
+	return( err );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extract_files_from_crud
+// Description  : Extract files from the CRUD file system, mounting it once
+//
+// Inputs       : ex_file - the name of the first file to extract
+//                others - the names of the other files
+//                count - the number of other files
+// Outputs      : 0 if successful test, -1 if failure
+
+int extract_files_from_crud(char *ex_file, char **others, int count) {
+
+	// Local variables
+	int i, err = 0;
+
+	// Mount, then take each file out (going on past one that fails)
+	if ( crud_mount() ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed mounting the crud filesystem.");
+		return(-1);
+	}
+	for ( i = -1; i < count; i++ ) {
+		if ( extract_file_from_crud((i < 0) ? ex_file : others[i]) ) {
+			err = -1;
+		}
+	}
+	return( err );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : extract_file_from_crud
-// Description  : Extract a file from the CRUD file system
+// Description  : Extract a file from the (mounted) CRUD file system
 //
 // Inputs       : ex_file - the name of the file to extract
 // Outputs      : 0 if successful test, -1 if failure
@@ -444,13 +1954,12 @@ int extract_file_from_crud(char *ex_file) {
 	// Local variables
 	int16_t fd;
 	int32_t len;
-	char buf[CRUD_MAX_OBJECT_SIZE];
+	char *buf;
     int fhandle, flags;
     mode_t mode;
-	// Open the file, read from it, close it
-	if ( (crud_mount()) || ((fd = crud_open(ex_file)) == -1) ||
-		 ((len = crud_read(fd, buf, CRUD_MAX_OBJECT_SIZE)) == -1) ||
-		 (crud_close(fd) == -1)	) {
+
+	// Open the file in the crud filesystem
+	if ( (fd = crud_open(ex_file)) == -1 ) {
 		// Error out
 		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
 		return(-1);
@@ -465,13 +1974,51 @@ int extract_file_from_crud(char *ex_file) {
         return( -1 );
     }
 
-    // Now write the read bytes to the file, then close
-    if (write(fhandle, buf, len) != len) {
-        fprintf( stderr, "CRUD: extraction write() failed, error=%s\n", strerror(errno) );
+    // Copy the file out a buffer at a time (files can exceed one object)
+    buf = malloc(CRUD_MAX_OBJECT_SIZE);
+    if ( buf == NULL ) {
+        close( fhandle );
         return( -1 );
     }
+    while ( (len = crud_read(fd, buf, CRUD_MAX_OBJECT_SIZE)) > 0 ) {
+        if (write(fhandle, buf, len) != len) {
+            fprintf( stderr, "CRUD: extraction write() failed, error=%s\n", strerror(errno) );
+            free( buf );
+            close( fhandle );
+            return( -1 );
+        }
+    }
+    free( buf );
     close( fhandle );
 
+    // Check the read loop ended on end of file, then close
+    if ( (len == -1) || (crud_close(fd) == -1) ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
+		return(-1);
+    }
+
     // Return successfully
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_crud
+// Description  : Check the CRUD device (see crud_fsck)
+//
+// Inputs       : jobs - the number of threads reading
+//                checksums - non-zero to hash the contents too
+//                rate - the most megabytes per second to read (0 for no limit)
+// Outputs      : 0 if the device is clean, -1 if not (or it was not checked)
+
+int check_crud( int jobs, int checksums, double rate ) {
+
+	// Local variables
+	CrudFsckOptions options;
+	CrudFsckReport report;
+
+	options.threads = (uint32_t) jobs;
+	options.rate = (uint64_t) (rate * 1e6);
+	options.checksums = (uint8_t) checksums;
+	return( (crud_fsck(&options, &report) == 0) ? 0 : -1 );
+}
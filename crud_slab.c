@@ -0,0 +1,347 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_slab.c
+//  Description    : This is the implementation of the buffer allocator.  Each
+//                   buffer is preceded by a small header naming its size
+//                   class, which is also where a released buffer links into
+//                   the free list of the class.  Requests bigger than the
+//                   largest class go straight to malloc.  The free lists
+//                   together hold at most CRUD_SLAB_KEEP_BYTES; past that,
+//                   released buffers go back to the system.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Thu Dec  4 14:05:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_slab.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_SLAB_LARGE CRUD_SLAB_CLASSES // Class of buffers from plain malloc
+#define CRUD_SLAB_CLASS_BYTES(c) ((uint32_t) 1 << ((c) + CRUD_SLAB_MIN_SHIFT))
+#define CRUD_SLAB_HEADER(buf) ((CrudSlabHeader *) (buf) - 1)
+
+// Type definitions
+
+// This is the header ahead of each buffer (16 bytes, so buffers stay aligned)
+typedef struct crud_slab_header {
+    struct crud_slab_header *next;   // The next free buffer of the class
+    uint32_t                 cls;    // The size class (CRUD_SLAB_LARGE if none)
+    uint32_t                 capacity; // The bytes the buffer can hold
+} CrudSlabHeader;
+
+// This is one size class, with its list of free buffers
+typedef struct {
+    pthread_mutex_t  lock;           // Held while the list is in use
+    CrudSlabHeader  *free;           // The free buffers
+} CrudSlabClass;
+
+// This is an allocator
+struct crud_slab {
+    CrudSlabClass classes[CRUD_SLAB_CLASSES]; // The size classes
+    uint64_t      held;              // Bytes on the free lists (atomic)
+    uint64_t      allocations;       // Buffers handed out (atomic)
+    uint64_t      recycled;          // Of those, taken from a free list (atomic)
+};
+
+// Module local methods
+static uint32_t crud_slab_class(uint32_t size);
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_new
+// Description  : Make a new allocator, with empty free lists
+//
+// Inputs       : none
+// Outputs      : the allocator, or NULL if failure
+
+CrudSlab *crud_slab_new(void) {
+    CrudSlab *slab;
+    int i;
+
+    if ((slab = calloc(1, sizeof(CrudSlab))) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD slab : failed allocating allocator.");
+        return NULL;
+    }
+    for (i = 0; i < CRUD_SLAB_CLASSES; i++)
+        pthread_mutex_init(&slab->classes[i].lock, NULL);
+
+    return slab;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_free
+// Description  : Release an allocator and the buffers on its free lists (the
+//                buffers handed out must all have been released)
+//
+// Inputs       : slab - the allocator
+// Outputs      : none
+
+void crud_slab_free(CrudSlab *slab) {
+    CrudSlabHeader *hdr;
+    int i;
+
+    if (slab == NULL)
+        return;
+
+    for (i = 0; i < CRUD_SLAB_CLASSES; i++)
+    {
+        while ((hdr = slab->classes[i].free) != NULL)
+        {
+            slab->classes[i].free = hdr->next;
+            free(hdr);
+        }
+        pthread_mutex_destroy(&slab->classes[i].lock);
+    }
+    free(slab);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_alloc
+// Description  : Get a buffer of at least size bytes, from the free list of
+//                its class if one is there
+//
+// Inputs       : slab - the allocator
+//                size - the bytes needed
+// Outputs      : the buffer, or NULL if failure
+
+void *crud_slab_alloc(CrudSlab *slab, uint32_t size) {
+    CrudSlabClass *sc;
+    CrudSlabHeader *hdr = NULL;
+    uint32_t cls = crud_slab_class(size), capacity;
+
+    __atomic_fetch_add(&slab->allocations, 1, __ATOMIC_RELAXED);
+
+    // Take a free buffer of the class, if there is one
+    if (cls != CRUD_SLAB_LARGE)
+    {
+        sc = &slab->classes[cls];
+        pthread_mutex_lock(&sc->lock);
+        if ((hdr = sc->free) != NULL)
+            sc->free = hdr->next;
+        pthread_mutex_unlock(&sc->lock);
+        if (hdr != NULL)
+        {
+            __atomic_fetch_sub(&slab->held, hdr->capacity, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&slab->recycled, 1, __ATOMIC_RELAXED);
+            return hdr + 1;
+        }
+    }
+
+    // Otherwise get a new one
+    capacity = (cls == CRUD_SLAB_LARGE) ? size : CRUD_SLAB_CLASS_BYTES(cls);
+    if ((hdr = malloc(sizeof(CrudSlabHeader) + capacity)) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD slab : failed allocating buffer [%u bytes].", size);
+        return NULL;
+    }
+    hdr->next = NULL;
+    hdr->cls = cls;
+    hdr->capacity = capacity;
+
+    return hdr + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_resize
+// Description  : Make a buffer hold at least size bytes, keeping its contents
+//                (a buffer that is already big enough is kept as it is)
+//
+// Inputs       : slab - the allocator
+//                buf - the buffer (NULL to allocate a new one)
+//                size - the bytes needed
+// Outputs      : the buffer, or NULL if failure (buf is then left alone)
+
+void *crud_slab_resize(CrudSlab *slab, void *buf, uint32_t size) {
+    void *grown;
+
+    if (buf == NULL)
+        return crud_slab_alloc(slab, size);
+    if (size <= CRUD_SLAB_HEADER(buf)->capacity)
+        return buf;
+
+    if ((grown = crud_slab_alloc(slab, size)) == NULL)
+        return NULL;
+    memcpy(grown, buf, CRUD_SLAB_HEADER(buf)->capacity);
+    crud_slab_release(slab, buf);
+
+    return grown;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_release
+// Description  : Give a buffer back, onto the free list of its class unless
+//                the free lists are full
+//
+// Inputs       : slab - the allocator
+//                buf - the buffer (NULL is ignored)
+// Outputs      : none
+
+void crud_slab_release(CrudSlab *slab, void *buf) {
+    CrudSlabHeader *hdr;
+    CrudSlabClass *sc;
+
+    if (buf == NULL)
+        return;
+
+    hdr = CRUD_SLAB_HEADER(buf);
+    if (hdr->cls == CRUD_SLAB_LARGE ||
+            __atomic_add_fetch(&slab->held, hdr->capacity, __ATOMIC_RELAXED) > CRUD_SLAB_KEEP_BYTES)
+    {
+        if (hdr->cls != CRUD_SLAB_LARGE)
+            __atomic_fetch_sub(&slab->held, hdr->capacity, __ATOMIC_RELAXED);
+        free(hdr);
+        return;
+    }
+
+    sc = &slab->classes[hdr->cls];
+    pthread_mutex_lock(&sc->lock);
+    hdr->next = sc->free;
+    sc->free = hdr;
+    pthread_mutex_unlock(&sc->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_capacity
+// Description  : Get the number of bytes a buffer can hold (the size of its
+//                class, at least the size asked for)
+//
+// Inputs       : buf - the buffer
+// Outputs      : the capacity in bytes
+
+uint32_t crud_slab_capacity(const void *buf) {
+    return ((const CrudSlabHeader *) buf - 1)->capacity;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_stats
+// Description  : Get the number of buffers handed out, and how many of them
+//                came from the free lists
+//
+// Inputs       : slab - the allocator
+//                allocations - the place to put the buffers handed out
+//                recycled - the place to put the free list hits
+// Outputs      : none
+
+void crud_slab_stats(CrudSlab *slab, uint64_t *allocations, uint64_t *recycled) {
+    *allocations = __atomic_load_n(&slab->allocations, __ATOMIC_RELAXED);
+    *recycled = __atomic_load_n(&slab->recycled, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudSlabUnitTest
+// Description  : Allocate, resize and release buffers of many sizes, checking
+//                that contents survive and released buffers are reused
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudSlabUnitTest(void) {
+
+	// Local variables
+	uint32_t sizes[] = { 0, 1, 63, 64, 65, 1000, 4096, 65537, 0xfffff, 0x100000, 0x100001 };
+	unsigned char *bufs[sizeof(sizes) / sizeof(sizes[0])] = { NULL }, *again;
+	uint64_t allocations, recycled;
+	uint32_t i, j, count = sizeof(sizes) / sizeof(sizes[0]);
+	CrudSlab *slab;
+	int result = 0;
+
+	// Get a buffer of each size, and fill it
+	if ((slab = crud_slab_new()) == NULL) {
+		return(-1);
+	}
+	for (i = 0; i < count; i++) {
+		bufs[i] = crud_slab_alloc(slab, sizes[i]);
+		if ((bufs[i] == NULL) || (crud_slab_capacity(bufs[i]) < sizes[i])) {
+			logMessage(LOG_ERROR_LEVEL, "Slab unit test failed allocating [%u bytes].", sizes[i]);
+			result = -1;
+			break;
+		}
+		memset(bufs[i], (int)i, sizes[i]);
+	}
+
+	// Grow each buffer to twice (plus one) its size, checking the contents are kept
+	for (i = 0; (i < count) && (result == 0); i++) {
+		again = crud_slab_resize(slab, bufs[i], sizes[i] * 2 + 1);
+		if (again == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Slab unit test failed resizing [%u bytes].", sizes[i]);
+			result = -1;
+			break;
+		}
+		bufs[i] = again;
+		for (j = 0; j < sizes[i]; j++) {
+			if (bufs[i][j] != (unsigned char)i) {
+				logMessage(LOG_ERROR_LEVEL, "Slab unit test failed, resize lost contents [%u bytes].", sizes[i]);
+				result = -1;
+				break;
+			}
+		}
+	}
+
+	// Release them all (those not allocated are NULL, which release skips),
+	//  and check that a buffer of one class comes back again
+	for (i = 0; i < count; i++) {
+		crud_slab_release(slab, bufs[i]);
+		bufs[i] = NULL;
+	}
+	for (i = 0; (i < 4) && (result == 0); i++) {
+		again = crud_slab_alloc(slab, (uint32_t)getRandomValue(2049, 4096));
+		if ((again == NULL) || (crud_slab_capacity(again) != 4096)) {
+			logMessage(LOG_ERROR_LEVEL, "Slab unit test failed, bad size class.");
+			result = -1;
+		}
+		crud_slab_release(slab, again);
+	}
+	crud_slab_stats(slab, &allocations, &recycled);
+	if ((result == 0) && (recycled < 4)) {
+		logMessage(LOG_ERROR_LEVEL, "Slab unit test failed, buffers not reused [%lu of %lu].",
+				recycled, allocations);
+		result = -1;
+	}
+
+	// Release the allocator, log and return
+	crud_slab_free(slab);
+	if (result == 0) {
+		logMessage(LOG_INFO_LEVEL, "Slab unit test completed successfully.");
+	}
+	return(result);
+}
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_class
+// Description  : Find the smallest size class holding a number of bytes
+//
+// Inputs       : size - the bytes needed
+// Outputs      : the class (CRUD_SLAB_LARGE if none is big enough)
+
+static uint32_t crud_slab_class(uint32_t size) {
+    uint32_t cls;
+
+    if (size <= CRUD_SLAB_CLASS_BYTES(0))
+        return 0;
+    cls = (32 - __builtin_clz(size - 1)) - CRUD_SLAB_MIN_SHIFT;
+
+    return (cls < CRUD_SLAB_CLASSES) ? cls : CRUD_SLAB_LARGE;
+}
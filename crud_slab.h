@@ -0,0 +1,63 @@
+#ifndef CRUD_SLAB_INCLUDED
+#define CRUD_SLAB_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_slab.h
+//  Description    : This is the header file for the buffer allocator of the
+//                   file system.  Object sized buffers (cache lines, write
+//                   buffers, scratch space) are handed out from power of two
+//                   size classes, and released buffers are kept on a free
+//                   list per class for the next request of that size, so a
+//                   remount or a busy cache does not go back to malloc (and,
+//                   for large buffers, to mmap) every time.  An allocator is
+//                   thread safe.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Thu Dec  4 14:05:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_SLAB_MIN_SHIFT 6 // The smallest class holds 64 bytes
+#define CRUD_SLAB_CLASSES 15 // Classes of 64 bytes up to 1MB (one whole object)
+#define CRUD_SLAB_KEEP_BYTES (32 * 1024 * 1024) // Most bytes kept on the free lists
+
+// Type definitions
+
+// This is a buffer allocator (opaque)
+typedef struct crud_slab CrudSlab;
+
+//
+// Allocator interface
+
+CrudSlab *crud_slab_new(void);
+	// Make a new allocator (with empty free lists)
+
+void crud_slab_free(CrudSlab *slab);
+	// Release an allocator and its free lists (all buffers must be released)
+
+void *crud_slab_alloc(CrudSlab *slab, uint32_t size);
+	// Get a buffer of at least size bytes (NULL if failure)
+
+void *crud_slab_resize(CrudSlab *slab, void *buf, uint32_t size);
+	// Grow a buffer (or allocate one, if NULL) keeping its contents
+
+void crud_slab_release(CrudSlab *slab, void *buf);
+	// Give a buffer back to the allocator (NULL is ignored)
+
+uint32_t crud_slab_capacity(const void *buf);
+	// Get the number of bytes a buffer can hold
+
+void crud_slab_stats(CrudSlab *slab, uint64_t *allocations, uint64_t *recycled);
+	// Get the buffers handed out, and how many came from the free lists
+
+//
+// Unit testing for the module
+
+int crudSlabUnitTest(void);
+	// Allocate, resize and release buffers of many sizes
+
+#endif
@@ -0,0 +1,933 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_store.c
+//  Description    : This is the implementation of the local object store.
+//                   Objects live in blocks of a memory-mapped store file
+//                   (see crud_store.h for the layout); requests are executed
+//                   in place, without a server or a socket.  An in-memory
+//                   hash on the OID finds the block of an object, and freed
+//                   blocks are reused through lists by size class.  Reads
+//                   share the store, everything else holds it exclusively
+//                   (the mapping may move when the file grows).
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Sat Nov 22 09:40:00 EST 2014
+//
+
+// Includes
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <crud_store.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_STORE_USED 0x1          // Block holds an object
+#define CRUD_STORE_PRIORITY 0x2      // Block holds the priority object
+#define CRUD_STORE_CLASSES 32        // Free lists, by log2 of block capacity
+#define CRUD_STORE_SPLIT_MIN 64      // Smallest free block split off an allocation
+#define CRUD_STORE_INDEX_SLOTS 1024  // Initial size of the OID index
+#define CRUD_STORE_ROUND(x) (((uint64_t) (x) + CRUD_STORE_GRANULE - 1) & ~(uint64_t) (CRUD_STORE_GRANULE - 1))
+#define CRUD_STORE_BLOCK(off) ((CrudStoreBlock *) (crud_store.base + (off)))
+#define CRUD_STORE_DATA(off) (crud_store.base + (off) + sizeof(CrudStoreBlock))
+#define CRUD_STORE_NEXT(off) ((off) + sizeof(CrudStoreBlock) + CRUD_STORE_BLOCK(off)->capacity)
+
+// Type definitions
+
+// This is the header at the start of a store file
+typedef struct {
+    char      magic[8];      // CRUD_STORE_MAGIC
+    uint32_t  version;       // CRUD_STORE_VERSION
+    uint32_t  next_oid;      // The next OID to hand out
+    uint64_t  end;           // Bytes of the file in use (header and blocks)
+    uint8_t   reserved[40];  // Unused (zero)
+} CrudStoreHeader;
+
+// This is the header of a block of the store file
+typedef struct {
+    CrudOID   oid;           // The object held (0 if free or priority)
+    uint32_t  length;        // The length of the object
+    uint32_t  capacity;      // The number of data bytes of the block
+    uint32_t  flags;         // CRUD_STORE_USED, CRUD_STORE_PRIORITY
+} CrudStoreBlock;
+
+// This is a slot of the OID index (open addressing, linear probing)
+typedef struct {
+    CrudOID   oid;           // The object (0 if slot empty)
+    uint64_t  offset;        // The offset of its block in the file
+} CrudStoreSlot;
+
+// This is the loaded store
+typedef struct {
+    pthread_rwlock_t  lock;                         // Shared by reads, exclusive otherwise
+    char             *name;                         // The store file (NULL if none loaded)
+    int               fd;                           // Descriptor of the store file
+    char             *base;                         // The mapping of the file
+    uint64_t          size;                         // Bytes mapped (the file size)
+    CrudStoreHeader  *header;                       // The header (at base)
+    CrudStoreSlot    *index;                        // The OID index
+    uint32_t          slots;                        // Slots of the index (power of 2)
+    uint32_t          objects;                      // Objects in the index
+    uint64_t          priority;                     // Block of the priority object (0 if none)
+    uint64_t          free_lists[CRUD_STORE_CLASSES]; // First free block of each class (0 ends)
+} CrudStore;
+
+// Module local data
+static CrudStore crud_store = { .lock = PTHREAD_RWLOCK_INITIALIZER, .fd = -1 };
+
+// Module local functions
+static CrudResponse crud_store_execute(CrudRequest op, CrudRequestExt ext, void *buf,
+        uint32_t skip, uint32_t take);
+static int crud_store_map(const char *fname);
+static void crud_store_unmap(void);
+static int crud_store_scan(void);
+static void crud_store_reset(void);
+static int crud_store_reserve(uint64_t bytes);
+static uint64_t crud_store_alloc(uint32_t length);
+static uint64_t crud_store_resize(uint64_t off, uint32_t length);
+static void crud_store_release(uint64_t off);
+static void crud_store_push_free(uint64_t off);
+static int crud_store_class(uint32_t capacity);
+static CrudStoreSlot *crud_store_lookup(CrudOID oid);
+static int crud_store_index_put(CrudOID oid, uint64_t off);
+static void crud_store_index_remove(CrudOID oid);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bus_request
+// Description  : This is the driver interface of the local store, executing
+//                one request (see crud_store_request)
+//
+// Inputs       : request - the request opcode for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_bus_request(CrudRequest request, void *buf) {
+    return crud_store_request(request, 0, buf, 0, UINT32_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_request
+// Description  : Execute a request on the local store, answering as a server
+//                would.  CRUD_INIT loads the store file named by
+//                crud_network_store if none is loaded yet, CRUD_CLOSE writes
+//                the store back to its file (it stays loaded).
+//
+// Inputs       : op - the request opcode for the command
+//                ext - the extension word (range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                skip - read bytes to leave out before filling buf
+//                take - most read bytes to put in buf
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_store_request(CrudRequest op, CrudRequestExt ext, void *buf,
+        uint32_t skip, uint32_t take) {
+    // Declare variables
+    CrudResponse response;
+    uint8_t req = CRUD_HEADER_REQ(op);
+
+    // Reads share the store, anything else may change (or move) it
+    if (req == CRUD_READ || req == CRUD_READ_RANGE)
+        pthread_rwlock_rdlock(&crud_store.lock);
+    else
+        pthread_rwlock_wrlock(&crud_store.lock);
+    response = crud_store_execute(op, ext, buf, skip, take);
+    pthread_rwlock_unlock(&crud_store.lock);
+    return response;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_compound
+// Description  : Execute the sub-requests of a compound request in order,
+//                stopping after the first that fails (the rest are left with
+//                the result bit set).  No other request runs in between.
+//
+// Inputs       : ops - the sub-requests (responses are put in place)
+//                count - the number of sub-requests
+// Outputs      : 0 if every sub-request succeeded, -1 if failure
+
+int crud_store_compound(CrudCompoundOp *ops, int count) {
+    // Declare variables
+    int i, result = 0;
+
+    pthread_rwlock_wrlock(&crud_store.lock);
+    for (i = 0; i < count; i++)
+        ops[i].response = -1;
+    for (i = 0; i < count && result == 0; i++)
+    {
+        ops[i].response = crud_store_execute(ops[i].op, ops[i].ext, ops[i].buf, 0, UINT32_MAX);
+        if (CRUD_HEADER_RESULT(ops[i].response))
+            result = -1;
+    }
+    pthread_rwlock_unlock(&crud_store.lock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_loaded
+// Description  : Check whether a store file is loaded
+//
+// Inputs       : none
+// Outputs      : 1 if loaded, 0 if not
+
+int crud_store_loaded(void) {
+    // Declare variables
+    int loaded;
+
+    pthread_rwlock_rdlock(&crud_store.lock);
+    loaded = (crud_store.base != NULL);
+    pthread_rwlock_unlock(&crud_store.lock);
+    return loaded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_store
+// Description  : Write the contents of the store to disk.  The loaded store
+//                file is synced in place, any other file gets a copy.
+//
+// Inputs       : fname - the file to write (NULL for the loaded store file)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_save_store(char *fname) {
+    // Declare variables
+    uint64_t done = 0;
+    ssize_t written;
+    int fd, result = 0;
+
+    pthread_rwlock_rdlock(&crud_store.lock);
+    if (crud_store.base == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : no store loaded, not saving.");
+        result = -1;
+    }
+    else if (fname == NULL || strcmp(fname, crud_store.name) == 0)
+    {
+        if (msync(crud_store.base, crud_store.header->end, MS_SYNC) == -1)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD store : sync of [%s] failed [%s].",
+                    crud_store.name, strerror(errno));
+            result = -1;
+        }
+    }
+    else if ((fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : open of [%s] failed [%s].", fname, strerror(errno));
+        result = -1;
+    }
+    else
+    {
+        // The copy is only as long as the part in use
+        while (done < crud_store.header->end)
+        {
+            written = write(fd, crud_store.base + done, crud_store.header->end - done);
+            if (written <= 0)
+            {
+                logMessage(LOG_ERROR_LEVEL, "CRUD store : write of [%s] failed [%s].",
+                        fname, strerror(errno));
+                result = -1;
+                break;
+            }
+            done += (uint64_t) written;
+        }
+        if (close(fd) == -1)
+            result = -1;
+    }
+    pthread_rwlock_unlock(&crud_store.lock);
+
+    if (result == 0)
+        logMessage(LOG_INFO_LEVEL, "CRUD store : saved [%s].", (fname != NULL) ? fname : crud_store.name);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_store
+// Description  : Load a store file (created empty if it does not exist) in
+//                place of the one loaded, if any
+//
+// Inputs       : fname - the store file
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_load_store(char *fname) {
+    // Declare variables
+    int result;
+
+    pthread_rwlock_wrlock(&crud_store.lock);
+    crud_store_unmap();
+    result = crud_store_map(fname);
+    pthread_rwlock_unlock(&crud_store.lock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_execute
+// Description  : Execute a request on the store (lock held)
+//
+// Inputs       : op - the request opcode for the command
+//                ext - the extension word (range requests only)
+//                buf - the block to be read/written from (READ/WRITE)
+//                skip - read bytes to leave out before filling buf
+//                take - most read bytes to put in buf
+// Outputs      : the response structure encoded as needed
+
+static CrudResponse crud_store_execute(CrudRequest op, CrudRequestExt ext, void *buf,
+        uint32_t skip, uint32_t take) {
+    // Declare variables
+    CrudOID oid;
+    CRUD_REQUEST_TYPES req;
+    CrudStoreBlock *block = NULL;
+    CrudStoreSlot *slot;
+    uint32_t length, offset, available;
+    uint64_t off = 0;
+    uint8_t flags, res, priority;
+
+    deconstruct_crud_request(op, &oid, &req, &length, &flags, &res);
+    priority = (flags & CRUD_PRIORITY_OBJECT) != 0;
+    offset = (uint32_t) (ext & 0xffffffff);
+    res = 1;
+
+    // Everything but CRUD_INIT needs a store
+    if (crud_store.base == NULL && req != CRUD_INIT)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : %s without a loaded store.",
+                (req < CRUD_MAXVAL) ? CRUD_REQUEST_TYPE_LABLES[req] : "request");
+        return construct_crud_request(oid, req, length, flags, 1);
+    }
+
+    // Find the object of requests that name one
+    if (req == CRUD_READ || req == CRUD_UPDATE || req == CRUD_DELETE ||
+            req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE)
+    {
+        if (priority)
+            off = crud_store.priority;
+        else if ((slot = crud_store_lookup(oid)) != NULL)
+            off = slot->offset;
+        if (off == 0)
+            return construct_crud_request(oid, req, 0, flags, 1);
+        block = CRUD_STORE_BLOCK(off);
+    }
+
+    switch (req)
+    {
+    case CRUD_INIT: // Load the store, report the extensions if asked
+        if (crud_store.base != NULL || (crud_network_store != NULL &&
+                crud_store_map((const char *) crud_network_store) == 0))
+            res = 0;
+        length = (flags & CRUD_EXT_PROBE_FLAG) ? CRUD_STORE_CAPS : 0;
+        break;
+
+    case CRUD_FORMAT: // Drop every object
+        crud_store_reset();
+        length = 0;
+        res = 0;
+        break;
+
+    case CRUD_CREATE: // Copy the object into a new block
+        if (length > CRUD_MAX_OBJECT_SIZE || (priority && crud_store.priority != 0))
+            break;
+        if (!priority)
+        {
+            oid = crud_store.header->next_oid;
+            if (crud_store_lookup(oid) != NULL || oid == CRUD_NO_OBJECT)
+            {
+                logMessage(LOG_ERROR_LEVEL, "CRUD store : OIDs exhausted.");
+                break;
+            }
+        }
+        if ((off = crud_store_alloc(length)) == 0)
+            break;
+        if (priority)
+        {
+            crud_store.priority = off;
+            oid = 0;
+        }
+        else if (crud_store_index_put(oid, off) != 0)
+        {
+            crud_store_release(off);
+            break;
+        }
+        else
+            crud_store.header->next_oid++;
+        block = CRUD_STORE_BLOCK(off);
+        block->oid = oid;
+        block->flags = CRUD_STORE_USED | (priority ? CRUD_STORE_PRIORITY : 0);
+        memcpy(CRUD_STORE_DATA(off), buf, length);
+        res = 0;
+        break;
+
+    case CRUD_READ: // The whole object, if the buffer holds it
+        if (length < block->length)
+        {
+            length = 0;
+            break;
+        }
+        length = block->length;
+        offset = 0;
+        // Fall through to copy out the wanted part
+
+    case CRUD_READ_RANGE: // The part of the range that exists
+        if (offset > block->length)
+        {
+            length = 0;
+            break;
+        }
+        available = block->length - offset;
+        if (req == CRUD_READ_RANGE && length > available)
+            length = available;
+        if (skip < length)
+            memcpy(buf, CRUD_STORE_DATA(off) + offset + skip, (take < length - skip) ? take : length - skip);
+        res = 0;
+        break;
+
+    case CRUD_UPDATE: // Replace the contents, the length cannot change
+        if (length != block->length)
+            break;
+        memcpy(CRUD_STORE_DATA(off), buf, length);
+        res = 0;
+        break;
+
+    case CRUD_UPDATE_RANGE: // Replace part of the contents, growing the object if past its end
+        if (offset > block->length || (uint64_t) offset + length > CRUD_MAX_OBJECT_SIZE)
+            break;
+        if (offset + length > block->length)
+        {
+            if ((off = crud_store_resize(off, offset + length)) == 0)
+                break;
+            block = CRUD_STORE_BLOCK(off);
+        }
+        memcpy(CRUD_STORE_DATA(off) + offset, buf, length);
+        res = 0;
+        break;
+
+    case CRUD_DELETE: // Free the block of the object
+        if (priority)
+            crud_store.priority = 0;
+        else
+            crud_store_index_remove(oid);
+        crud_store_release(off);
+        length = 0;
+        res = 0;
+        break;
+
+    case CRUD_CLOSE: // Write the store back to its file
+        if (msync(crud_store.base, crud_store.header->end, MS_SYNC) == 0)
+            res = 0;
+        else
+            logMessage(LOG_ERROR_LEVEL, "CRUD store : sync of [%s] failed [%s].",
+                    crud_store.name, strerror(errno));
+        length = 0;
+        break;
+
+    default: // Not a request of the protocol
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : unknown request type [%u].", req);
+        break;
+    }
+
+    return construct_crud_request(oid, req, length, flags, res);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_map
+// Description  : Open and map a store file, setting up a new one if it is
+//                empty, and index its blocks
+//
+// Inputs       : fname - the store file
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_store_map(const char *fname) {
+    // Declare variables
+    CrudStoreHeader header;
+    struct stat st;
+
+    if ((crud_store.fd = open(fname, O_RDWR|O_CREAT, 0644)) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : open of [%s] failed [%s].", fname, strerror(errno));
+        return -1;
+    }
+
+    // A new file gets a header, an existing one must be a store (checked
+    //  before the file is touched)
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CRUD_STORE_MAGIC, sizeof(header.magic));
+    header.version = CRUD_STORE_VERSION;
+    header.next_oid = 1;
+    header.end = sizeof(CrudStoreHeader);
+    if (fstat(crud_store.fd, &st) == -1 || (st.st_size > 0 &&
+            (pread(crud_store.fd, &header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header.magic, CRUD_STORE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != CRUD_STORE_VERSION || header.end < sizeof(CrudStoreHeader) ||
+            header.end > (uint64_t) st.st_size)))
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : [%s] is not a store file (version %d).",
+                fname, CRUD_STORE_VERSION);
+        crud_store_unmap();
+        return -1;
+    }
+
+    // Map at least the minimum size, growing the file as needed
+    crud_store.size = CRUD_STORE_MIN_SIZE;
+    if ((uint64_t) st.st_size > crud_store.size)
+        crud_store.size = (uint64_t) st.st_size;
+    if ((uint64_t) st.st_size < crud_store.size && ftruncate(crud_store.fd, (off_t) crud_store.size) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : sizing [%s] failed [%s].", fname, strerror(errno));
+        crud_store_unmap();
+        return -1;
+    }
+    crud_store.base = mmap(NULL, crud_store.size, PROT_READ|PROT_WRITE, MAP_SHARED, crud_store.fd, 0);
+    if (crud_store.base == MAP_FAILED)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : mmap of [%s] failed [%s].", fname, strerror(errno));
+        crud_store.base = NULL;
+        crud_store_unmap();
+        return -1;
+    }
+    crud_store.header = (CrudStoreHeader *) crud_store.base;
+    crud_store.name = strdup(fname);
+    if (st.st_size == 0)
+        memcpy(crud_store.header, &header, sizeof(header));
+
+    if (crud_store_scan() != 0)
+    {
+        crud_store_unmap();
+        return -1;
+    }
+    logMessage(LOG_INFO_LEVEL, "CRUD store : loaded [%s], %u objects in %lu bytes.",
+            fname, crud_store.objects, crud_store.header->end);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_unmap
+// Description  : Unmap and close the store file and drop the in-memory state
+//                (nothing is synced)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_store_unmap(void) {
+    if (crud_store.base != NULL)
+        munmap(crud_store.base, crud_store.size);
+    if (crud_store.fd != -1)
+        close(crud_store.fd);
+    free(crud_store.name);
+    free(crud_store.index);
+    crud_store.name = NULL;
+    crud_store.base = NULL;
+    crud_store.header = NULL;
+    crud_store.index = NULL;
+    crud_store.fd = -1;
+    crud_store.size = 0;
+    crud_store.slots = 0;
+    crud_store.objects = 0;
+    crud_store.priority = 0;
+    memset(crud_store.free_lists, 0, sizeof(crud_store.free_lists));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_scan
+// Description  : Walk the blocks of the mapped store, indexing the objects
+//                and putting the free blocks on the free lists (runs of free
+//                blocks are merged, free blocks at the end are cut off)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if the store is corrupt
+
+static int crud_store_scan(void) {
+    // Declare variables
+    CrudStoreBlock *block, *next;
+    uint64_t off = sizeof(CrudStoreHeader), end = crud_store.header->end;
+
+    crud_store.slots = CRUD_STORE_INDEX_SLOTS;
+    if ((crud_store.index = calloc(crud_store.slots, sizeof(CrudStoreSlot))) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : failed allocating OID index.");
+        return -1;
+    }
+
+    while (off < end)
+    {
+        // Check the block lies within what is in use
+        block = CRUD_STORE_BLOCK(off);
+        if (end - off < sizeof(CrudStoreBlock) || block->capacity % CRUD_STORE_GRANULE != 0 ||
+                CRUD_STORE_NEXT(off) > end || block->length > block->capacity)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD store : corrupt block at offset %lu.", off);
+            return -1;
+        }
+
+        if (block->flags & CRUD_STORE_USED)
+        {
+            if (block->flags & CRUD_STORE_PRIORITY)
+                crud_store.priority = off;
+            else if (crud_store_lookup(block->oid) != NULL || block->oid == CRUD_NO_OBJECT ||
+                    crud_store_index_put(block->oid, off) != 0)
+            {
+                logMessage(LOG_ERROR_LEVEL, "CRUD store : bad object %u at offset %lu.", block->oid, off);
+                return -1;
+            }
+        }
+        else
+        {
+            // Take in the free blocks that follow, give up the tail of the heap
+            while (CRUD_STORE_NEXT(off) < end)
+            {
+                next = CRUD_STORE_BLOCK(CRUD_STORE_NEXT(off));
+                if ((next->flags & CRUD_STORE_USED) || end - CRUD_STORE_NEXT(off) < sizeof(CrudStoreBlock))
+                    break;
+                block->capacity += sizeof(CrudStoreBlock) + next->capacity;
+            }
+            if (CRUD_STORE_NEXT(off) >= end)
+            {
+                crud_store.header->end = off;
+                break;
+            }
+            crud_store_push_free(off);
+        }
+        off = CRUD_STORE_NEXT(off);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_reset
+// Description  : Empty the store (CRUD_FORMAT), keeping the OID counter so
+//                old OIDs are not handed out again
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_store_reset(void) {
+    memset(crud_store.index, 0, crud_store.slots * sizeof(CrudStoreSlot));
+    memset(crud_store.free_lists, 0, sizeof(crud_store.free_lists));
+    crud_store.objects = 0;
+    crud_store.priority = 0;
+    crud_store.header->end = sizeof(CrudStoreHeader);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_reserve
+// Description  : Make sure the heap can grow by a number of bytes, extending
+//                the file and its mapping (which may move) if needed
+//
+// Inputs       : bytes - the bytes to be added past the end of the heap
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_store_reserve(uint64_t bytes) {
+    // Declare variables
+    uint64_t size = crud_store.size;
+    char *base;
+
+    if (crud_store.header->end + bytes <= size)
+        return 0;
+
+    // Double the file, so growing costs little per object
+    while (crud_store.header->end + bytes > size)
+        size *= 2;
+    if (ftruncate(crud_store.fd, (off_t) size) == -1 ||
+            (base = mremap(crud_store.base, crud_store.size, size, MREMAP_MAYMOVE)) == MAP_FAILED)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD store : growing [%s] to %lu bytes failed [%s].",
+                crud_store.name, size, strerror(errno));
+        return -1;
+    }
+    crud_store.base = base;
+    crud_store.header = (CrudStoreHeader *) base;
+    crud_store.size = size;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_alloc
+// Description  : Get a block for an object of some length, from the free
+//                lists or else the end of the heap (a free block much larger
+//                than needed is split)
+//
+// Inputs       : length - the object length
+// Outputs      : the offset of the block (0 if failure)
+
+static uint64_t crud_store_alloc(uint32_t length) {
+    // Declare variables
+    CrudStoreBlock *block;
+    uint64_t off, *link, rest;
+    uint32_t want = (uint32_t) CRUD_STORE_ROUND((length > 0) ? length : 1);
+    int class;
+
+    // First fit in the class of the size, any block of a larger class fits
+    off = 0;
+    for (class = crud_store_class(want); class < CRUD_STORE_CLASSES && off == 0; class++)
+    {
+        for (link = &crud_store.free_lists[class]; *link != 0;
+                link = (uint64_t *) CRUD_STORE_DATA(*link))
+        {
+            if (CRUD_STORE_BLOCK(*link)->capacity >= want)
+            {
+                off = *link;
+                *link = *(uint64_t *) CRUD_STORE_DATA(off);
+                break;
+            }
+        }
+    }
+
+    if (off != 0)
+    {
+        // Split off the rest if it is worth keeping
+        block = CRUD_STORE_BLOCK(off);
+        if (block->capacity - want >= sizeof(CrudStoreBlock) + CRUD_STORE_SPLIT_MIN)
+        {
+            rest = off + sizeof(CrudStoreBlock) + want;
+            CRUD_STORE_BLOCK(rest)->capacity = block->capacity - want - sizeof(CrudStoreBlock);
+            CRUD_STORE_BLOCK(rest)->flags = 0;
+            CRUD_STORE_BLOCK(rest)->length = 0;
+            CRUD_STORE_BLOCK(rest)->oid = 0;
+            crud_store_push_free(rest);
+            block->capacity = want;
+        }
+    }
+    else
+    {
+        // Append a block to the heap
+        if (crud_store_reserve(sizeof(CrudStoreBlock) + want) != 0)
+            return 0;
+        off = crud_store.header->end;
+        crud_store.header->end += sizeof(CrudStoreBlock) + want;
+        CRUD_STORE_BLOCK(off)->capacity = want;
+    }
+
+    block = CRUD_STORE_BLOCK(off);
+    block->length = length;
+    block->flags = CRUD_STORE_USED;
+    return off;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_resize
+// Description  : Grow an object, moving it to a new block if its own is too
+//                small.  The block at the end of the heap grows in place;
+//                others move to a block with room to double, so objects grown
+//                by appends move rarely.
+//
+// Inputs       : off - the block of the object
+//                length - the new length of the object
+// Outputs      : the (new) block of the object, or 0 if failure
+
+static uint64_t crud_store_resize(uint64_t off, uint32_t length) {
+    // Declare variables
+    CrudStoreBlock *block = CRUD_STORE_BLOCK(off), *moved;
+    CrudStoreSlot *slot;
+    uint32_t old, want;
+    uint64_t to;
+
+    if (length <= block->capacity)
+    {
+        block->length = length;
+        return off;
+    }
+
+    // The last block can simply extend the heap
+    want = (uint32_t) CRUD_STORE_ROUND(length);
+    if (CRUD_STORE_NEXT(off) == crud_store.header->end)
+    {
+        if (crud_store_reserve(want - block->capacity) != 0)
+            return 0;
+        block = CRUD_STORE_BLOCK(off);
+        crud_store.header->end += want - block->capacity;
+        block->capacity = want;
+        block->length = length;
+        return off;
+    }
+
+    // Otherwise move it (the mapping may move while allocating)
+    old = block->length;
+    if (want < 2 * block->capacity)
+        want = 2 * block->capacity;
+    if (want > CRUD_STORE_ROUND(CRUD_MAX_OBJECT_SIZE))
+        want = (uint32_t) CRUD_STORE_ROUND(CRUD_MAX_OBJECT_SIZE);
+    if ((to = crud_store_alloc(want)) == 0)
+        return 0;
+    block = CRUD_STORE_BLOCK(off);
+    moved = CRUD_STORE_BLOCK(to);
+    memcpy(CRUD_STORE_DATA(to), CRUD_STORE_DATA(off), old);
+    moved->oid = block->oid;
+    moved->flags = block->flags;
+    moved->length = length;
+
+    if (block->flags & CRUD_STORE_PRIORITY)
+        crud_store.priority = to;
+    else if ((slot = crud_store_lookup(block->oid)) != NULL)
+        slot->offset = to;
+    crud_store_release(off);
+    return to;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_release
+// Description  : Free the block of a deleted object (the heap shrinks if it
+//                was the last one)
+//
+// Inputs       : off - the block
+// Outputs      : none
+
+static void crud_store_release(uint64_t off) {
+    // Declare variables
+    CrudStoreBlock *block = CRUD_STORE_BLOCK(off);
+
+    block->flags = 0;
+    block->oid = 0;
+    block->length = 0;
+    if (CRUD_STORE_NEXT(off) == crud_store.header->end)
+        crud_store.header->end = off;
+    else
+        crud_store_push_free(off);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_push_free
+// Description  : Put a free block on the list of its class (the link to the
+//                next free block is kept in its data area)
+//
+// Inputs       : off - the block
+// Outputs      : none
+
+static void crud_store_push_free(uint64_t off) {
+    // Declare variables
+    int class = crud_store_class(CRUD_STORE_BLOCK(off)->capacity);
+
+    *(uint64_t *) CRUD_STORE_DATA(off) = crud_store.free_lists[class];
+    crud_store.free_lists[class] = off;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_class
+// Description  : Get the free list class of a block capacity (its log2)
+//
+// Inputs       : capacity - the data bytes of the block (non-zero)
+// Outputs      : the class
+
+static int crud_store_class(uint32_t capacity) {
+    return 31 - __builtin_clz(capacity);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_lookup
+// Description  : Find the index slot of an object
+//
+// Inputs       : oid - the object
+// Outputs      : the slot, or NULL if the object does not exist
+
+static CrudStoreSlot *crud_store_lookup(CrudOID oid) {
+    // Declare variables
+    uint32_t i = (oid * 0x9e3779b1u) & (crud_store.slots - 1);
+
+    while (crud_store.index[i].oid != 0)
+    {
+        if (crud_store.index[i].oid == oid)
+            return &crud_store.index[i];
+        i = (i + 1) & (crud_store.slots - 1);
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_index_put
+// Description  : Add an object to the index, doubling it if it gets three
+//                quarters full
+//
+// Inputs       : oid - the object (not in the index)
+//                off - the offset of its block
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_store_index_put(CrudOID oid, uint64_t off) {
+    // Declare variables
+    CrudStoreSlot *old = crud_store.index, *grown;
+    uint32_t i, slots = crud_store.slots;
+
+    if ((crud_store.objects + 1) * 4 > crud_store.slots * 3)
+    {
+        if ((grown = calloc(slots * 2, sizeof(CrudStoreSlot))) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "CRUD store : failed growing OID index.");
+            return -1;
+        }
+        crud_store.index = grown;
+        crud_store.slots = slots * 2;
+        crud_store.objects = 0;
+        for (i = 0; i < slots; i++)
+        {
+            if (old[i].oid != 0)
+                crud_store_index_put(old[i].oid, old[i].offset);
+        }
+        free(old);
+    }
+
+    i = (oid * 0x9e3779b1u) & (crud_store.slots - 1);
+    while (crud_store.index[i].oid != 0)
+        i = (i + 1) & (crud_store.slots - 1);
+    crud_store.index[i].oid = oid;
+    crud_store.index[i].offset = off;
+    crud_store.objects++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_index_remove
+// Description  : Remove an object from the index, moving back the entries
+//                after it that would no longer be found
+//
+// Inputs       : oid - the object
+// Outputs      : none
+
+static void crud_store_index_remove(CrudOID oid) {
+    // Declare variables
+    CrudStoreSlot *slot = crud_store_lookup(oid);
+    uint32_t mask = crud_store.slots - 1, hole, i, home;
+
+    if (slot == NULL)
+        return;
+    hole = (uint32_t) (slot - crud_store.index);
+    crud_store.index[hole].oid = 0;
+    crud_store.objects--;
+
+    // Fill the hole with any later entry of the run whose home is not
+    //  between the hole and it
+    for (i = (hole + 1) & mask; crud_store.index[i].oid != 0; i = (i + 1) & mask)
+    {
+        home = (crud_store.index[i].oid * 0x9e3779b1u) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            crud_store.index[hole] = crud_store.index[i];
+            crud_store.index[i].oid = 0;
+            hole = i;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef CRUD_STORE_INCLUDED
+#define CRUD_STORE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_store.h
+//  Description    : This is the header file for the local object store, an
+//                   in-process CRUD device kept in a memory-mapped store
+//                   file.  It implements the driver interface (crud_bus_request,
+//                   crud_save_store, crud_load_store) and the protocol
+//                   extensions, so the client can use it in place of a server
+//                   when the store is on the same host.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Sat Nov 22 09:40:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+#include <crud_network.h>
+
+// Defines
+#define CRUD_STORE_MAGIC "CRUDSTOR"  // First bytes of a store file
+#define CRUD_STORE_VERSION 1         // Layout version of the store file
+#define CRUD_STORE_GRANULE 16        // Block sizes are multiples of this
+#define CRUD_STORE_MIN_SIZE 0x100000 // Smallest store file mapped (bytes)
+#define CRUD_STORE_CAPS (CRUD_CAP_RANGE|CRUD_CAP_GROW|CRUD_CAP_COMPOUND) // Extensions offered
+
+/*
+
+ Store File Layout
+
+  The file starts with a 64 byte header (CrudStoreHeader), followed by a
+  heap of blocks up to the end recorded in the header.  Each block is a 16
+  byte block header (CrudStoreBlock) and a data area of "capacity" bytes
+  holding an object, or nothing if the block is free.  All fields are in
+  host byte order, a store file is not portable between architectures.
+
+  The OID index and the free lists are kept in memory only and rebuilt by
+  walking the blocks when the store is loaded (which also merges runs of
+  free blocks).
+
+*/
+
+//
+// Local store interface
+
+CrudResponse crud_store_request(CrudRequest op, CrudRequestExt ext, void *buf,
+        uint32_t skip, uint32_t take);
+	// Execute a request (with extension word) on the local store
+
+int crud_store_compound(CrudCompoundOp *ops, int count);
+	// Execute the sub-requests of a compound request on the local store
+
+int crud_store_loaded(void);
+	// Check whether a store file is loaded
+
+#endif
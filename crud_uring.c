@@ -0,0 +1,459 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_uring.c
+//  Description    : This is the implementation of the io_uring rings, on the
+//                   bare system calls.  The submission ring, its entries and
+//                   the completion ring are mapped from the kernel; queuing
+//                   fills the next submission entry, and the tail is handed
+//                   to the kernel when the ring is entered.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Mon Dec  8 10:20:00 EST 2014
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Project Includes
+#include <crud_uring.h>
+#include <cmpsc311_log.h>
+
+// The rings need the kernel interface (Linux 5.6 or later at run time)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CRUD_URING_SUPPORTED 1
+#endif
+#endif
+
+#ifdef CRUD_URING_SUPPORTED
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Type definitions
+
+// This is a ring
+struct crud_uring {
+    int                   fd;        // The ring file descriptor
+    void                 *sq_ptr;    // The mapped submission ring
+    size_t                sq_size;   // Its size
+    void                 *cq_ptr;    // The mapped completion ring (may be sq_ptr)
+    size_t                cq_size;   // Its size
+    struct io_uring_sqe  *sqes;      // The mapped submission entries
+    size_t                sqes_size; // Their size
+    uint32_t             *sq_head;   // Submission ring head (moved by the kernel)
+    uint32_t             *sq_tail;   // Submission ring tail (moved by us)
+    uint32_t             *sq_array;  // Submission ring slots (entry indices)
+    uint32_t              sq_mask;   // Mask of a submission ring index
+    uint32_t              sq_entries; // Entries of the submission ring
+    uint32_t              tail;      // Our tail (entries filled, not yet handed over)
+    uint32_t             *cq_head;   // Completion ring head (moved by us)
+    uint32_t             *cq_tail;   // Completion ring tail (moved by the kernel)
+    uint32_t              cq_mask;   // Mask of a completion ring index
+    struct io_uring_cqe  *cqes;      // The completion ring entries
+};
+
+// Module local methods
+static struct io_uring_sqe *crud_uring_sqe(CrudUring *ring);
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_new
+// Description  : Set up a ring and map its submission and completion rings
+//
+// Inputs       : entries - the operations the ring holds at once
+// Outputs      : the ring, or NULL if failure (or no io_uring here)
+
+CrudUring *crud_uring_new(uint32_t entries) {
+    struct io_uring_params params;
+    CrudUring *ring;
+    char *sq;
+
+    if ((ring = calloc(1, sizeof(CrudUring))) == NULL)
+        return NULL;
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params)) < 0)
+    {
+        logMessage(LOG_INFO_LEVEL, "CRUD uring : io_uring_setup failed [%s].", strerror(errno));
+        free(ring);
+        return NULL;
+    }
+
+    // Map the rings (one mapping holds both if the kernel allows it)
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = 0;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ptr = (ring->cq_size == 0) ? ring->sq_ptr : mmap(NULL, ring->cq_size,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD uring : mapping the rings failed [%s].", strerror(errno));
+        if (ring->sq_ptr == MAP_FAILED)
+            ring->sq_ptr = NULL;
+        if (ring->cq_ptr == MAP_FAILED)
+            ring->cq_ptr = NULL;
+        if (ring->sqes == MAP_FAILED)
+            ring->sqes = NULL;
+        crud_uring_free(ring);
+        return NULL;
+    }
+
+    // Find the ring fields
+    sq = ring->sq_ptr;
+    ring->sq_head = (uint32_t *) (sq + params.sq_off.head);
+    ring->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    ring->sq_array = (uint32_t *) (sq + params.sq_off.array);
+    ring->sq_mask = *(uint32_t *) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->tail = *ring->sq_tail;
+    ring->cq_head = (uint32_t *) ((char *) ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (uint32_t *) ((char *) ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+
+    return ring;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_free
+// Description  : Unmap and close a ring
+//
+// Inputs       : ring - the ring (NULL is ignored)
+// Outputs      : none
+
+void crud_uring_free(CrudUring *ring) {
+    if (ring == NULL)
+        return;
+
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != NULL)
+        munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    free(ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_register
+// Description  : Register the buffer that fixed reads land in, so the kernel
+//                keeps it mapped instead of looking it up on every read
+//
+// Inputs       : ring - the ring
+//                buf - the buffer
+//                length - its size in bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_uring_register(CrudUring *ring, void *buf, uint32_t length) {
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = length;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+    {
+        logMessage(LOG_INFO_LEVEL, "CRUD uring : buffer registration failed [%s].", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_sendmsg
+// Description  : Queue a sendmsg on a socket
+//
+// Inputs       : ring - the ring
+//                fd - the socket
+//                msg - the message (in place until the send completes)
+//                flags - the send flags
+//                tag - the value handed back with the completion
+// Outputs      : 0 if successful, -1 if the ring is full
+
+int crud_uring_sendmsg(CrudUring *ring, int fd, struct msghdr *msg, int flags, uint64_t tag) {
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = crud_uring_sqe(ring)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) msg;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t) flags;
+    sqe->user_data = tag;
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_recv
+// Description  : Queue a recv on a socket
+//
+// Inputs       : ring - the ring
+//                fd - the socket
+//                buf - the place to put the bytes
+//                length - the most bytes received
+//                flags - the recv flags
+//                tag - the value handed back with the completion
+// Outputs      : 0 if successful, -1 if the ring is full
+
+int crud_uring_recv(CrudUring *ring, int fd, void *buf, uint32_t length, int flags, uint64_t tag) {
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = crud_uring_sqe(ring)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = length;
+    sqe->msg_flags = (uint32_t) flags;
+    sqe->user_data = tag;
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_read_fixed
+// Description  : Queue a read into the registered buffer (it may come back
+//                short, like any read of a socket)
+//
+// Inputs       : ring - the ring
+//                fd - the socket
+//                buf - the place to put the bytes (inside the registered buffer)
+//                length - the most bytes read
+//                tag - the value handed back with the completion
+// Outputs      : 0 if successful, -1 if the ring is full
+
+int crud_uring_read_fixed(CrudUring *ring, int fd, void *buf, uint32_t length, uint64_t tag) {
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = crud_uring_sqe(ring)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = length;
+    sqe->buf_index = 0;
+    sqe->user_data = tag;
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_enter
+// Description  : Hand the queued operations to the kernel, and wait for
+//                completions (all queued operations go in a single call)
+//
+// Inputs       : ring - the ring
+//                wait - the completions to wait for (0 just submits)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_uring_enter(CrudUring *ring, uint32_t wait) {
+    uint32_t pending;
+    long result;
+
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+    do
+    {
+        pending = ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        result = syscall(__NR_io_uring_enter, ring->fd, pending, wait,
+                (wait > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD uring : io_uring_enter failed [%s].", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_complete
+// Description  : Take the next completion off the completion ring
+//
+// Inputs       : ring - the ring
+//                tag - the place to put the tag of the operation
+//                result - the place to put its result (bytes, or -errno)
+// Outputs      : 1 if a completion was taken, 0 if there is none
+
+int crud_uring_complete(CrudUring *ring, uint64_t *tag, int32_t *result) {
+    struct io_uring_cqe *cqe;
+    uint32_t head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    cqe = &ring->cqes[head & ring->cq_mask];
+    *tag = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_uring_sqe
+// Description  : Get the next free submission entry, cleared
+//
+// Inputs       : ring - the ring
+// Outputs      : the entry, or NULL if the ring is full
+
+static struct io_uring_sqe *crud_uring_sqe(CrudUring *ring) {
+    struct io_uring_sqe *sqe;
+    uint32_t slot;
+
+    if (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        logMessage(LOG_ERROR_LEVEL, "CRUD uring : submission ring full [%u].", ring->sq_entries);
+        return NULL;
+    }
+    slot = ring->tail & ring->sq_mask;
+    sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[slot] = slot;
+    ring->tail++;
+
+    return sqe;
+}
+
+#else
+
+//
+// No io_uring in this build, callers stay with blocking sockets
+
+CrudUring *crud_uring_new(uint32_t entries) {
+    logMessage(LOG_INFO_LEVEL, "CRUD uring : not supported in this build.");
+    return NULL;
+}
+
+void crud_uring_free(CrudUring *ring) {
+}
+
+int crud_uring_register(CrudUring *ring, void *buf, uint32_t length) {
+    return -1;
+}
+
+int crud_uring_sendmsg(CrudUring *ring, int fd, struct msghdr *msg, int flags, uint64_t tag) {
+    return -1;
+}
+
+int crud_uring_recv(CrudUring *ring, int fd, void *buf, uint32_t length, int flags, uint64_t tag) {
+    return -1;
+}
+
+int crud_uring_read_fixed(CrudUring *ring, int fd, void *buf, uint32_t length, uint64_t tag) {
+    return -1;
+}
+
+int crud_uring_enter(CrudUring *ring, uint32_t wait) {
+    return -1;
+}
+
+int crud_uring_complete(CrudUring *ring, uint64_t *tag, int32_t *result) {
+    return 0;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudUringUnitTest
+// Description  : Send a message through a ring over a socket pair, and read
+//                it back in two parts (one into the registered buffer, or
+//                with a plain receive, as the client does, if the buffer
+//                cannot be registered)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudUringUnitTest(void) {
+
+	// Local variables
+	static char fixed[64];
+	char first[] = "crud ", second[] = "uring ring", back[16];
+	struct iovec iov[2];
+	struct msghdr msg;
+	CrudUring *ring;
+	uint64_t tag;
+	int32_t result;
+	int fds[2], step, registered, ok = 1;
+
+	// Nothing to test without io_uring
+	if ((ring = crud_uring_new(8)) == NULL) {
+		logMessage(LOG_INFO_LEVEL, "Uring unit test skipped (no io_uring).");
+		return(0);
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		crud_uring_free(ring);
+		return(-1);
+	}
+
+	// Registering can fail (RLIMIT_MEMLOCK, say), which the client survives
+	registered = (crud_uring_register(ring, fixed, sizeof(fixed)) == 0);
+
+	// Send both parts in one message, then read 5 bytes fixed (if the buffer
+	//  is registered) and the rest plain
+	memset(&msg, 0, sizeof(msg));
+	iov[0].iov_base = first;
+	iov[0].iov_len = strlen(first);
+	iov[1].iov_base = second;
+	iov[1].iov_len = strlen(second);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	for (step = 1; (step <= 3) && ok; step++) {
+		if (step == 1) {
+			ok = (crud_uring_sendmsg(ring, fds[0], &msg, 0, step) == 0);
+		} else if (step == 2) {
+			ok = registered ? (crud_uring_read_fixed(ring, fds[1], fixed, 5, step) == 0) :
+				(crud_uring_recv(ring, fds[1], fixed, 5, MSG_WAITALL, step) == 0);
+		} else {
+			ok = (crud_uring_recv(ring, fds[1], back, 10, MSG_WAITALL, step) == 0);
+		}
+		ok = ok && (crud_uring_enter(ring, 1) == 0) && (crud_uring_complete(ring, &tag, &result) == 1) &&
+			(tag == (uint64_t)step) && (result == ((step == 1) ? 15 : (step == 2) ? 5 : 10));
+	}
+	if (ok && ((memcmp(fixed, first, 5) != 0) || (memcmp(back, second, 10) != 0))) {
+		ok = 0;
+	}
+
+	// Clean up, log and return
+	close(fds[0]);
+	close(fds[1]);
+	crud_uring_free(ring);
+	if (!ok) {
+		logMessage(LOG_ERROR_LEVEL, "Uring unit test failed.");
+		return(-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "Uring unit test completed successfully%s.",
+			registered ? "" : " (buffer not registered)");
+	return(0);
+}
@@ -0,0 +1,61 @@
+#ifndef CRUD_URING_INCLUDED
+#define CRUD_URING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_uring.h
+//  Description    : This is the header file for the io_uring rings the client
+//                   pipeline can send and receive through (see crud_network_uring).
+//                   A ring queues socket operations without a system call
+//                   each, and hands back their results as completions tagged
+//                   with a caller value.  Where the system (or the build) has
+//                   no io_uring, crud_uring_new fails and callers stay with
+//                   blocking sockets.  A ring is used by one thread.
+//
+//  Author         : Ryan Geiger
+//  Last Modified  : Mon Dec  8 10:20:00 EST 2014
+//
+
+// Include files
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Type definitions
+
+// This is a submission/completion ring (opaque)
+typedef struct crud_uring CrudUring;
+
+//
+// Ring interface
+
+CrudUring *crud_uring_new(uint32_t entries);
+	// Set up a ring of (at least) entries operations (NULL if unavailable)
+
+void crud_uring_free(CrudUring *ring);
+	// Release a ring (operations still in flight are abandoned)
+
+int crud_uring_register(CrudUring *ring, void *buf, uint32_t length);
+	// Register the buffer crud_uring_read_fixed reads into
+
+int crud_uring_sendmsg(CrudUring *ring, int fd, struct msghdr *msg, int flags, uint64_t tag);
+	// Queue a sendmsg (msg must stay in place until it completes)
+
+int crud_uring_recv(CrudUring *ring, int fd, void *buf, uint32_t length, int flags, uint64_t tag);
+	// Queue a recv into buf
+
+int crud_uring_read_fixed(CrudUring *ring, int fd, void *buf, uint32_t length, uint64_t tag);
+	// Queue a read into (part of) the registered buffer
+
+int crud_uring_enter(CrudUring *ring, uint32_t wait);
+	// Submit the queued operations, waiting for at least wait completions
+
+int crud_uring_complete(CrudUring *ring, uint64_t *tag, int32_t *result);
+	// Take the next completion, if there is one (1 if taken, 0 if none)
+
+//
+// Unit testing for the module
+
+int crudUringUnitTest(void);
+	// Send and receive through a ring over a socket pair
+
+#endif